@@ -22,15 +22,24 @@
 #define ALLOCATE_EXPR(tr, type, exprType) \
     (type*)allocateExpression(tr, sizeof(type), exprType)
 
-#define FREE_EXPR(ptr, type) \
-        exprAlloc(ptr, sizeof(type), 0)
-
 #define GROW_EXPR_ARRAY(ptr, osize, nsize, type)  \
         (type*)exprAlloc(ptr, sizeof(type) * osize, sizeof(type) * nsize)
 
 #define FREE_EXPR_ARRAY(ptr, osize, type) \
         exprAlloc(ptr, sizeof(type) * osize, 0)
 
+// Nodes are bumped out of chunks that double in size, up to a point, and
+// are all freed together with their tree
+#define ARENA_CHUNK_MIN (16 * 1024)
+#define ARENA_CHUNK_MAX (1024 * 1024)
+#define ARENA_ALIGN 8
+
+struct ArenaChunk {
+    ArenaChunk* next;
+    size_t size;
+    char data[];
+};
+
 static void* exprAlloc(void* ptr, size_t oldSize, size_t newSize) {
     if (newSize == 0) {
         #ifdef DEBUG_LOG_MEMORY
@@ -66,13 +75,60 @@ const char* getExprName(ExprType type) {
     }
 }
 
+static void* arenaAlloc(ProgramTree* tree, size_t size) {
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+    ArenaChunk* chunk = tree->arena;
+
+    if (chunk == NULL || chunk->size - tree->arenaUsed < size) {
+        size_t capacity = chunk == NULL ? ARENA_CHUNK_MIN : chunk->size * 2;
+
+        if (capacity > ARENA_CHUNK_MAX) {
+            capacity = ARENA_CHUNK_MAX;
+        }
+
+        if (capacity < size) {
+            capacity = size;
+        }
+
+        chunk = (ArenaChunk*)exprAlloc(NULL, 0, sizeof(ArenaChunk) + capacity);
+        chunk->next = tree->arena;
+        chunk->size = capacity;
+        tree->arena = chunk;
+        tree->arenaUsed = 0;
+    }
+
+    void* result = chunk->data + tree->arenaUsed;
+    tree->arenaUsed += size;
+
+    return result;
+}
+
+// Grows an array in the arena, in place when it's the last thing bumped
+static void* arenaGrow(ProgramTree* tree, void* array, size_t oldSize, size_t newSize) {
+    oldSize = (oldSize + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    newSize = (newSize + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    ArenaChunk* chunk = tree->arena;
+
+    if (array != NULL && (char*)array + oldSize == chunk->data + tree->arenaUsed
+        && chunk->size - tree->arenaUsed >= newSize - oldSize) {
+        tree->arenaUsed += newSize - oldSize;
+        return array;
+    }
+
+    void* grown = arenaAlloc(tree, newSize);
+
+    if (array != NULL) {
+        memcpy(grown, array, oldSize);
+    }
+
+    return grown;
+}
+
 static Expr* allocateExpression(ProgramTree* tree, size_t size, ExprType type) {
-    Expr* expression = (Expr*)exprAlloc(NULL, 0, size);
+    Expr* expression = (Expr*)arenaAlloc(tree, size);
     expression->type = type;
 
-    expression->next = tree->expressions;
-    tree->expressions = expression;
-
     #ifdef DEBUG_LOG_MEMORY
     printf("%p allocate %zu for %s\n", (void*)expression, size, getExprName(type));
     #endif
@@ -80,37 +136,6 @@ static Expr* allocateExpression(ProgramTree* tree, size_t size, ExprType type) {
     return expression;
 }
 
-static void freeExpr(Expr* expr) {
-    switch (expr->type) {
-        case EXPR_LITERAL: {
-            LiteralExpr* literal = (LiteralExpr*)expr;
-            FREE_EXPR(literal, LiteralExpr);
-            break;
-        }
-        case EXPR_UNARY: {
-            UnaryExpr* unary = (UnaryExpr*)expr;
-            FREE_EXPR(unary, UnaryExpr);
-            break;
-        }
-        case EXPR_BINARY: {
-            BinaryExpr* binary = (BinaryExpr*)expr;
-            FREE_EXPR(binary, BinaryExpr);
-            break;
-        }
-        case EXPR_TERNARY: {
-            TernaryExpr* ternary = (TernaryExpr*)expr;
-            FREE_EXPR(ternary, TernaryExpr);
-            break;
-        }
-        case EXPR_BLOCK: {
-            BlockExpr* block = (BlockExpr*)expr;
-            FREE_EXPR_ARRAY(block->subexprs, block->capacity, Expr*);
-            FREE_EXPR(block, BlockExpr);
-            break;
-        }
-    }
-}
-
 static LiteralExpr* Literal(ProgramTree* tree, Token token) {
     LiteralExpr* literal = ALLOCATE_EXPR(tree, LiteralExpr, EXPR_LITERAL);
     literal->token = token;
@@ -145,12 +170,12 @@ static TernaryExpr* Ternary(ProgramTree* tree, Token token) {
     return ternary;
 }
 
-static void writeExpr(BlockExpr* block, Expr* expr) {
+static void writeExpr(ProgramTree* tree, BlockExpr* block, Expr* expr) {
     if (block->capacity < block->count + 1) {
         int oldCapacity = block->capacity;
         block->capacity = GROW_CAP(oldCapacity);
-        block->subexprs = GROW_EXPR_ARRAY(block->subexprs,
-            oldCapacity, block->capacity, Expr*);
+        block->subexprs = (Expr**)arenaGrow(tree, block->subexprs,
+            sizeof(Expr*) * oldCapacity, sizeof(Expr*) * block->capacity);
     }
 
     block->subexprs[block->count] = expr;
@@ -178,7 +203,11 @@ static BlockExpr* Block(ProgramTree* tree, Token token) {
 static void writeToken(ProgramTree* tree, Token token) {
     if (tree->tokenCapacity < tree->tokenCount + 1) {
         int oldCapacity = tree->tokenCapacity;
-        tree->tokenCapacity = GROW_CAP(oldCapacity);
+        // there's about one token for every four characters of source, so
+        // most files are scanned without growing the array at all
+        tree->tokenCapacity = oldCapacity == 0
+            ? (int)(strlen(tree->scanner.trueBeginning) / 4) + 8
+            : GROW_CAP(oldCapacity);
         tree->tokens = GROW_EXPR_ARRAY(tree->tokens,
             oldCapacity, tree->tokenCapacity, Token);
     }
@@ -192,7 +221,8 @@ void initTree(ProgramTree* tree, Compiler* compiler, const char* source) {
     tree->tokenCapacity = 0;
     tree->tokens = NULL;
     tree->current = NULL;
-    tree->expressions = NULL;
+    tree->arena = NULL;
+    tree->arenaUsed = 0;
     tree->program = NULL;
     tree->hadError = false;
     tree->panicMode = false;
@@ -203,11 +233,11 @@ void initTree(ProgramTree* tree, Compiler* compiler, const char* source) {
 void freeTree(ProgramTree* tree) {
     FREE_EXPR_ARRAY(tree->tokens, tree->tokenCapacity, Token);
 
-    Expr* expr = tree->expressions;
-    while (expr != NULL) {
-        Expr* next = expr->next;
-        freeExpr(expr);
-        expr = next;
+    ArenaChunk* chunk = tree->arena;
+    while (chunk != NULL) {
+        ArenaChunk* next = chunk->next;
+        exprAlloc(chunk, sizeof(ArenaChunk) + chunk->size, 0);
+        chunk = next;
     }
 
     initTree(tree, NULL, NULL);
@@ -411,7 +441,7 @@ static void mapArgs(ProgramTree* tree, BlockExpr* map) {
         pair->left = key;
         pair->right = value;
 
-        writeExpr(map, (Expr*)pair);
+        writeExpr(tree, map, (Expr*)pair);
 
         crossLine(tree);
     }
@@ -419,7 +449,7 @@ static void mapArgs(ProgramTree* tree, BlockExpr* map) {
 
 static void listArgs(ProgramTree* tree, BlockExpr* list) {
     while (!check(tree, TOKEN_RIGHT_BRACKET) && !atEnd(tree)) {
-        writeExpr(list, expression(tree, PREC_GENERIC_LOW));
+        writeExpr(tree, list, expression(tree, PREC_GENERIC_LOW));
         crossLine(tree);
     }
 }
@@ -434,14 +464,14 @@ static void container(ProgramTree* tree, BlockExpr* container) {
         BinaryExpr* pair = Binary(tree, bisector);
         pair->left = first;
         pair->right = value;
-        writeExpr(container, (Expr*)pair);
+        writeExpr(tree, container, (Expr*)pair);
 
         crossLine(tree);
 
         mapArgs(tree, container);
     }
     else {
-        writeExpr(container, first);
+        writeExpr(tree, container, first);
         crossLine(tree);
 
         container->token.type = TOKEN_LEFT_PAREN;
@@ -603,7 +633,7 @@ static Expr* block(ProgramTree* tree, Expr* last) {
     BlockExpr* blck = Block(tree, open);
 
     while (!check(tree, TOKEN_RIGHT_BRACE) && !check(tree, TOKEN_EOF)) {
-        writeExpr(blck, topLevel(tree));
+        writeExpr(tree, blck, topLevel(tree));
     }
 
     consume(tree, TOKEN_RIGHT_BRACE, "Expected closing '}' after block");
@@ -633,7 +663,7 @@ static Expr* _match(ProgramTree* tree, Expr* last) {
 
         _case->left = l;
         _case->right = r;
-        writeExpr(cases, (Expr*)_case);
+        writeExpr(tree, cases, (Expr*)_case);
     }
 
     _switch->right = (Expr*)cases;
@@ -648,7 +678,7 @@ static Expr* function(ProgramTree* tree, Expr* last) {
     BlockExpr* operands = Block(tree, operator);
     while (!check(tree, TOKEN_EQUALS) && !atEnd(tree)) {
         glare(tree, TOKEN_IDENTIFIER, "Expected identifier in fn declaration");
-        writeExpr(operands, literal(tree, NULL));
+        writeExpr(tree, operands, literal(tree, NULL));
     }
 
     consume(tree, TOKEN_EQUALS, "Expected '=' after function operands");
@@ -693,7 +723,7 @@ static Expr* partialApply(ProgramTree* tree, BinaryExpr* application, BlockExpr*
 
     for (int i = 0; i < partial; i++) {
         ObjString* str = genID(tree, i);
-        writeExpr(lmbd_params, (Expr*)Literal(tree, (Token){TOKEN_IDENTIFIER, str->chars, 3, operator.line}));
+        writeExpr(tree, lmbd_params, (Expr*)Literal(tree, (Token){TOKEN_IDENTIFIER, str->chars, 3, operator.line}));
     }
 
     lmbd->pivot = (Expr*)lmbd_params;
@@ -732,7 +762,7 @@ static Expr* apply(ProgramTree* tree, Expr* last) {
                 partial++;
             }
 
-            writeExpr(args, param);
+            writeExpr(tree, args, param);
             crossLine(tree);
         }
         consume(tree, TOKEN_RIGHT_PAREN, "Expected ')' after params");
@@ -745,7 +775,7 @@ static Expr* apply(ProgramTree* tree, Expr* last) {
                 partial++;
             }
 
-            writeExpr(args, param);
+            writeExpr(tree, args, param);
         }
     }
 
@@ -939,12 +969,12 @@ void debugAST(const char* source) {
     match(&tree, TOKEN_SEMICOLON);
 
     while (!check(&tree, TOKEN_EOF)) {
-        writeExpr(tree.program, topLevel(&tree));
+        writeExpr(&tree, tree.program, topLevel(&tree));
     }
 
     UnaryExpr* end = Unary(&tree, *tree.current);
     end->operand = (Expr*)Literal(&tree, (Token){TOKEN_UNIT, tree.current->start, 0, tree.current->line});
-    writeExpr(tree.program, (Expr*)end);
+    writeExpr(&tree, tree.program, (Expr*)end);
 
     printExpression((Expr*)tree.program);
 
@@ -978,10 +1008,10 @@ void createTree(Compiler* compiler, ProgramTree* tree, const char* source) {
     match(tree, TOKEN_SEMICOLON);
 
     while (!check(tree, TOKEN_EOF)) {
-        writeExpr(tree->program, topLevel(tree));
+        writeExpr(tree, tree->program, topLevel(tree));
     }
 
-    writeExpr(tree->program, (Expr*)Literal(tree, (Token){TOKEN_UNIT, tree->current->start, 0, tree->current->line}));
+    writeExpr(tree, tree->program, (Expr*)Literal(tree, (Token){TOKEN_UNIT, tree->current->start, 0, tree->current->line}));
 
 
     #ifdef DEBUG_DISPLAY_AST
@@ -999,7 +1029,7 @@ void createTree(Compiler* compiler, ProgramTree* tree, const char* source) {
 +---------------------------+
 */
 
-void serialiseAST(FILE* file, const char* source) {
+static void serialiseWith(FILE* file, const char* source, void (*write)(FILE* file, Expr* program)) {
     // SETUP ------------------------------- vvvv
     VM vm;
     initVM(&vm);
@@ -1036,12 +1066,12 @@ void serialiseAST(FILE* file, const char* source) {
     match(&tree, TOKEN_SEMICOLON);
 
     while (!check(&tree, TOKEN_EOF)) {
-        writeExpr(tree.program, topLevel(&tree));
+        writeExpr(&tree, tree.program, topLevel(&tree));
     }
 
-    writeExpr(tree.program, (Expr*)Literal(&tree, (Token){TOKEN_UNIT, tree.current->start, 0, tree.current->line}));
+    writeExpr(&tree, tree.program, (Expr*)Literal(&tree, (Token){TOKEN_UNIT, tree.current->start, 0, tree.current->line}));
 
-    serialiseExpr(file, (Expr*)tree.program);
+    write(file, (Expr*)tree.program);
 
     freeTree(&tree);
 
@@ -1050,9 +1080,13 @@ void serialiseAST(FILE* file, const char* source) {
     freeVM(&vm);
 }
 
-#include "cJSON/cJSON.h"
+void serialiseAST(FILE* file, const char* source) {
+    serialiseWith(file, source, serialiseExpr);
+}
 
-Expr *deserialiseExpr(ProgramTree *tree, const cJSON *js);
+void serialiseFlatAST(FILE* file, const char* source) {
+    serialiseWith(file, source, serialiseFlat);
+}
 
 ExprType exprTypeFromName(const char *name) {
     switch (name[2]) {
@@ -1237,164 +1271,696 @@ TokenType tTypeFromName(const char *start) {
     }
 }
 
-Token deserialiseToken(ProgramTree *tree, const cJSON *js) {
-    Token token;
-
-    token.type = tTypeFromName(cJSON_GetObjectItem(js, "type")->valuestring);
-
-    token.line = cJSON_GetObjectItem(js, "line")->valueint;
-
-    cJSON *content = cJSON_GetObjectItem(js, "content");
-
-    if (cJSON_IsNull(content)) {
-        token.length = 0;
-        token.start = NULL;
-    } else if (cJSON_IsString(content)) {
-        if (token.type == TOKEN_FORMAT_STRING) {
-            size_t len = strlen(content->valuestring) + 3;
-            char *new = (char*)malloc(len);
-            strncpy(new + 2, content->valuestring, len-1);
-            new[0] = 'f';
-            new[1] = '"';
-            new[len - 1] = '"';
-
-            token.start = copyString(tree->compiler->vm, new, len)->chars;
-            token.length = len;
-            free(new);
-        } else if (token.type == TOKEN_STRING) {
-            size_t len = strlen(content->valuestring) + 2;
-            char *new = (char*)malloc(len);
-            strncpy(new + 1, content->valuestring, len-1);
-            new[0] = '"';
-            new[len - 1] = '"';
-
-            token.start = copyString(tree->compiler->vm, new, len)->chars;
-            token.length = len;
-            free(new);
-        } else if (strlen(content->valuestring) == 0) {
-            token.length = 0;
-            token.start = NULL;
-        } else  {
-            size_t len = strlen(content->valuestring);
-            char *new = (char*)malloc(len);
-            strncpy(new, content->valuestring, len);
-
-            token.start = copyString(tree->compiler->vm, new, len)->chars;
-            token.length = len;
-            free(new);
+// Pulls the AST straight out of the JSON text as it goes, so the only memory
+// used on top of the tree is a buffer for the odd token with escapes in it.
+// Token text without escapes is pointed at where it sits in 'source'
+typedef struct {
+    ProgramTree* tree;
+    const char* source;
+    const char* at;
+    bool failed;
+    char* scratch;          // decoded strings that had escapes in them
+    int scratchCapacity;
+} JsonReader;
+
+// A string as it appears in the JSON, quotes not included
+typedef struct {
+    const char* start;
+    int length;
+    bool escaped;
+} JsonString;
+
+static bool jsonFail(JsonReader* reader) {
+    if (!reader->failed) {
+        int line = 1;
+
+        for (const char* c = reader->source; c < reader->at; c++) {
+            line += *c == '\n';
+        }
+
+        fprintf(stderr, "Malformed JSON AST at line %d\n", line);
+    }
+
+    reader->failed = true;
+    return false;
+}
+
+static void jsonSkipSpace(JsonReader* reader) {
+    while (*reader->at == ' ' || *reader->at == '\n' || *reader->at == '\t' || *reader->at == '\r') {
+        reader->at++;
+    }
+}
+
+static bool jsonMatch(JsonReader* reader, char c) {
+    jsonSkipSpace(reader);
+
+    if (*reader->at != c) {
+        return false;
+    }
+
+    reader->at++;
+    return true;
+}
+
+static bool readString(JsonReader* reader, JsonString* string) {
+    if (!jsonMatch(reader, '"')) {
+        return jsonFail(reader);
+    }
+
+    string->start = reader->at;
+    string->escaped = false;
+
+    for (;;) {
+        char c = *reader->at;
+
+        if (c == '\0') {
+            return jsonFail(reader);
         }
+
+        if (c == '"') {
+            break;
+        }
+
+        if (c == '\\') {
+            string->escaped = true;
+
+            if (reader->at[1] == '\0') {
+                return jsonFail(reader);
+            }
+
+            reader->at++;
+        }
+
+        reader->at++;
     }
 
-    return token;
+    string->length = (int)(reader->at - string->start);
+    reader->at++;
+    return true;
 }
 
-Expr* deserialiseLiteral(ProgramTree *tree, const cJSON *js) {
-    cJSON *tk = cJSON_GetObjectItem(js, "token");
-    Token token = deserialiseToken(tree, tk);
+static int hexDigit(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+static bool readHex(const char* at, uint32_t* code) {
+    *code = 0;
+
+    for (int i = 0; i < 4; i++) {
+        int digit = hexDigit(at[i]);
+
+        if (digit < 0) {
+            return false;
+        }
 
-    LiteralExpr *literal = Literal(tree, token);
+        *code = (*code << 4) | (uint32_t)digit;
+    }
 
-    return (Expr*)literal;
+    return true;
 }
 
-Expr* deserialiseUnary(ProgramTree *tree, const cJSON *js) {
-    cJSON *tk = cJSON_GetObjectItem(js, "token");
-    Token token = deserialiseToken(tree, tk);
+// Decodes an escaped string into the scratch buffer, after 'offset' bytes
+// already put there; returns the decoded length, or -1
+static int unescape(JsonReader* reader, JsonString* string, int offset) {
+    if (reader->scratchCapacity < offset + string->length + 2) {
+        int oldCapacity = reader->scratchCapacity;
+        reader->scratchCapacity = offset + string->length + 2;
+        reader->scratch = GROW_EXPR_ARRAY(reader->scratch, oldCapacity, reader->scratchCapacity, char);
+    }
 
-    UnaryExpr *unary = Unary(tree, token);
+    char* out = reader->scratch + offset;
+    const char* in = string->start;
+    const char* end = string->start + string->length;
 
-    unary->operand = deserialiseExpr(tree, cJSON_GetObjectItem(js, "operand"));
+    while (in < end) {
+        if (*in != '\\') {
+            *out++ = *in++;
+            continue;
+        }
 
-    return (Expr*)unary;
+        in++;
+
+        switch (*in++) {
+            case '"':  *out++ = '"'; break;
+            case '\\': *out++ = '\\'; break;
+            case '/':  *out++ = '/'; break;
+            case 'b':  *out++ = '\b'; break;
+            case 'f':  *out++ = '\f'; break;
+            case 'n':  *out++ = '\n'; break;
+            case 'r':  *out++ = '\r'; break;
+            case 't':  *out++ = '\t'; break;
+            case 'u': {
+                uint32_t code;
+
+                if (end - in < 4 || !readHex(in, &code)) {
+                    return -1;
+                }
+
+                in += 4;
+
+                if (code >= 0xD800 && code <= 0xDBFF) {
+                    uint32_t low;
+
+                    if (end - in < 6 || in[0] != '\\' || in[1] != 'u' || !readHex(in + 2, &low)
+                        || low < 0xDC00 || low > 0xDFFF) {
+                        return -1;
+                    }
+
+                    in += 6;
+                    code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                }
+
+                // never longer than the six escaped characters it came from
+                if (code < 0x80) {
+                    *out++ = (char)code;
+                } else if (code < 0x800) {
+                    *out++ = (char)(0xC0 | (code >> 6));
+                    *out++ = (char)(0x80 | (code & 0x3F));
+                } else if (code < 0x10000) {
+                    *out++ = (char)(0xE0 | (code >> 12));
+                    *out++ = (char)(0x80 | ((code >> 6) & 0x3F));
+                    *out++ = (char)(0x80 | (code & 0x3F));
+                } else {
+                    *out++ = (char)(0xF0 | (code >> 18));
+                    *out++ = (char)(0x80 | ((code >> 12) & 0x3F));
+                    *out++ = (char)(0x80 | ((code >> 6) & 0x3F));
+                    *out++ = (char)(0x80 | (code & 0x3F));
+                }
+                break;
+            }
+            default:
+                return -1;
+        }
+    }
+
+    return (int)(out - (reader->scratch + offset));
 }
 
-Expr* deserialiseBinary(ProgramTree *tree, const cJSON *js) {
-    cJSON *tk = cJSON_GetObjectItem(js, "token");
-    Token token = deserialiseToken(tree, tk);
+static bool isKey(JsonString* key, const char* name) {
+    int length = (int)strlen(name);
+    return key->length == length && memcmp(key->start, name, length) == 0;
+}
 
-    BinaryExpr *binary = Binary(tree, token);
+// Names are read through a zeroed buffer, since the lookups below peek a
+// few characters ahead of wherever a name might end
+static bool readName(JsonReader* reader, char* name, int size) {
+    JsonString string;
 
-    binary->left = deserialiseExpr(tree, cJSON_GetObjectItem(js, "left"));
+    if (!readString(reader, &string)) {
+        return false;
+    }
 
-    binary->right = deserialiseExpr(tree, cJSON_GetObjectItem(js, "right"));
+    if (string.escaped || string.length >= size) {
+        return jsonFail(reader);
+    }
 
-    return (Expr*)binary;
+    memset(name, 0, size);
+    memcpy(name, string.start, string.length);
+    return true;
 }
 
-Expr* deserialiseTernary(ProgramTree *tree, const cJSON *js) {
-    cJSON *tk = cJSON_GetObjectItem(js, "token");
-    Token token = deserialiseToken(tree, tk);
+static bool skipValue(JsonReader* reader);
 
-    TernaryExpr *ternary = Ternary(tree, token);
+static bool skipContainer(JsonReader* reader, char close) {
+    reader->at++;
 
-    ternary->pivot = deserialiseExpr(tree, cJSON_GetObjectItem(js, "pivot"));
+    if (jsonMatch(reader, close)) {
+        return true;
+    }
 
-    ternary->left = deserialiseExpr(tree, cJSON_GetObjectItem(js, "left"));
+    do {
+        if (close == '}') {
+            JsonString key;
 
-    ternary->right = deserialiseExpr(tree, cJSON_GetObjectItem(js, "right"));
+            if (!readString(reader, &key) || !jsonMatch(reader, ':')) {
+                return jsonFail(reader);
+            }
+        }
 
-    return (Expr*)ternary;
+        if (!skipValue(reader)) {
+            return false;
+        }
+    } while (jsonMatch(reader, ','));
+
+    return jsonMatch(reader, close) || jsonFail(reader);
 }
 
-Expr* deserialiseBlock(ProgramTree *tree, const cJSON *js) {
-    cJSON *tk = cJSON_GetObjectItem(js, "token");
-    Token token = deserialiseToken(tree, tk);
+static bool skipValue(JsonReader* reader) {
+    jsonSkipSpace(reader);
+
+    switch (*reader->at) {
+        case '"': {
+            JsonString string;
+            return readString(reader, &string);
+        }
+        case '{': return skipContainer(reader, '}');
+        case '[': return skipContainer(reader, ']');
+        default: break;
+    }
 
-    BlockExpr* block = Block(tree, token);
+    const char* start = reader->at;
 
-    cJSON *subexpressions = cJSON_GetObjectItem(js, "subexprs");
+    while (*reader->at != '\0' && strchr(" \t\r\n,}]", *reader->at) == NULL) {
+        reader->at++;
+    }
 
-    for (const cJSON *tbd = (subexpressions != NULL ? (subexpressions)->child : NULL); tbd != NULL; tbd = tbd->next)
-    {
-        Expr* new = deserialiseExpr(tree, tbd);
+    return reader->at > start || jsonFail(reader);
+}
+
+static bool readContent(JsonReader* reader, Token* token) {
+    jsonSkipSpace(reader);
+
+    if (strncmp(reader->at, "null", 4) == 0) {
+        reader->at += 4;
+        token->start = NULL;
+        token->length = 0;
+        return true;
+    }
+
+    JsonString content;
+
+    if (!readString(reader, &content)) {
+        return false;
+    }
+
+    if (token->type == TOKEN_FORMAT_STRING || (content.escaped && token->type == TOKEN_STRING)) {
+        // rebuilt around the decoded text, as f"..." or "..."
+        int prefix = token->type == TOKEN_FORMAT_STRING ? 2 : 1;
+        int length = unescape(reader, &content, prefix);
+
+        if (length < 0) {
+            return jsonFail(reader);
+        }
+
+        reader->scratch[0] = 'f';
+        reader->scratch[prefix - 1] = '"';
+        reader->scratch[prefix + length] = '"';
+
+        token->start = copyString(reader->tree->compiler->vm, reader->scratch, prefix + length + 1)->chars;
+        token->length = prefix + length + 1;
+        return true;
+    }
+
+    if (token->type == TOKEN_STRING) {
+        // the quotes around it in the JSON are the ones the literal needs
+        token->start = content.start - 1;
+        token->length = content.length + 2;
+        return true;
+    }
+
+    if (content.length == 0) {
+        token->start = NULL;
+        token->length = 0;
+        return true;
+    }
 
-        writeExpr(block, new);
+    if (content.escaped) {
+        int length = unescape(reader, &content, 0);
+
+        if (length < 0) {
+            return jsonFail(reader);
+        }
+
+        token->start = copyString(reader->tree->compiler->vm, reader->scratch, length)->chars;
+        token->length = length;
+        return true;
     }
 
-    return (Expr*)block;
+    token->start = content.start;
+    token->length = content.length;
+    return true;
+}
+
+static bool readToken(JsonReader* reader, Token* token) {
+    *token = (Token){ TOKEN_ERROR, NULL, 0, 0 };
+    bool typed = false;
+
+    if (!jsonMatch(reader, '{')) {
+        return jsonFail(reader);
+    }
+
+    if (jsonMatch(reader, '}')) {
+        return jsonFail(reader);
+    }
+
+    do {
+        JsonString key;
+
+        if (!readString(reader, &key) || !jsonMatch(reader, ':')) {
+            return jsonFail(reader);
+        }
+
+        if (isKey(&key, "type")) {
+            char name[32];
+
+            if (!readName(reader, name, sizeof(name))) {
+                return false;
+            }
+
+            token->type = tTypeFromName(name);
+            typed = true;
+        }
+        else if (isKey(&key, "line")) {
+            jsonSkipSpace(reader);
+            char* end;
+            long line = strtol(reader->at, &end, 10);
+
+            if (end == reader->at) {
+                return jsonFail(reader);
+            }
+
+            token->line = (int)line;
+            reader->at = end;
+        }
+        else if (isKey(&key, "content")) {
+            // the type has to be known to make sense of the content
+            if (!typed || !readContent(reader, token)) {
+                return jsonFail(reader);
+            }
+        }
+        else if (!skipValue(reader)) {
+            return false;
+        }
+    } while (jsonMatch(reader, ','));
+
+    return jsonMatch(reader, '}') || jsonFail(reader);
 }
 
-// Deserialise expr type and call corresponding function to deserialise the rest
-Expr *deserialiseExpr(ProgramTree *tree, const cJSON *js) {
-    cJSON *type_param = cJSON_GetObjectItem(js, "type");
+static Expr* readExpr(JsonReader* reader);
+
+static bool readSubexprs(JsonReader* reader, BlockExpr* block) {
+    if (!jsonMatch(reader, '[')) {
+        return jsonFail(reader);
+    }
 
-    if (type_param == NULL) {
-        fprintf(stderr, "Error while deserialising JSON\n");
-        Token token = deserialiseToken(tree, js);
-        errorAt(tree, &token, "Could not read type param while deserialising\n");
+    if (jsonMatch(reader, ']')) {
+        return true;
+    }
+
+    do {
+        Expr* expr = readExpr(reader);
+
+        if (expr == NULL) {
+            return false;
+        }
+
+        writeExpr(reader->tree, block, expr);
+    } while (jsonMatch(reader, ','));
+
+    return jsonMatch(reader, ']') || jsonFail(reader);
+}
+
+// Fields can come in any order, so children are held until the node's type
+// is known; a block's subexpressions go straight into it
+static Expr* readExpr(JsonReader* reader) {
+    ExprType type = (ExprType)255;
+    Token token = { TOKEN_ERROR, NULL, 0, 0 };
+    Expr* operand = NULL;
+    Expr* pivot = NULL;
+    Expr* left = NULL;
+    Expr* right = NULL;
+    BlockExpr* block = NULL;
+
+    if (!jsonMatch(reader, '{')) {
+        jsonFail(reader);
         return NULL;
     }
 
-    ExprType type = exprTypeFromName(type_param->valuestring);
+    if (jsonMatch(reader, '}')) {
+        jsonFail(reader);
+        return NULL;
+    }
+
+    do {
+        JsonString key;
+        bool ok = true;
+
+        if (!readString(reader, &key) || !jsonMatch(reader, ':')) {
+            jsonFail(reader);
+            return NULL;
+        }
 
+        if (isKey(&key, "type")) {
+            char name[16];
+            ok = readName(reader, name, sizeof(name));
+            type = exprTypeFromName(name);
+        }
+        else if (isKey(&key, "token")) {
+            ok = readToken(reader, &token);
+        }
+        else if (isKey(&key, "operand")) {
+            ok = (operand = readExpr(reader)) != NULL;
+        }
+        else if (isKey(&key, "pivot")) {
+            ok = (pivot = readExpr(reader)) != NULL;
+        }
+        else if (isKey(&key, "left")) {
+            ok = (left = readExpr(reader)) != NULL;
+        }
+        else if (isKey(&key, "right")) {
+            ok = (right = readExpr(reader)) != NULL;
+        }
+        else if (isKey(&key, "subexprs")) {
+            block = block != NULL ? block : Block(reader->tree, token);
+            ok = readSubexprs(reader, block);
+        }
+        else {
+            ok = skipValue(reader);
+        }
+
+        if (!ok) {
+            return NULL;
+        }
+    } while (jsonMatch(reader, ','));
+
+    if (!jsonMatch(reader, '}')) {
+        jsonFail(reader);
+        return NULL;
+    }
+
+    // anything made but not used is still on the tree's list, and freed
     switch (type) {
-        case EXPR_LITERAL: return deserialiseLiteral(tree, js);
-        case EXPR_UNARY: return deserialiseUnary(tree, js);
-        case EXPR_BINARY: return deserialiseBinary(tree, js);
-        case EXPR_TERNARY: return deserialiseTernary(tree, js);
-        case EXPR_BLOCK: return deserialiseBlock(tree, js);
-        default: break;
+        case EXPR_LITERAL:
+            return (Expr*)Literal(reader->tree, token);
+        case EXPR_UNARY: {
+            if (operand == NULL) break;
+
+            UnaryExpr* unary = Unary(reader->tree, token);
+            unary->operand = operand;
+            return (Expr*)unary;
+        }
+        case EXPR_BINARY: {
+            if (left == NULL || right == NULL) break;
+
+            BinaryExpr* binary = Binary(reader->tree, token);
+            binary->left = left;
+            binary->right = right;
+            return (Expr*)binary;
+        }
+        case EXPR_TERNARY: {
+            if (pivot == NULL || left == NULL || right == NULL) break;
+
+            TernaryExpr* ternary = Ternary(reader->tree, token);
+            ternary->pivot = pivot;
+            ternary->left = left;
+            ternary->right = right;
+            return (Expr*)ternary;
+        }
+        case EXPR_BLOCK: {
+            block = block != NULL ? block : Block(reader->tree, token);
+            block->token = token;
+            return (Expr*)block;
+        }
+        default:
+            break;
     }
 
-    fprintf(stderr, "Error while deserialising JSON\n");
-    Token token = deserialiseToken(tree, js);
-    errorAt(tree, &token, "Could not recognise expression type while deserialising\n");
+    jsonFail(reader);
     return NULL;
 }
 
+// The tree's tokens may point into 'source', which has to outlive it
 void deserialiseJSON(Compiler* compiler, ProgramTree* tree, const char* source) {
     initTree(tree, compiler, source);
 
-    cJSON *js = cJSON_Parse(source);
+    JsonReader reader = { tree, source, source, false, NULL, 0 };
+    Expr* program = readExpr(&reader);
 
-    if (js == NULL) {
-        fprintf(stderr, "Failed to parse JSON\n");
-        return;
+    jsonSkipSpace(&reader);
+
+    if (program != NULL && *reader.at != '\0') {
+        jsonFail(&reader);
+    }
+    else if (program != NULL && (program->type != EXPR_BLOCK || ((BlockExpr*)program)->count == 0)) {
+        fprintf(stderr, "JSON AST has no program block\n");
+        reader.failed = true;
+    }
+
+    if (reader.failed) {
+        tree->hadError = true;
+    }
+    else {
+        tree->program = (BlockExpr*)program;
+    }
+
+    FREE_EXPR_ARRAY(reader.scratch, reader.scratchCapacity, char);
+}
+
+bool isFlatAST(const uint8_t* bytes, size_t length) {
+    return length >= 4 && memcmp(bytes, FLAT_MAGIC, 4) == 0;
+}
+
+// Everything a node points at has to come before it and be pointed at only
+// once, so what's built is always a tree
+static bool takeChild(FlatHeader* header, uint32_t node, uint32_t child, bool* taken) {
+    if (child >= node || child >= header->nodeCount || taken[child]) {
+        return false;
+    }
+
+    taken[child] = true;
+    return true;
+}
+
+static bool readFlat(ProgramTree* tree, const uint8_t* bytes, size_t length) {
+    FlatHeader header;
+
+    if (length < sizeof(header) || (uintptr_t)bytes % 4 != 0) {
+        return false;
+    }
+
+    memcpy(&header, bytes, sizeof(header));
+
+    if (memcmp(header.magic, FLAT_MAGIC, 4) != 0 || header.version != FLAT_VERSION || header.order != FLAT_ORDER) {
+        return false;
+    }
+
+    uint64_t expected = sizeof(header)
+        + (uint64_t)header.tokenCount * sizeof(FlatToken)
+        + (uint64_t)header.nodeCount * sizeof(FlatNode)
+        + (uint64_t)header.childCount * sizeof(uint32_t)
+        + header.stringBytes;
+
+    if (expected != length || header.nodeCount == 0) {
+        return false;
     }
 
-    tree->program = (BlockExpr*)deserialiseExpr(tree, js);
+    const FlatToken* flatTokens = (const FlatToken*)(bytes + sizeof(header));
+    const FlatNode* nodes = (const FlatNode*)(flatTokens + header.tokenCount);
+    const uint32_t* children = (const uint32_t*)(nodes + header.nodeCount);
+    const char* strings = (const char*)(children + header.childCount);
 
-    cJSON_Delete(js);
+    // tokens point straight at their text in the string table
+    Token* tokens = GROW_EXPR_ARRAY(NULL, 0, header.tokenCount + 1, Token);
+
+    for (uint32_t i = 0; i < header.tokenCount; i++) {
+        const FlatToken* flat = &flatTokens[i];
+
+        if (flat->type > TOKEN_ERROR || flat->length >= header.stringBytes
+            || flat->start > header.stringBytes - flat->length - 1
+            || strings[flat->start + flat->length] != '\0') {
+            FREE_EXPR_ARRAY(tokens, header.tokenCount + 1, Token);
+            return false;
+        }
+
+        tokens[i] = (Token){ (TokenType)flat->type, strings + flat->start, (int)flat->length, flat->line };
+    }
+
+    Expr** made = GROW_EXPR_ARRAY(NULL, 0, header.nodeCount, Expr*);
+    bool* taken = (bool*)calloc(header.nodeCount, sizeof(bool));
+    bool ok = taken != NULL;
+
+    for (uint32_t i = 0; ok && i < header.nodeCount; i++) {
+        const FlatNode* node = &nodes[i];
+
+        if (node->token >= header.tokenCount) {
+            ok = false;
+            break;
+        }
+
+        Token token = tokens[node->token];
+
+        switch (node->type) {
+            case EXPR_LITERAL:
+                made[i] = (Expr*)Literal(tree, token);
+                break;
+            case EXPR_UNARY: {
+                ok = takeChild(&header, i, node->a, taken);
+                UnaryExpr* unary = Unary(tree, token);
+                unary->operand = ok ? made[node->a] : NULL;
+                made[i] = (Expr*)unary;
+                break;
+            }
+            case EXPR_BINARY: {
+                ok = takeChild(&header, i, node->a, taken) && takeChild(&header, i, node->b, taken);
+                BinaryExpr* binary = Binary(tree, token);
+                binary->left = ok ? made[node->a] : NULL;
+                binary->right = ok ? made[node->b] : NULL;
+                made[i] = (Expr*)binary;
+                break;
+            }
+            case EXPR_TERNARY: {
+                ok = takeChild(&header, i, node->a, taken) && takeChild(&header, i, node->b, taken)
+                    && takeChild(&header, i, node->c, taken);
+                TernaryExpr* ternary = Ternary(tree, token);
+                ternary->pivot = ok ? made[node->a] : NULL;
+                ternary->left = ok ? made[node->b] : NULL;
+                ternary->right = ok ? made[node->c] : NULL;
+                made[i] = (Expr*)ternary;
+                break;
+            }
+            case EXPR_BLOCK: {
+                BlockExpr* block = Block(tree, token);
+                made[i] = (Expr*)block;
+
+                if (node->a > header.childCount || node->b > header.childCount - node->a) {
+                    ok = false;
+                    break;
+                }
+
+                block->capacity = (int)node->b;
+                block->subexprs = (Expr**)arenaAlloc(tree, sizeof(Expr*) * block->capacity);
+
+                for (uint32_t j = 0; ok && j < node->b; j++) {
+                    ok = takeChild(&header, i, children[node->a + j], taken);
+
+                    if (ok) {
+                        block->subexprs[block->count++] = made[children[node->a + j]];
+                    }
+                }
+                break;
+            }
+            default:
+                ok = false;
+                break;
+        }
+    }
+
+    Expr* program = ok ? made[header.nodeCount - 1] : NULL;
+    ok = ok && program->type == EXPR_BLOCK && ((BlockExpr*)program)->count > 0;
+
+    if (ok) {
+        tree->program = (BlockExpr*)program;
+    }
+
+    // what's been made is already on the tree's list, so freeTree takes it
+    free(taken);
+    FREE_EXPR_ARRAY(made, header.nodeCount, Expr*);
+    FREE_EXPR_ARRAY(tokens, header.tokenCount + 1, Token);
+
+    return ok;
+}
+
+// The tree's tokens point into 'bytes', which has to outlive it
+void deserialiseFlat(Compiler* compiler, ProgramTree* tree, const uint8_t* bytes, size_t length) {
+    initTree(tree, compiler, "");
+
+    if (!readFlat(tree, bytes, length)) {
+        fprintf(stderr, "Malformed binary AST\n");
+        tree->hadError = true;
+    }
 }
 
 /*
@@ -6,6 +6,7 @@
 #include <stdio.h>
 
 typedef struct Expr Expr;
+typedef struct ArenaChunk ArenaChunk;
 
 
 typedef enum {
@@ -18,7 +19,6 @@ typedef enum {
 
 struct Expr {
     ExprType type;
-    Expr* next;
 };
 
 typedef struct {
@@ -67,7 +67,8 @@ typedef struct {
     // Dynamic
     Token* current;      // the current (yet-to-be-consumed) token
     BlockExpr* program;  // the actual Abstract Syntax Tree
-    Expr* expressions;   // linked list head for memory collection
+    ArenaChunk* arena;   // where the nodes live, newest chunk first
+    size_t arenaUsed;    // of the newest chunk
     Token* tokens;       // the token stack
     Compiler* compiler;  // the associated compiler
 } ProgramTree;
@@ -81,7 +82,10 @@ void createTree(Compiler* compiler, ProgramTree* tree, const char* source);
 void initTree(ProgramTree* tree, Compiler* compiler, const char* source);
 void freeTree(ProgramTree* tree);
 void serialiseAST(FILE* file, const char *source);
+void serialiseFlatAST(FILE* file, const char* source);
 void deserialiseJSON(Compiler* compiler, ProgramTree* tree, const char* source);
+void deserialiseFlat(Compiler* compiler, ProgramTree* tree, const uint8_t* bytes, size_t length);
+bool isFlatAST(const uint8_t* bytes, size_t length);
 
 
 #endif
@@ -0,0 +1,483 @@
+#include <math.h>
+
+#include "common.h"
+#include "broadcast.h"
+#include "object.h"
+#include "memory.h"
+#include "debug.h"
+#include "sequence.h"
+#include "vm.h"
+
+// Operators applied element by element over lists and typed arrays, with
+// scalars and single-kind lists going through tight loops over unboxed
+// numbers and everything else through a per-element fallback
+
+static const char* opNames[] = {
+    [BCAST_ADD] = "ARITH",
+    [BCAST_SUB] = "ARITH",
+    [BCAST_MUL] = "ARITH",
+    [BCAST_DIV] = "ARITH",
+    [BCAST_MOD] = "MOD",
+    [BCAST_POW] = "POW",
+    [BCAST_GT]  = "DIFF",
+    [BCAST_GE]  = "DIFFEQ",
+};
+
+static inline bool isNumericSeq(Value value) {
+    return IS_LIST(value) || IS_ARRAY(value) || IS_RANGE(value);
+}
+
+bool isBroadcast(Value a, Value b) {
+    return (isNumericSeq(a) && (isNumericSeq(b) || IS_ARITH(b)))
+        || (IS_ARITH(a) && isNumericSeq(b));
+}
+
+
+/*
++---------------------+
+| Kernels       vvvv  |
++---------------------+
+*/
+
+
+#define ADD(x, y)   ((x) + (y))
+#define SUB(x, y)   ((x) - (y))
+#define MUL(x, y)   ((x) * (y))
+#define DIV(x, y)   ((x) / (y))
+#define MODI(x, y)  ((x) % (y))
+#define MODF(x, y)  (fmod((x), (y)))
+#define POWI(x, y)  ((long long)pow((double)(x), (double)(y)))
+#define POWF(x, y)  (pow((x), (y)))
+
+// Array-array, array-scalar and scalar-array forms of one operator
+#define KERNELS(name, type, OP)                                                                 \
+static void name##VV(type* restrict out, const type* restrict xs, const type* restrict ys, int n) { \
+    for (int i = 0; i < n; i++) out[i] = OP(xs[i], ys[i]);                                      \
+}                                                                                               \
+static void name##VS(type* restrict out, const type* restrict xs, type y, int n) {              \
+    for (int i = 0; i < n; i++) out[i] = OP(xs[i], y);                                          \
+}                                                                                               \
+static void name##SV(type* restrict out, type x, const type* restrict ys, int n) {              \
+    for (int i = 0; i < n; i++) out[i] = OP(x, ys[i]);                                          \
+}
+
+KERNELS(addInts, long long, ADD)
+KERNELS(subInts, long long, SUB)
+KERNELS(mulInts, long long, MUL)
+KERNELS(divInts, long long, DIV)
+KERNELS(modInts, long long, MODI)
+KERNELS(powInts, long long, POWI)
+
+KERNELS(addFloats, double, ADD)
+KERNELS(subFloats, double, SUB)
+KERNELS(mulFloats, double, MUL)
+KERNELS(divFloats, double, DIV)
+KERNELS(modFloats, double, MODF)
+KERNELS(powFloats, double, POWF)
+
+#undef KERNELS
+
+typedef struct {
+    void (*vv)(long long* out, const long long* xs, const long long* ys, int n);
+    void (*vs)(long long* out, const long long* xs, long long y, int n);
+    void (*sv)(long long* out, long long x, const long long* ys, int n);
+} IntKernels;
+
+typedef struct {
+    void (*vv)(double* out, const double* xs, const double* ys, int n);
+    void (*vs)(double* out, const double* xs, double y, int n);
+    void (*sv)(double* out, double x, const double* ys, int n);
+} FloatKernels;
+
+static const IntKernels intKernels[] = {
+    [BCAST_ADD] = { addIntsVV, addIntsVS, addIntsSV },
+    [BCAST_SUB] = { subIntsVV, subIntsVS, subIntsSV },
+    [BCAST_MUL] = { mulIntsVV, mulIntsVS, mulIntsSV },
+    [BCAST_DIV] = { divIntsVV, divIntsVS, divIntsSV },
+    [BCAST_MOD] = { modIntsVV, modIntsVS, modIntsSV },
+    [BCAST_POW] = { powIntsVV, powIntsVS, powIntsSV },
+};
+
+static const FloatKernels floatKernels[] = {
+    [BCAST_ADD] = { addFloatsVV, addFloatsVS, addFloatsSV },
+    [BCAST_SUB] = { subFloatsVV, subFloatsVS, subFloatsSV },
+    [BCAST_MUL] = { mulFloatsVV, mulFloatsVS, mulFloatsSV },
+    [BCAST_DIV] = { divFloatsVV, divFloatsVS, divFloatsSV },
+    [BCAST_MOD] = { modFloatsVV, modFloatsVS, modFloatsSV },
+    [BCAST_POW] = { powFloatsVV, powFloatsVS, powFloatsSV },
+};
+
+
+/*
++---------------------+
+| Kernels       ^^^^  |
++=====================+
+| Values        vvvv  |
++---------------------+
+*/
+
+
+static inline double asDouble(Value value) {
+    return IS_INT(value) ? (double)AS_INT(value) : AS_FLOAT(value);
+}
+
+// Scalar fallback with the same rules as the VM's own arithmetic
+static bool scalarOp(VM* vm, BroadcastOp op, Value a, Value b, Value* out) {
+    if (!IS_ARITH(a) || !IS_ARITH(b)) {
+        runtimeError(vm, "%s : Cannot perform op on %s and %s", opNames[op], getValName(a), getValName(b));
+        return false;
+    }
+
+    if (IS_INT(a) && IS_INT(b)) {
+        long long x = AS_INT(a);
+        long long y = AS_INT(b);
+
+        if ((op == BCAST_DIV || op == BCAST_MOD) && y == 0) {
+            runtimeError(vm, "%s : Division by zero", opNames[op]);
+            return false;
+        }
+
+        switch (op) {
+        case BCAST_ADD: *out = INT_VAL(ADD(x, y)); break;
+        case BCAST_SUB: *out = INT_VAL(SUB(x, y)); break;
+        case BCAST_MUL: *out = INT_VAL(MUL(x, y)); break;
+        case BCAST_DIV: *out = INT_VAL(DIV(x, y)); break;
+        case BCAST_MOD: *out = INT_VAL(MODI(x, y)); break;
+        case BCAST_POW: *out = INT_VAL(POWI(x, y)); break;
+        case BCAST_GT:  *out = BOOL_VAL(x > y); break;
+        case BCAST_GE:  *out = BOOL_VAL(x >= y); break;
+        }
+
+        return true;
+    }
+
+    double x = asDouble(a);
+    double y = asDouble(b);
+
+    switch (op) {
+    case BCAST_ADD: *out = FLOAT_VAL(ADD(x, y)); break;
+    case BCAST_SUB: *out = FLOAT_VAL(SUB(x, y)); break;
+    case BCAST_MUL: *out = FLOAT_VAL(MUL(x, y)); break;
+    case BCAST_DIV: *out = FLOAT_VAL(DIV(x, y)); break;
+    case BCAST_MOD: *out = FLOAT_VAL(MODF(x, y)); break;
+    case BCAST_POW: *out = FLOAT_VAL(POWF(x, y)); break;
+    case BCAST_GT:  *out = BOOL_VAL(x > y); break;
+    case BCAST_GE:  *out = BOOL_VAL(x >= y); break;
+    }
+
+    return true;
+}
+
+// Element 'index' of a broadcast operand; scalars repeat
+static inline Value operandAt(Value operand, int index) {
+    return IS_ARITH(operand) ? operand : seqAt(operand, index);
+}
+
+static ObjList* newSizedList(VM* vm, int count) {
+    ObjList* list = newList(vm);
+    push(vm, OBJ_VAL(list));
+
+    list->array.values = GROW_ARRAY(vm, list->array.values, 0, count, Value);
+    list->array.capacity = count;
+
+    pop(vm);
+
+    return list;
+}
+
+// Per-element route for mixed lists; results are always numbers or bools, so
+// filling the list never allocates
+static bool broadcastValues(VM* vm, BroadcastOp op, Value a, Value b, int n, Value* result) {
+    ObjList* list = newSizedList(vm, n);
+
+    for (int i = 0; i < n; i++) {
+        if (!scalarOp(vm, op, operandAt(a, i), operandAt(b, i), &list->array.values[i])) {
+            return false;
+        }
+    }
+
+    list->array.count = n;
+    *result = OBJ_VAL(list);
+    return true;
+}
+
+// A list holding only ints or only floats can go through the kernels
+static bool isHomogeneous(Value list, ArrayKind* kind) {
+    int count = ARRAY(list).count;
+    Value* values = ELEMS(list);
+
+    if (count == 0) {
+        *kind = ARRAY_INT;
+        return true;
+    }
+
+    if (!IS_ARITH(values[0])) {
+        return false;
+    }
+
+    ValType type = values[0].type;
+
+    for (int i = 1; i < count; i++) {
+        if (values[i].type != type) {
+            return false;
+        }
+    }
+
+    *kind = type == VAL_INT ? ARRAY_INT : ARRAY_FLOAT;
+    return true;
+}
+
+static ObjArray* unboxList(VM* vm, Value list, ArrayKind kind) {
+    int count = ARRAY(list).count;
+    ObjArray* array = newArray(vm, kind, count);
+    Value* values = ELEMS(list);
+
+    if (kind == ARRAY_INT) {
+        for (int i = 0; i < count; i++) {
+            array->as.ints[i] = AS_INT(values[i]);
+        }
+    }
+    else {
+        for (int i = 0; i < count; i++) {
+            array->as.floats[i] = AS_FLOAT(values[i]);
+        }
+    }
+
+    return array;
+}
+
+static ObjList* boxArray(VM* vm, ObjArray* array) {
+    ObjList* list = newSizedList(vm, array->count);
+
+    for (int i = 0; i < array->count; i++) {
+        list->array.values[i] = arrayAt(array, i);
+    }
+
+    list->array.count = array->count;
+    return list;
+}
+
+static ObjArray* toFloats(VM* vm, ObjArray* array) {
+    ObjArray* floats = newArray(vm, ARRAY_FLOAT, array->count);
+
+    for (int i = 0; i < array->count; i++) {
+        floats->as.floats[i] = (double)array->as.ints[i];
+    }
+
+    return floats;
+}
+
+
+// Homogeneous lists of ints skip unboxing altogether for the cheap operators,
+// working straight on the tagged values in a single pass
+#define BOXED_INT_LOOP(OP)                                                                  \
+    for (int i = 0; i < n; i++) {                                                           \
+        long long x = xs != NULL ? xs[i].as.integer : xv;                                   \
+        long long y = ys != NULL ? ys[i].as.integer : yv;                                   \
+        out[i] = INT_VAL(OP(x, y));                                                         \
+    }
+
+static ObjList* boxedInts(VM* vm, BroadcastOp op, Value a, Value b, int n) {
+    ObjList* list = newSizedList(vm, n);
+    Value* out = list->array.values;
+
+    const Value* xs = IS_LIST(a) ? ELEMS(a) : NULL;
+    const Value* ys = IS_LIST(b) ? ELEMS(b) : NULL;
+    long long xv = xs == NULL ? AS_INT(a) : 0;
+    long long yv = ys == NULL ? AS_INT(b) : 0;
+
+    switch (op) {
+    case BCAST_ADD: BOXED_INT_LOOP(ADD) break;
+    case BCAST_SUB: BOXED_INT_LOOP(SUB) break;
+    case BCAST_MUL: BOXED_INT_LOOP(MUL) break;
+    default: break;
+    }
+
+    list->array.count = n;
+    return list;
+}
+
+#undef BOXED_INT_LOOP
+
+
+/*
++---------------------+
+| Values        ^^^^  |
++=====================+
+| Arrays        vvvv  |
++---------------------+
+*/
+
+
+static ObjList* compareArrays(VM* vm, BroadcastOp op, Value x, Value y, int n) {
+    ObjList* list = newSizedList(vm, n);
+
+    for (int i = 0; i < n; i++) {
+        scalarOp(vm, op, operandAt(x, i), operandAt(y, i), &list->array.values[i]);
+    }
+
+    list->array.count = n;
+    return list;
+}
+
+static bool hasZero(Value operand) {
+    if (IS_INT(operand)) {
+        return AS_INT(operand) == 0;
+    }
+
+    ObjArray* array = AS_ARRAY(operand);
+
+    for (int i = 0; i < array->count; i++) {
+        if (array->as.ints[i] == 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// 'x' and 'y' are typed arrays or scalars, at least one an array
+static bool broadcastArrays(VM* vm, BroadcastOp op, Value x, Value y, int n, Value* result) {
+    if (op == BCAST_GT || op == BCAST_GE) {
+        *result = OBJ_VAL(compareArrays(vm, op, x, y, n));
+        return true;
+    }
+
+    ObjArray* xa = IS_ARRAY(x) ? AS_ARRAY(x) : NULL;
+    ObjArray* ya = IS_ARRAY(y) ? AS_ARRAY(y) : NULL;
+
+    bool ints = (xa != NULL ? xa->kind == ARRAY_INT : IS_INT(x))
+             && (ya != NULL ? ya->kind == ARRAY_INT : IS_INT(y));
+
+    if (ints) {
+        if ((op == BCAST_DIV || op == BCAST_MOD) && hasZero(y)) {
+            runtimeError(vm, "%s : Division by zero", opNames[op]);
+            return false;
+        }
+
+        ObjArray* out = newArray(vm, ARRAY_INT, n);
+        const IntKernels* kernel = &intKernels[op];
+
+        if (xa != NULL && ya != NULL)   kernel->vv(out->as.ints, xa->as.ints, ya->as.ints, n);
+        else if (xa != NULL)            kernel->vs(out->as.ints, xa->as.ints, AS_INT(y), n);
+        else                            kernel->sv(out->as.ints, AS_INT(x), ya->as.ints, n);
+
+        *result = OBJ_VAL(out);
+        return true;
+    }
+
+    // anything involving a float is done in floats, so int arrays are widened first
+    int temps = 0;
+
+    if (xa != NULL && xa->kind == ARRAY_INT) {
+        xa = toFloats(vm, xa);
+        push(vm, OBJ_VAL(xa));
+        temps++;
+    }
+
+    if (ya != NULL && ya->kind == ARRAY_INT) {
+        ya = toFloats(vm, ya);
+        push(vm, OBJ_VAL(ya));
+        temps++;
+    }
+
+    ObjArray* out = newArray(vm, ARRAY_FLOAT, n);
+    const FloatKernels* kernel = &floatKernels[op];
+
+    if (xa != NULL && ya != NULL)   kernel->vv(out->as.floats, xa->as.floats, ya->as.floats, n);
+    else if (xa != NULL)            kernel->vs(out->as.floats, xa->as.floats, asDouble(y), n);
+    else                            kernel->sv(out->as.floats, asDouble(x), ya->as.floats, n);
+
+    while (temps--) {
+        pop(vm);
+    }
+
+    *result = OBJ_VAL(out);
+    return true;
+}
+
+
+/*
++---------------------+
+| Arrays        ^^^^  |
++---------------------+
+*/
+
+
+// Replaces the two operands on top of the stack with the result; lists give
+// lists and arrays give arrays, except comparisons, which always give a list
+// of bools
+bool broadcast(VM* vm, BroadcastOp op) {
+    // ranges behave as the lists they stand for
+    for (int i = 0; i < 2; i++) {
+        if (IS_RANGE(peek(vm, i))) {
+            vm->stackTop[-1 - i] = OBJ_VAL(rangeToList(vm, AS_RANGE(peek(vm, i))));
+        }
+    }
+
+    Value a = peek(vm, 1);
+    Value b = peek(vm, 0);
+
+    int n = IS_ARITH(a) ? seqLength(b) : seqLength(a);
+
+    if (!IS_ARITH(a) && !IS_ARITH(b) && seqLength(b) != n) {
+        runtimeError(vm, "%s : Cannot broadcast over lengths %d and %d", opNames[op], n, seqLength(b));
+        return false;
+    }
+
+    ArrayKind kindA = ARRAY_INT, kindB = ARRAY_INT;
+    Value result;
+
+    bool mixed = (IS_LIST(a) && !isHomogeneous(a, &kindA))
+              || (IS_LIST(b) && !isHomogeneous(b, &kindB));
+
+    bool intLists = !IS_ARRAY(a) && !IS_ARRAY(b)
+                 && (IS_LIST(a) ? kindA == ARRAY_INT : IS_INT(a))
+                 && (IS_LIST(b) ? kindB == ARRAY_INT : IS_INT(b));
+
+    if (mixed) {
+        if (!broadcastValues(vm, op, a, b, n, &result)) {
+            return false;
+        }
+    }
+    else if (intLists && (op == BCAST_ADD || op == BCAST_SUB || op == BCAST_MUL)) {
+        result = OBJ_VAL(boxedInts(vm, op, a, b, n));
+    }
+    else {
+        Value x = a;
+        Value y = b;
+        int temps = 0;
+
+        if (IS_LIST(a)) {
+            x = OBJ_VAL(unboxList(vm, a, kindA));
+            push(vm, x);
+            temps++;
+        }
+
+        if (IS_LIST(b)) {
+            y = OBJ_VAL(unboxList(vm, b, kindB));
+            push(vm, y);
+            temps++;
+        }
+
+        if (!broadcastArrays(vm, op, x, y, n, &result)) {
+            return false;
+        }
+
+        if (temps > 0 && IS_ARRAY(result)) {
+            push(vm, result);
+            result = OBJ_VAL(boxArray(vm, AS_ARRAY(result)));
+            pop(vm);
+        }
+
+        while (temps--) {
+            pop(vm);
+        }
+    }
+
+    pop(vm); // b
+    pop(vm); // a
+    push(vm, result);
+
+    return true;
+}
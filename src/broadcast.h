@@ -0,0 +1,21 @@
+#ifndef broadcast_h_hammer
+#define broadcast_h_hammer
+
+#include "common.h"
+#include "object.h"
+
+typedef enum {
+    BCAST_ADD,
+    BCAST_SUB,
+    BCAST_MUL,
+    BCAST_DIV,
+    BCAST_MOD,
+    BCAST_POW,
+    BCAST_GT,
+    BCAST_GE,
+} BroadcastOp;
+
+bool isBroadcast(Value a, Value b);
+bool broadcast(VM* vm, BroadcastOp op);
+
+#endif
@@ -0,0 +1,325 @@
+#include <string.h>
+
+#include "builtins.h"
+#include "../vm.h"
+#include "../debug.h"
+#include "../sequence.h"
+
+// The kernels below keep several independent accumulators so the compiler is
+// free to put them in vector registers; a single running total would tie
+// every step to the one before it
+
+
+static long long sumInts(const long long* restrict xs, int n) {
+    long long a0 = 0, a1 = 0, a2 = 0, a3 = 0;
+    int i = 0;
+
+    for (; i + 4 <= n; i += 4) {
+        a0 += xs[i];
+        a1 += xs[i + 1];
+        a2 += xs[i + 2];
+        a3 += xs[i + 3];
+    }
+
+    for (; i < n; i++) {
+        a0 += xs[i];
+    }
+
+    return (a0 + a1) + (a2 + a3);
+}
+
+static double sumFloats(const double* restrict xs, int n) {
+    double a0 = 0, a1 = 0, a2 = 0, a3 = 0;
+    int i = 0;
+
+    for (; i + 4 <= n; i += 4) {
+        a0 += xs[i];
+        a1 += xs[i + 1];
+        a2 += xs[i + 2];
+        a3 += xs[i + 3];
+    }
+
+    for (; i < n; i++) {
+        a0 += xs[i];
+    }
+
+    return (a0 + a1) + (a2 + a3);
+}
+
+static long long dotInts(const long long* restrict xs, const long long* restrict ys, int n) {
+    long long a0 = 0, a1 = 0, a2 = 0, a3 = 0;
+    int i = 0;
+
+    for (; i + 4 <= n; i += 4) {
+        a0 += xs[i] * ys[i];
+        a1 += xs[i + 1] * ys[i + 1];
+        a2 += xs[i + 2] * ys[i + 2];
+        a3 += xs[i + 3] * ys[i + 3];
+    }
+
+    for (; i < n; i++) {
+        a0 += xs[i] * ys[i];
+    }
+
+    return (a0 + a1) + (a2 + a3);
+}
+
+static double dotFloats(const double* restrict xs, const double* restrict ys, int n) {
+    double a0 = 0, a1 = 0, a2 = 0, a3 = 0;
+    int i = 0;
+
+    for (; i + 4 <= n; i += 4) {
+        a0 += xs[i] * ys[i];
+        a1 += xs[i + 1] * ys[i + 1];
+        a2 += xs[i + 2] * ys[i + 2];
+        a3 += xs[i + 3] * ys[i + 3];
+    }
+
+    for (; i < n; i++) {
+        a0 += xs[i] * ys[i];
+    }
+
+    return (a0 + a1) + (a2 + a3);
+}
+
+// Defines a min or max kernel over 'type'; 'n' must be at least 1
+#define EXTREME_KERNEL(name, type, better)                                  \
+static type name(const type* restrict xs, int n) {                          \
+    type a0 = xs[0], a1 = xs[0], a2 = xs[0], a3 = xs[0];                    \
+    int i = 0;                                                              \
+                                                                            \
+    for (; i + 4 <= n; i += 4) {                                            \
+        a0 = better(xs[i], a0) ? xs[i] : a0;                                \
+        a1 = better(xs[i + 1], a1) ? xs[i + 1] : a1;                        \
+        a2 = better(xs[i + 2], a2) ? xs[i + 2] : a2;                        \
+        a3 = better(xs[i + 3], a3) ? xs[i + 3] : a3;                        \
+    }                                                                       \
+                                                                            \
+    for (; i < n; i++) {                                                    \
+        a0 = better(xs[i], a0) ? xs[i] : a0;                                \
+    }                                                                       \
+                                                                            \
+    a0 = better(a1, a0) ? a1 : a0;                                          \
+    a2 = better(a3, a2) ? a3 : a2;                                          \
+    return better(a2, a0) ? a2 : a0;                                        \
+}
+
+#define LESS(a, b)      ((a) < (b))
+#define GREATER(a, b)   ((a) > (b))
+
+EXTREME_KERNEL(minInts, long long, LESS)
+EXTREME_KERNEL(minFloats, double, LESS)
+EXTREME_KERNEL(maxInts, long long, GREATER)
+EXTREME_KERNEL(maxFloats, double, GREATER)
+
+#undef EXTREME_KERNEL
+
+
+/*
++---------------------+
+| Kernels       ^^^^  |
++=====================+
+| NativeFns     vvvv  |
++---------------------+
+*/
+
+
+// Builds an array from any sequence of numbers, or converts between kinds
+static bool toTypedArray(VM* vm, int argc, Value* argv, ArrayKind kind, const char* name) {
+    Value from = argv[0];
+
+    if (IS_ARRAY(from)) {
+        ObjArray* source = AS_ARRAY(from);
+
+        if (source->kind == kind) {
+            returnNative(vm, argc, from);
+            return true;
+        }
+
+        ObjArray* array = newArray(vm, kind, source->count);
+
+        for (int i = 0; i < source->count; i++) {
+            if (kind == ARRAY_INT) {
+                array->as.ints[i] = (long long)source->as.floats[i];
+            }
+            else {
+                array->as.floats[i] = (double)source->as.ints[i];
+            }
+        }
+
+        returnNative(vm, argc, OBJ_VAL(array));
+        return true;
+    }
+
+    if (!isSequence(from)) {
+        runtimeError(vm, "%s$ : Expected sequence, got %s", name, getValName(from));
+        return false;
+    }
+
+    ObjArray* array = newArray(vm, kind, seqLength(from));
+
+    for (int i = 0; i < array->count; i++) {
+        Value x = seqAt(from, i);
+
+        if (kind == ARRAY_INT && IS_INT(x)) {
+            array->as.ints[i] = AS_INT(x);
+        }
+        else if (kind == ARRAY_FLOAT && IS_ARITH(x)) {
+            array->as.floats[i] = IS_INT(x) ? (double)AS_INT(x) : AS_FLOAT(x);
+        }
+        else {
+            runtimeError(vm, "%s$ : Cannot store %s in %s array", name, getValName(x), kind == ARRAY_INT ? "an int" : "a float");
+            return false;
+        }
+    }
+
+    returnNative(vm, argc, OBJ_VAL(array));
+    return true;
+}
+
+bool intsNative(VM* vm, int argc, Value* argv) {
+    return toTypedArray(vm, argc, argv, ARRAY_INT, "ints");
+}
+
+bool floatsNative(VM* vm, int argc, Value* argv) {
+    return toTypedArray(vm, argc, argv, ARRAY_FLOAT, "floats");
+}
+
+bool sumNative(VM* vm, int argc, Value* argv) {
+    if (!IS_ARRAY(argv[0])) {
+        runtimeError(vm, "sum$ : Expected array, got %s", getValName(argv[0]));
+        return false;
+    }
+
+    ObjArray* array = AS_ARRAY(argv[0]);
+
+    returnNative(vm, argc, array->kind == ARRAY_INT
+        ? INT_VAL(sumInts(array->as.ints, array->count))
+        : FLOAT_VAL(sumFloats(array->as.floats, array->count)));
+    return true;
+}
+
+bool minNative(VM* vm, int argc, Value* argv) {
+    if (!IS_ARRAY(argv[0])) {
+        runtimeError(vm, "min$ : Expected array, got %s", getValName(argv[0]));
+        return false;
+    }
+
+    ObjArray* array = AS_ARRAY(argv[0]);
+
+    if (array->count == 0) {
+        runtimeError(vm, "min$ : Array is empty");
+        return false;
+    }
+
+    returnNative(vm, argc, array->kind == ARRAY_INT
+        ? INT_VAL(minInts(array->as.ints, array->count))
+        : FLOAT_VAL(minFloats(array->as.floats, array->count)));
+    return true;
+}
+
+bool maxNative(VM* vm, int argc, Value* argv) {
+    if (!IS_ARRAY(argv[0])) {
+        runtimeError(vm, "max$ : Expected array, got %s", getValName(argv[0]));
+        return false;
+    }
+
+    ObjArray* array = AS_ARRAY(argv[0]);
+
+    if (array->count == 0) {
+        runtimeError(vm, "max$ : Array is empty");
+        return false;
+    }
+
+    returnNative(vm, argc, array->kind == ARRAY_INT
+        ? INT_VAL(maxInts(array->as.ints, array->count))
+        : FLOAT_VAL(maxFloats(array->as.floats, array->count)));
+    return true;
+}
+
+bool dotNative(VM* vm, int argc, Value* argv) {
+    if (!IS_ARRAY(argv[0]) || !IS_ARRAY(argv[1])) {
+        runtimeError(vm, "dot$ : Expected arrays, got %s and %s", getValName(argv[0]), getValName(argv[1]));
+        return false;
+    }
+
+    ObjArray* a = AS_ARRAY(argv[0]);
+    ObjArray* b = AS_ARRAY(argv[1]);
+
+    if (a->kind != b->kind) {
+        runtimeError(vm, "dot$ : Arrays must be of the same kind");
+        return false;
+    }
+
+    if (a->count != b->count) {
+        runtimeError(vm, "dot$ : Arrays must be the same length; got %d and %d", a->count, b->count);
+        return false;
+    }
+
+    returnNative(vm, argc, a->kind == ARRAY_INT
+        ? INT_VAL(dotInts(a->as.ints, b->as.ints, a->count))
+        : FLOAT_VAL(dotFloats(a->as.floats, b->as.floats, a->count)));
+    return true;
+}
+
+// Int arrays scaled by an int stay ints; anything involving a float gives floats
+bool scaleNative(VM* vm, int argc, Value* argv) {
+    if (!IS_ARRAY(argv[0])) {
+        runtimeError(vm, "scale$ : Expected array, got %s", getValName(argv[0]));
+        return false;
+    }
+
+    if (!IS_ARITH(argv[1])) {
+        runtimeError(vm, "scale$ : Expected number, got %s", getValName(argv[1]));
+        return false;
+    }
+
+    ObjArray* source = AS_ARRAY(argv[0]);
+    int n = source->count;
+
+    if (source->kind == ARRAY_INT && IS_INT(argv[1])) {
+        long long k = AS_INT(argv[1]);
+        ObjArray* array = newArray(vm, ARRAY_INT, n);
+        long long* restrict out = array->as.ints;
+        const long long* restrict xs = source->as.ints;
+
+        for (int i = 0; i < n; i++) {
+            out[i] = xs[i] * k;
+        }
+
+        returnNative(vm, argc, OBJ_VAL(array));
+        return true;
+    }
+
+    double k = IS_INT(argv[1]) ? (double)AS_INT(argv[1]) : AS_FLOAT(argv[1]);
+    ObjArray* array = newArray(vm, ARRAY_FLOAT, n);
+    double* restrict out = array->as.floats;
+
+    if (source->kind == ARRAY_INT) {
+        const long long* restrict xs = source->as.ints;
+
+        for (int i = 0; i < n; i++) {
+            out[i] = (double)xs[i] * k;
+        }
+    }
+    else {
+        const double* restrict xs = source->as.floats;
+
+        for (int i = 0; i < n; i++) {
+            out[i] = xs[i] * k;
+        }
+    }
+
+    returnNative(vm, argc, OBJ_VAL(array));
+    return true;
+}
+
+void defineArrays(VM* vm) {
+    defineNative(vm, "ints", intsNative, 1);
+    defineNative(vm, "floats", floatsNative, 1);
+    defineNative(vm, "sum", sumNative, 1);
+    defineNative(vm, "min", minNative, 1);
+    defineNative(vm, "max", maxNative, 1);
+    defineNative(vm, "dot", dotNative, 2);
+    defineNative(vm, "scale", scaleNative, 2);
+}
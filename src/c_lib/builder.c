@@ -0,0 +1,127 @@
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "builtins.h"
+#include "../vm.h"
+#include "../debug.h"
+#include "../memory.h"
+#include "../output.h"
+
+// Whole floats under this print the same under %lg as the int would, so they
+// can skip snprintf; from 1e6 up %lg switches to an exponent
+#define WHOLE_FLOAT_MAX 1e6
+
+
+// Leaves room for 'extra' more chars and the terminator build$ adds
+static void reserve(VM* vm, ObjStringBuilder* builder, int extra) {
+    if (builder->count + extra + 1 <= builder->capacity) {
+        return;
+    }
+
+    int capacity = GROW_CAP(builder->capacity);
+
+    while (capacity < builder->count + extra + 1) {
+        capacity *= 2;
+    }
+
+    builder->chars = GROW_ARRAY(vm, builder->chars, builder->capacity, capacity, char);
+    builder->capacity = capacity;
+}
+
+static void appendChars(VM* vm, ObjStringBuilder* builder, const char* chars, int length) {
+    reserve(vm, builder, length);
+    memcpy(builder->chars + builder->count, chars, length);
+    builder->count += length;
+}
+
+static void appendInt(VM* vm, ObjStringBuilder* builder, long long n) {
+    char digits[INT_DIGITS_MAX];
+    char* end = digits + sizeof(digits);
+    char* start = formatInt(end, n);
+
+    appendChars(vm, builder, start, (int)(end - start));
+}
+
+// Same text printf$ would give
+static void appendFloat(VM* vm, ObjStringBuilder* builder, double x) {
+    if (x > -WHOLE_FLOAT_MAX && x < WHOLE_FLOAT_MAX && x == (double)(long long)x && (x != 0 || !signbit(x))) {
+        appendInt(vm, builder, (long long)x);
+        return;
+    }
+
+    char digits[32];
+    int length = snprintf(digits, sizeof(digits), "%lg", x);
+    appendChars(vm, builder, digits, length);
+}
+
+bool builderNative(VM* vm, int argc, Value* argv) {
+    (void)argv;
+    returnNative(vm, argc, OBJ_VAL(newStringBuilder(vm)));
+    return true;
+}
+
+// Adds a string, char or number to the end; returns the builder, so calls
+// can be chained or folded
+bool appendNative(VM* vm, int argc, Value* argv) {
+    if (!IS_BUILDER(argv[0])) {
+        runtimeError(vm, "append$ : Expected builder, got %s", getValName(argv[0]));
+        return false;
+    }
+
+    ObjStringBuilder* builder = AS_BUILDER(argv[0]);
+    Value x = argv[1];
+
+    if (IS_STRING(x)) {
+        appendChars(vm, builder, AS_CSTRING(x), AS_STRING(x)->length);
+    }
+    else if (IS_CHAR(x)) {
+        char c = AS_CHAR(x);
+        appendChars(vm, builder, &c, 1);
+    }
+    else if (IS_INT(x)) {
+        appendInt(vm, builder, AS_INT(x));
+    }
+    else if (IS_FLOAT(x)) {
+        appendFloat(vm, builder, AS_FLOAT(x));
+    }
+    else {
+        runtimeError(vm, "append$ : Expected string, char or number, got %s", getValName(x));
+        return false;
+    }
+
+    returnNative(vm, argc, argv[0]);
+    return true;
+}
+
+// Hands the text over to a string without copying it, leaving the builder
+// empty for reuse
+bool buildNative(VM* vm, int argc, Value* argv) {
+    if (!IS_BUILDER(argv[0])) {
+        runtimeError(vm, "build$ : Expected builder, got %s", getValName(argv[0]));
+        return false;
+    }
+
+    ObjStringBuilder* builder = AS_BUILDER(argv[0]);
+
+    // strings own exactly length + 1 chars; shrinking is done in place
+    reserve(vm, builder, 0);
+    builder->chars = GROW_ARRAY(vm, builder->chars, builder->capacity, builder->count + 1, char);
+    builder->chars[builder->count] = '\0';
+
+    char* chars = builder->chars;
+    int length = builder->count;
+
+    builder->chars = NULL;
+    builder->count = 0;
+    builder->capacity = 0;
+
+    returnNative(vm, argc, OBJ_VAL(takeString(vm, chars, length)));
+    return true;
+}
+
+void defineBuilders(VM* vm) {
+    defineNative(vm, "builder", builderNative, 0);
+    defineNative(vm, "append", appendNative, 2);
+    defineNative(vm, "build", buildNative, 1);
+}
@@ -1,4 +1,3 @@
-
 #include "builtins.h"
 #include "../vm.h"
 
@@ -6,5 +5,16 @@
 
 void defineBuiltins(VM *vm)
 {
-
+    defineCollections(vm);
+    defineArrays(vm);
+    defineFibers(vm);
+    defineEvents(vm);
+    defineParallel(vm);
+    defineChannels(vm);
+    defineBuilders(vm);
+    defineFiles(vm);
+    defineReaders(vm);
+    defineJson(vm);
+    defineCsv(vm);
+    defineSerial(vm);
 }
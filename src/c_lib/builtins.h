@@ -5,4 +5,58 @@
 
 void defineBuiltins(VM *vm);
 
+// collections.c
+void defineCollections(VM* vm);
+
+// array.c
+void defineArrays(VM* vm);
+
+// fiber.c
+void defineFibers(VM* vm);
+
+// event.c
+void defineEvents(VM* vm);
+void markEventLoop(VM* vm);
+void freeEventLoop(VM* vm);
+bool closeFdNative(VM* vm, int argc, Value* argv);
+
+// parallel.c
+void defineParallel(VM* vm);
+void freeWorkerPool(VM* vm);
+void releaseJob(Job* job);
+bool enterBlocking(VM* vm, Ring* ring);
+void leaveBlocking(VM* vm);
+bool poolClosing(VM* vm);
+
+// channel.c
+void defineChannels(VM* vm);
+
+// builder.c
+void defineBuilders(VM* vm);
+
+// file.c
+void defineFiles(VM* vm);
+
+// reader.c
+typedef enum {
+    READ_RECORD,
+    READ_END,
+    READ_FAILED,    // an error's been raised
+} ReadResult;
+
+void defineReaders(VM* vm);
+ObjReader* openReader(VM* vm, Value source, char delimiter, int blockSize, const char* name);
+ReadResult readRecord(VM* vm, ObjReader* reader, Value* out);
+bool readMore(VM* vm, ObjReader* reader);
+
+// json.c
+void defineJson(VM* vm);
+
+// csv.c
+void defineCsv(VM* vm);
+ReadResult readRow(VM* vm, ObjReader* reader, Value* out);
+
+// serial.c
+void defineSerial(VM* vm);
+
 #endif
@@ -0,0 +1,180 @@
+#include "builtins.h"
+#include "../vm.h"
+#include "../debug.h"
+#include "../ring.h"
+#include "../transfer.h"
+
+// Room in a channel made without a capacity
+#define CHANNEL_DEFAULT_CAPACITY 64
+#define CHANNEL_MAX_CAPACITY (1 << 24)
+
+
+static bool expectChannel(VM* vm, Value value, const char* name) {
+    if (!IS_CHANNEL(value)) {
+        runtimeError(vm, "%s$ : Expected channel, got %s", name, getValName(value));
+        return false;
+    }
+
+    return true;
+}
+
+// Tries once, and only if that fails does it wait; a worker that has to wait
+// tells the pool first, so a pipeline can't stall every thread it has
+static RingResult sendParcel(VM* vm, Ring* ring, Parcel* parcel, bool wait) {
+    RingResult result = ringSend(ring, parcel, false);
+
+    if (result != RING_FULL || !wait) {
+        return result;
+    }
+
+    flushOutput(&vm->output);
+
+    if (!enterBlocking(vm, ring)) {
+        return RING_CLOSED;
+    }
+
+    result = ringSend(ring, parcel, true);
+    leaveBlocking(vm);
+
+    return result;
+}
+
+static RingResult receiveParcel(VM* vm, Ring* ring, Parcel* parcel, bool wait) {
+    RingResult result = ringReceive(ring, parcel, false);
+
+    if (result != RING_EMPTY || !wait) {
+        return result;
+    }
+
+    flushOutput(&vm->output);
+
+    if (!enterBlocking(vm, ring)) {
+        return RING_CLOSED;
+    }
+
+    result = ringReceive(ring, parcel, true);
+    leaveBlocking(vm);
+
+    return result;
+}
+
+static bool sendValue(VM* vm, int argc, Value* argv, bool wait, const char* name) {
+    if (!expectChannel(vm, argv[0], name)) {
+        return false;
+    }
+
+    Parcel parcel;
+    initParcel(&parcel);
+
+    if (!packValues(&parcel, &argv[1], 1)) {
+        freeParcel(&parcel);
+        runtimeError(vm, "%s$ : Cannot send fibers or futures over a channel", name);
+        return false;
+    }
+
+    RingResult result = sendParcel(vm, AS_CHANNEL(argv[0])->ring, &parcel, wait);
+    freeParcel(&parcel);
+
+    if (result == RING_CLOSED) {
+        // a task cut off by the end of the script just stops
+        if (!poolClosing(vm)) {
+            runtimeError(vm, "%s$ : Channel is closed", name);
+        }
+
+        return false;
+    }
+
+    if (wait) {
+        returnNative(vm, argc, UNIT_VAL);
+    }
+    else {
+        returnNative(vm, argc, BOOL_VAL(result == RING_OK));
+    }
+
+    return true;
+}
+
+static bool receiveValue(VM* vm, int argc, Value* argv, bool wait, const char* name) {
+    if (!expectChannel(vm, argv[0], name)) {
+        return false;
+    }
+
+    Parcel parcel;
+    initParcel(&parcel);
+
+    if (receiveParcel(vm, AS_CHANNEL(argv[0])->ring, &parcel, wait) != RING_OK) {
+        returnNative(vm, argc, UNIT_VAL);
+        return true;
+    }
+
+    unpackValues(vm, &parcel, 1);
+    freeParcel(&parcel);
+
+    returnNative(vm, argc, pop(vm));
+    return true;
+}
+
+// Makes a bounded channel; the capacity is rounded up to a power of two. The
+// same channel can be handed to any number of spawned tasks
+bool channelNative(VM* vm, int argc, Value* argv) {
+    long long capacity = CHANNEL_DEFAULT_CAPACITY;
+
+    if (argc > 0 && !IS_UNIT(argv[0])) {
+        if (!IS_INT(argv[0])) {
+            runtimeError(vm, "channel$ : Expected integer capacity, got %s", getValName(argv[0]));
+            return false;
+        }
+
+        capacity = AS_INT(argv[0]);
+
+        if (capacity < 1 || capacity > CHANNEL_MAX_CAPACITY) {
+            runtimeError(vm, "channel$ : Capacity must be between 1 and %d, got %lld", CHANNEL_MAX_CAPACITY, capacity);
+            return false;
+        }
+    }
+
+    returnNative(vm, argc, OBJ_VAL(newChannel(vm, newRing((int)capacity))));
+    return true;
+}
+
+// Copies the value into the channel, waiting while it's full
+bool sendNative(VM* vm, int argc, Value* argv) {
+    return sendValue(vm, argc, argv, true, "send");
+}
+
+// Like send$, but returns false rather than waiting
+bool trySendNative(VM* vm, int argc, Value* argv) {
+    return sendValue(vm, argc, argv, false, "trySend");
+}
+
+// Takes the oldest value, waiting while the channel is empty; once it's been
+// closed and drained this returns ()
+bool recvNative(VM* vm, int argc, Value* argv) {
+    return receiveValue(vm, argc, argv, true, "recv");
+}
+
+// Like recv$, but returns () rather than waiting
+bool tryRecvNative(VM* vm, int argc, Value* argv) {
+    return receiveValue(vm, argc, argv, false, "tryRecv");
+}
+
+// Closes a channel or an fd; a closed channel takes no more values, but what's
+// already in it can still be received
+bool closeNative(VM* vm, int argc, Value* argv) {
+    if (!IS_CHANNEL(argv[0])) {
+        return closeFdNative(vm, argc, argv);
+    }
+
+    closeRing(AS_CHANNEL(argv[0])->ring);
+    returnNative(vm, argc, UNIT_VAL);
+    return true;
+}
+
+void defineChannels(VM* vm) {
+    defineNative(vm, "channel", channelNative, 1);
+    defineNative(vm, "send", sendNative, 2);
+    defineNative(vm, "trySend", trySendNative, 2);
+    defineNative(vm, "recv", recvNative, 1);
+    defineNative(vm, "tryRecv", tryRecvNative, 1);
+    defineNative(vm, "close", closeNative, 1);
+}
@@ -0,0 +1,272 @@
+#include "builtins.h"
+#include "../vm.h"
+#include "../debug.h"
+#include "../shape.h"
+#include "../persistent.h"
+#include "../sequence.h"
+
+
+static ObjVector* listToVector(VM* vm, Value list) {
+    ObjVector* empty = newVector(vm);
+    push(vm, OBJ_VAL(empty));
+
+    ObjVector* vector = vectorAppend(vm, empty, list);
+
+    pop(vm);
+
+    return vector;
+}
+
+bool vecNative(VM* vm, int argc, Value* argv) {
+    if (IS_VECTOR(argv[0])) {
+        returnNative(vm, argc, argv[0]);
+        return true;
+    }
+
+    if (IS_RANGE(argv[0])) {
+        argv[0] = OBJ_VAL(rangeToList(vm, AS_RANGE(argv[0])));
+    }
+
+    if (!IS_LIST(argv[0])) {
+        runtimeError(vm, "vec$ : Expected list, got %s", getValName(argv[0]));
+        return false;
+    }
+
+    returnNative(vm, argc, OBJ_VAL(listToVector(vm, argv[0])));
+    return true;
+}
+
+// Swaps the map on top of the stack for 'map' with 'key' set
+static bool assocTop(VM* vm, Value key, Value value, const char* name) {
+    if (!IS_STRING(key)) {
+        runtimeError(vm, "%s$ : Expected string key, got %s", name, getValName(key));
+        return false;
+    }
+
+    ObjString* interned = internString(vm, AS_STRING(key));
+    push(vm, OBJ_VAL(interned));
+
+    ObjPMap* map = pmapAssoc(vm, AS_PMAP(peek(vm, 1)), interned, value);
+
+    pop(vm);
+    pop(vm);
+    push(vm, OBJ_VAL(map));
+
+    return true;
+}
+
+bool dictNative(VM* vm, int argc, Value* argv) {
+    Value from = argv[0];
+
+    if (IS_PMAP(from)) {
+        returnNative(vm, argc, from);
+        return true;
+    }
+
+    push(vm, OBJ_VAL(newPMap(vm)));
+
+    if (IS_MAP(from)) {
+        int cursor = 0;
+        ObjString* key;
+        Value value;
+
+        while (mapNext(AS_MAP(from), &cursor, &key, &value)) {
+            if (!assocTop(vm, OBJ_VAL(key), value, "dict")) {
+                return false;
+            }
+        }
+    }
+    else if (IS_LIST(from)) {
+        for (int i = 0; i < ARRAY(from).count; i++) {
+            Value pair = ELEMS(from)[i];
+
+            if (!IS_CELL(pair)) {
+                runtimeError(vm, "dict$ : Expected k, v pair, got %s", getValName(pair));
+                return false;
+            }
+
+            if (!assocTop(vm, CAR(pair), CDR(pair), "dict")) {
+                return false;
+            }
+        }
+    }
+    else {
+        runtimeError(vm, "dict$ : Expected map or list of pairs, got %s", getValName(from));
+        return false;
+    }
+
+    returnNative(vm, argc, pop(vm));
+    return true;
+}
+
+bool conjNative(VM* vm, int argc, Value* argv) {
+    Value coll = argv[0];
+    Value item = argv[1];
+
+    if (IS_VECTOR(coll)) {
+        returnNative(vm, argc, OBJ_VAL(vectorConj(vm, AS_VECTOR(coll), item)));
+        return true;
+    }
+
+    if (IS_PMAP(coll)) {
+        if (!IS_CELL(item)) {
+            runtimeError(vm, "conj$ : Expected k, v pair, got %s", getValName(item));
+            return false;
+        }
+
+        push(vm, coll);
+
+        if (!assocTop(vm, CAR(item), CDR(item), "conj")) {
+            return false;
+        }
+
+        returnNative(vm, argc, pop(vm));
+        return true;
+    }
+
+    runtimeError(vm, "conj$ : Expected vector or dict, got %s", getValName(coll));
+    return false;
+}
+
+bool assocNative(VM* vm, int argc, Value* argv) {
+    Value coll = argv[0];
+    Value key = argv[1];
+    Value value = argv[2];
+
+    if (IS_VECTOR(coll)) {
+        uint8_t offset;
+        #ifdef OPTION_ONE_INDEXED
+        offset = 1;
+        #else
+        offset = 0;
+        #endif
+
+        ObjVector* vector = AS_VECTOR(coll);
+
+        if (!IS_INT(key)) {
+            runtimeError(vm, "assoc$ : Expected integer index, got %s", getValName(key));
+            return false;
+        }
+
+        long long index = AS_INT(key) - offset;
+
+        // one past the end appends
+        if (index == vector->count) {
+            returnNative(vm, argc, OBJ_VAL(vectorConj(vm, vector, value)));
+            return true;
+        }
+
+        if (index < 0 || index > vector->count) {
+            runtimeError(vm, "assoc$ : Index was outside of vector; length was %d, got %lld", vector->count, AS_INT(key));
+            return false;
+        }
+
+        returnNative(vm, argc, OBJ_VAL(vectorAssoc(vm, vector, index, value)));
+        return true;
+    }
+
+    if (IS_PMAP(coll)) {
+        push(vm, coll);
+
+        if (!assocTop(vm, key, value, "assoc")) {
+            return false;
+        }
+
+        returnNative(vm, argc, pop(vm));
+        return true;
+    }
+
+    runtimeError(vm, "assoc$ : Expected vector or dict, got %s", getValName(coll));
+    return false;
+}
+
+bool dissocNative(VM* vm, int argc, Value* argv) {
+    if (!IS_PMAP(argv[0])) {
+        runtimeError(vm, "dissoc$ : Expected dict, got %s", getValName(argv[0]));
+        return false;
+    }
+
+    if (!IS_STRING(argv[1])) {
+        runtimeError(vm, "dissoc$ : Expected string key, got %s", getValName(argv[1]));
+        return false;
+    }
+
+    ObjPMap* map = AS_PMAP(argv[0]);
+    ObjString* key = findInterned(vm, AS_STRING(argv[1]));
+
+    if (key != NULL) {
+        map = pmapDissoc(vm, map, key);
+    }
+
+    returnNative(vm, argc, OBJ_VAL(map));
+    return true;
+}
+
+bool toListNative(VM* vm, int argc, Value* argv) {
+    Value coll = argv[0];
+
+    if (IS_LIST(coll)) {
+        returnNative(vm, argc, coll);
+        return true;
+    }
+
+    if (IS_RANGE(coll)) {
+        returnNative(vm, argc, OBJ_VAL(rangeToList(vm, AS_RANGE(coll))));
+        return true;
+    }
+
+    if (IS_ITERATOR(coll) || IS_FIBER(coll) || IS_READER(coll)) {
+        ObjList* list = drainIterator(vm, coll);
+
+        if (list == NULL) {
+            return false;
+        }
+
+        returnNative(vm, argc, OBJ_VAL(list));
+        return true;
+    }
+
+    ObjList* list = newList(vm);
+    push(vm, OBJ_VAL(list));
+
+    if (IS_VECTOR(coll)) {
+        ObjVector* vector = AS_VECTOR(coll);
+
+        for (int i = 0; i < vector->count; i++) {
+            writeValueArray(vm, &list->array, vectorGet(vector, i));
+        }
+    }
+    else if (IS_PMAP(coll)) {
+        PMapCursor cursor;
+        ObjString* key;
+        Value value;
+
+        pmapCursor(AS_PMAP(coll), &cursor);
+
+        while (pmapNext(&cursor, &key, &value)) {
+            ObjCell* pair = newCell(vm);
+            pair->car = OBJ_VAL(key);
+            pair->cdr = value;
+
+            push(vm, OBJ_VAL(pair));
+            writeValueArray(vm, &list->array, OBJ_VAL(pair));
+            pop(vm);
+        }
+    }
+    else {
+        runtimeError(vm, "toList$ : Expected vector, dict, range, iterator, fiber or reader, got %s", getValName(coll));
+        return false;
+    }
+
+    returnNative(vm, argc, pop(vm));
+    return true;
+}
+
+void defineCollections(VM* vm) {
+    defineNative(vm, "vec", vecNative, 1);
+    defineNative(vm, "dict", dictNative, 1);
+    defineNative(vm, "conj", conjNative, 2);
+    defineNative(vm, "assoc", assocNative, 3);
+    defineNative(vm, "dissoc", dissocNative, 2);
+    defineNative(vm, "toList", toListNative, 1);
+}
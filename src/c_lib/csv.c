@@ -0,0 +1,848 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "builtins.h"
+#include "../vm.h"
+#include "../debug.h"
+#include "../memory.h"
+#include "../output.h"
+#include "../sequence.h"
+#include "../shape.h"
+
+#define CSV_BLOCK_SIZE 262144
+// Fields of a row are noted here before any strings are made, so a row cut
+// off at the end of a block costs nothing to start over
+#define CSV_LOCAL_FIELDS 32
+// Longest field that's still tried as a number
+#define CSV_NUMBER_MAX 64
+
+
+typedef enum {
+    FIELD_PLAIN,    // taken as it is
+    FIELD_QUOTED,   // taken from between its quotes
+    FIELD_ESCAPED,  // has doubled quotes or text after the closing one
+} FieldKind;
+
+typedef struct {
+    int start;      // from the start of the row
+    int length;
+    FieldKind kind;
+} Field;
+
+typedef struct {
+    Field local[CSV_LOCAL_FIELDS];
+    Field* fields;
+    int count;
+    int capacity;
+} FieldList;
+
+static void addField(FieldList* list, int start, int end, FieldKind kind, int closedAt) {
+    if (list->count == list->capacity) {
+        int capacity = list->capacity * 2;
+        Field* fields = malloc(capacity * sizeof(Field));
+
+        if (fields == NULL) {
+            exit(1);
+        }
+
+        memcpy(fields, list->fields, list->count * sizeof(Field));
+
+        if (list->fields != list->local) {
+            free(list->fields);
+        }
+
+        list->fields = fields;
+        list->capacity = capacity;
+    }
+
+    // "a"b reads as ab
+    if (kind == FIELD_QUOTED && closedAt != end) {
+        kind = FIELD_ESCAPED;
+    }
+
+    Field* field = &list->fields[list->count++];
+    field->start = start;
+    field->length = end - start;
+    field->kind = kind;
+}
+
+// The first delimiter, quote or newline in [from, end), sixteen bytes at a time
+// where SSE2 is around
+static const char* findSpecial(const char* from, const char* end, char delimiter) {
+    const char* c = from;
+
+    #ifdef __SSE2__
+    __m128i delimiters = _mm_set1_epi8(delimiter);
+    __m128i quotes = _mm_set1_epi8('"');
+    __m128i newlines = _mm_set1_epi8('\n');
+
+    for (; end - c >= 16; c += 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i*)c);
+        __m128i hits = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(chunk, delimiters), _mm_cmpeq_epi8(chunk, quotes)),
+            _mm_cmpeq_epi8(chunk, newlines)
+        );
+        int mask = _mm_movemask_epi8(hits);
+
+        if (mask != 0) {
+            return c + __builtin_ctz(mask);
+        }
+    }
+    #endif
+
+    for (; c < end; c++) {
+        if (*c == delimiter || *c == '"' || *c == '\n') {
+            return c;
+        }
+    }
+
+    return NULL;
+}
+
+static ObjString* unescapeField(VM* vm, const char* chars, int length) {
+    char* text = malloc(length + 1);
+    int count = 0;
+    int i = 1;
+
+    // inside the quotes, "" is one quote and a lone one ends them
+    for (; i < length; i++) {
+        if (chars[i] == '"') {
+            if (i + 1 < length && chars[i + 1] == '"') {
+                text[count++] = '"';
+                i++;
+                continue;
+            }
+
+            i++;
+            break;
+        }
+
+        text[count++] = chars[i];
+    }
+
+    // anything after that is taken as it is
+    for (; i < length; i++) {
+        text[count++] = chars[i];
+    }
+
+    ObjString* string = copyString(vm, text, count);
+    free(text);
+    return string;
+}
+
+// Plain and simply quoted fields are views into the block like any record;
+// only fields with doubled quotes get copied
+static ObjString* fieldString(VM* vm, ObjMapping* block, int start, int length, FieldKind kind) {
+    switch (kind) {
+        case FIELD_PLAIN:
+            return newMappedString(vm, block, start, length);
+        case FIELD_QUOTED:
+            return newMappedString(vm, block, start + 1, length - 2);
+        case FIELD_ESCAPED:
+        default:
+            return unescapeField(vm, block->bytes + start, length);
+    }
+}
+
+static Value makeRow(VM* vm, ObjReader* reader, FieldList* list) {
+    ObjList* row = newList(vm);
+    push(vm, OBJ_VAL(row));
+
+    row->array.values = ALLOCATE(vm, list->count, Value);
+    row->array.capacity = list->count;
+    row->array.count = list->count;
+
+    for (int i = 0; i < list->count; i++) {
+        row->array.values[i] = UNIT_VAL;
+    }
+
+    for (int i = 0; i < list->count; i++) {
+        Field* field = &list->fields[i];
+        ObjString* string = fieldString(vm, reader->block, reader->start + field->start, field->length, field->kind);
+        row->array.values[i] = OBJ_VAL(string);
+    }
+
+    pop(vm);
+    return OBJ_VAL(row);
+}
+
+static void initFieldList(FieldList* list) {
+    list->fields = list->local;
+    list->count = 0;
+    list->capacity = CSV_LOCAL_FIELDS;
+}
+
+static void freeFieldList(FieldList* list) {
+    if (list->fields != list->local) {
+        free(list->fields);
+    }
+}
+
+// Notes the fields of the next row, reading more as it needs to, and leaves
+// the row itself in the current block at reader->start; '*length' is how much
+// of the block the row takes up. Quotes only mean something at the start of
+// a field, and blank lines are skipped
+static ReadResult scanRow(VM* vm, ObjReader* reader, FieldList* list, int* length) {
+    // all offsets are from reader->start, which stay put when a new block
+    // takes over the unfinished row
+    int at = 0;
+    int fieldStart = 0;
+    int closedAt = -1;
+    FieldKind kind = FIELD_PLAIN;
+    bool inQuotes = false;
+
+    for (;;) {
+        const char* row = reader->block == NULL ? NULL : reader->block->bytes + reader->start;
+        int pending = reader->end - reader->start;
+        bool needMore = false;
+
+        while (at < pending && !needMore) {
+            if (inQuotes) {
+                const char* quote = memchr(row + at, '"', pending - at);
+
+                if (quote == NULL) {
+                    at = pending;
+                    break;
+                }
+
+                at = (int)(quote - row);
+
+                // a quote at the end of what's been read could be half of ""
+                if (at + 1 == pending && !reader->atEnd) {
+                    needMore = true;
+                    break;
+                }
+
+                if (at + 1 < pending && row[at + 1] == '"') {
+                    kind = FIELD_ESCAPED;
+                    at += 2;
+                    continue;
+                }
+
+                inQuotes = false;
+                closedAt = ++at;
+                continue;
+            }
+
+            const char* special = findSpecial(row + at, row + pending, reader->delimiter);
+
+            if (special == NULL) {
+                at = pending;
+                break;
+            }
+
+            at = (int)(special - row);
+
+            if (*special == '"') {
+                if (at == fieldStart) {
+                    kind = FIELD_QUOTED;
+                    inQuotes = true;
+                }
+
+                at++;
+                continue;
+            }
+
+            if (*special == reader->delimiter) {
+                addField(list, fieldStart, at, kind, closedAt);
+                fieldStart = ++at;
+                kind = FIELD_PLAIN;
+                closedAt = -1;
+                continue;
+            }
+
+            // a newline ends the row, and takes a '\r' before it along
+            int end = at > fieldStart && row[at - 1] == '\r' ? at - 1 : at;
+
+            if (list->count == 0 && end == fieldStart) {
+                reader->start += at + 1;
+                row += at + 1;
+                pending -= at + 1;
+                at = 0;
+                fieldStart = 0;
+                continue;
+            }
+
+            addField(list, fieldStart, end, kind, closedAt);
+            *length = at + 1;
+            return READ_RECORD;
+        }
+
+        if (reader->atEnd && !needMore) {
+            // the last row needn't end with a newline
+            int end = pending > fieldStart && row[pending - 1] == '\r' && !inQuotes ? pending - 1 : pending;
+
+            if (list->count == 0 && end == fieldStart) {
+                reader->start = reader->end;
+                return READ_END;
+            }
+
+            addField(list, fieldStart, end, inQuotes ? FIELD_ESCAPED : kind, closedAt);
+            *length = pending;
+            return READ_RECORD;
+        }
+
+        if (!readMore(vm, reader)) {
+            return READ_FAILED;
+        }
+    }
+}
+
+ReadResult readRow(VM* vm, ObjReader* reader, Value* out) {
+    FieldList list;
+    int length;
+    initFieldList(&list);
+
+    ReadResult result = scanRow(vm, reader, &list, &length);
+
+    if (result == READ_RECORD) {
+        *out = makeRow(vm, reader, &list);
+        reader->start += length;
+    }
+
+    freeFieldList(&list);
+    return result;
+}
+
+static bool csvOptions(VM* vm, int argc, Value* argv, char* delimiter, const char* name) {
+    *delimiter = ',';
+
+    if (argc > 2) {
+        runtimeError(vm, "%s$ : Expected at most 2 args, got %d", name, argc);
+        return false;
+    }
+
+    if (argc > 1) {
+        if (!IS_CHAR(argv[1]) || AS_CHAR(argv[1]) == '"' || AS_CHAR(argv[1]) == '\n') {
+            runtimeError(vm, "%s$ : Expected char delimiter, got %s", name, getValName(argv[1]));
+            return false;
+        }
+
+        *delimiter = AS_CHAR(argv[1]);
+    }
+
+    return true;
+}
+
+// csvReader(source) or csvReader(source ; delimiter); a reader whose records
+// are rows, each a list of strings
+bool csvReaderNative(VM* vm, int argc, Value* argv) {
+    char delimiter;
+
+    if (!csvOptions(vm, argc, argv, &delimiter, "csvReader")) {
+        return false;
+    }
+
+    ObjReader* reader = openReader(vm, argv[0], delimiter, CSV_BLOCK_SIZE, "csvReader");
+
+    if (reader == NULL) {
+        return false;
+    }
+
+    reader->csv = true;
+
+    returnNative(vm, argc, OBJ_VAL(reader));
+    return true;
+}
+
+// Where csvColumns$ found each field of a column; strings are only made for
+// the columns that turn out not to be numbers
+typedef struct {
+    int block;      // index into the blocks the table was read into
+    int start;      // in that block
+    int length;
+    FieldKind kind;
+} Span;
+
+typedef struct {
+    int count;
+    int capacity;
+    Span* spans;
+} Column;
+
+static void addSpan(Column* column, int block, int start, int length, FieldKind kind) {
+    if (column->count == column->capacity) {
+        column->capacity = column->capacity < 64 ? 64 : column->capacity * 2;
+        column->spans = realloc(column->spans, column->capacity * sizeof(Span));
+
+        if (column->spans == NULL) {
+            exit(1);
+        }
+    }
+
+    Span* span = &column->spans[column->count++];
+    span->block = block;
+    span->start = start;
+    span->length = length;
+    span->kind = kind;
+}
+
+// The text of a field that could be a number; fields with escaped quotes
+// can't be
+static bool spanText(Span* span, ObjList* blocks, const char** chars, int* length) {
+    const char* bytes = AS_MAPPING(blocks->array.values[span->block])->bytes + span->start;
+
+    switch (span->kind) {
+        case FIELD_PLAIN:
+            *chars = bytes;
+            *length = span->length;
+            return true;
+        case FIELD_QUOTED:
+            *chars = bytes + 1;
+            *length = span->length - 2;
+            return true;
+        case FIELD_ESCAPED:
+        default:
+            return false;
+    }
+}
+
+static bool parseIntField(const char* chars, int length, long long* out) {
+    const char* c = chars;
+    const char* end = c + length;
+    bool negative = false;
+
+    if (c < end && (*c == '-' || *c == '+')) {
+        negative = *c++ == '-';
+    }
+
+    if (c == end) {
+        return false;
+    }
+
+    unsigned long long limit = negative ? (unsigned long long)LLONG_MAX + 1 : (unsigned long long)LLONG_MAX;
+    unsigned long long n = 0;
+
+    for (; c < end; c++) {
+        if (*c < '0' || *c > '9') {
+            return false;
+        }
+
+        unsigned digit = *c - '0';
+
+        if (n > (limit - digit) / 10) {
+            return false;
+        }
+
+        n = n * 10 + digit;
+    }
+
+    *out = negative ? (long long)(0 - n) : (long long)n;
+    return true;
+}
+
+// Plain decimal notation only, so "nan" and "0x10" stay strings
+static bool parseFloatField(const char* chars, int length, double* out) {
+    char digits[CSV_NUMBER_MAX];
+
+    if (length == 0 || length >= CSV_NUMBER_MAX) {
+        return false;
+    }
+
+    for (int i = 0; i < length; i++) {
+        char c = chars[i];
+
+        if (!((c >= '0' && c <= '9') || c == '.' || c == '-' || c == '+' || c == 'e' || c == 'E')) {
+            return false;
+        }
+    }
+
+    memcpy(digits, chars, length);
+    digits[length] = '\0';
+
+    char* end;
+    *out = strtod(digits, &end);
+    return end == digits + length;
+}
+
+// Columns of nothing but ints or floats become arrays; anything else becomes
+// a list of strings
+static Value buildColumn(VM* vm, Column* column, ObjList* blocks) {
+    const char* chars;
+    int length;
+    long long n;
+    double x;
+    bool ints = column->count > 0;
+    bool floats = column->count > 0;
+
+    for (int i = 0; i < column->count && ints; i++) {
+        ints = spanText(&column->spans[i], blocks, &chars, &length) && parseIntField(chars, length, &n);
+    }
+
+    for (int i = 0; i < column->count && floats && !ints; i++) {
+        floats = spanText(&column->spans[i], blocks, &chars, &length) && parseFloatField(chars, length, &x);
+    }
+
+    if (ints) {
+        ObjArray* array = newArray(vm, ARRAY_INT, column->count);
+
+        for (int i = 0; i < column->count; i++) {
+            spanText(&column->spans[i], blocks, &chars, &length);
+            parseIntField(chars, length, &array->as.ints[i]);
+        }
+
+        return OBJ_VAL(array);
+    }
+
+    if (floats) {
+        ObjArray* array = newArray(vm, ARRAY_FLOAT, column->count);
+
+        for (int i = 0; i < column->count; i++) {
+            spanText(&column->spans[i], blocks, &chars, &length);
+            parseFloatField(chars, length, &array->as.floats[i]);
+        }
+
+        return OBJ_VAL(array);
+    }
+
+    ObjList* list = newList(vm);
+
+    if (column->count == 0) {
+        return OBJ_VAL(list);
+    }
+
+    push(vm, OBJ_VAL(list));
+
+    list->array.values = ALLOCATE(vm, column->count, Value);
+    list->array.capacity = column->count;
+    list->array.count = column->count;
+
+    for (int i = 0; i < column->count; i++) {
+        list->array.values[i] = UNIT_VAL;
+    }
+
+    for (int i = 0; i < column->count; i++) {
+        Span* span = &column->spans[i];
+        ObjMapping* block = AS_MAPPING(blocks->array.values[span->block]);
+        list->array.values[i] = OBJ_VAL(fieldString(vm, block, span->start, span->length, span->kind));
+    }
+
+    pop(vm);
+    return OBJ_VAL(list);
+}
+
+static void freeColumns(Column* columns, int width) {
+    for (int i = 0; i < width; i++) {
+        free(columns[i].spans);
+    }
+
+    free(columns);
+}
+
+// csvColumns(source) or csvColumns(source ; delimiter); reads a whole table
+// whose first row names its columns, and returns a map of name => column.
+// Rows are only scanned while reading, and the blocks they were read into
+// kept, so no strings are made for the fields of numeric columns
+bool csvColumnsNative(VM* vm, int argc, Value* argv) {
+    char delimiter;
+
+    if (!csvOptions(vm, argc, argv, &delimiter, "csvColumns")) {
+        return false;
+    }
+
+    ObjReader* reader = openReader(vm, argv[0], delimiter, CSV_BLOCK_SIZE, "csvColumns");
+
+    if (reader == NULL) {
+        return false;
+    }
+
+    reader->csv = true;
+    push(vm, OBJ_VAL(reader));
+
+    FieldList list;
+    int length;
+    initFieldList(&list);
+
+    ReadResult result = scanRow(vm, reader, &list, &length);
+
+    if (result != READ_RECORD) {
+        freeFieldList(&list);
+
+        if (result == READ_FAILED) {
+            return false;
+        }
+
+        pop(vm);
+        returnNative(vm, argc, OBJ_VAL(newMap(vm)));
+        return true;
+    }
+
+    Value header = makeRow(vm, reader, &list);
+    reader->start += length;
+    push(vm, header);
+
+    ObjList* blocks = newList(vm);
+    push(vm, OBJ_VAL(blocks));
+
+    int width = list.count;
+    Column* columns = calloc(width, sizeof(Column));
+    int line = 1;
+
+    for (;;) {
+        list.count = 0;
+        result = scanRow(vm, reader, &list, &length);
+
+        if (result != READ_RECORD) {
+            break;
+        }
+
+        line++;
+
+        if (list.count != width) {
+            runtimeError(vm, "csvColumns$ : Row %d has %d fields, expected %d", line, list.count, width);
+            result = READ_FAILED;
+            break;
+        }
+
+        // every field of a row is in the block the row ended in
+        if (blocks->array.count == 0 || AS_MAPPING(blocks->array.values[blocks->array.count - 1]) != reader->block) {
+            writeValueArray(vm, &blocks->array, OBJ_VAL(reader->block));
+        }
+
+        for (int i = 0; i < width; i++) {
+            Field* field = &list.fields[i];
+            addSpan(&columns[i], blocks->array.count - 1, reader->start + field->start, field->length, field->kind);
+        }
+
+        reader->start += length;
+    }
+
+    freeFieldList(&list);
+
+    if (result == READ_FAILED) {
+        freeColumns(columns, width);
+        return false;
+    }
+
+    ObjMap* table = newMap(vm);
+    push(vm, OBJ_VAL(table));
+
+    if (width > SHAPE_MAX_SLOTS) {
+        table->shape = NULL;
+        tableReserve(vm, &table->table, width);
+    }
+
+    for (int i = 0; i < width; i++) {
+        ObjString* name = internString(vm, AS_STRING(AS_LIST(header)->array.values[i]));
+        push(vm, OBJ_VAL(name));
+
+        Value column = buildColumn(vm, &columns[i], blocks);
+        push(vm, column);
+
+        mapSet(vm, table, name, column);
+        pop(vm);
+        pop(vm);
+    }
+
+    freeColumns(columns, width);
+
+    pop(vm);
+    pop(vm);
+    pop(vm);
+    pop(vm);
+
+    returnNative(vm, argc, OBJ_VAL(table));
+    return true;
+}
+
+static void writeField(Output* out, Value value, char delimiter) {
+    char buffer[DOUBLE_DIGITS_MAX];
+    const char* chars;
+    int length;
+
+    switch (value.type) {
+        case VAL_UNIT:
+            return;
+        case VAL_BOOL:
+            if (AS_BOOL(value)) outputChars(out, "true", 4);
+            else                outputChars(out, "false", 5);
+            return;
+        case VAL_INT:
+            outputInt(out, AS_INT(value));
+            return;
+        case VAL_FLOAT:
+            outputChars(out, buffer, formatDouble(buffer, AS_FLOAT(value)));
+            return;
+        case VAL_CHAR:
+            buffer[0] = AS_CHAR(value);
+            chars = buffer;
+            length = 1;
+            break;
+        case VAL_OBJ:
+        default:
+            chars = AS_CSTRING(value);
+            length = AS_STRING(value)->length;
+            break;
+    }
+
+    bool quote = false;
+
+    for (int i = 0; i < length && !quote; i++) {
+        char c = chars[i];
+        quote = c == delimiter || c == '"' || c == '\n' || c == '\r';
+    }
+
+    if (!quote) {
+        outputChars(out, chars, length);
+        return;
+    }
+
+    outputChar(out, '"');
+
+    const char* run = chars;
+    const char* end = chars + length;
+    const char* c;
+
+    while ((c = memchr(run, '"', end - run)) != NULL) {
+        outputChars(out, run, c - run + 1);
+        outputChar(out, '"');
+        run = c + 1;
+    }
+
+    outputChars(out, run, end - run);
+    outputChar(out, '"');
+}
+
+static bool writeRows(VM* vm, Output* out, Value rows, char delimiter) {
+    Cursor cursor;
+    Value row;
+    initCursor(&cursor, rows);
+
+    while (cursorNext(vm, &cursor, &row)) {
+        if (!isIterable(row)) {
+            runtimeError(vm, "writeCsv$ : Expected row of fields, got %s", getValName(row));
+            return false;
+        }
+
+        // GC :: the row may be fresh from an iterator
+        push(vm, row);
+
+        Cursor fields;
+        Value field;
+        bool first = true;
+        initCursor(&fields, row);
+
+        while (cursorNext(vm, &fields, &field)) {
+            if (IS_OBJ(field) && !IS_STRING(field)) {
+                runtimeError(vm, "writeCsv$ : Cannot write %s as a field", getValName(field));
+                pop(vm);
+                return false;
+            }
+
+            if (!first) {
+                outputChar(out, delimiter);
+            }
+
+            writeField(out, field, delimiter);
+            first = false;
+        }
+
+        pop(vm);
+
+        if (fields.failed) {
+            return false;
+        }
+
+        outputChar(out, '\n');
+    }
+
+    return !cursor.failed;
+}
+
+// writeCsv(target ; rows) or writeCsv(target ; rows ; delimiter); the target
+// is a path or an fd, and rows can be any sequence of sequences, readers
+// included. Fields are quoted only when they have to be
+bool writeCsvNative(VM* vm, int argc, Value* argv) {
+    char delimiter = ',';
+
+    if (argc > 3) {
+        runtimeError(vm, "writeCsv$ : Expected at most 3 args, got %d", argc);
+        return false;
+    }
+
+    if (argc > 2) {
+        if (!IS_CHAR(argv[2]) || AS_CHAR(argv[2]) == '"' || AS_CHAR(argv[2]) == '\n') {
+            runtimeError(vm, "writeCsv$ : Expected char delimiter, got %s", getValName(argv[2]));
+            return false;
+        }
+
+        delimiter = AS_CHAR(argv[2]);
+    }
+
+    if (!isIterable(argv[1])) {
+        runtimeError(vm, "writeCsv$ : Expected sequence of rows, got %s", getValName(argv[1]));
+        return false;
+    }
+
+    // stdout goes through the VM's own buffer, so it keeps its place among
+    // whatever else has been printed
+    if (IS_INT(argv[0]) && AS_INT(argv[0]) == STDOUT_FILENO) {
+        if (!writeRows(vm, &vm->output, argv[1], delimiter)) {
+            return false;
+        }
+
+        returnNative(vm, argc, UNIT_VAL);
+        return true;
+    }
+
+    int fd;
+    bool owned = false;
+
+    if (IS_INT(argv[0])) {
+        fd = (int)AS_INT(argv[0]);
+    }
+    else if (IS_STRING(argv[0])) {
+        ObjString* path = AS_STRING(argv[0]);
+        char* cpath = toCString(vm, path);
+        fd = open(cpath, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        int error = errno;
+
+        freeCString(vm, cpath, path);
+
+        if (fd < 0) {
+            runtimeError(vm, "writeCsv$ : Could not open '%.*s': %s", path->length, path->chars, strerror(error));
+            return false;
+        }
+
+        owned = true;
+    }
+    else {
+        runtimeError(vm, "writeCsv$ : Expected path or fd, got %s", getValName(argv[0]));
+        return false;
+    }
+
+    Output out;
+    initOutput(&out, fd);
+
+    bool written = writeRows(vm, &out, argv[1], delimiter);
+
+    // whatever was written before an error still goes out
+    freeOutput(&out);
+
+    if (owned) {
+        close(fd);
+    }
+
+    if (!written) {
+        return false;
+    }
+
+    returnNative(vm, argc, UNIT_VAL);
+    return true;
+}
+
+void defineCsv(VM* vm) {
+    defineNative(vm, "csvReader", csvReaderNative, -2);
+    defineNative(vm, "csvColumns", csvColumnsNative, -2);
+    defineNative(vm, "writeCsv", writeCsvNative, -3);
+}
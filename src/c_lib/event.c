@@ -0,0 +1,650 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "builtins.h"
+#include "../vm.h"
+#include "../debug.h"
+#include "../memory.h"
+
+#define EVENT_BATCH 64
+
+typedef enum {
+    WAIT_NONE,
+    WAIT_READ,
+    WAIT_WRITE,
+    WAIT_ACCEPT,
+    WAIT_TIMER,
+} WaitKind;
+
+typedef enum {
+    OP_DONE,
+    OP_BLOCKED,
+    OP_FAILED,
+} OpResult;
+
+// A fiber being run by the loop, and whatever it's parked on
+typedef struct {
+    ObjFiber* fiber;
+    WaitKind wait;
+    int fd;
+    int count;          // bytes a read wants, or bytes a write has got through
+    long long deadline; // when a timer is up, in ms on the monotonic clock
+    Value data;         // the string being written, then what to resume with
+} Task;
+
+struct EventLoop {
+    int epfd;
+    int count;
+    int capacity;
+    Task* tasks;
+};
+
+
+static long long nowMs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void sleepMs(long long ms) {
+    struct timespec ts = { ms / 1000, (ms % 1000) * 1000000 };
+    while (nanosleep(&ts, &ts) < 0 && errno == EINTR);
+}
+
+static EventLoop* getLoop(VM* vm) {
+    if (vm->loop == NULL) {
+        EventLoop* loop = ALLOCATE(vm, 1, EventLoop);
+        loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+        loop->count = 0;
+        loop->capacity = 0;
+        loop->tasks = NULL;
+        vm->loop = loop;
+    }
+
+    return vm->loop;
+}
+
+// The task for the running fiber, if the loop is running it directly
+static Task* currentTask(VM* vm) {
+    if (vm->loop == NULL || vm->fiber == NULL) {
+        return NULL;
+    }
+
+    for (int i = 0; i < vm->loop->count; i++) {
+        if (vm->loop->tasks[i].fiber == vm->fiber) {
+            return &vm->loop->tasks[i];
+        }
+    }
+
+    return NULL;
+}
+
+static uint32_t eventsFor(WaitKind wait) {
+    switch (wait) {
+    case WAIT_READ:
+    case WAIT_ACCEPT:   return EPOLLIN;
+    case WAIT_WRITE:    return EPOLLOUT;
+    default:            return 0;
+    }
+}
+
+// Points epoll at whatever the tasks parked on 'fd' are waiting for
+static bool watch(EventLoop* loop, int fd) {
+    struct epoll_event event = { 0 };
+    event.data.fd = fd;
+
+    for (int i = 0; i < loop->count; i++) {
+        if (loop->tasks[i].fd == fd) {
+            event.events |= eventsFor(loop->tasks[i].wait);
+        }
+    }
+
+    if (event.events == 0) {
+        epoll_ctl(loop->epfd, EPOLL_CTL_DEL, fd, NULL);
+        return true;
+    }
+
+    if (epoll_ctl(loop->epfd, EPOLL_CTL_MOD, fd, &event) == 0) {
+        return true;
+    }
+
+    return errno == ENOENT && epoll_ctl(loop->epfd, EPOLL_CTL_ADD, fd, &event) == 0;
+}
+
+// Tries to finish 'op' without blocking; a finished op leaves its result in 'data'
+static OpResult attempt(VM* vm, Task* op) {
+    switch (op->wait) {
+    case WAIT_READ: {
+        char* buffer = ALLOCATE(vm, op->count, char);
+        ssize_t got = read(op->fd, buffer, op->count);
+
+        if (got >= 0) {
+            op->data = OBJ_VAL(copyString(vm, buffer, got));
+        }
+
+        FREE_ARRAY(vm, buffer, op->count, char);
+
+        if (got < 0) {
+            return errno == EAGAIN || errno == EWOULDBLOCK ? OP_BLOCKED : OP_FAILED;
+        }
+
+        return OP_DONE;
+    }
+    case WAIT_WRITE: {
+        ObjString* string = AS_STRING(op->data);
+
+        while (op->count < string->length) {
+            ssize_t put = write(op->fd, string->chars + op->count, string->length - op->count);
+
+            if (put < 0) {
+                return errno == EAGAIN || errno == EWOULDBLOCK ? OP_BLOCKED : OP_FAILED;
+            }
+
+            op->count += put;
+        }
+
+        op->data = INT_VAL(op->count);
+        return OP_DONE;
+    }
+    case WAIT_ACCEPT: {
+        int fd = accept4(op->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+        if (fd < 0) {
+            return errno == EAGAIN || errno == EWOULDBLOCK ? OP_BLOCKED : OP_FAILED;
+        }
+
+        op->data = INT_VAL(fd);
+        return OP_DONE;
+    }
+    case WAIT_TIMER: {
+        if (nowMs() < op->deadline) {
+            return OP_BLOCKED;
+        }
+
+        op->data = UNIT_VAL;
+        return OP_DONE;
+    }
+    default:
+        return OP_DONE;
+    }
+}
+
+// Runs 'op' for a native: when it would block, a task parks until the loop
+// sees it can go on, and anything else just waits for it here
+static bool perform(VM* vm, int argc, Task* op, const char* name) {
+    // printed output goes ahead of anything written to an fd, and out
+    // before anything waits
+    flushOutput(&vm->output);
+
+    for (;;) {
+        switch (attempt(vm, op)) {
+        case OP_DONE:
+            returnNative(vm, argc, op->data);
+            return true;
+        case OP_FAILED:
+            runtimeError(vm, "%s$ : %s", name, strerror(errno));
+            return false;
+        case OP_BLOCKED:
+            break;
+        }
+
+        Task* task = currentTask(vm);
+
+        if (task != NULL && vm->nativeDepth == 0) {
+            task->wait = op->wait;
+            task->fd = op->wait == WAIT_TIMER ? -1 : op->fd;
+            task->count = op->count;
+            task->deadline = op->deadline;
+            task->data = op->data;
+
+            if (task->fd >= 0 && !watch(vm->loop, task->fd)) {
+                runtimeError(vm, "%s$ : %s", name, strerror(errno));
+                return false;
+            }
+
+            // parked like a yield; the loop resumes it with the result
+            vm->fiber->transfer = UNIT_VAL;
+            vm->yielding = true;
+            returnNative(vm, argc, UNIT_VAL);
+            return true;
+        }
+
+        if (op->wait == WAIT_TIMER) {
+            sleepMs(op->deadline - nowMs());
+            continue;
+        }
+
+        struct pollfd pfd = { op->fd, op->wait == WAIT_WRITE ? POLLOUT : POLLIN, 0 };
+
+        if (poll(&pfd, 1, -1) < 0 && errno != EINTR) {
+            runtimeError(vm, "%s$ : %s", name, strerror(errno));
+            return false;
+        }
+    }
+}
+
+static void removeTask(EventLoop* loop, int index) {
+    memmove(&loop->tasks[index], &loop->tasks[index + 1], sizeof(Task) * (loop->count - index - 1));
+    loop->count--;
+}
+
+// Blocks until a parked task can go on, finishing its op so it's ready to
+// resume; doesn't block at all when something is already ready
+static bool waitForEvents(VM* vm, EventLoop* loop) {
+    long long now = nowMs();
+    long long timeout = -1;
+    bool ready = false;
+    bool polling = false;
+
+    for (int i = 0; i < loop->count; i++) {
+        Task* task = &loop->tasks[i];
+
+        if (task->wait == WAIT_NONE) {
+            ready = true;
+        }
+        else if (task->wait == WAIT_TIMER) {
+            if (task->deadline <= now) {
+                task->wait = WAIT_NONE;
+                task->data = UNIT_VAL;
+                ready = true;
+            }
+            else if (timeout < 0 || task->deadline - now < timeout) {
+                timeout = task->deadline - now;
+            }
+        }
+        else {
+            polling = true;
+        }
+    }
+
+    if (ready) {
+        timeout = 0;
+    }
+
+    if (!polling) {
+        if (timeout > 0) {
+            sleepMs(timeout);
+        }
+        return true;
+    }
+
+    struct epoll_event events[EVENT_BATCH];
+    int count = epoll_wait(loop->epfd, events, EVENT_BATCH, (int)timeout);
+
+    if (count < 0) {
+        if (errno == EINTR) {
+            return true;
+        }
+
+        runtimeError(vm, "runTasks$ : %s", strerror(errno));
+        return false;
+    }
+
+    for (int e = 0; e < count; e++) {
+        int fd = events[e].data.fd;
+
+        for (int i = 0; i < loop->count; i++) {
+            Task* task = &loop->tasks[i];
+
+            if (task->fd != fd || task->wait == WAIT_NONE || task->wait == WAIT_TIMER) {
+                continue;
+            }
+
+            switch (attempt(vm, task)) {
+            case OP_DONE:
+                task->wait = WAIT_NONE;
+                task->fd = -1;
+                break;
+            case OP_FAILED:
+                runtimeError(vm, "runTasks$ : %s", strerror(errno));
+                return false;
+            case OP_BLOCKED:
+                break;
+            }
+        }
+
+        if (!watch(loop, fd)) {
+            runtimeError(vm, "runTasks$ : %s", strerror(errno));
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool expectFd(VM* vm, Value value, const char* name) {
+    if (!IS_INT(value) || AS_INT(value) < 0) {
+        runtimeError(vm, "%s$ : Expected file descriptor, got %s", name, getValName(value));
+        return false;
+    }
+
+    return true;
+}
+
+
+/*
++---------------------+
+| Loop          ^^^^  |
++=====================+
+| NativeFns     vvvv  |
++---------------------+
+*/
+
+
+// Queues a fiber for runTasks$; it's resumed with unit to start
+bool goNative(VM* vm, int argc, Value* argv) {
+    Value fn = argv[0];
+
+    if (!IS_FUNC(fn) && !IS_CLOSURE(fn)) {
+        runtimeError(vm, "go$ : Expected function, got %s", getValName(fn));
+        return false;
+    }
+
+    int arity = IS_CLOSURE(fn) ? CLOSED_FN(fn)->arity : AS_FUNC(fn)->arity;
+
+    if (arity > 1) {
+        runtimeError(vm, "go$ : Expected a function of 0 or 1 args, got %d", arity);
+        return false;
+    }
+
+    EventLoop* loop = getLoop(vm);
+    ObjFiber* fiber = newFiber(vm, fn);
+
+    if (loop->count + 1 > loop->capacity) {
+        int oldCapacity = loop->capacity;
+        push(vm, OBJ_VAL(fiber));
+        loop->capacity = GROW_CAP(oldCapacity);
+        loop->tasks = GROW_ARRAY(vm, loop->tasks, oldCapacity, loop->capacity, Task);
+        pop(vm);
+    }
+
+    loop->tasks[loop->count++] = (Task){ fiber, WAIT_NONE, -1, 0, 0, UNIT_VAL };
+
+    returnNative(vm, argc, OBJ_VAL(fiber));
+    return true;
+}
+
+// Runs queued tasks until every one of them has finished
+bool runTasksNative(VM* vm, int argc, Value* argv) {
+    (void)argv;
+
+    if (vm->fiber != NULL) {
+        runtimeError(vm, "runTasks$ : Cannot run the loop from inside a fiber");
+        return false;
+    }
+
+    EventLoop* loop = getLoop(vm);
+
+    while (loop->count > 0) {
+        // tasks queued along the way are appended, so they get a turn too
+        for (int i = 0; i < loop->count; i++) {
+            if (loop->tasks[i].wait != WAIT_NONE) {
+                continue;
+            }
+
+            Value in = loop->tasks[i].data;
+            Value out;
+            loop->tasks[i].data = UNIT_VAL;
+
+            if (!resumeFiber(vm, loop->tasks[i].fiber, in, &out)) {
+                return false;
+            }
+
+            if (loop->tasks[i].fiber->state == FIBER_DONE) {
+                removeTask(loop, i--);
+            }
+        }
+
+        if (loop->count > 0 && !waitForEvents(vm, loop)) {
+            return false;
+        }
+    }
+
+    returnNative(vm, argc, UNIT_VAL);
+    return true;
+}
+
+bool sleepNative(VM* vm, int argc, Value* argv) {
+    if (!IS_INT(argv[0])) {
+        runtimeError(vm, "sleep$ : Expected int, got %s", getValName(argv[0]));
+        return false;
+    }
+
+    Task op = { NULL, WAIT_TIMER, -1, 0, nowMs() + AS_INT(argv[0]), UNIT_VAL };
+    return perform(vm, argc, &op, "sleep");
+}
+
+bool readNative(VM* vm, int argc, Value* argv) {
+    if (!expectFd(vm, argv[0], "read")) {
+        return false;
+    }
+
+    if (!IS_INT(argv[1]) || AS_INT(argv[1]) <= 0) {
+        runtimeError(vm, "read$ : Expected positive int, got %s", getValName(argv[1]));
+        return false;
+    }
+
+    Task op = { NULL, WAIT_READ, (int)AS_INT(argv[0]), (int)AS_INT(argv[1]), 0, UNIT_VAL };
+    return perform(vm, argc, &op, "read");
+}
+
+bool writeNative(VM* vm, int argc, Value* argv) {
+    if (!expectFd(vm, argv[0], "write")) {
+        return false;
+    }
+
+    if (!IS_STRING(argv[1])) {
+        runtimeError(vm, "write$ : Expected string, got %s", getValName(argv[1]));
+        return false;
+    }
+
+    Task op = { NULL, WAIT_WRITE, (int)AS_INT(argv[0]), 0, 0, argv[1] };
+    return perform(vm, argc, &op, "write");
+}
+
+bool acceptNative(VM* vm, int argc, Value* argv) {
+    if (!expectFd(vm, argv[0], "accept")) {
+        return false;
+    }
+
+    Task op = { NULL, WAIT_ACCEPT, (int)AS_INT(argv[0]), 0, 0, UNIT_VAL };
+    return perform(vm, argc, &op, "accept");
+}
+
+// Gives back read end , write end
+bool pipeNative(VM* vm, int argc, Value* argv) {
+    (void)argv;
+    int fds[2];
+
+    signal(SIGPIPE, SIG_IGN);
+
+    if (pipe2(fds, O_NONBLOCK | O_CLOEXEC) < 0) {
+        runtimeError(vm, "pipe$ : %s", strerror(errno));
+        return false;
+    }
+
+    ObjCell* pair = newCell(vm);
+    pair->car = INT_VAL(fds[0]);
+    pair->cdr = INT_VAL(fds[1]);
+
+    returnNative(vm, argc, OBJ_VAL(pair));
+    return true;
+}
+
+// Modes are "r", "w" and "a"; regular files never block, so they're read
+// and written in place even from a task
+bool openNative(VM* vm, int argc, Value* argv) {
+    if (!IS_STRING(argv[0]) || !IS_STRING(argv[1])) {
+        runtimeError(vm, "open$ : Expected path and mode, got %s and %s", getValName(argv[0]), getValName(argv[1]));
+        return false;
+    }
+
+    ObjString* mode = AS_STRING(argv[1]);
+    int flags;
+
+    if (mode->length == 1 && mode->chars[0] == 'r') {
+        flags = O_RDONLY;
+    }
+    else if (mode->length == 1 && mode->chars[0] == 'w') {
+        flags = O_WRONLY | O_CREAT | O_TRUNC;
+    }
+    else if (mode->length == 1 && mode->chars[0] == 'a') {
+        flags = O_WRONLY | O_CREAT | O_APPEND;
+    }
+    else {
+        runtimeError(vm, "open$ : Unknown mode '%.*s'", mode->length, mode->chars);
+        return false;
+    }
+
+    char* path = toCString(vm, AS_STRING(argv[0]));
+    int fd = open(path, flags | O_CLOEXEC | O_NONBLOCK, 0644);
+    int error = errno;
+
+    freeCString(vm, path, AS_STRING(argv[0]));
+
+    if (fd < 0) {
+        runtimeError(vm, "open$ : %s", strerror(error));
+        return false;
+    }
+
+    returnNative(vm, argc, INT_VAL(fd));
+    return true;
+}
+
+// close$ itself lives with the channels, which it closes too
+bool closeFdNative(VM* vm, int argc, Value* argv) {
+    if (!expectFd(vm, argv[0], "close")) {
+        return false;
+    }
+
+    int fd = (int)AS_INT(argv[0]);
+
+    if (vm->loop != NULL) {
+        epoll_ctl(vm->loop->epfd, EPOLL_CTL_DEL, fd, NULL);
+    }
+
+    if (close(fd) < 0) {
+        runtimeError(vm, "close$ : %s", strerror(errno));
+        return false;
+    }
+
+    returnNative(vm, argc, UNIT_VAL);
+    return true;
+}
+
+static bool socketAddress(VM* vm, Value path, struct sockaddr_un* address, const char* name) {
+    if (!IS_STRING(path)) {
+        runtimeError(vm, "%s$ : Expected path, got %s", name, getValName(path));
+        return false;
+    }
+
+    if ((size_t)AS_STRING(path)->length >= sizeof(address->sun_path)) {
+        runtimeError(vm, "%s$ : Socket path is too long", name);
+        return false;
+    }
+
+    memset(address, 0, sizeof(*address));
+    address->sun_family = AF_UNIX;
+    memcpy(address->sun_path, AS_CSTRING(path), AS_STRING(path)->length);
+
+    return true;
+}
+
+// Unix-domain stream sockets only
+bool listenNative(VM* vm, int argc, Value* argv) {
+    struct sockaddr_un address;
+
+    if (!socketAddress(vm, argv[0], &address, "listen")) {
+        return false;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+    unlink(address.sun_path);
+
+    if (fd < 0
+        || bind(fd, (struct sockaddr*)&address, sizeof(address)) < 0
+        || listen(fd, SOMAXCONN) < 0) {
+        runtimeError(vm, "listen$ : %s", strerror(errno));
+        if (fd >= 0) {
+            close(fd);
+        }
+        return false;
+    }
+
+    returnNative(vm, argc, INT_VAL(fd));
+    return true;
+}
+
+bool connectNative(VM* vm, int argc, Value* argv) {
+    struct sockaddr_un address;
+
+    if (!socketAddress(vm, argv[0], &address, "connect")) {
+        return false;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+
+    // local connects don't wait on the network, so this one blocks
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+    if (fd < 0
+        || connect(fd, (struct sockaddr*)&address, sizeof(address)) < 0
+        || fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) < 0) {
+        runtimeError(vm, "connect$ : %s", strerror(errno));
+        if (fd >= 0) {
+            close(fd);
+        }
+        return false;
+    }
+
+    returnNative(vm, argc, INT_VAL(fd));
+    return true;
+}
+
+void markEventLoop(VM* vm) {
+    if (vm->loop == NULL) {
+        return;
+    }
+
+    for (int i = 0; i < vm->loop->count; i++) {
+        markObject(vm, (Obj*)vm->loop->tasks[i].fiber);
+        markValue(vm, vm->loop->tasks[i].data);
+    }
+}
+
+void freeEventLoop(VM* vm) {
+    if (vm->loop == NULL) {
+        return;
+    }
+
+    close(vm->loop->epfd);
+    FREE_ARRAY(vm, vm->loop->tasks, vm->loop->capacity, Task);
+    FREE(vm, vm->loop, EventLoop);
+    vm->loop = NULL;
+}
+
+void defineEvents(VM* vm) {
+    defineNative(vm, "go", goNative, 1);
+    defineNative(vm, "runTasks", runTasksNative, 0);
+    defineNative(vm, "sleep", sleepNative, 1);
+    defineNative(vm, "read", readNative, 2);
+    defineNative(vm, "write", writeNative, 2);
+    defineNative(vm, "accept", acceptNative, 1);
+    defineNative(vm, "pipe", pipeNative, 0);
+    defineNative(vm, "open", openNative, 2);
+    defineNative(vm, "listen", listenNative, 1);
+    defineNative(vm, "connect", connectNative, 1);
+}
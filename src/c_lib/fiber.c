@@ -0,0 +1,80 @@
+#include "builtins.h"
+#include "../vm.h"
+#include "../debug.h"
+
+
+// The function is run on the fiber's own stacks the first time it's resumed,
+// taking the value it was resumed with if it has a parameter
+bool fiberNative(VM* vm, int argc, Value* argv) {
+    Value fn = argv[0];
+
+    if (!IS_FUNC(fn) && !IS_CLOSURE(fn)) {
+        runtimeError(vm, "fiber$ : Expected function, got %s", getValName(fn));
+        return false;
+    }
+
+    int arity = IS_CLOSURE(fn) ? CLOSED_FN(fn)->arity : AS_FUNC(fn)->arity;
+
+    if (arity > 1) {
+        runtimeError(vm, "fiber$ : Expected a function of 0 or 1 args, got %d", arity);
+        return false;
+    }
+
+    returnNative(vm, argc, OBJ_VAL(newFiber(vm, fn)));
+    return true;
+}
+
+bool resumeNative(VM* vm, int argc, Value* argv) {
+    if (!IS_FIBER(argv[0])) {
+        runtimeError(vm, "resume$ : Expected fiber, got %s", getValName(argv[0]));
+        return false;
+    }
+
+    Value in = argc > 1 ? argv[1] : UNIT_VAL;
+    Value out;
+
+    if (!resumeFiber(vm, AS_FIBER(argv[0]), in, &out)) {
+        return false;
+    }
+
+    returnNative(vm, argc, out);
+    return true;
+}
+
+// Only the run() started by resume$ can be left, so a fiber can't yield from
+// inside a function called by another native
+bool yieldNative(VM* vm, int argc, Value* argv) {
+    if (vm->fiber == NULL) {
+        runtimeError(vm, "yield$ : Cannot yield outside of a fiber");
+        return false;
+    }
+
+    if (vm->nativeDepth > 0) {
+        runtimeError(vm, "yield$ : Cannot yield from inside a native call");
+        return false;
+    }
+
+    vm->fiber->transfer = argv[0];
+    vm->yielding = true;
+
+    // stands in for the value the fiber is next resumed with
+    returnNative(vm, argc, UNIT_VAL);
+    return true;
+}
+
+bool doneNative(VM* vm, int argc, Value* argv) {
+    if (!IS_FIBER(argv[0])) {
+        runtimeError(vm, "done$ : Expected fiber, got %s", getValName(argv[0]));
+        return false;
+    }
+
+    returnNative(vm, argc, BOOL_VAL(AS_FIBER(argv[0])->state == FIBER_DONE));
+    return true;
+}
+
+void defineFibers(VM* vm) {
+    defineNative(vm, "fiber", fiberNative, 1);
+    defineNative(vm, "resume", resumeNative, -2);
+    defineNative(vm, "yield", yieldNative, 1);
+    defineNative(vm, "done", doneNative, 1);
+}
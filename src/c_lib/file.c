@@ -0,0 +1,182 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "builtins.h"
+#include "../vm.h"
+#include "../debug.h"
+#include "../memory.h"
+
+// Files smaller than this are read into an ordinary string; a mapping costs
+// a page and a syscall or two, which isn't worth it for a few lines
+#define MAP_MIN_SIZE 16384
+
+
+static bool openFile(VM* vm, Value path, int* fd, size_t* size, const char* name) {
+    if (!IS_STRING(path)) {
+        runtimeError(vm, "%s$ : Expected path, got %s", name, getValName(path));
+        return false;
+    }
+
+    ObjString* string = AS_STRING(path);
+    char* cpath = toCString(vm, string);
+    *fd = open(cpath, O_RDONLY | O_CLOEXEC);
+    int error = errno;
+
+    freeCString(vm, cpath, string);
+
+    if (*fd < 0) {
+        runtimeError(vm, "%s$ : Could not open '%.*s': %s", name, string->length, string->chars, strerror(error));
+        return false;
+    }
+
+    struct stat info;
+
+    if (fstat(*fd, &info) < 0) {
+        error = errno;
+        close(*fd);
+        runtimeError(vm, "%s$ : %s", name, strerror(error));
+        return false;
+    }
+
+    if (info.st_size > INT_MAX) {
+        close(*fd);
+        runtimeError(vm, "%s$ : '%.*s' is too large", name, string->length, string->chars);
+        return false;
+    }
+
+    *size = (size_t)info.st_size;
+    return true;
+}
+
+// Maps the whole of 'path'; NULL with an error raised if it can't, or with
+// 'size' left at 0 for an empty file, which can't be mapped at all
+static ObjMapping* mapPath(VM* vm, Value path, int advice, const char* name) {
+    int fd;
+    size_t size;
+
+    if (!openFile(vm, path, &fd, &size, name)) {
+        return NULL;
+    }
+
+    if (size == 0) {
+        close(fd);
+        return newMapping(vm, NULL, 0);
+    }
+
+    char* bytes = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    int error = errno;
+    close(fd);
+
+    if (bytes == MAP_FAILED) {
+        runtimeError(vm, "%s$ : %s", name, strerror(error));
+        return NULL;
+    }
+
+    madvise(bytes, size, advice);
+    return newMapping(vm, bytes, (int)size);
+}
+
+// The whole file as a string viewing the mapping
+bool mapFileNative(VM* vm, int argc, Value* argv) {
+    ObjMapping* mapping = mapPath(vm, argv[0], MADV_NORMAL, "mapFile");
+
+    if (mapping == NULL) {
+        return false;
+    }
+
+    push(vm, OBJ_VAL(mapping));
+    ObjString* contents = newMappedString(vm, mapping, 0, mapping->length);
+    pop(vm);
+
+    returnNative(vm, argc, OBJ_VAL(contents));
+    return true;
+}
+
+// Like mapFile$, but small files are read into an ordinary string
+bool readFileNative(VM* vm, int argc, Value* argv) {
+    int fd;
+    size_t size;
+
+    if (!openFile(vm, argv[0], &fd, &size, "readFile")) {
+        return false;
+    }
+
+    if (size >= MAP_MIN_SIZE) {
+        close(fd);
+        return mapFileNative(vm, argc, argv);
+    }
+
+    char* chars = ALLOCATE(vm, size + 1, char);
+    size_t total = 0;
+
+    while (total < size) {
+        ssize_t got = read(fd, chars + total, size - total);
+
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (got <= 0) {
+            break;
+        }
+
+        total += got;
+    }
+
+    close(fd);
+
+    // a file that shrank since it was sized is read as far as it goes
+    chars = GROW_ARRAY(vm, chars, size + 1, total + 1, char);
+    chars[total] = '\0';
+
+    returnNative(vm, argc, OBJ_VAL(takeString(vm, chars, total)));
+    return true;
+}
+
+// Every line of the file, without its '\n', as strings viewing one mapping
+bool linesNative(VM* vm, int argc, Value* argv) {
+    ObjMapping* mapping = mapPath(vm, argv[0], MADV_SEQUENTIAL, "lines");
+
+    if (mapping == NULL) {
+        return false;
+    }
+
+    push(vm, OBJ_VAL(mapping));
+
+    ObjList* lines = newList(vm);
+    push(vm, OBJ_VAL(lines));
+
+    const char* bytes = mapping->bytes;
+    int start = 0;
+
+    while (start < mapping->length) {
+        const char* newline = memchr(bytes + start, '\n', mapping->length - start);
+        int end = newline != NULL ? (int)(newline - bytes) : mapping->length;
+
+        ObjString* line = newMappedString(vm, mapping, start, end - start);
+        push(vm, OBJ_VAL(line));
+        writeValueArray(vm, &lines->array, OBJ_VAL(line));
+        pop(vm);
+
+        start = end + 1;
+    }
+
+    pop(vm);
+    pop(vm);
+
+    returnNative(vm, argc, OBJ_VAL(lines));
+    return true;
+}
+
+void defineFiles(VM* vm) {
+    defineNative(vm, "readFile", readFileNative, 1);
+    defineNative(vm, "lines", linesNative, 1);
+    defineNative(vm, "mapFile", mapFileNative, 1);
+}
@@ -0,0 +1,749 @@
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "builtins.h"
+#include "../vm.h"
+#include "../debug.h"
+#include "../memory.h"
+#include "../output.h"
+#include "../shape.h"
+#include "../persistent.h"
+
+// Deeper than this is almost certainly a cycle (or an attack on the C stack)
+#define JSON_MAX_DEPTH 512
+// Longest number copied onto the stack for strtod; longer ones go on the heap
+#define JSON_NUMBER_MAX 64
+
+
+// Values are parsed straight onto 'scratch', which is rooted on the VM stack;
+// when a container closes its values are moved off the top of it into a list
+// or map allocated at exactly the right size
+typedef struct {
+    VM* vm;
+    const char* start;
+    const char* current;
+    const char* end;
+    ObjList* scratch;
+    int depth;
+} JsonParser;
+
+static bool parseValue(JsonParser* parser);
+
+static bool parseError(JsonParser* parser, const char* message) {
+    int line = 1;
+    const char* lineStart = parser->start;
+
+    for (const char* c = parser->start; c < parser->current; c++) {
+        if (*c == '\n') {
+            line++;
+            lineStart = c + 1;
+        }
+    }
+
+    runtimeError(parser->vm, "jsonParse$ : %s at line %d, column %d",
+        message, line, (int)(parser->current - lineStart) + 1);
+    return false;
+}
+
+static void skipWhitespace(JsonParser* parser) {
+    while (parser->current < parser->end) {
+        switch (*parser->current) {
+            case ' ': case '\t': case '\n': case '\r':
+                parser->current++;
+                break;
+            default:
+                return;
+        }
+    }
+}
+
+// GC :: 'value' may be fresh, and growing the scratch array can collect
+static void keepValue(JsonParser* parser, Value value) {
+    push(parser->vm, value);
+    writeValueArray(parser->vm, &parser->scratch->array, value);
+    pop(parser->vm);
+}
+
+static bool matchWord(JsonParser* parser, const char* word, Value value) {
+    size_t length = strlen(word);
+
+    if ((size_t)(parser->end - parser->current) < length || memcmp(parser->current, word, length) != 0) {
+        return parseError(parser, "Unexpected character");
+    }
+
+    parser->current += length;
+    keepValue(parser, value);
+    return true;
+}
+
+static bool isDigit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+static const char* skipDigits(const char* c, const char* end) {
+    while (c < end && isDigit(*c)) c++;
+    return c;
+}
+
+// Whole numbers that fit are ints, everything else is a float
+static bool parseNumber(JsonParser* parser) {
+    const char* start = parser->current;
+    const char* c = start;
+    const char* end = parser->end;
+    bool integral = true;
+
+    if (c < end && *c == '-') c++;
+
+    if (c < end && *c == '0') {
+        c++;
+    }
+    else if (c < end && isDigit(*c)) {
+        c = skipDigits(c, end);
+    }
+    else {
+        parser->current = c;
+        return parseError(parser, "Expected digit");
+    }
+
+    if (c < end && *c == '.') {
+        integral = false;
+
+        if (c + 1 >= end || !isDigit(c[1])) {
+            parser->current = c + 1;
+            return parseError(parser, "Expected digit");
+        }
+
+        c = skipDigits(c + 1, end);
+    }
+
+    if (c < end && (*c == 'e' || *c == 'E')) {
+        integral = false;
+        c++;
+
+        if (c < end && (*c == '+' || *c == '-')) c++;
+
+        if (c >= end || !isDigit(*c)) {
+            parser->current = c;
+            return parseError(parser, "Expected digit");
+        }
+
+        c = skipDigits(c, end);
+    }
+
+    parser->current = c;
+
+    if (integral) {
+        bool negative = *start == '-';
+        unsigned long long n = 0;
+        unsigned long long limit = negative ? (unsigned long long)LLONG_MAX + 1 : (unsigned long long)LLONG_MAX;
+        bool fits = true;
+
+        for (const char* d = start + negative; d < c; d++) {
+            unsigned digit = *d - '0';
+
+            if (n > (limit - digit) / 10) {
+                fits = false;
+                break;
+            }
+
+            n = n * 10 + digit;
+        }
+
+        if (fits) {
+            long long value = negative ? (long long)(0 - n) : (long long)n;
+            keepValue(parser, INT_VAL(value));
+            return true;
+        }
+    }
+
+    // the source needn't be terminated right after the number, so strtod
+    // gets its own copy
+    size_t length = c - start;
+    char digits[JSON_NUMBER_MAX];
+    char* text = length < sizeof(digits) ? digits : malloc(length + 1);
+
+    memcpy(text, start, length);
+    text[length] = '\0';
+
+    double x = strtod(text, NULL);
+
+    if (text != digits) {
+        free(text);
+    }
+
+    keepValue(parser, FLOAT_VAL(x));
+    return true;
+}
+
+static int hexDigit(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+static bool readHex4(JsonParser* parser, const char* c, unsigned* out) {
+    if (parser->end - c < 4) {
+        return false;
+    }
+
+    unsigned n = 0;
+
+    for (int i = 0; i < 4; i++) {
+        int digit = hexDigit(c[i]);
+
+        if (digit < 0) {
+            return false;
+        }
+
+        n = (n << 4) | digit;
+    }
+
+    *out = n;
+    return true;
+}
+
+static int encodeUtf8(unsigned point, char* out) {
+    if (point < 0x80) {
+        out[0] = (char)point;
+        return 1;
+    }
+    if (point < 0x800) {
+        out[0] = (char)(0xC0 | (point >> 6));
+        out[1] = (char)(0x80 | (point & 0x3F));
+        return 2;
+    }
+    if (point < 0x10000) {
+        out[0] = (char)(0xE0 | (point >> 12));
+        out[1] = (char)(0x80 | ((point >> 6) & 0x3F));
+        out[2] = (char)(0x80 | (point & 0x3F));
+        return 3;
+    }
+
+    out[0] = (char)(0xF0 | (point >> 18));
+    out[1] = (char)(0x80 | ((point >> 12) & 0x3F));
+    out[2] = (char)(0x80 | ((point >> 6) & 0x3F));
+    out[3] = (char)(0x80 | (point & 0x3F));
+    return 4;
+}
+
+// Decodes the escapes in a string known to have some; the decoded text is
+// never longer than the source
+static bool unescapeString(JsonParser* parser, const char* start, const char* end, ObjString** out) {
+    char* chars = malloc(end - start + 1);
+    int length = 0;
+
+    for (const char* c = start; c < end; c++) {
+        if (*c != '\\') {
+            chars[length++] = *c;
+            continue;
+        }
+
+        c++;
+
+        switch (*c) {
+            case '"':   chars[length++] = '"'; break;
+            case '\\':  chars[length++] = '\\'; break;
+            case '/':   chars[length++] = '/'; break;
+            case 'b':   chars[length++] = '\b'; break;
+            case 'f':   chars[length++] = '\f'; break;
+            case 'n':   chars[length++] = '\n'; break;
+            case 'r':   chars[length++] = '\r'; break;
+            case 't':   chars[length++] = '\t'; break;
+            case 'u': {
+                unsigned point;
+
+                if (!readHex4(parser, c + 1, &point)) {
+                    free(chars);
+                    parser->current = c;
+                    return parseError(parser, "Bad unicode escape");
+                }
+
+                c += 4;
+
+                // a high surrogate only means something with a low one after it
+                if (point >= 0xD800 && point <= 0xDBFF) {
+                    unsigned low;
+
+                    if (c + 2 < end && c[1] == '\\' && c[2] == 'u' && readHex4(parser, c + 3, &low)
+                        && low >= 0xDC00 && low <= 0xDFFF) {
+                        point = 0x10000 + ((point - 0xD800) << 10) + (low - 0xDC00);
+                        c += 6;
+                    }
+                    else {
+                        free(chars);
+                        parser->current = c;
+                        return parseError(parser, "Unpaired surrogate");
+                    }
+                }
+                else if (point >= 0xDC00 && point <= 0xDFFF) {
+                    free(chars);
+                    parser->current = c;
+                    return parseError(parser, "Unpaired surrogate");
+                }
+
+                length += encodeUtf8(point, chars + length);
+                break;
+            }
+            default:
+                free(chars);
+                parser->current = c;
+                return parseError(parser, "Bad escape");
+        }
+    }
+
+    *out = copyString(parser->vm, chars, length);
+    free(chars);
+    return true;
+}
+
+// Strings without escapes are interned straight from the source
+static bool parseString(JsonParser* parser, ObjString** out) {
+    const char* start = ++parser->current;
+    const char* c = start;
+    bool escaped = false;
+
+    while (true) {
+        if (c >= parser->end) {
+            parser->current = c;
+            return parseError(parser, "Unterminated string");
+        }
+
+        if (*c == '"') {
+            break;
+        }
+
+        if ((unsigned char)*c < 0x20) {
+            parser->current = c;
+            return parseError(parser, "Control character in string");
+        }
+
+        if (*c == '\\') {
+            escaped = true;
+
+            if (++c >= parser->end) {
+                continue;
+            }
+        }
+
+        c++;
+    }
+
+    parser->current = c + 1;
+
+    if (!escaped) {
+        *out = copyString(parser->vm, start, c - start);
+        return true;
+    }
+
+    return unescapeString(parser, start, c, out);
+}
+
+static bool enter(JsonParser* parser) {
+    if (++parser->depth > JSON_MAX_DEPTH) {
+        return parseError(parser, "Nested too deeply");
+    }
+
+    parser->current++;
+    skipWhitespace(parser);
+    return true;
+}
+
+static bool parseArray(JsonParser* parser) {
+    if (!enter(parser)) {
+        return false;
+    }
+
+    ValueArray* scratch = &parser->scratch->array;
+    int base = scratch->count;
+
+    if (parser->current < parser->end && *parser->current == ']') {
+        parser->current++;
+    }
+    else {
+        while (true) {
+            if (!parseValue(parser)) {
+                return false;
+            }
+
+            skipWhitespace(parser);
+
+            if (parser->current < parser->end && *parser->current == ',') {
+                parser->current++;
+                continue;
+            }
+            if (parser->current < parser->end && *parser->current == ']') {
+                parser->current++;
+                break;
+            }
+
+            return parseError(parser, "Expected ',' or ']'");
+        }
+    }
+
+    int count = scratch->count - base;
+    ObjList* list = newList(parser->vm);
+    push(parser->vm, OBJ_VAL(list));
+
+    if (count > 0) {
+        list->array.values = ALLOCATE(parser->vm, count, Value);
+        list->array.capacity = count;
+        list->array.count = count;
+        memcpy(list->array.values, scratch->values + base, count * sizeof(Value));
+    }
+
+    scratch->count = base;
+    writeValueArray(parser->vm, scratch, OBJ_VAL(list));
+    pop(parser->vm);
+
+    parser->depth--;
+    return true;
+}
+
+static bool parseObject(JsonParser* parser) {
+    if (!enter(parser)) {
+        return false;
+    }
+
+    ValueArray* scratch = &parser->scratch->array;
+    int base = scratch->count;
+
+    if (parser->current < parser->end && *parser->current == '}') {
+        parser->current++;
+    }
+    else {
+        while (true) {
+            if (parser->current >= parser->end || *parser->current != '"') {
+                return parseError(parser, "Expected key");
+            }
+
+            ObjString* key;
+
+            if (!parseString(parser, &key)) {
+                return false;
+            }
+
+            keepValue(parser, OBJ_VAL(key));
+            skipWhitespace(parser);
+
+            if (parser->current >= parser->end || *parser->current != ':') {
+                return parseError(parser, "Expected ':'");
+            }
+
+            parser->current++;
+            skipWhitespace(parser);
+
+            if (!parseValue(parser)) {
+                return false;
+            }
+
+            skipWhitespace(parser);
+
+            if (parser->current < parser->end && *parser->current == ',') {
+                parser->current++;
+                skipWhitespace(parser);
+                continue;
+            }
+            if (parser->current < parser->end && *parser->current == '}') {
+                parser->current++;
+                break;
+            }
+
+            return parseError(parser, "Expected ',' or '}'");
+        }
+    }
+
+    int count = (scratch->count - base) / 2;
+    ObjMap* map = newMap(parser->vm);
+    push(parser->vm, OBJ_VAL(map));
+
+    // small objects take the shape path and usually share a shape with their
+    // siblings; big ones go straight to a dictionary
+    if (count > SHAPE_MAX_SLOTS) {
+        map->shape = NULL;
+        tableReserve(parser->vm, &map->table, count);
+    }
+    else if (count > 0) {
+        map->slots.values = ALLOCATE(parser->vm, count, Value);
+        map->slots.capacity = count;
+    }
+
+    // a repeated key keeps its last value
+    for (int i = base; i < scratch->count; i += 2) {
+        mapSet(parser->vm, map, AS_STRING(scratch->values[i]), scratch->values[i + 1]);
+    }
+
+    scratch->count = base;
+    writeValueArray(parser->vm, scratch, OBJ_VAL(map));
+    pop(parser->vm);
+
+    parser->depth--;
+    return true;
+}
+
+static bool parseValue(JsonParser* parser) {
+    skipWhitespace(parser);
+
+    if (parser->current >= parser->end) {
+        return parseError(parser, "Expected value");
+    }
+
+    switch (*parser->current) {
+        case '{':   return parseObject(parser);
+        case '[':   return parseArray(parser);
+        case 't':   return matchWord(parser, "true", BOOL_VAL(true));
+        case 'f':   return matchWord(parser, "false", BOOL_VAL(false));
+        case 'n':   return matchWord(parser, "null", UNIT_VAL);
+        case '"': {
+            ObjString* string;
+
+            if (!parseString(parser, &string)) {
+                return false;
+            }
+
+            keepValue(parser, OBJ_VAL(string));
+            return true;
+        }
+        default:
+            if (*parser->current == '-' || isDigit(*parser->current)) {
+                return parseNumber(parser);
+            }
+
+            return parseError(parser, "Unexpected character");
+    }
+}
+
+
+static void writeJsonString(Output* out, const char* chars, int length) {
+    static const char hex[] = "0123456789abcdef";
+    const char* run = chars;
+    const char* end = chars + length;
+
+    outputChar(out, '"');
+
+    // plain runs go out in one piece
+    for (const char* c = chars; c < end; c++) {
+        unsigned char ch = (unsigned char)*c;
+
+        if (ch >= 0x20 && ch != '"' && ch != '\\') {
+            continue;
+        }
+
+        outputChars(out, run, c - run);
+        run = c + 1;
+
+        switch (ch) {
+            case '"':   outputChars(out, "\\\"", 2); break;
+            case '\\':  outputChars(out, "\\\\", 2); break;
+            case '\b':  outputChars(out, "\\b", 2); break;
+            case '\f':  outputChars(out, "\\f", 2); break;
+            case '\n':  outputChars(out, "\\n", 2); break;
+            case '\r':  outputChars(out, "\\r", 2); break;
+            case '\t':  outputChars(out, "\\t", 2); break;
+            default: {
+                char escape[6] = { '\\', 'u', '0', '0', hex[ch >> 4], hex[ch & 0xF] };
+                outputChars(out, escape, 6);
+                break;
+            }
+        }
+    }
+
+    outputChars(out, run, end - run);
+    outputChar(out, '"');
+}
+
+// Whole floats keep a '.0' so they come back as floats
+static void writeJsonFloat(Output* out, double x) {
+    char digits[DOUBLE_DIGITS_MAX];
+    int length = formatDouble(digits, x);
+
+    outputChars(out, digits, length);
+
+    if (strpbrk(digits, ".e") == NULL) {
+        outputChars(out, ".0", 2);
+    }
+}
+
+static bool writeJson(VM* vm, Output* out, Value value, int depth);
+
+static bool writeJsonMember(VM* vm, Output* out, ObjString* key, Value value, bool first, int depth) {
+    if (!first) {
+        outputChar(out, ',');
+    }
+
+    writeJsonString(out, key->chars, key->length);
+    outputChar(out, ':');
+    return writeJson(vm, out, value, depth);
+}
+
+static bool writeJson(VM* vm, Output* out, Value value, int depth) {
+    if (depth > JSON_MAX_DEPTH) {
+        runtimeError(vm, "jsonStringify$ : Nested more than %d deep", JSON_MAX_DEPTH);
+        return false;
+    }
+
+    switch (value.type) {
+        case VAL_UNIT:
+            outputChars(out, "null", 4);
+            return true;
+        case VAL_BOOL:
+            if (AS_BOOL(value)) outputChars(out, "true", 4);
+            else                outputChars(out, "false", 5);
+            return true;
+        case VAL_INT:
+            outputInt(out, AS_INT(value));
+            return true;
+        case VAL_FLOAT:
+            if (!isfinite(AS_FLOAT(value))) {
+                runtimeError(vm, "jsonStringify$ : Cannot encode %lg", AS_FLOAT(value));
+                return false;
+            }
+
+            writeJsonFloat(out, AS_FLOAT(value));
+            return true;
+        case VAL_CHAR: {
+            char c = AS_CHAR(value);
+            writeJsonString(out, &c, 1);
+            return true;
+        }
+        case VAL_OBJ:
+            break;
+    }
+
+    switch (OBJ_TYPE(value)) {
+        case OBJ_STRING:
+            writeJsonString(out, AS_CSTRING(value), AS_STRING(value)->length);
+            return true;
+        case OBJ_LIST: {
+            ObjList* list = AS_LIST(value);
+            Value* items = listValues(list);
+
+            outputChar(out, '[');
+            for (int i = 0; i < list->array.count; i++) {
+                if (i > 0) outputChar(out, ',');
+                if (list->step != 0) {
+                    outputInt(out, rangeAt(list, i));
+                }
+                else if (!writeJson(vm, out, items[i], depth + 1)) return false;
+            }
+            outputChar(out, ']');
+            return true;
+        }
+        case OBJ_VECTOR: {
+            ObjVector* vector = AS_VECTOR(value);
+
+            outputChar(out, '[');
+            for (int i = 0; i < vector->count; i++) {
+                if (i > 0) outputChar(out, ',');
+                if (!writeJson(vm, out, vectorGet(vector, i), depth + 1)) return false;
+            }
+            outputChar(out, ']');
+            return true;
+        }
+        case OBJ_ARRAY: {
+            ObjArray* array = AS_ARRAY(value);
+
+            outputChar(out, '[');
+            for (int i = 0; i < array->count; i++) {
+                if (i > 0) outputChar(out, ',');
+                if (!writeJson(vm, out, arrayAt(array, i), depth + 1)) return false;
+            }
+            outputChar(out, ']');
+            return true;
+        }
+        case OBJ_MAP: {
+            ObjMap* map = AS_MAP(value);
+            int cursor = 0;
+            ObjString* key;
+            Value item;
+
+            outputChar(out, '{');
+            for (bool first = true; mapNext(map, &cursor, &key, &item); first = false) {
+                if (!writeJsonMember(vm, out, key, item, first, depth + 1)) return false;
+            }
+            outputChar(out, '}');
+            return true;
+        }
+        case OBJ_PMAP: {
+            PMapCursor cursor;
+            ObjString* key;
+            Value item;
+
+            pmapCursor(AS_PMAP(value), &cursor);
+
+            outputChar(out, '{');
+            for (bool first = true; pmapNext(&cursor, &key, &item); first = false) {
+                if (!writeJsonMember(vm, out, key, item, first, depth + 1)) return false;
+            }
+            outputChar(out, '}');
+            return true;
+        }
+        default:
+            runtimeError(vm, "jsonStringify$ : Cannot encode %s", getValName(value));
+            return false;
+    }
+}
+
+
+// Objects become maps, arrays become lists, null becomes (); whole numbers
+// that fit are ints
+bool jsonParseNative(VM* vm, int argc, Value* argv) {
+    if (!IS_STRING(argv[0])) {
+        runtimeError(vm, "jsonParse$ : Expected string, got %s", getValName(argv[0]));
+        return false;
+    }
+
+    ObjString* source = AS_STRING(argv[0]);
+    JsonParser parser;
+
+    parser.vm = vm;
+    parser.start = source->chars;
+    parser.current = source->chars;
+    parser.end = source->chars + source->length;
+    parser.depth = 0;
+    parser.scratch = newList(vm);
+
+    push(vm, OBJ_VAL(parser.scratch));
+
+    if (!parseValue(&parser)) {
+        return false;
+    }
+
+    skipWhitespace(&parser);
+
+    if (parser.current != parser.end) {
+        return parseError(&parser, "Unexpected character after value");
+    }
+
+    Value result = parser.scratch->array.values[0];
+    pop(vm);
+
+    returnNative(vm, argc, result);
+    return true;
+}
+
+// Lists, vectors, arrays and ranges become arrays, maps become objects, ()
+// becomes null; chars are written as one-char strings
+bool jsonStringifyNative(VM* vm, int argc, Value* argv) {
+    Output out;
+    initCollector(&out);
+
+    if (!writeJson(vm, &out, argv[0], 0)) {
+        freeOutput(&out);
+        return false;
+    }
+
+    ObjString* string = copyString(vm, out.bytes, out.count);
+    freeOutput(&out);
+
+    returnNative(vm, argc, OBJ_VAL(string));
+    return true;
+}
+
+void defineJson(VM* vm) {
+    defineNative(vm, "jsonParse", jsonParseNative, 1);
+    defineNative(vm, "jsonStringify", jsonStringifyNative, 1);
+}
@@ -0,0 +1,1041 @@
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "builtins.h"
+#include "../vm.h"
+#include "../debug.h"
+#include "../memory.h"
+#include "../sequence.h"
+#include "../transfer.h"
+#include "../ring.h"
+
+#define POOL_MAX_WORKERS 64
+// Lists are split into chunks no shorter than this, so small ones stay on the
+// calling thread where copying them across would cost more than it saves
+#define PMAP_MIN_CHUNK 64
+
+typedef enum {
+    JOB_CHUNK,      // part of a pmap$
+    JOB_CALL,       // a spawn$
+} JobKind;
+
+typedef enum {
+    JOB_PENDING,
+    JOB_OK,
+    JOB_SEND_FAILED,    // something couldn't be copied across
+    JOB_CALL_FAILED,    // the function raised an error
+} JobStatus;
+
+// Jobs are shared between threads, so they live outside every VM's heap; each
+// holder lets go with releaseJob() and the last one frees it. Everything a
+// worker needs is packed on the calling side, so it never reads that heap
+struct Job {
+    JobKind kind;
+    atomic_int refs;
+    JobStatus status;   // only touched under the pool's lock
+
+    // the function followed by its arguments, or for a chunk by a list of
+    // its share of the inputs
+    Parcel call;
+    int argc;
+
+    // the varying globals its code names; the chunks of a pmap$ share the
+    // caller's packing, which is kept until every one of them has settled
+    const Parcel* globals;
+    Parcel ownGlobals;
+
+    Parcel result;
+};
+
+// Jobs waiting on one worker; it takes the newest, others steal the oldest
+typedef struct {
+    pthread_mutex_t lock;
+    Job** jobs;
+    int capacity;
+    int head;
+    int count;
+} Deque;
+
+// A thread with a VM of its own
+typedef struct {
+    VM* vm;
+    pthread_t thread;
+    WorkerPool* pool;
+    Deque deque;
+    int synced;         // how many of the pool's fixed globals this VM has
+    Ring* waitingOn;    // the channel it's blocked on, under the pool's lock
+} Worker;
+
+// A global of the calling VM, packed once for every worker to unpack
+typedef struct {
+    char* name;
+    int length;
+    Parcel value;
+} SharedGlobal;
+
+struct WorkerPool {
+    atomic_int count;           // only grows; room is kept for the most
+    Worker* workers;
+    int next;                   // worker the next job is handed to
+
+    pthread_mutex_t lock;
+    pthread_cond_t wake;        // a job was queued, or the pool is closing
+    pthread_cond_t settled;     // a job finished
+    int queued;
+    int blocked;                // workers waiting on something mid-job
+    bool closing;
+
+    // Globals can't be rebound, but lists, maps and the like can still be
+    // changed through them. Globals holding nothing changeable are packed the
+    // once; the rest are packed with each job whose code names them, so the
+    // workers see them as they are and anything shared between them stays
+    // shared
+    Table published;
+    int seenGlobals;
+    int globalCount;
+    int globalCapacity;
+    SharedGlobal* globals;
+};
+
+
+static Job* newJob(JobKind kind) {
+    Job* job = malloc(sizeof(Job));
+
+    if (job == NULL) {
+        exit(1);
+    }
+
+    job->kind = kind;
+    atomic_init(&job->refs, 2);
+    job->status = JOB_PENDING;
+    job->argc = 0;
+    job->globals = &job->ownGlobals;
+    initParcel(&job->call);
+    initParcel(&job->ownGlobals);
+    initParcel(&job->result);
+    return job;
+}
+
+void releaseJob(Job* job) {
+    if (atomic_fetch_sub(&job->refs, 1) == 1) {
+        freeParcel(&job->call);
+        freeParcel(&job->ownGlobals);
+        freeParcel(&job->result);
+        free(job);
+    }
+}
+
+static void pushJob(Deque* deque, Job* job) {
+    pthread_mutex_lock(&deque->lock);
+
+    if (deque->count == deque->capacity) {
+        int capacity = GROW_CAP(deque->capacity);
+        Job** jobs = malloc(capacity * sizeof(Job*));
+
+        if (jobs == NULL) {
+            exit(1);
+        }
+
+        for (int i = 0; i < deque->count; i++) {
+            jobs[i] = deque->jobs[(deque->head + i) % deque->capacity];
+        }
+
+        free(deque->jobs);
+        deque->jobs = jobs;
+        deque->capacity = capacity;
+        deque->head = 0;
+    }
+
+    deque->jobs[(deque->head + deque->count) % deque->capacity] = job;
+    deque->count++;
+
+    pthread_mutex_unlock(&deque->lock);
+}
+
+static Job* popJob(Deque* deque) {
+    Job* job = NULL;
+    pthread_mutex_lock(&deque->lock);
+
+    if (deque->count > 0) {
+        deque->count--;
+        job = deque->jobs[(deque->head + deque->count) % deque->capacity];
+    }
+
+    pthread_mutex_unlock(&deque->lock);
+    return job;
+}
+
+static Job* stealJob(Deque* deque) {
+    Job* job = NULL;
+    pthread_mutex_lock(&deque->lock);
+
+    if (deque->count > 0) {
+        job = deque->jobs[deque->head];
+        deque->head = (deque->head + 1) % deque->capacity;
+        deque->count--;
+    }
+
+    pthread_mutex_unlock(&deque->lock);
+    return job;
+}
+
+
+/*
++---------------------+
+| Jobs          ^^^^  |
++=====================+
+| Workers       vvvv  |
++---------------------+
+*/
+
+
+// Leaves a worker on its main stacks with nothing on them, whatever the last
+// job was doing when it stopped
+static void resetWorker(VM* vm) {
+    vm->fiber = NULL;
+    vm->frames = vm->mainFrames;
+    vm->frameMax = FRAME_MAX;
+    vm->stack = vm->mainStack;
+    vm->frameCount = 0;
+    vm->stackTop = vm->stack;
+    vm->nativeDepth = 0;
+    vm->yielding = false;
+}
+
+// Unpacks the fixed globals published since the worker last looked; names it
+// already has (its own natives, mostly) are left alone. The pool's list can
+// move as it grows, so only what's needed is copied out under its lock
+static void syncGlobals(Worker* worker) {
+    VM* vm = worker->vm;
+    WorkerPool* pool = worker->pool;
+
+    pthread_mutex_lock(&pool->lock);
+
+    int count = pool->globalCount - worker->synced;
+    SharedGlobal* fresh = NULL;
+
+    if (count > 0) {
+        fresh = malloc(count * sizeof(SharedGlobal));
+
+        if (fresh == NULL) {
+            exit(1);
+        }
+
+        memcpy(fresh, &pool->globals[worker->synced], count * sizeof(SharedGlobal));
+        worker->synced += count;
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+
+    // names and values are never changed or freed while the pool is open
+    for (int i = 0; i < count; i++) {
+        ObjString* key = copyString(vm, fresh[i].name, fresh[i].length);
+        push(vm, OBJ_VAL(key));
+
+        if (tableGetEntry(&vm->globals, key) == NULL && unpackValues(vm, &fresh[i].value, 1)) {
+            tableAddEntry(vm, &vm->globals, key, peek(vm, 0));
+            pop(vm);
+        }
+
+        pop(vm);
+    }
+
+    free(fresh);
+}
+
+// Sets the varying globals a job was packed with; any that couldn't be sent
+// are taken away, so using one is an error
+static bool setGlobals(VM* vm, Job* job) {
+    if (!unpackValues(vm, job->globals, 2)) {
+        return false;
+    }
+
+    ObjList* sent = AS_LIST(peek(vm, 1));
+    ObjList* dropped = AS_LIST(peek(vm, 0));
+
+    for (int i = 0; i < sent->array.count; i += 2) {
+        ObjString* key = AS_STRING(sent->array.values[i]);
+        Entry* entry = tableGetEntry(&vm->globals, key);
+
+        if (entry != NULL) {
+            entry->value = sent->array.values[i + 1];
+        }
+        else {
+            tableAddEntry(vm, &vm->globals, key, sent->array.values[i + 1]);
+        }
+    }
+
+    for (int i = 0; i < dropped->array.count; i++) {
+        tableDeleteEntry(&vm->globals, AS_STRING(dropped->array.values[i]));
+    }
+
+    pop(vm);
+    pop(vm);
+    return true;
+}
+
+static JobStatus runChunk(VM* vm, Job* job) {
+    if (!unpackValues(vm, &job->call, 2)) {
+        return JOB_SEND_FAILED;
+    }
+
+    Value fn = peek(vm, 1);
+    ObjList* inputs = AS_LIST(peek(vm, 0));
+
+    ObjList* results = newList(vm);
+    push(vm, OBJ_VAL(results));
+
+    for (int i = 0; i < inputs->array.count; i++) {
+        push(vm, fn);
+        push(vm, inputs->array.values[i]);
+
+        if (!callFromC(vm, fn, 1)) {
+            return JOB_CALL_FAILED;
+        }
+
+        writeValueArray(vm, &results->array, peek(vm, 0));
+        pop(vm);
+    }
+
+    Value out = OBJ_VAL(results);
+    return packValues(&job->result, &out, 1) ? JOB_OK : JOB_SEND_FAILED;
+}
+
+static JobStatus runCall(VM* vm, Job* job) {
+    if (!unpackValues(vm, &job->call, job->argc + 1)) {
+        return JOB_SEND_FAILED;
+    }
+
+    if (!callFromC(vm, vm->stack[0], job->argc)) {
+        return JOB_CALL_FAILED;
+    }
+
+    return packValues(&job->result, &vm->stackTop[-1], 1) ? JOB_OK : JOB_SEND_FAILED;
+}
+
+static void* workerMain(void* arg) {
+    Worker* worker = (Worker*)arg;
+    WorkerPool* pool = worker->pool;
+    int self = (int)(worker - pool->workers);
+
+    for (;;) {
+        Job* job = popJob(&worker->deque);
+        int count = atomic_load(&pool->count);
+
+        for (int i = 1; job == NULL && i < count; i++) {
+            job = stealJob(&pool->workers[(self + i) % count].deque);
+        }
+
+        pthread_mutex_lock(&pool->lock);
+
+        if (job == NULL) {
+            while (pool->queued == 0 && !pool->closing) {
+                pthread_cond_wait(&pool->wake, &pool->lock);
+            }
+
+            bool closing = pool->closing;
+            pthread_mutex_unlock(&pool->lock);
+
+            if (closing) {
+                return NULL;
+            }
+
+            continue;
+        }
+
+        pool->queued--;
+        pthread_mutex_unlock(&pool->lock);
+
+        resetWorker(worker->vm);
+        syncGlobals(worker);
+
+        JobStatus status = !setGlobals(worker->vm, job) ? JOB_SEND_FAILED
+            : job->kind == JOB_CHUNK ? runChunk(worker->vm, job)
+            : runCall(worker->vm, job);
+
+        resetWorker(worker->vm);
+        flushOutput(&worker->vm->output);
+
+        pthread_mutex_lock(&pool->lock);
+        job->status = status;
+        pthread_cond_broadcast(&pool->settled);
+        pthread_mutex_unlock(&pool->lock);
+
+        releaseJob(job);
+    }
+}
+
+// Worker VMs are malloc'd, since a pool can grow from any of its threads
+static void setUpWorker(WorkerPool* pool, Worker* worker) {
+    worker->vm = malloc(sizeof(VM));
+
+    if (worker->vm == NULL) {
+        exit(1);
+    }
+
+    worker->pool = pool;
+    worker->synced = 0;
+    worker->waitingOn = NULL;
+    worker->deque = (Deque){ .jobs = NULL, .capacity = 0, .head = 0, .count = 0 };
+    pthread_mutex_init(&worker->deque.lock, NULL);
+
+    initVM(worker->vm);
+    worker->vm->pool = pool;
+    worker->vm->isWorker = true;
+    worker->vm->isActive = true;
+}
+
+// Adds a worker when every one there is has blocked with jobs still queued,
+// so tasks waiting on each other can't starve the pool; needs the pool's lock
+static void growIfStuck(WorkerPool* pool) {
+    int count = atomic_load(&pool->count);
+
+    if (pool->closing || pool->queued == 0 || pool->blocked < count || count == POOL_MAX_WORKERS) {
+        return;
+    }
+
+    Worker* worker = &pool->workers[count];
+    setUpWorker(pool, worker);
+
+    // set up before anyone can try stealing from it
+    atomic_store(&pool->count, count + 1);
+    pthread_create(&worker->thread, NULL, workerMain, worker);
+}
+
+static WorkerPool* getPool(VM* vm) {
+    if (vm->pool == NULL) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        int count = cores < 1 ? 1 : cores > POOL_MAX_WORKERS ? POOL_MAX_WORKERS : (int)cores;
+
+        WorkerPool* pool = ALLOCATE(vm, 1, WorkerPool);
+        atomic_init(&pool->count, count);
+        pool->workers = ALLOCATE(vm, POOL_MAX_WORKERS, Worker);
+        pool->next = 0;
+        pool->queued = 0;
+        pool->blocked = 0;
+        pool->closing = false;
+        pthread_mutex_init(&pool->lock, NULL);
+        pthread_cond_init(&pool->wake, NULL);
+        pthread_cond_init(&pool->settled, NULL);
+
+        initTable(&pool->published);
+        pool->seenGlobals = 0;
+        pool->globalCount = 0;
+        pool->globalCapacity = 0;
+        pool->globals = NULL;
+
+        for (int i = 0; i < count; i++) {
+            setUpWorker(pool, &pool->workers[i]);
+        }
+
+        // every worker is set up before any of them starts looking for work
+        for (int i = 0; i < count; i++) {
+            pthread_create(&pool->workers[i].thread, NULL, workerMain, &pool->workers[i]);
+        }
+
+        vm->pool = pool;
+    }
+
+    return vm->pool;
+}
+
+void freeWorkerPool(VM* vm) {
+    WorkerPool* pool = vm->pool;
+
+    // workers only borrow the pool they belong to
+    if (pool == NULL || vm->isWorker) {
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->closing = true;
+    pthread_cond_broadcast(&pool->wake);
+
+    // the script is over, so a task blocked on a channel would wait forever;
+    // closing the channel sends it on its way
+    for (int i = 0; i < atomic_load(&pool->count); i++) {
+        if (pool->workers[i].waitingOn != NULL) {
+            closeRing(pool->workers[i].waitingOn);
+        }
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+
+    // nothing is added once it's closing
+    int count = atomic_load(&pool->count);
+
+    for (int i = 0; i < count; i++) {
+        pthread_join(pool->workers[i].thread, NULL);
+    }
+
+    for (int i = 0; i < count; i++) {
+        Worker* worker = &pool->workers[i];
+        Job* job;
+
+        // jobs nobody got to
+        while ((job = popJob(&worker->deque)) != NULL) {
+            releaseJob(job);
+        }
+
+        free(worker->deque.jobs);
+        pthread_mutex_destroy(&worker->deque.lock);
+        freeVM(worker->vm);
+        free(worker->vm);
+    }
+
+    for (int i = 0; i < pool->globalCount; i++) {
+        free(pool->globals[i].name);
+        freeParcel(&pool->globals[i].value);
+    }
+
+    free(pool->globals);
+    freeTable(vm, &pool->published);
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->wake);
+    pthread_cond_destroy(&pool->settled);
+    FREE_ARRAY(vm, pool->workers, POOL_MAX_WORKERS, Worker);
+    FREE(vm, pool, WorkerPool);
+    vm->pool = NULL;
+}
+
+
+/*
++---------------------+
+| Workers       ^^^^  |
++=====================+
+| Scheduling    vvvv  |
++---------------------+
+*/
+
+
+// Whether nothing reached through 'value' can be changed once it's made
+static bool isFixed(Value value) {
+    return !IS_OBJ(value) || IS_STRING(value) || IS_NATIVE(value) || IS_FUNC(value);
+}
+
+// Packs the fixed globals defined since the last job for good; the varying
+// ones are left to the jobs that name them
+static void sortNewGlobals(VM* vm, WorkerPool* pool) {
+    if (vm->globals.count == pool->seenGlobals) {
+        return;
+    }
+
+    pool->seenGlobals = vm->globals.count;
+
+    for (int i = 0; i < vm->globals.capacity; i++) {
+        Entry* entry = &vm->globals.entries[i];
+
+        if (entry->key == NULL || tableGetEntry(&pool->published, entry->key) != NULL) {
+            continue;
+        }
+
+        tableAddEntry(vm, &pool->published, entry->key, BOOL_VAL(true));
+
+        if (!isFixed(entry->value)) {
+            continue;
+        }
+
+        SharedGlobal global;
+        global.length = entry->key->length;
+        global.name = malloc(global.length);
+        initParcel(&global.value);
+
+        if (global.name == NULL) {
+            exit(1);
+        }
+
+        memcpy(global.name, entry->key->chars, global.length);
+
+        // globals that can't be sent are left out, so using one on a worker
+        // is an error there
+        if (!packValues(&global.value, &entry->value, 1)) {
+            free(global.name);
+            freeParcel(&global.value);
+            continue;
+        }
+
+        pthread_mutex_lock(&pool->lock);
+
+        if (pool->globalCount == pool->globalCapacity) {
+            pool->globalCapacity = GROW_CAP(pool->globalCapacity);
+            pool->globals = realloc(pool->globals, pool->globalCapacity * sizeof(SharedGlobal));
+
+            if (pool->globals == NULL) {
+                exit(1);
+            }
+        }
+
+        pool->globals[pool->globalCount++] = global;
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+// Notes in 'names' each global that 'function', or a function nested in it,
+// could read, as true when it's varying. Fixed functions aren't packed with
+// the job, so the globals they name are looked for here
+static void nameGlobals(VM* vm, ObjFunction* function, Table* names) {
+    ValueArray* constants = &function->body.constants;
+
+    for (int i = 0; i < constants->count; i++) {
+        Value constant = constants->values[i];
+
+        if (IS_FUNC(constant)) {
+            nameGlobals(vm, AS_FUNC(constant), names);
+            continue;
+        }
+
+        // any string constant might be read as a global, so some are named
+        // that never will be
+        if (!IS_STRING(constant) || tableGetEntry(names, AS_STRING(constant)) != NULL) {
+            continue;
+        }
+
+        Entry* global = tableGetEntry(&vm->globals, AS_STRING(constant));
+
+        if (global == NULL) {
+            continue;
+        }
+
+        bool fixed = isFixed(global->value);
+        tableAddEntry(vm, names, AS_STRING(constant), BOOL_VAL(!fixed));
+
+        if (fixed && IS_FUNC(global->value)) {
+            nameGlobals(vm, AS_FUNC(global->value), names);
+        }
+    }
+}
+
+static void listNamed(VM* vm, Table* names, ObjList* sent, ObjList* dropped, bool probe) {
+    for (int i = 0; i < names->capacity; i++) {
+        Entry* name = &names->entries[i];
+
+        if (name->key == NULL || !AS_BOOL(name->value)) {
+            continue;
+        }
+
+        Value value = tableGetEntry(&vm->globals, name->key)->value;
+        Parcel parcel;
+        initParcel(&parcel);
+
+        if (!probe || packValues(&parcel, &value, 1)) {
+            writeValueArray(vm, &sent->array, OBJ_VAL(name->key));
+            writeValueArray(vm, &sent->array, value);
+        }
+        else {
+            writeValueArray(vm, &dropped->array, OBJ_VAL(name->key));
+        }
+
+        freeParcel(&parcel);
+    }
+}
+
+// Packs the varying globals in 'names', each after its name, then a list of
+// the names of those that can't be sent
+static void packNamed(VM* vm, Table* names, Parcel* parcel, PackedCode* code) {
+    ObjList* sent = newList(vm);
+    push(vm, OBJ_VAL(sent));
+    ObjList* dropped = newList(vm);
+    push(vm, OBJ_VAL(dropped));
+
+    listNamed(vm, names, sent, dropped, false);
+
+    if (!packValuesWithCode(parcel, &vm->stackTop[-2], 2, code)) {
+        // find the ones at fault, then pack the rest
+        sent->array.count = 0;
+        listNamed(vm, names, sent, dropped, true);
+
+        freeParcel(parcel);
+        initParcel(parcel);
+        packValuesWithCode(parcel, &vm->stackTop[-2], 2, code);
+    }
+
+    pop(vm);
+    pop(vm);
+}
+
+// Packs into 'parcel' what the varying globals named by the code already
+// packed in 'code' hold now. Their values can hold code naming yet more of
+// them, so it's packed again until no new names turn up
+static void packGlobals(VM* vm, WorkerPool* pool, PackedCode* code, Parcel* parcel) {
+    sortNewGlobals(vm, pool);
+
+    Table names;
+    initTable(&names);
+
+    int own = code->count;
+
+    for (int i = 0; i < own; i++) {
+        nameGlobals(vm, code->functions[i], &names);
+    }
+
+    for (;;) {
+        int known = names.count;
+
+        freeParcel(parcel);
+        code->count = own;
+        packNamed(vm, &names, parcel, code);
+
+        for (int i = own; i < code->count; i++) {
+            nameGlobals(vm, code->functions[i], &names);
+        }
+
+        if (names.count == known) {
+            break;
+        }
+    }
+
+    freeTable(vm, &names);
+}
+
+static void submitJob(WorkerPool* pool, Job* job) {
+    pushJob(&pool->workers[pool->next].deque, job);
+    pool->next = (pool->next + 1) % atomic_load(&pool->count);
+
+    pthread_mutex_lock(&pool->lock);
+    pool->queued++;
+    growIfStuck(pool);
+    pthread_cond_signal(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+// Needs the pool's lock
+static Worker* findWorker(WorkerPool* pool, VM* vm) {
+    int count = atomic_load(&pool->count);
+
+    for (int i = 0; i < count; i++) {
+        if (pool->workers[i].vm == vm) {
+            return &pool->workers[i];
+        }
+    }
+
+    return NULL;
+}
+
+// Brackets a worker waiting on a channel's ring, which may never be woken; the
+// calling thread isn't part of the pool, so it doesn't count. False once the
+// pool is closing, since nothing will be left to wake it
+bool enterBlocking(VM* vm, Ring* ring) {
+    if (!vm->isWorker) {
+        return true;
+    }
+
+    WorkerPool* pool = vm->pool;
+
+    pthread_mutex_lock(&pool->lock);
+
+    bool closing = pool->closing;
+
+    if (!closing) {
+        findWorker(pool, vm)->waitingOn = ring;
+        pool->blocked++;
+        growIfStuck(pool);
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+    return !closing;
+}
+
+void leaveBlocking(VM* vm) {
+    if (!vm->isWorker) {
+        return;
+    }
+
+    WorkerPool* pool = vm->pool;
+
+    pthread_mutex_lock(&pool->lock);
+    findWorker(pool, vm)->waitingOn = NULL;
+    pool->blocked--;
+    pthread_mutex_unlock(&pool->lock);
+}
+
+// Whether 'vm' is a worker being shut down with the script it ran for
+bool poolClosing(VM* vm) {
+    if (!vm->isWorker) {
+        return false;
+    }
+
+    pthread_mutex_lock(&vm->pool->lock);
+    bool closing = vm->pool->closing;
+    pthread_mutex_unlock(&vm->pool->lock);
+
+    return closing;
+}
+
+static JobStatus waitForJob(WorkerPool* pool, Job* job) {
+    pthread_mutex_lock(&pool->lock);
+
+    while (job->status == JOB_PENDING) {
+        pthread_cond_wait(&pool->settled, &pool->lock);
+    }
+
+    JobStatus status = job->status;
+    pthread_mutex_unlock(&pool->lock);
+    return status;
+}
+
+
+/*
++---------------------+
+| Scheduling    ^^^^  |
++=====================+
+| NativeFns     vvvv  |
++---------------------+
+*/
+
+
+static bool mapHere(VM* vm, int argc, Value f, Value seq) {
+    ObjList* results = newList(vm);
+    push(vm, OBJ_VAL(results));
+
+    for (int i = 0; i < seqLength(seq); i++) {
+        push(vm, f);
+        push(vm, seqAt(seq, i));
+
+        if (!callFromC(vm, f, 1)) {
+            return false;
+        }
+
+        writeValueArray(vm, &results->array, peek(vm, 0));
+        pop(vm);
+    }
+
+    returnNative(vm, argc, pop(vm));
+    return true;
+}
+
+// Collects the chunks of a pmap$ in order, or raises the first failure. Every
+// chunk is waited on first, since they all read the globals packed for them
+static bool gatherChunks(VM* vm, WorkerPool* pool, Job** jobs, int chunks) {
+    for (int i = 0; i < chunks; i++) {
+        waitForJob(pool, jobs[i]);
+    }
+
+    for (int i = 0; i < chunks; i++) {
+        switch (jobs[i]->status) {
+            case JOB_SEND_FAILED:
+                runtimeError(vm, "pmap$ : Cannot send fibers or futures between workers");
+                return false;
+            case JOB_CALL_FAILED:
+                runtimeError(vm, "pmap$ : Function raised an error on a worker");
+                return false;
+            default:
+                break;
+        }
+    }
+
+    ObjList* results = newList(vm);
+    push(vm, OBJ_VAL(results));
+
+    for (int i = 0; i < chunks; i++) {
+        unpackValues(vm, &jobs[i]->result, 1);
+
+        ObjList* chunk = AS_LIST(peek(vm, 0));
+
+        for (int j = 0; j < chunk->array.count; j++) {
+            writeValueArray(vm, &results->array, chunk->array.values[j]);
+        }
+
+        pop(vm);
+    }
+
+    return true;
+}
+
+// Like map$, but the list is split across worker threads; 'f' and anything it
+// reaches through globals or upvalues is copied to each worker, so changes it
+// makes to shared state aren't seen by the caller
+bool pmapNative(VM* vm, int argc, Value* argv) {
+    if (!IS_CALLABLE(argv[0])) {
+        runtimeError(vm, "pmap$ : Expected callable, got %s", getValName(argv[0]));
+        return false;
+    }
+
+    if (IS_ITERATOR(argv[1]) || IS_FIBER(argv[1])) {
+        ObjList* list = drainIterator(vm, argv[1]);
+
+        if (list == NULL) {
+            return false;
+        }
+
+        argv[1] = OBJ_VAL(list);
+    }
+
+    if (!isSequence(argv[1])) {
+        runtimeError(vm, "pmap$ : Expected sequence, got %s", getValName(argv[1]));
+        return false;
+    }
+
+    Value f = argv[0];
+    Value seq = argv[1];
+    int length = seqLength(seq);
+
+    // workers run their chunk sequentially rather than waiting on themselves
+    if (vm->isWorker || length < PMAP_MIN_CHUNK * 2) {
+        return mapHere(vm, argc, f, seq);
+    }
+
+    WorkerPool* pool = getPool(vm);
+
+    int chunks = length / PMAP_MIN_CHUNK;
+    if (chunks > pool->count) {
+        chunks = pool->count;
+    }
+
+    Job* jobs[POOL_MAX_WORKERS];
+    PackedCode code;
+    Parcel globals;
+    initPackedCode(&code);
+    initParcel(&globals);
+
+    for (int i = 0; i < chunks; i++) {
+        int start = (int)((long long)length * i / chunks);
+        int end = (int)((long long)length * (i + 1) / chunks);
+
+        ObjList* inputs = newList(vm);
+        push(vm, OBJ_VAL(inputs));
+
+        for (int j = start; j < end; j++) {
+            push(vm, seqAt(seq, j));
+            writeValueArray(vm, &inputs->array, peek(vm, 0));
+            pop(vm);
+        }
+
+        Value sent[2] = { f, OBJ_VAL(inputs) };
+        jobs[i] = newJob(JOB_CHUNK);
+        jobs[i]->globals = &globals;
+
+        bool packed = packValuesWithCode(&jobs[i]->call, sent, 2, &code);
+        pop(vm);
+
+        if (!packed) {
+            for (int j = 0; j <= i; j++) {
+                releaseJob(jobs[j]);
+                releaseJob(jobs[j]);
+            }
+
+            freePackedCode(&code);
+            runtimeError(vm, "pmap$ : Cannot send fibers or futures between workers");
+            return false;
+        }
+    }
+
+    packGlobals(vm, pool, &code, &globals);
+    freePackedCode(&code);
+
+    // anything printed before the call comes out before what the workers print
+    flushOutput(&vm->output);
+
+    for (int i = 0; i < chunks; i++) {
+        submitJob(pool, jobs[i]);
+    }
+
+    bool ok = gatherChunks(vm, pool, jobs, chunks);
+
+    for (int i = 0; i < chunks; i++) {
+        releaseJob(jobs[i]);
+    }
+
+    freeParcel(&globals);
+
+    if (!ok) {
+        return false;
+    }
+
+    returnNative(vm, argc, pop(vm));
+    return true;
+}
+
+// Runs f(args...) on the pool and returns a future for the result; inside a
+// worker the call is made straight away instead
+bool spawnNative(VM* vm, int argc, Value* argv) {
+    if (!IS_CALLABLE(argv[0])) {
+        runtimeError(vm, "spawn$ : Expected callable, got %s", getValName(argv[0]));
+        return false;
+    }
+
+    if (vm->isWorker) {
+        for (int i = 0; i < argc; i++) {
+            push(vm, argv[i]);
+        }
+
+        if (!callFromC(vm, argv[0], argc - 1)) {
+            return false;
+        }
+
+        ObjFuture* future = newFuture(vm, NULL);
+        future->value = pop(vm);
+
+        returnNative(vm, argc, OBJ_VAL(future));
+        return true;
+    }
+
+    Job* job = newJob(JOB_CALL);
+    job->argc = argc - 1;
+
+    PackedCode code;
+    initPackedCode(&code);
+
+    if (!packValuesWithCode(&job->call, argv, argc, &code)) {
+        freePackedCode(&code);
+        releaseJob(job);
+        releaseJob(job);
+        runtimeError(vm, "spawn$ : Cannot send fibers or futures to a task");
+        return false;
+    }
+
+    WorkerPool* pool = getPool(vm);
+    packGlobals(vm, pool, &code, &job->ownGlobals);
+    freePackedCode(&code);
+
+    ObjFuture* future = newFuture(vm, job);
+    flushOutput(&vm->output);
+    submitJob(pool, job);
+
+    returnNative(vm, argc, OBJ_VAL(future));
+    return true;
+}
+
+// Blocks until the task behind a future is done and returns its result
+bool awaitNative(VM* vm, int argc, Value* argv) {
+    if (!IS_FUTURE(argv[0])) {
+        runtimeError(vm, "await$ : Expected future, got %s", getValName(argv[0]));
+        return false;
+    }
+
+    ObjFuture* future = AS_FUTURE(argv[0]);
+
+    if (future->job != NULL) {
+        flushOutput(&vm->output);
+
+        switch (waitForJob(vm->pool, future->job)) {
+            case JOB_SEND_FAILED:
+                runtimeError(vm, "await$ : Cannot return fibers or futures from a task");
+                return false;
+            case JOB_CALL_FAILED:
+                runtimeError(vm, "await$ : Task raised an error");
+                return false;
+            default:
+                break;
+        }
+
+        unpackValues(vm, &future->job->result, 1);
+        future->value = pop(vm);
+
+        releaseJob(future->job);
+        future->job = NULL;
+    }
+
+    returnNative(vm, argc, future->value);
+    return true;
+}
+
+void defineParallel(VM* vm) {
+    defineNative(vm, "pmap", pmapNative, 2);
+    defineNative(vm, "spawn", spawnNative, -2);
+    defineNative(vm, "await", awaitNative, 1);
+}
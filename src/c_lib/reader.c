@@ -0,0 +1,216 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "builtins.h"
+#include "../vm.h"
+#include "../debug.h"
+#include "../memory.h"
+
+#define READER_BLOCK_SIZE 65536
+#define READER_MIN_BLOCK 64
+#define READER_MAX_BLOCK (1 << 28)
+
+
+// Starts a new block holding the unfinished record, with room to read more
+// after it; the old block lives on for as long as records view it
+static void nextBlock(VM* vm, ObjReader* reader) {
+    int partial = reader->end - reader->start;
+    int size = reader->blockSize;
+
+    // a record longer than a block gets a block of its own
+    while (size - partial < reader->blockSize / 2 && size < READER_MAX_BLOCK) {
+        size *= 2;
+    }
+
+    ObjMapping* block = newBlock(vm, size);
+
+    if (partial > 0) {
+        memcpy(block->bytes, reader->block->bytes + reader->start, partial);
+    }
+
+    reader->block = block;
+    reader->start = 0;
+    reader->end = partial;
+}
+
+// Reads whatever's ready into the current block, which needs room for it
+static bool fill(VM* vm, ObjReader* reader) {
+    // anything printed before waiting on input should be seen first
+    flushOutput(&vm->output);
+
+    for (;;) {
+        ssize_t got = read(reader->fd, reader->block->bytes + reader->end, reader->block->length - reader->end);
+
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (got < 0) {
+            return false;
+        }
+
+        if (got == 0) {
+            reader->atEnd = true;
+        }
+
+        reader->end += (int)got;
+        return true;
+    }
+}
+
+// Reads more after what's pending, moving it to a new block first if this one
+// is full
+bool readMore(VM* vm, ObjReader* reader) {
+    if (reader->block == NULL || reader->end == reader->block->length) {
+        nextBlock(vm, reader);
+    }
+
+    if (!fill(vm, reader)) {
+        runtimeError(vm, "readLine$ : %s", strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
+ReadResult readRecord(VM* vm, ObjReader* reader, Value* out) {
+    if (reader->csv) {
+        return readRow(vm, reader, out);
+    }
+
+    int scanned = 0;    // of the pending bytes, those known to have no delimiter
+
+    for (;;) {
+        if (reader->block != NULL) {
+            char* from = reader->block->bytes + reader->start;
+            int pending = reader->end - reader->start;
+            char* delimiter = memchr(from + scanned, reader->delimiter, pending - scanned);
+
+            if (delimiter != NULL) {
+                int length = (int)(delimiter - from);
+                *out = OBJ_VAL(newMappedString(vm, reader->block, reader->start, length));
+                reader->start += length + 1;
+                return READ_RECORD;
+            }
+
+            if (reader->atEnd) {
+                if (pending == 0) {
+                    return READ_END;
+                }
+
+                // the last record needn't end with a delimiter
+                *out = OBJ_VAL(newMappedString(vm, reader->block, reader->start, pending));
+                reader->start = reader->end;
+                return READ_RECORD;
+            }
+
+            scanned = pending;
+        }
+
+        if (!readMore(vm, reader)) {
+            return READ_FAILED;
+        }
+    }
+}
+
+// Opens a path, or wraps an fd like 0 for stdin; NULL once an error's raised
+ObjReader* openReader(VM* vm, Value source, char delimiter, int blockSize, const char* name) {
+    int fd;
+    bool owned = false;
+
+    if (IS_INT(source)) {
+        fd = (int)AS_INT(source);
+    }
+    else if (IS_STRING(source)) {
+        ObjString* path = AS_STRING(source);
+        char* cpath = toCString(vm, path);
+        fd = open(cpath, O_RDONLY | O_CLOEXEC);
+        int error = errno;
+
+        freeCString(vm, cpath, path);
+
+        if (fd < 0) {
+            runtimeError(vm, "%s$ : Could not open '%.*s': %s", name, path->length, path->chars, strerror(error));
+            return NULL;
+        }
+
+        owned = true;
+    }
+    else {
+        runtimeError(vm, "%s$ : Expected path or fd, got %s", name, getValName(source));
+        return NULL;
+    }
+
+    return newReader(vm, fd, owned, delimiter, blockSize);
+}
+
+// reader(source), reader(source ; delimiter) or reader(source ; delimiter ;
+// blockSize); the source is a path or an fd, like 0 for stdin. Records are
+// split on '\n' unless told otherwise, and can be walked like an iterator
+bool readerNative(VM* vm, int argc, Value* argv) {
+    if (argc > 3) {
+        runtimeError(vm, "reader$ : Expected at most 3 args, got %d", argc);
+        return false;
+    }
+
+    char delimiter = '\n';
+    long long blockSize = READER_BLOCK_SIZE;
+
+    if (argc > 1) {
+        if (!IS_CHAR(argv[1])) {
+            runtimeError(vm, "reader$ : Expected char delimiter, got %s", getValName(argv[1]));
+            return false;
+        }
+
+        delimiter = AS_CHAR(argv[1]);
+    }
+
+    if (argc > 2) {
+        if (!IS_INT(argv[2]) || AS_INT(argv[2]) < READER_MIN_BLOCK || AS_INT(argv[2]) > READER_MAX_BLOCK) {
+            runtimeError(vm, "reader$ : Expected block size between %d and %d", READER_MIN_BLOCK, READER_MAX_BLOCK);
+            return false;
+        }
+
+        blockSize = AS_INT(argv[2]);
+    }
+
+    ObjReader* reader = openReader(vm, argv[0], delimiter, (int)blockSize, "reader");
+
+    if (reader == NULL) {
+        return false;
+    }
+
+    returnNative(vm, argc, OBJ_VAL(reader));
+    return true;
+}
+
+// The next record, or () once the input runs out
+bool readLineNative(VM* vm, int argc, Value* argv) {
+    if (!IS_READER(argv[0])) {
+        runtimeError(vm, "readLine$ : Expected reader, got %s", getValName(argv[0]));
+        return false;
+    }
+
+    Value record;
+
+    switch (readRecord(vm, AS_READER(argv[0]), &record)) {
+        case READ_RECORD:
+            returnNative(vm, argc, record);
+            return true;
+        case READ_END:
+            returnNative(vm, argc, UNIT_VAL);
+            return true;
+        case READ_FAILED:
+        default:
+            return false;
+    }
+}
+
+void defineReaders(VM* vm) {
+    defineNative(vm, "reader", readerNative, -2);
+    defineNative(vm, "readLine", readLineNative, 1);
+}
@@ -0,0 +1,126 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "builtins.h"
+#include "../vm.h"
+#include "../debug.h"
+#include "../memory.h"
+#include "../transfer.h"
+
+
+static bool writeImage(VM* vm, ObjString* path, const Parcel* parcel) {
+    char* cpath = toCString(vm, path);
+    int fd = open(cpath, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    int error = errno;
+
+    freeCString(vm, cpath, path);
+
+    if (fd < 0) {
+        runtimeError(vm, "serialise$ : Could not open '%.*s': %s", path->length, path->chars, strerror(error));
+        return false;
+    }
+
+    size_t written = 0;
+
+    while (written < parcel->count) {
+        ssize_t done = write(fd, parcel->bytes + written, parcel->count - written);
+
+        if (done < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (done < 0) {
+            error = errno;
+            close(fd);
+            runtimeError(vm, "serialise$ : %s", strerror(error));
+            return false;
+        }
+
+        written += done;
+    }
+
+    close(fd);
+    return true;
+}
+
+// serialise(value) gives the image as a string; serialise(value ; path)
+// writes it to a file instead. Shared parts and cycles are kept as they are
+bool serialiseNative(VM* vm, int argc, Value* argv) {
+    if (argc > 2) {
+        runtimeError(vm, "serialise$ : Expected at most 2 args, got %d", argc);
+        return false;
+    }
+
+    if (argc > 1 && !IS_STRING(argv[1])) {
+        runtimeError(vm, "serialise$ : Expected path, got %s", getValName(argv[1]));
+        return false;
+    }
+
+    Parcel parcel;
+    initParcel(&parcel);
+
+    if (!packImage(&parcel, argv[0])) {
+        freeParcel(&parcel);
+        runtimeError(vm, "serialise$ : Only plain data can be serialised, not code, channels or fibers");
+        return false;
+    }
+
+    Value result = UNIT_VAL;
+
+    if (argc > 1) {
+        if (!writeImage(vm, AS_STRING(argv[1]), &parcel)) {
+            freeParcel(&parcel);
+            return false;
+        }
+    }
+    else {
+        result = OBJ_VAL(copyString(vm, (const char*)parcel.bytes, parcel.count));
+    }
+
+    freeParcel(&parcel);
+
+    returnNative(vm, argc, result);
+    return true;
+}
+
+// Reads back what serialise$ wrote. Strings are interned as they're made; an
+// image from mapFile$ lends big arrays their numbers straight from the mapping
+bool deserialiseNative(VM* vm, int argc, Value* argv) {
+    if (!IS_STRING(argv[0])) {
+        runtimeError(vm, "deserialise$ : Expected string, got %s", getValName(argv[0]));
+        return false;
+    }
+
+    ObjString* image = AS_STRING(argv[0]);
+    ObjMapping* mapping = image->owner != NULL && image->owner->type == OBJ_MAPPING
+        ? (ObjMapping*)image->owner
+        : NULL;
+    int version = 0;
+
+    switch (unpackImage(vm, (const uint8_t*)image->chars, image->length, mapping, &version)) {
+        case IMAGE_OK:
+            break;
+        case IMAGE_NOT_IMAGE:
+            runtimeError(vm, "deserialise$ : Not a serialised value");
+            return false;
+        case IMAGE_WRONG_VERSION:
+            runtimeError(vm, "deserialise$ : Image is format %d, or from a machine of another byte order; expected %d", version, IMAGE_VERSION);
+            return false;
+        case IMAGE_CORRUPT:
+        default:
+            runtimeError(vm, "deserialise$ : Image is corrupt");
+            return false;
+    }
+
+    returnNative(vm, argc, pop(vm));
+    return true;
+}
+
+void defineSerial(VM* vm) {
+    defineNative(vm, "serialise", serialiseNative, -2);
+    defineNative(vm, "deserialise", deserialiseNative, 1);
+}
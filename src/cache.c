@@ -0,0 +1,315 @@
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "compiler.h"
+#include "transfer.h"
+
+#define CACHE_PATH_MAX 4096
+// Every edited script and every rebuild of hmc leaves an entry nothing will
+// ask for again, so the cache is pruned back to these whenever one is stored
+#define CACHE_MAX_BYTES (64LL * 1024 * 1024)
+#define CACHE_MAX_AGE (30 * 24 * 60 * 60)
+// A temporary this old belongs to a run that died before renaming it
+#define CACHE_TEMPORARY_AGE (60 * 60)
+
+
+// Two independent 64-bit hashes, so telling sources apart never hinges on
+// one of them; the build goes in first, so a new build misses every entry
+typedef struct {
+    uint64_t a;
+    uint64_t b;
+} CacheKey;
+
+static void hashBytes(CacheKey* key, const char* bytes, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        uint8_t byte = (uint8_t)bytes[i];
+
+        key->a = (key->a ^ byte) * 0x100000001b3ULL;
+        key->b = (key->b + byte + 1) * 0x9e3779b97f4a7c15ULL;
+        key->b ^= key->b >> 29;
+    }
+}
+
+// The version string stays the same across rebuilds, and the image formats
+// only change when someone remembers to bump them, so neither tells builds
+// apart; the executable itself does. Where it can't be found, the time this
+// file was compiled stands in
+static void hashBuild(CacheKey* key) {
+    struct stat info;
+
+    if (stat("/proc/self/exe", &info) == 0) {
+        long long identity[4] = {
+            (long long)info.st_ino, (long long)info.st_size,
+            (long long)info.st_mtim.tv_sec, (long long)info.st_mtim.tv_nsec
+        };
+
+        hashBytes(key, (const char*)identity, sizeof(identity));
+    }
+    else {
+        const char* built = __DATE__ " " __TIME__;
+        hashBytes(key, built, strlen(built) + 1);
+    }
+}
+
+static CacheKey makeKey(const char* source, size_t length, const char* version) {
+    CacheKey key = { 0xcbf29ce484222325ULL, 0x84222325cbf29ce4ULL };
+    uint32_t formats[2] = { IMAGE_VERSION, BYTECODE_VERSION };
+
+    hashBuild(&key);
+    hashBytes(&key, version, strlen(version) + 1);
+    hashBytes(&key, (const char*)formats, sizeof(formats));
+    hashBytes(&key, source, length);
+
+    return key;
+}
+
+// Fills in the cache directory, making it if it isn't there yet
+static bool cacheDirectory(char* path, size_t size) {
+    const char* base = getenv("XDG_CACHE_HOME");
+    int written;
+
+    if (base != NULL && base[0] == '/') {
+        written = snprintf(path, size, "%s", base);
+    }
+    else {
+        const char* home = getenv("HOME");
+
+        if (home == NULL || home[0] == '\0') {
+            return false;
+        }
+
+        written = snprintf(path, size, "%s/.cache", home);
+    }
+
+    if (written < 0 || (size_t)written >= size) {
+        return false;
+    }
+
+    if (mkdir(path, 0755) < 0 && errno != EEXIST) {
+        return false;
+    }
+
+    written = snprintf(path + written, size - written, "/hammer");
+
+    if (written < 0 || strlen(path) + 1 >= size) {
+        return false;
+    }
+
+    return mkdir(path, 0755) == 0 || errno == EEXIST;
+}
+
+// Pushes the script cached at 'path', if there is one and it loads
+static bool loadEntry(VM* vm, const char* path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat info;
+
+    if (fd < 0) {
+        return false;
+    }
+
+    if (fstat(fd, &info) < 0 || info.st_size == 0) {
+        close(fd);
+        return false;
+    }
+
+    size_t length = (size_t)info.st_size;
+    void* bytes = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (bytes == MAP_FAILED) {
+        return false;
+    }
+
+    int version = 0;
+    bool ok = unpackCode(vm, bytes, length, &version) == IMAGE_OK;
+    munmap(bytes, length);
+
+    // entries are pruned oldest first, so one in use is kept fresh
+    if (ok) {
+        utimensat(AT_FDCWD, path, NULL, 0);
+    }
+
+    return ok;
+}
+
+// Written beside the entry and renamed into place, so a run that reads it
+// at the same time sees all of it or none of it
+static void storeEntry(const char* path, ObjFunction* script) {
+    char temporary[CACHE_PATH_MAX];
+    int written = snprintf(temporary, sizeof(temporary), "%s.%d", path, (int)getpid());
+
+    if (written < 0 || (size_t)written >= sizeof(temporary)) {
+        return;
+    }
+
+    Parcel parcel;
+    initParcel(&parcel);
+
+    if (!packCode(&parcel, script)) {
+        freeParcel(&parcel);
+        return;
+    }
+
+    int fd = open(temporary, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    bool ok = fd >= 0;
+    size_t done = 0;
+
+    while (ok && done < parcel.count) {
+        ssize_t n = write(fd, parcel.bytes + done, parcel.count - done);
+
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+
+        ok = n > 0;
+        done += ok ? (size_t)n : 0;
+    }
+
+    if (fd >= 0) {
+        ok = close(fd) == 0 && ok;
+    }
+
+    if (!ok || rename(temporary, path) < 0) {
+        unlink(temporary);
+    }
+
+    freeParcel(&parcel);
+}
+
+typedef struct {
+    char name[48];
+    time_t used;
+    long long size;
+} CacheFile;
+
+static int compareUse(const void* a, const void* b) {
+    time_t x = ((const CacheFile*)a)->used;
+    time_t y = ((const CacheFile*)b)->used;
+    return (x > y) - (x < y);
+}
+
+// Drops entries not used for CACHE_MAX_AGE, then the least recently used
+// until the rest fit in CACHE_MAX_BYTES; 'keep' is the entry just stored
+static void pruneCache(const char* directory, const char* keep) {
+    DIR* dir = opendir(directory);
+
+    if (dir == NULL) {
+        return;
+    }
+
+    int fd = dirfd(dir);
+    time_t now = time(NULL);
+    CacheFile* files = NULL;
+    int count = 0;
+    int capacity = 0;
+    long long total = 0;
+    struct dirent* item;
+
+    while ((item = readdir(dir)) != NULL) {
+        const char* name = item->d_name;
+        const char* suffix = strstr(name, ".o");
+        struct stat info;
+
+        if (suffix == NULL || strlen(name) >= sizeof(files->name) || strcmp(name, keep) == 0 ||
+            fstatat(fd, name, &info, AT_SYMLINK_NOFOLLOW) < 0 || !S_ISREG(info.st_mode)) {
+            continue;
+        }
+
+        // "<key>.o.<pid>" is a store that's still going, or never finished
+        if (suffix[2] != '\0') {
+            if (now - info.st_mtime > CACHE_TEMPORARY_AGE) {
+                unlinkat(fd, name, 0);
+            }
+
+            continue;
+        }
+
+        if (now - info.st_mtime > CACHE_MAX_AGE) {
+            unlinkat(fd, name, 0);
+            continue;
+        }
+
+        if (count == capacity) {
+            capacity = capacity < 64 ? 64 : capacity * 2;
+            CacheFile* grown = realloc(files, sizeof(CacheFile) * capacity);
+
+            if (grown == NULL) {
+                break;
+            }
+
+            files = grown;
+        }
+
+        strcpy(files[count].name, name);
+        files[count].used = info.st_mtime;
+        files[count].size = (long long)info.st_size;
+        total += files[count].size;
+        count++;
+    }
+
+    if (total > CACHE_MAX_BYTES) {
+        qsort(files, count, sizeof(CacheFile), compareUse);
+
+        for (int i = 0; i < count && total > CACHE_MAX_BYTES; i++) {
+            if (unlinkat(fd, files[i].name, 0) == 0) {
+                total -= files[i].size;
+            }
+        }
+    }
+
+    free(files);
+    closedir(dir);
+}
+
+InterpretResult interpretCached(VM* vm, const char* source, const char* version) {
+    #ifdef DEBUG_DISPLAY_PROGRAM
+    // the listing comes from the compiler, so debug builds always compile
+    return interpret(vm, source);
+    #endif
+
+    char path[CACHE_PATH_MAX];
+
+    if (!cacheDirectory(path, sizeof(path))) {
+        return interpret(vm, source);
+    }
+
+    CacheKey key = makeKey(source, strlen(source), version);
+    size_t length = strlen(path);
+    int written = snprintf(path + length, sizeof(path) - length, "/%016llx%016llx.o",
+                           (unsigned long long)key.a, (unsigned long long)key.b);
+
+    if (written < 0 || (size_t)written >= sizeof(path) - length) {
+        return interpret(vm, source);
+    }
+
+    vm->isActive = false;
+
+    if (loadEntry(vm, path)) {
+        return interpretCompiled(vm, AS_FUNC(pop(vm)));
+    }
+
+    ObjFunction* script = compile(source, vm);
+
+    if (script == NULL) {
+        return INTERPRET_COMPILATION_ERROR;
+    }
+
+    storeEntry(path, script);
+
+    // splits the path into the directory and the entry's name
+    path[length] = '\0';
+    pruneCache(path, path + length + 1);
+
+    return interpretCompiled(vm, script);
+}
@@ -0,0 +1,14 @@
+#ifndef cache_h_hammer
+#define cache_h_hammer
+
+#include "common.h"
+#include "vm.h"
+
+// Compiled scripts are kept as code images in $XDG_CACHE_HOME/hammer (or
+// ~/.cache/hammer), named for a hash of the source, 'version' and the build of
+// hmc running it, so a script that hasn't changed is only compiled the first
+// time a given build runs it. Anything wrong with the cache just means
+// compiling as if it weren't there
+InterpretResult interpretCached(VM* vm, const char* source, const char* version);
+
+#endif
@@ -13,6 +13,8 @@ void initChunk(Chunk* chunk)
     chunk->code = NULL;
     chunk->lines = NULL;
     initValueArray(&chunk->constants);
+    chunk->cacheCount = 0;
+    chunk->caches = NULL;
 }
 
 void freeChunk(VM* vm, Chunk* chunk)
@@ -20,6 +22,7 @@ void freeChunk(VM* vm, Chunk* chunk)
     FREE_ARRAY(vm, chunk->code, chunk->capacity, uint8_t);
     FREE_ARRAY(vm, chunk->lines, chunk->capacity, int);
     freeValueArray(vm, &chunk->constants);
+    FREE_ARRAY(vm, chunk->caches, chunk->cacheCount, InlineCache);
     initChunk(chunk);
 }
 
@@ -52,4 +55,13 @@ int addConstant(VM* vm, Chunk* chunk, Value value) {
     #endif
     
     return chunk->constants.count - 1;
+}
+
+int addCache(VM* vm, Chunk* chunk) {
+    // Caches are only added at compile time, so grow one at a time
+    int newCount = chunk->cacheCount + 1;
+    chunk->caches = GROW_ARRAY(vm, chunk->caches, chunk->cacheCount, newCount, InlineCache);
+    chunk->caches[chunk->cacheCount] = (InlineCache){ NULL, 0 };
+
+    return chunk->cacheCount++;
 }
\ No newline at end of file
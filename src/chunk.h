@@ -56,19 +56,30 @@ typedef enum {
     OP_SWAP_TOP,        // 0x2F
     OP_SLICE,           // 0x30
     OP_IN,              // 0x31
+    OP_GET_FIELD,       // 0x32
 } OpCode; 
 
+// Per-site memo for OP_GET_FIELD; remembers which slot the
+// key lived in for the last shape seen at that site
+typedef struct {
+    ObjShape* shape;
+    int slot;
+} InlineCache;
+
 typedef struct {
     int count;
     int capacity;
     uint8_t* code;
     int* lines;
     ValueArray constants;
+    int cacheCount;
+    InlineCache* caches;
 } Chunk;
 
 void initChunk(Chunk* chunk);
 void freeChunk(VM* vm, Chunk* chunk);
 void writeChunk(VM* vm, Chunk* chunk, uint8_t op, int line);
 int addConstant(VM* vm, Chunk* chunk, Value value);
+int addCache(VM* vm, Chunk* chunk);
 
 #endif
\ No newline at end of file
@@ -7,6 +7,13 @@
 typedef enum { false, true } bool;
 typedef struct Compiler Compiler;
 typedef struct VM VM;
+typedef struct CallFrame CallFrame;
+typedef struct EventLoop EventLoop;
+typedef struct WorkerPool WorkerPool;
+typedef struct Job Job;
+typedef struct Ring Ring;
+typedef struct Output Output;
+typedef struct Format Format;
 
 typedef enum {
     MEM_BLACK,
@@ -61,5 +68,7 @@ typedef enum {
 #define UINT8_COUNT (UINT8_MAX + 1)
 #define FRAME_MAX 128
 #define STACK_SIZE UINT8_COUNT * FRAME_MAX
+#define FIBER_FRAME_MAX 32
+#define FIBER_STACK_SIZE UINT8_COUNT * FIBER_FRAME_MAX
 
 #endif
@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <limits.h>
 #include <stdarg.h>
 #include <math.h>
 
@@ -818,16 +819,19 @@ static void optimiseConcatenation(Compiler* compiler, BinaryExpr* binary) {
     if (getToken(compiler, binary->left).type == TOKEN_INTEGER && getToken(compiler, binary->right).type == TOKEN_INTEGER) {
         long long a = strtoll(getToken(compiler, binary->left).start, NULL, 0);
         long long b = strtoll(getToken(compiler, binary->right).start, NULL, 0);
-        ObjList* list = newList(compiler->vm);
+        unsigned long long span = a > b
+            ? (unsigned long long)a - (unsigned long long)b
+            : (unsigned long long)b - (unsigned long long)a;
 
-        long long c = a;
-        int dir = a < b ? 1 : -1;
-        while (c != b + dir) {
-            writeValueArray(compiler->vm, &list->array, INT_VAL(c));
-            c += dir;
+        // leave ranges that are too long for the VM to report
+        if (span >= INT_MAX) {
+            plainBinary(compiler, binary, OP_CONCAT);
+            return;
         }
 
-        emitConstant(compiler, OBJ_VAL(list), getToken(compiler, (Expr*)binary).line);
+        ObjList* range = newRange(compiler->vm, a, a > b ? -1 : 1, (int)span + 1);
+
+        emitConstant(compiler, OBJ_VAL(range), getToken(compiler, (Expr*)binary).line);
     }
     else if (getToken(compiler, binary->left).type == TOKEN_STRING && getToken(compiler, binary->right).type == TOKEN_STRING) {
         Token a = getToken(compiler, binary->left);
@@ -874,11 +878,32 @@ static void slice(Compiler* compiler, BinaryExpr* binary) {
     }
 }
 
+// r["key"] is the common case for records, so give the site its own cache
+static void field(Compiler* compiler, BinaryExpr* binary) {
+    Token key = getToken(compiler, binary->right);
+
+    compileExpr(compiler, binary->left);
+
+    uint8_t constant = makeConstant(compiler, OBJ_VAL(copyString(compiler->vm, key.start + 1, key.length - 2)));
+    int cache = addCache(compiler->vm, currentChunk(compiler));
+
+    if (cache > UINT16_MAX) {
+        compilerError(compiler, "Too many field accesses in %s; limit is %d, had %d", getName(compiler), UINT16_MAX, cache);
+        return;
+    }
+
+    emitBytes(compiler, OP_GET_FIELD, constant, binary->token.line);
+    emitBytes(compiler, (uint8_t)((cache & 0xFF00) >> 8), (uint8_t)(cache & 0x00FF), binary->token.line);
+}
+
 static void subscripting(Compiler* compiler, BinaryExpr* binary) {
     if (getToken(compiler, binary->right).type == TOKEN_COLON && binary->right->type == EXPR_BINARY) {
         compileExpr(compiler, binary->left);
         slice(compiler, (BinaryExpr*)binary->right);
     }
+    else if (binary->right->type == EXPR_LITERAL && getToken(compiler, binary->right).type == TOKEN_STRING) {
+        field(compiler, binary);
+    }
     else {
         plainBinary(compiler, binary, OP_SUBSCRIPT);
     }
@@ -887,7 +912,7 @@ static void subscripting(Compiler* compiler, BinaryExpr* binary) {
 static void getCustom(Compiler* compiler, Expr* expr) {
     Token toLiteral = getToken(compiler, expr);
     toLiteral.type = TOKEN_IDENTIFIER;
-    LiteralExpr operator = (LiteralExpr){(Expr){EXPR_LITERAL, NULL}, toLiteral};
+    LiteralExpr operator = (LiteralExpr){(Expr){EXPR_LITERAL}, toLiteral};
     compileLiteral(compiler, &operator);
 }
 
@@ -1259,37 +1284,52 @@ ObjFunction* compile(const char* source, VM* vm) {
     return endCompiler(&compiler);
 }
 
-ObjFunction* recompile(const char* source, VM* vm) {
-    Compiler compiler;
-    initCompiler(&compiler, vm, FUN_SCRIPT, NULL);
-
-    ProgramTree tree;
-    deserialiseJSON(&compiler, &tree, source);
-
-    if (tree.hadError) {
+// Compiles a tree read back from a serialised AST
+static ObjFunction* compileTree(Compiler* compiler, ProgramTree* tree) {
+    if (tree->hadError) {
         fprintf(stderr, "Encountered error in parsing\n");
-        freeTree(&tree);
+        freeTree(tree);
         return NULL;
     }
 
-    compiler.tree = &tree;
+    compiler->tree = tree;
 
-    for (size_t i = 0; i < tree.program->count - 1; i++) {
-        Expr* next = compiler.tree->program->subexprs[i];
+    for (size_t i = 0; i < tree->program->count - 1; i++) {
+        Expr* next = compiler->tree->program->subexprs[i];
 
-        compileExpr(&compiler, next);
+        compileExpr(compiler, next);
 
-        emitByte(&compiler, OP_POP, getLastLine(&compiler));
+        emitByte(compiler, OP_POP, getLastLine(compiler));
     }
 
-    compileExpr(&compiler, compiler.tree->program->subexprs[compiler.tree->program->count - 1]);
+    compileExpr(compiler, compiler->tree->program->subexprs[compiler->tree->program->count - 1]);
 
-    if (tree.hadError) {
+    if (tree->hadError) {
         fprintf(stderr, "Encountered error in compiling\n");
-        freeTree(&tree);
+        freeTree(tree);
         return NULL;
     }
 
-    freeTree(&tree);
-    return endCompiler(&compiler);
+    freeTree(tree);
+    return endCompiler(compiler);
+}
+
+ObjFunction* recompile(const char* source, VM* vm) {
+    Compiler compiler;
+    initCompiler(&compiler, vm, FUN_SCRIPT, NULL);
+
+    ProgramTree tree;
+    deserialiseJSON(&compiler, &tree, source);
+
+    return compileTree(&compiler, &tree);
+}
+
+ObjFunction* recompileFlat(const uint8_t* bytes, size_t length, VM* vm) {
+    Compiler compiler;
+    initCompiler(&compiler, vm, FUN_SCRIPT, NULL);
+
+    ProgramTree tree;
+    deserialiseFlat(&compiler, &tree, bytes, length);
+
+    return compileTree(&compiler, &tree);
 }
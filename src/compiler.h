@@ -52,5 +52,6 @@ void initCompiler(Compiler* compiler, VM* vm, FunctionType type, ObjString* name
 ObjFunction* endCompiler(Compiler* compiler);
 ObjFunction* compile(const char* source, VM* vm);
 ObjFunction* recompile(const char* source, VM* vm);
+ObjFunction* recompileFlat(const uint8_t* bytes, size_t length, VM* vm);
 
 #endif
@@ -33,6 +33,30 @@ const char* getObjName(int type) {
         return "OBJ_LIST";
     case OBJ_MAP:
         return "OBJ_MAP";
+    case OBJ_SHAPE:
+        return "OBJ_SHAPE";
+    case OBJ_NODE:
+        return "OBJ_NODE";
+    case OBJ_VECTOR:
+        return "OBJ_VECTOR";
+    case OBJ_PMAP:
+        return "OBJ_PMAP";
+    case OBJ_ARRAY:
+        return "OBJ_ARRAY";
+    case OBJ_ITERATOR:
+        return "OBJ_ITERATOR";
+    case OBJ_FIBER:
+        return "OBJ_FIBER";
+    case OBJ_FUTURE:
+        return "OBJ_FUTURE";
+    case OBJ_CHANNEL:
+        return "OBJ_CHANNEL";
+    case OBJ_BUILDER:
+        return "OBJ_BUILDER";
+    case OBJ_MAPPING:
+        return "OBJ_MAPPING";
+    case OBJ_READER:
+        return "OBJ_READER";
     default:
         return "UNKNOWN_OBJ";
     }
@@ -51,7 +75,8 @@ const char* getValName(Value val) {
     case VAL_CHAR:
         return "VAL_CHAR";
     case VAL_OBJ:
-        return getObjName(OBJ_TYPE(val));
+        // ranges are lists underneath, but not to anyone reading an error
+        return IS_RANGE(val) ? "OBJ_RANGE" : getObjName(OBJ_TYPE(val));
     default:
         return "UNKNOWN_VAL";
     }
@@ -104,6 +129,8 @@ const char* getInstructionName(int type) {
         case OP_CHAR:           return "OP_CHAR";
         case OP_COMPOSE:        return "OP_COMPOSE";
         case OP_SLICE:          return "OP_SLICE";
+        case OP_IN:             return "OP_IN";
+        case OP_GET_FIELD:      return "OP_GET_FIELD";
         default:                return "UNKNOWN_OP";
     }
 }
@@ -153,6 +180,16 @@ static int integerInstruction(const char* name, int sign, Chunk* chunk, int offs
     return offset + 3;
 }
 
+static int fieldInstruction(const char* name, Chunk* chunk, int offset) {
+    uint8_t constant = chunk->code[offset];
+    uint8_t position = chunk->code[offset + 1];
+    uint16_t cache = (uint16_t)((chunk->code[offset + 2] << 8) | chunk->code[offset + 3]);
+    printf("%-16s %02d '", name, constant);
+    printValue(chunk->constants.values[position]);
+    printf("' #%d\n", cache);
+    return offset + 4;
+}
+
 static int jumpInstruction(const char* name, int sign, Chunk* chunk, int offset) {
     uint8_t constant = chunk->code[offset];
     uint16_t jump = (uint16_t)((chunk->code[offset + 1] << 8) | chunk->code[offset + 2]);
@@ -267,6 +304,10 @@ int disassembleInstruction(Chunk* chunk, int offset) {
             return simpleInstruction("OP_COMPOSE", chunk, offset);
         case OP_SLICE:
             return doubleInstruction("OP_SLICE", chunk, offset);
+        case OP_IN:
+            return simpleInstruction("OP_IN", chunk, offset);
+        case OP_GET_FIELD:
+            return fieldInstruction("OP_GET_FIELD", chunk, offset);
         default:
             return simpleInstruction("UNKNOWN_OP", chunk, offset);
     }
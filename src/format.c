@@ -0,0 +1,123 @@
+#include "format.h"
+#include "memory.h"
+#include "output.h"
+#include "vm.h"
+
+// Past this a slot can't be in range anyway, so it stops growing
+#define FORMAT_MAX_SLOT 100000
+
+
+static inline bool isIntChar(char ch) {
+    return ch >= '0' && ch <= '9';
+}
+
+static size_t formatSize(int count) {
+    return sizeof(Format) + count * sizeof(FormatSegment);
+}
+
+// Splits 'string' into runs of text and '{n}' slots; a '{' that isn't
+// followed by a digit is just text
+static Format* compileFormat(VM* vm, ObjString* string, const char** error) {
+    const char* chars = string->chars;
+    int length = string->length;
+
+    // at most one segment for every character
+    FormatSegment* segments = ALLOCATE(vm, length, FormatSegment);
+    int count = 0;
+    int slots = 0;
+    int run = 0;
+    int i = 0;
+
+    while (i < length) {
+        if (chars[i] != '{' || i + 1 >= length || !isIntChar(chars[i + 1])) {
+            i++;
+            continue;
+        }
+
+        if (i > run) {
+            segments[count++] = (FormatSegment){ run, i - run, -1 };
+        }
+
+        int slot = 0;
+        i++;
+
+        while (i < length && isIntChar(chars[i])) {
+            if (slot < FORMAT_MAX_SLOT) {
+                slot = slot * 10 + (chars[i] - '0');
+            }
+
+            i++;
+        }
+
+        if (i == length || chars[i] != '}') {
+            FREE_ARRAY(vm, segments, length, FormatSegment);
+            *error = "Expected '}' in format";
+            return NULL;
+        }
+
+        i++;
+        run = i;
+
+        segments[count++] = (FormatSegment){ 0, 0, slot };
+
+        if (slot + 1 > slots) {
+            slots = slot + 1;
+        }
+    }
+
+    if (length > run) {
+        segments[count++] = (FormatSegment){ run, length - run, -1 };
+    }
+
+    Format* format = ALLOCATE_FAM(vm, Format, FormatSegment, count);
+    format->count = count;
+    format->slots = slots;
+
+    for (int j = 0; j < count; j++) {
+        format->segments[j] = segments[j];
+    }
+
+    FREE_ARRAY(vm, segments, length, FormatSegment);
+    return format;
+}
+
+Format* getFormat(VM* vm, ObjString* string, const char** error) {
+    if (string->format == NULL) {
+        string->format = compileFormat(vm, string, error);
+    }
+
+    return string->format;
+}
+
+void freeFormat(VM* vm, Format* format) {
+    reallocate(vm, format, formatSize(format->count), 0);
+}
+
+bool renderFormat(VM* vm, Output* out, ObjString* string, int argc, Value* args, const char* name) {
+    const char* error = NULL;
+    Format* format = getFormat(vm, string, &error);
+
+    if (format == NULL) {
+        runtimeError(vm, "%s$ : %s", name, error);
+        return false;
+    }
+
+    // checked up front, so nothing is half-written
+    if (format->slots > argc) {
+        runtimeError(vm, "%s$ : Attempted to index out of args; got %d with %d args", name, format->slots, argc);
+        return false;
+    }
+
+    for (int i = 0; i < format->count; i++) {
+        FormatSegment* segment = &format->segments[i];
+
+        if (segment->slot < 0) {
+            outputChars(out, string->chars + segment->start, segment->length);
+        }
+        else {
+            outputValue(out, args[segment->slot]);
+        }
+    }
+
+    return true;
+}
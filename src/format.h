@@ -0,0 +1,30 @@
+#ifndef format_h_hammer
+#define format_h_hammer
+
+#include "common.h"
+#include "object.h"
+
+// One piece of a format string: a run of its text, or an argument
+typedef struct {
+    int start;
+    int length;
+    int slot;           // -1 for a run of text
+} FormatSegment;
+
+// A format string split up once, so printing doesn't have to scan it again
+struct Format {
+    int count;
+    int slots;          // one past the highest slot used
+    FormatSegment segments[];
+};
+
+// Formats are made the first time a string is used as one and kept on it;
+// NULL, with 'error' set, if the string isn't a valid format
+Format* getFormat(VM* vm, ObjString* string, const char** error);
+void freeFormat(VM* vm, Format* format);
+
+// Writes the string with each '{n}' replaced by args[n]; raises an error
+// prefixed with 'name' instead when the format or the arguments are wrong
+bool renderFormat(VM* vm, Output* out, ObjString* string, int argc, Value* args, const char* name);
+
+#endif
@@ -6,14 +6,23 @@
 #include <argp.h>
 #include <errno.h>
 #include <memory.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "common.h"
 
 #include "scanner.h"
 #include "vm.h"
 #include "ast.h"
+#include "compiler.h"
+#include "transfer.h"
+#include "cache.h"
 
 static char* readFile(const char* path);
+static InterpretResult linkFile(VM* vm, const char* path);
+static int compileFile(const char* source, const char* path);
 void say_error(const char* msg, int n);
 char *convertPath(const char *path, const char *ftype);
 
@@ -24,16 +33,18 @@ static struct argp_option options[] = {
     { "repl", 'r', 0, 0, "Start a repl session", 0 },
     { "interpret", 'i', "FILE", 0, "Interpret FILE", 0 },
     { "json", 'j', "FILE", 0, "Output AST of FILE as JSON data", 0 },
-    { "compile", 'c', "FILE", 0, "Compile AST of FILE to binary", 0 },
-    { "ouput", 'o', "FILENAME", 0, "Send output to FILENAME instead of stdout", 0 },
+    { "ast", 'a', "FILE", 0, "Output AST of FILE as flat binary", 0 },
+    { "compile", 'c', "FILE", 0, "Compile FILE to a bytecode image", 0 },
+    { "output", 'o', "FILENAME", 0, "Send output to FILENAME instead of stdout", 0 },
     { "link", 'l', "SRC", 0, "Link SRC with compilation unit", 0 },
-    { 0, 0, 0, OPTION_DOC, "SRC is a .o or .json file executed before main unit", 0 },
+    { "no-cache", 'n', 0, 0, "Compile FILE even if it's in the compile cache, and leave the cache alone", 0 },
+    { 0, 0, 0, OPTION_DOC, "SRC is a .o, .ast or .json file executed before main unit", 0 },
     { 0 }
 };
 
 struct input {
     // working mode
-    enum { ERROR_MODE, REPL_MODE, INTERPRET_MODE, JSON_DATA_MODE, COMPILE_MODE  } mode;
+    enum { ERROR_MODE, REPL_MODE, INTERPRET_MODE, JSON_DATA_MODE, AST_DATA_MODE, COMPILE_MODE  } mode;
     // working file (for certain working modes)
     const char* arg;
     // output path (for when -o is specified)
@@ -42,6 +53,8 @@ struct input {
     const char *links[256];
     // link count
     int linkn;
+    // whether to skip the compile cache (for when -n is specified)
+    bool noCache;
 };
 
 static error_t parse_opt(int key, char *arg, struct argp_state* state) {
@@ -50,9 +63,11 @@ static error_t parse_opt(int key, char *arg, struct argp_state* state) {
         case 'r': input->mode = REPL_MODE; break;
         case 'i': input->mode = INTERPRET_MODE; input->arg = arg; break;
         case 'j': input->mode = JSON_DATA_MODE; input->arg = arg; break;
+        case 'a': input->mode = AST_DATA_MODE; input->arg = arg; break;
         case 'c': input->mode = COMPILE_MODE; input->arg = arg; break;
         case 'o': input->output = arg; break;
         case 'l': input->links[input->linkn++] = arg; break;
+        case 'n': input->noCache = true; break;
         case ARGP_KEY_ARG: {
             //non-key option passed, probably interpreting a file
             input->mode = INTERPRET_MODE;
@@ -73,6 +88,7 @@ int main(int argc, char* argv[])
     input.arg = NULL;
     input.output = NULL;
     input.linkn = 0;
+    input.noCache = false;
 
     int result = argp_parse(&argp, argc, argv, ARGP_IN_ORDER, 0, &input);
 
@@ -91,25 +107,44 @@ int main(int argc, char* argv[])
             case INTERPRET_MODE: {
                 VM vm; initVM(&vm);
 
+                int out = -1;
+
+                if (input.output != NULL) {
+                    out = open(input.output, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+                    if (out < 0) {
+                        fprintf(stderr, "Could not open file at '%s'", input.output);
+                        freeVM(&vm);
+                        return errno;
+                    }
+
+                    redirectOutput(&vm.output, out);
+                }
+
                 for (int i = 0; i < input.linkn; i++) {
-                    char * js = readFile(input.links[i]);
-                    InterpretResult result = interpretPrecompiled(&vm, js);
+                    InterpretResult result = linkFile(&vm, input.links[i]);
 
                     if (result != INTERPRET_OK) {
                         fprintf(stderr, "Error while linking '%s'", input.links[i]);
                         freeVM(&vm);
-                        free(js);
                         return EINVAL;
                     }
-
-                    free(js);
                 }
 
                 char *source = readFile(input.arg);
-                interpret(&vm, source);
+
+                if (input.noCache) {
+                    interpret(&vm, source);
+                } else {
+                    interpretCached(&vm, source, argp_program_version);
+                }
 
                 freeVM(&vm);
                 free(source);
+
+                if (out >= 0) {
+                    close(out);
+                }
                 break;
             }
             case JSON_DATA_MODE: {
@@ -132,26 +167,45 @@ int main(int argc, char* argv[])
                 free(source);
                 break;
             }
-            case COMPILE_MODE: {
+            case AST_DATA_MODE: {
                 char *source = readFile(input.arg);
 
                 if (input.output == NULL) {
-                    char *path = convertPath(input.arg, ".o");
+                    char *path = convertPath(input.arg, ".ast");
 
-                    FILE *file = fopen(path, "w");
-                    serialiseAST(file, source);
+                    FILE *file = fopen(path, "wb");
+                    serialiseFlatAST(file, source);
 
                     fclose(file);
                     free(path);
                 } else {
-                    FILE *file = fopen(input.output, "w");
-                    serialiseAST(file, source);
+                    FILE *file = fopen(input.output, "wb");
+                    serialiseFlatAST(file, source);
                     fclose(file);
                 }
 
                 free(source);
                 break;
             }
+            case COMPILE_MODE: {
+                char *source = readFile(input.arg);
+                int status;
+
+                if (input.output == NULL) {
+                    char *path = convertPath(input.arg, ".o");
+                    status = compileFile(source, path);
+                    free(path);
+                } else {
+                    status = compileFile(source, input.output);
+                }
+
+                free(source);
+
+                if (status != 0) {
+                    return status;
+                }
+                break;
+            }
             default:
                 fprintf(stderr, "Unknown option\n"); break;
         }
@@ -192,6 +246,83 @@ static char* readFile(const char* path) {
     return buffer;
 }
 
+// Code images are mapped and run as they are, flat ASTs are compiled straight
+// from the mapping; anything else is taken to be an AST in JSON
+static InterpretResult linkFile(VM* vm, const char* path) {
+    int fd = open(path, O_RDONLY);
+    struct stat info;
+
+    if (fd < 0 || fstat(fd, &info) < 0) {
+        fprintf(stderr, "Could not open file at '%s'", path);
+        exit(74);
+    }
+
+    size_t length = (size_t)info.st_size;
+    void* bytes = length > 0 ? mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+
+    if (bytes != MAP_FAILED && isCodeImage(bytes, length)) {
+        InterpretResult result = interpretImage(vm, bytes, length);
+        munmap(bytes, length);
+        return result;
+    }
+
+    if (bytes != MAP_FAILED && isFlatAST(bytes, length)) {
+        InterpretResult result = interpretFlat(vm, bytes, length);
+        munmap(bytes, length);
+        return result;
+    }
+
+    if (bytes != MAP_FAILED) {
+        munmap(bytes, length);
+    }
+
+    char* js = readFile(path);
+    InterpretResult result = interpretPrecompiled(vm, js);
+    free(js);
+
+    return result;
+}
+
+// Writes the code image of 'source' to 'path', or nothing if it doesn't compile
+static int compileFile(const char* source, const char* path) {
+    VM vm; initVM(&vm);
+    vm.isActive = false;
+
+    ObjFunction* script = compile(source, &vm);
+
+    if (script == NULL) {
+        freeVM(&vm);
+        return EINVAL;
+    }
+
+    Parcel parcel;
+    initParcel(&parcel);
+
+    if (!packCode(&parcel, script)) {
+        fprintf(stderr, "Could not compile to a bytecode image\n");
+        freeParcel(&parcel);
+        freeVM(&vm);
+        return EINVAL;
+    }
+
+    FILE *file = fopen(path, "wb");
+    int status = 0;
+
+    if (file == NULL || fwrite(parcel.bytes, 1, parcel.count, file) < parcel.count) {
+        fprintf(stderr, "Could not write file at '%s'", path);
+        status = errno;
+    }
+
+    if (file != NULL) {
+        fclose(file);
+    }
+
+    freeParcel(&parcel);
+    freeVM(&vm);
+    return status;
+}
+
 void say_error(const char* msg, int n) {
     fprintf(stderr, "%s\n%s\n", msg, strerror(n));
 }
@@ -1,5 +1,7 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <unistd.h>
+#include <sys/mman.h>
 
 #include "common.h"
 #include "debug.h"
@@ -7,6 +9,9 @@
 #include "vm.h"
 #include "compiler.h"
 #include "table.h"
+#include "builtins.h"
+#include "ring.h"
+#include "format.h"
 
 
 #define GC_CONSTANT 2
@@ -62,6 +67,12 @@ static void freeObject(VM* vm, Obj* object) {
     switch (object->type) {
         case OBJ_STRING: {
             ObjString* string = (ObjString*)object;
+            if (string->owner == NULL) {
+                FREE_ARRAY(vm, string->chars, string->length + 1, char);
+            }
+            if (string->format != NULL) {
+                freeFormat(vm, string->format);
+            }
             FREE(vm, string, ObjString);
             break;
         }
@@ -96,10 +107,91 @@ static void freeObject(VM* vm, Obj* object) {
         }
         case OBJ_MAP: {
             ObjMap* map = (ObjMap*)object;
+            freeValueArray(vm, &map->slots);
             freeTable(vm, &map->table);
             FREE(vm, map, ObjMap);
             break;
         }
+        case OBJ_SHAPE: {
+            ObjShape* shape = (ObjShape*)object;
+            freeValueArray(vm, &shape->keys);
+            freeTable(vm, &shape->index);
+            freeTable(vm, &shape->transitions);
+            FREE(vm, shape, ObjShape);
+            break;
+        }
+        case OBJ_NODE: {
+            ObjNode* node = (ObjNode*)object;
+            reallocate(vm, node, sizeof(ObjNode) + node->count * sizeof(Value), 0);
+            break;
+        }
+        case OBJ_VECTOR: {
+            ObjVector* vector = (ObjVector*)object;
+            FREE(vm, vector, ObjVector);
+            break;
+        }
+        case OBJ_PMAP: {
+            ObjPMap* map = (ObjPMap*)object;
+            FREE(vm, map, ObjPMap);
+            break;
+        }
+        case OBJ_ARRAY: {
+            ObjArray* array = (ObjArray*)object;
+            if (array->owner == NULL) {
+                FREE_ARRAY(vm, array->as.ints, array->count, long long);
+            }
+            FREE(vm, array, ObjArray);
+            break;
+        }
+        case OBJ_ITERATOR: {
+            FREE(vm, object, ObjIterator);
+            break;
+        }
+        case OBJ_FIBER: {
+            ObjFiber* fiber = (ObjFiber*)object;
+            FREE_ARRAY(vm, fiber->stack, FIBER_STACK_SIZE, Value);
+            FREE_ARRAY(vm, fiber->frames, FIBER_FRAME_MAX, CallFrame);
+            FREE(vm, fiber, ObjFiber);
+            break;
+        }
+        case OBJ_FUTURE: {
+            ObjFuture* future = (ObjFuture*)object;
+            if (future->job != NULL) {
+                releaseJob(future->job);
+            }
+            FREE(vm, future, ObjFuture);
+            break;
+        }
+        case OBJ_CHANNEL: {
+            releaseRing(((ObjChannel*)object)->ring);
+            FREE(vm, object, ObjChannel);
+            break;
+        }
+        case OBJ_BUILDER: {
+            ObjStringBuilder* builder = (ObjStringBuilder*)object;
+            FREE_ARRAY(vm, builder->chars, builder->capacity, char);
+            FREE(vm, builder, ObjStringBuilder);
+            break;
+        }
+        case OBJ_MAPPING: {
+            ObjMapping* mapping = (ObjMapping*)object;
+            if (!mapping->mapped) {
+                FREE_ARRAY(vm, mapping->bytes, mapping->length, char);
+            }
+            else if (mapping->bytes != NULL) {
+                munmap(mapping->bytes, mapping->length);
+            }
+            FREE(vm, mapping, ObjMapping);
+            break;
+        }
+        case OBJ_READER: {
+            ObjReader* reader = (ObjReader*)object;
+            if (reader->owned) {
+                close(reader->fd);
+            }
+            FREE(vm, reader, ObjReader);
+            break;
+        }
     }
 }
 
@@ -146,6 +238,8 @@ static void markArray(VM* vm, ValueArray* array) {
     }
 }
 
+static void markStack(VM* vm, Value* stack, Value* stackTop, CallFrame* frames, int frameCount);
+
 static void blackenObject(VM* vm, Obj* object) {
     #ifdef DEBUG_LOG_GC
     printf("Blackening %p : %s\n", (void*)object, getObjName(object->type));
@@ -161,6 +255,9 @@ static void blackenObject(VM* vm, Obj* object) {
             ObjFunction* function = (ObjFunction*)object;
             markObject(vm, (Obj*)function->name);
             markArray(vm, &function->body.constants);
+            for (int i = 0; i < function->body.cacheCount; i++) {
+                markObject(vm, (Obj*)function->body.caches[i].shape);
+            }
             break;
         }
         case OBJ_CLOSURE: {
@@ -173,25 +270,99 @@ static void blackenObject(VM* vm, Obj* object) {
         }
         case OBJ_LIST: {
             ObjList* list = (ObjList*)object;
-            markArray(vm, &list->array);
+            if (list->parent != NULL) {
+                markObject(vm, (Obj*)list->parent);
+            }
+            else if (list->step == 0) {
+                markArray(vm, &list->array);
+            }
             break;
         }
         case OBJ_MAP: {
             ObjMap* map = (ObjMap*)object;
+            markObject(vm, (Obj*)map->shape);
+            markArray(vm, &map->slots);
             markTable(vm, &map->table);
             break;
         }
-        case OBJ_STRING:
+        case OBJ_SHAPE: {
+            ObjShape* shape = (ObjShape*)object;
+            markArray(vm, &shape->keys);
+            markTable(vm, &shape->index);
+            markTable(vm, &shape->transitions);
+            break;
+        }
+        case OBJ_NODE: {
+            ObjNode* node = (ObjNode*)object;
+            for (int i = 0; i < node->count; i++) {
+                markValue(vm, node->slots[i]);
+            }
+            break;
+        }
+        case OBJ_VECTOR: {
+            ObjVector* vector = (ObjVector*)object;
+            markObject(vm, (Obj*)vector->root);
+            markObject(vm, (Obj*)vector->tail);
+            break;
+        }
+        case OBJ_PMAP: {
+            markObject(vm, (Obj*)((ObjPMap*)object)->root);
+            break;
+        }
+        case OBJ_ARRAY: {
+            markObject(vm, ((ObjArray*)object)->owner);
+            break;
+        }
+        case OBJ_STRING: {
+            ObjString* string = (ObjString*)object;
+            if (string->owner != NULL) {
+                markObject(vm, string->owner);
+            }
+            break;
+        }
+        case OBJ_ITERATOR: {
+            ObjIterator* iter = (ObjIterator*)object;
+            markValue(vm, iter->fn);
+            markValue(vm, iter->source);
+            markValue(vm, iter->other);
+            break;
+        }
+        case OBJ_READER: {
+            ObjReader* reader = (ObjReader*)object;
+            if (reader->block != NULL) {
+                markObject(vm, (Obj*)reader->block);
+            }
+            break;
+        }
+        case OBJ_FIBER: {
+            ObjFiber* fiber = (ObjFiber*)object;
+            markValue(vm, fiber->fn);
+            markValue(vm, fiber->transfer);
+            markObject(vm, (Obj*)fiber->caller);
+
+            // the running fiber's stacks are marked as the VM's own
+            if (fiber != vm->fiber) {
+                markStack(vm, fiber->stack, fiber->stackTop, fiber->frames, fiber->frameCount);
+            }
+            break;
+        }
+        case OBJ_FUTURE: {
+            markValue(vm, ((ObjFuture*)object)->value);
+            break;
+        }
         case OBJ_NATIVE: 
+        case OBJ_CHANNEL:
+        case OBJ_BUILDER:
+        case OBJ_MAPPING:
             break;
     }
 }
 
-static void markRoots(VM* vm) {
+static void markStack(VM* vm, Value* stack, Value* stackTop, CallFrame* frames, int frameCount) {
     #ifdef DEBUG_LOG_GC
     printf("Slots:\n");
     #endif
-    for (Value* slot = vm->stack; slot < vm->stackTop; slot++) {
+    for (Value* slot = stack; slot < stackTop; slot++) {
         markValue(vm, *slot);
         #ifdef DEBUG_LOG_GC
         printValue(*slot);
@@ -201,16 +372,29 @@ static void markRoots(VM* vm) {
     #ifdef DEBUG_LOG_GC
     printf("Frames:\n");
     #endif
-    for (int i = 0; i < vm->frameCount; i++) {
-        markObject(vm, (Obj*)vm->frames[i].function);
-        markObject(vm, (Obj*)vm->frames[i].closure);
+    for (int i = 0; i < frameCount; i++) {
+        markObject(vm, (Obj*)frames[i].function);
+        markObject(vm, (Obj*)frames[i].closure);
         #ifdef DEBUG_LOG_GC
-        printValue(OBJ_VAL((Obj*)vm->frames[i].function));
+        printValue(OBJ_VAL((Obj*)frames[i].function));
         printf("\n");
         #endif
     }
+}
+
+static void markRoots(VM* vm) {
+    markStack(vm, vm->stack, vm->stackTop, vm->frames, vm->frameCount);
+
+    // the main stacks are parked while a fiber runs; the fibers that resumed
+    // this one are reached through its 'caller'
+    if (vm->fiber != NULL) {
+        markStack(vm, vm->mainStack, vm->mainTop, vm->mainFrames, vm->mainFrameCount);
+        markObject(vm, (Obj*)vm->fiber);
+    }
 
+    markEventLoop(vm);
     markTable(vm, &vm->globals);
+    markObject(vm, (Obj*)vm->rootShape);
     // markCompiler(vm); // I don't think I need this??? Shouldn't have to tiptoe
     // around allocation during the compilation phase... just wait until after
 }
@@ -8,6 +8,8 @@
 #include "table.h"
 #include "debug.h"
 #include "memory.h"
+#include "shape.h"
+#include "persistent.h"
 
 
 #define ALLOCATE_OBJ(v, type, objectType) \
@@ -51,8 +53,13 @@ ObjString* allocateString(VM* vm, char* chars, int length, uint32_t hash) {
     string->length = length;
     string->chars = chars;
     string->hash = hash;
+    string->owner = NULL;
+    string->format = NULL;
 
+    // GC :: growing the intern table can collect, and nothing else refers to 'string' yet
+    push(vm, OBJ_VAL(string));
     tableAddEntry(vm, &vm->strings, string, UNIT_VAL);
+    pop(vm);
 
     return string;
 }
@@ -84,6 +91,51 @@ ObjString* takeString(VM* vm, char* chars, size_t length) {
     return allocateString(vm, chars, length, hash);
 }
 
+// A NUL-terminated copy of 'string' for C APIs like open(2), since views
+// aren't terminated; give it back with freeCString
+char* toCString(VM* vm, ObjString* string) {
+    char* chars = ALLOCATE(vm, string->length + 1, char);
+    memcpy(chars, string->chars, string->length);
+    chars[string->length] = '\0';
+    return chars;
+}
+
+void freeCString(VM* vm, char* chars, ObjString* string) {
+    FREE_ARRAY(vm, chars, string->length + 1, char);
+}
+
+// Caller keeps 'string' reachable; the view refers to whatever owns the chars,
+// so views of views don't form chains
+ObjString* newStringView(VM* vm, ObjString* string, int start, int length) {
+    ObjString* view = ALLOCATE_OBJ(vm, ObjString, OBJ_STRING);
+    view->length = length;
+    view->hash = 0;
+    view->owner = string->owner != NULL ? string->owner : (Obj*)string;
+    view->chars = string->chars + start;
+    view->format = NULL;
+    return view;
+}
+
+// Interned string with the same contents, allocating one if need be
+ObjString* internString(VM* vm, ObjString* string) {
+    if (string->owner == NULL) {
+        return string;
+    }
+
+    return copyString(vm, string->chars, string->length);
+}
+
+// Interned string with the same contents, or NULL if there isn't one; anything
+// keyed by strings can only hold interned keys, so NULL means it isn't there
+ObjString* findInterned(VM* vm, ObjString* string) {
+    if (string->owner == NULL) {
+        return string;
+    }
+
+    uint32_t hash = hashString(string->chars, string->length);
+    return tableFindString(&vm->strings, string->chars, string->length, hash);
+}
+
 
 ObjCell* newCell(VM* vm) {
     ObjCell* cell = ALLOCATE_OBJ(vm, ObjCell, OBJ_CELL);
@@ -123,127 +175,484 @@ ObjClosure* newClosure(VM* vm, ObjFunction* function, uint8_t upvalueCount) {
 ObjList* newList(VM* vm) {
     ObjList* list = ALLOCATE_OBJ(vm, ObjList, OBJ_LIST);
     initValueArray(&list->array);
+    list->parent = NULL;
+    list->offset = 0;
+    list->start = 0;
+    list->step = 0;
     return list;
 }
 
+// Caller keeps 'list' reachable
+ObjList* newListView(VM* vm, ObjList* list, int start, int count) {
+    ObjList* view = newList(vm);
+    view->array.count = count;
+
+    if (list->parent != NULL) {
+        view->parent = list->parent;
+        view->offset = list->offset + start;
+    }
+    else {
+        view->parent = list;
+        view->offset = start;
+    }
+
+    return view;
+}
+
+// Gives a view or a range its own copy of its values so it can be written to;
+// it stays the same object, so everything holding it sees the write
+void materialiseList(VM* vm, ObjList* list) {
+    if (list->parent == NULL && list->step == 0) {
+        return;
+    }
+
+    int count = list->array.count;
+    Value* values = ALLOCATE(vm, count, Value);
+
+    if (list->step != 0) {
+        for (int i = 0; i < count; i++) {
+            values[i] = INT_VAL(rangeAt(list, i));
+        }
+    }
+    else {
+        memcpy(values, listValues(list), sizeof(Value) * count);
+    }
+
+    list->array.values = values;
+    list->array.capacity = count;
+    list->parent = NULL;
+    list->offset = 0;
+    list->start = 0;
+    list->step = 0;
+}
+
 ObjMap* newMap(VM* vm) {
     ObjMap* map = ALLOCATE_OBJ(vm, ObjMap, OBJ_MAP);
+    map->shape = vm->rootShape;
+    initValueArray(&map->slots);
     initTable(&map->table);
     return map;
 }
 
+ObjShape* newShape(VM* vm) {
+    ObjShape* shape = ALLOCATE_OBJ(vm, ObjShape, OBJ_SHAPE);
+    initValueArray(&shape->keys);
+    initTable(&shape->index);
+    initTable(&shape->transitions);
+    return shape;
+}
+
+ObjNode* newNode(VM* vm, int count) {
+    ObjNode* node = (ObjNode*)allocateObject(vm, sizeof(ObjNode) + count * sizeof(Value), OBJ_NODE);
+    node->bitmap = 0;
+    node->count = count;
+    for (int i = 0; i < count; i++) {
+        node->slots[i] = UNIT_VAL;
+    }
+    return node;
+}
+
+ObjVector* newVector(VM* vm) {
+    ObjVector* vector = ALLOCATE_OBJ(vm, ObjVector, OBJ_VECTOR);
+    vector->count = 0;
+    vector->shift = VECTOR_BITS;
+    vector->root = NULL;
+    vector->tail = NULL;
+    return vector;
+}
+
+// Elements are left uninitialised
+ObjArray* newArray(VM* vm, ArrayKind kind, int count) {
+    // both kinds are 8 bytes wide; the buffer comes first so the GC never sees
+    // an array without one
+    long long* data = ALLOCATE(vm, count, long long);
+
+    ObjArray* array = ALLOCATE_OBJ(vm, ObjArray, OBJ_ARRAY);
+    array->kind = kind;
+    array->count = count;
+    array->owner = NULL;
+    array->as.ints = data;
+    return array;
+}
+
+// Caller keeps 'array' reachable
+ObjArray* newArrayView(VM* vm, ObjArray* array, int start, int count) {
+    ObjArray* view = ALLOCATE_OBJ(vm, ObjArray, OBJ_ARRAY);
+    view->kind = array->kind;
+    view->count = count;
+    view->owner = array->owner != NULL ? array->owner : (Obj*)array;
+    view->as.ints = array->as.ints + start;
+    return view;
+}
+
+ObjList* newRange(VM* vm, long long start, int step, int count) {
+    ObjList* range = newList(vm);
+    range->array.count = count;
+    range->start = start;
+    range->step = step;
+    return range;
+}
+
+// A fresh list of the range's values, leaving the range as it is; 'range'
+// must be reachable by the GC
+ObjList* rangeToList(VM* vm, ObjList* range) {
+    ObjList* list = newRange(vm, range->start, range->step, range->array.count);
+    push(vm, OBJ_VAL(list));
+    materialiseList(vm, list);
+    pop(vm);
+    return list;
+}
+
+ObjIterator* newIterator(VM* vm, IterKind kind, Value fn, Value source, Value other) {
+    ObjIterator* iter = ALLOCATE_OBJ(vm, ObjIterator, OBJ_ITERATOR);
+    iter->kind = kind;
+    iter->fn = fn;
+    iter->source = source;
+    iter->other = other;
+    iter->sources = kind == ITER_SOURCE ? 1 : 0;
+
+    if (IS_ITERATOR(source)) {
+        iter->sources += AS_ITERATOR(source)->sources;
+    }
+    if (IS_ITERATOR(other)) {
+        iter->sources += AS_ITERATOR(other)->sources;
+    }
+
+    return iter;
+}
+
+ObjFiber* newFiber(VM* vm, Value fn) {
+    Value* stack = ALLOCATE(vm, FIBER_STACK_SIZE, Value);
+    CallFrame* frames = ALLOCATE(vm, FIBER_FRAME_MAX, CallFrame);
+
+    ObjFiber* fiber = ALLOCATE_OBJ(vm, ObjFiber, OBJ_FIBER);
+    fiber->state = FIBER_NEW;
+    fiber->fn = fn;
+    fiber->transfer = UNIT_VAL;
+    fiber->caller = NULL;
+    fiber->stack = stack;
+    fiber->stackTop = stack;
+    fiber->frames = frames;
+    fiber->frameCount = 0;
+    return fiber;
+}
+
+ObjFuture* newFuture(VM* vm, Job* job) {
+    ObjFuture* future = ALLOCATE_OBJ(vm, ObjFuture, OBJ_FUTURE);
+    future->job = job;
+    future->value = UNIT_VAL;
+    return future;
+}
+
+// Takes over a reference to 'ring'
+ObjChannel* newChannel(VM* vm, Ring* ring) {
+    ObjChannel* channel = ALLOCATE_OBJ(vm, ObjChannel, OBJ_CHANNEL);
+    channel->ring = ring;
+    return channel;
+}
+
+ObjStringBuilder* newStringBuilder(VM* vm) {
+    ObjStringBuilder* builder = ALLOCATE_OBJ(vm, ObjStringBuilder, OBJ_BUILDER);
+    builder->count = 0;
+    builder->capacity = 0;
+    builder->chars = NULL;
+    return builder;
+}
+
+// Takes over the mapping at 'bytes'
+ObjMapping* newMapping(VM* vm, char* bytes, int length) {
+    ObjMapping* mapping = ALLOCATE_OBJ(vm, ObjMapping, OBJ_MAPPING);
+    mapping->mapped = true;
+    mapping->length = length;
+    mapping->bytes = bytes;
+    return mapping;
+}
+
+// An ObjMapping over bytes on the heap, for filling in
+ObjMapping* newBlock(VM* vm, int length) {
+    ObjMapping* block = ALLOCATE_OBJ(vm, ObjMapping, OBJ_MAPPING);
+    block->mapped = false;
+    block->length = 0;
+    block->bytes = NULL;
+
+    push(vm, OBJ_VAL(block));
+    block->bytes = ALLOCATE(vm, length, char);
+    block->length = length;
+    pop(vm);
+
+    return block;
+}
 
-void printObject(Value value) {
+ObjReader* newReader(VM* vm, int fd, bool owned, char delimiter, int blockSize) {
+    ObjReader* reader = ALLOCATE_OBJ(vm, ObjReader, OBJ_READER);
+    reader->fd = fd;
+    reader->owned = owned;
+    reader->atEnd = false;
+    reader->csv = false;
+    reader->delimiter = delimiter;
+    reader->blockSize = blockSize;
+    reader->block = NULL;
+    reader->start = 0;
+    reader->end = 0;
+    return reader;
+}
+
+// A view straight into a mapping; like any view it isn't interned
+ObjString* newMappedString(VM* vm, ObjMapping* mapping, int start, int length) {
+    ObjString* view = ALLOCATE_OBJ(vm, ObjString, OBJ_STRING);
+    view->length = length;
+    view->hash = 0;
+    view->owner = (Obj*)mapping;
+    view->chars = mapping->bytes + start;
+    view->format = NULL;
+    return view;
+}
+
+// An array straight out of a mapping; 'start' must leave it 8-byte aligned
+ObjArray* newMappedArray(VM* vm, ObjMapping* mapping, ArrayKind kind, int start, int count) {
+    ObjArray* array = ALLOCATE_OBJ(vm, ObjArray, OBJ_ARRAY);
+    array->kind = kind;
+    array->count = count;
+    array->owner = (Obj*)mapping;
+    array->as.ints = (long long*)(mapping->bytes + start);
+    return array;
+}
+
+ObjPMap* newPMap(VM* vm) {
+    ObjPMap* map = ALLOCATE_OBJ(vm, ObjPMap, OBJ_PMAP);
+    map->count = 0;
+    map->root = NULL;
+    return map;
+}
+
+
+void outputObject(Output* out, Value value) {
     switch (OBJ_TYPE(value)) {
         case OBJ_STRING: {
             #ifdef DEBUG_STRING_DETAILS
-            printf("%s : %d : %p", AS_CSTRING(value), AS_STRING(value)->hash, AS_OBJ(value));
+            outputFormat(out, "%.*s : %d : %p", AS_STRING(value)->length, AS_CSTRING(value), AS_STRING(value)->hash, AS_OBJ(value));
             #else
-            printf("%s", AS_CSTRING(value));
+            outputChars(out, AS_CSTRING(value), AS_STRING(value)->length);
             #endif
             break;
         }
         case OBJ_CELL: {
             #ifdef OPTION_RECURSIVE_PRINTING
-            printf("(");
-            printValue(CAR(value));
-            printf(" , ");
-            printValue(CDR(value));
-            printf(")");
+            outputCString(out, "(");
+            outputValue(out, CAR(value));
+            outputCString(out, " , ");
+            outputValue(out, CDR(value));
+            outputCString(out, ")");
             #else
-            printf("(");
+            outputCString(out, "(");
             if (!IS_CELL(CAR(value)))
-                printValue(CAR(value));
+                outputValue(out, CAR(value));
             else
-                printf("(,)");
-            printf(" , ");
+                outputCString(out, "(,)");
+            outputCString(out, " , ");
             if (!IS_CELL(CDR(value)))
-                printValue(CDR(value));
+                outputValue(out, CDR(value));
             else
-                printf("(,)");
-            printf(")");
+                outputCString(out, "(,)");
+            outputCString(out, ")");
             #endif
             break;
         }
         case OBJ_FUNCTION: {
             ObjFunction* func = AS_FUNC(value);
             if (func->name != NULL) {
-                printf("<fn %s : %d>", func->name->chars, func->arity);
+                outputFormat(out, "<fn %s : %d>", func->name->chars, func->arity);
             } else {
-                printf("<lmbd : %d>", func->arity);
+                outputFormat(out, "<lmbd : %d>", func->arity);
             }
             break;
         }
         case OBJ_NATIVE: {
             ObjNative* native = AS_NATIVE(value);
-            printf("<ntv : %d>", native->arity);
+            outputFormat(out, "<ntv : %d>", native->arity);
             break;
         }
         case OBJ_CLOSURE: {
             ObjClosure* closure = AS_CLOSURE(value);
             if (closure->function->name != NULL) {
-                printf("<clsr %s : %d %d>", closure->function->name->chars, closure->function->arity, closure->upvalueCount);
+                outputFormat(out, "<clsr %s : %d %d>", closure->function->name->chars, closure->function->arity, closure->upvalueCount);
             } else {
-                printf("<clsr %d : %d>", closure->upvalueCount, closure->function->arity);
+                outputFormat(out, "<clsr %d : %d>", closure->upvalueCount, closure->function->arity);
             }
             break;
         }
         case OBJ_LIST: {
             #ifdef OPTION_DETAILED_PRINTING
             ObjList* list = AS_LIST(value);
-            printf("[ ");
+
+            // printed as the list it stands for
+            if (list->step != 0) {
+                outputCString(out, "[ ");
+                if (list->array.count > 0) {
+                    outputFormat(out, "%lli", rangeAt(list, 0));
+
+                    for (int i = 1; i < list->array.count; ++i) {
+                        outputFormat(out, " ; %lli", rangeAt(list, i));
+                    }
+                }
+                else {
+                    outputCString(out, ";");
+                }
+                outputCString(out, " ]");
+                break;
+            }
+
+            outputCString(out, "[ ");
             if (list->array.count > 0) {
-                printValue(list->array.values[0]);
+                outputValue(out, ELEMS(value)[0]);
 
                 for (size_t i = 1; i < list->array.count; ++i) {
-                    printf(" ; ");
-                    printValue(list->array.values[i]);
+                    outputCString(out, " ; ");
+                    outputValue(out, ELEMS(value)[i]);
                 }
             }
             else {
-                printf(";");
+                outputCString(out, ";");
             }
-            printf(" ]");
+            outputCString(out, " ]");
             #else
-            printf("[;]");
+            outputCString(out, "[;]");
             #endif
             break;
         }
         case OBJ_MAP: {
             #ifdef OPTION_DETAILED_PRINTING
             ObjMap* map = AS_MAP(value);
-            Table* table = &map->table;
-            printf("[ ");
-            if (table->count == 1) {
-                for (int i = 0; i < table->capacity; i++) {
-                    Entry* entry = &table->entries[i];
-                    if (entry->key != NULL) {
-                        printf("%s => ", entry->key->chars);
-                        printValue(entry->value);
-                    }
+            int count = mapCount(map);
+            outputCString(out, "[ ");
+            if (count > 0) {
+                int cursor = 0, j = 0;
+                ObjString* key;
+                Value item;
+
+                while (mapNext(map, &cursor, &key, &item)) {
+                    j++;
+                    outputChars(out, key->chars, key->length);
+                    outputCString(out, " => ");
+                    outputValue(out, item);
+                    if (j < count) outputCString(out, " ; ");
+                }
+            }
+            else {
+                outputCString(out, "=>");
+            }
+            outputCString(out, " ]");
+            #else
+            outputCString(out, "[=>]");
+            #endif
+            break;
+        }
+        case OBJ_SHAPE: {
+            outputFormat(out, "<shape : %d>", AS_SHAPE(value)->keys.count);
+            break;
+        }
+        case OBJ_NODE: {
+            outputFormat(out, "<node : %d>", AS_NODE(value)->count);
+            break;
+        }
+        case OBJ_VECTOR: {
+            #ifdef OPTION_DETAILED_PRINTING
+            ObjVector* vector = AS_VECTOR(value);
+            outputCString(out, "[| ");
+            if (vector->count > 0) {
+                outputValue(out, vectorGet(vector, 0));
+
+                for (int i = 1; i < vector->count; ++i) {
+                    outputCString(out, " ; ");
+                    outputValue(out, vectorGet(vector, i));
                 }
             }
-            else if (table->count > 1) {
+            else {
+                outputCString(out, ";");
+            }
+            outputCString(out, " |]");
+            #else
+            outputCString(out, "[|;|]");
+            #endif
+            break;
+        }
+        case OBJ_PMAP: {
+            #ifdef OPTION_DETAILED_PRINTING
+            ObjPMap* map = AS_PMAP(value);
+            outputCString(out, "[| ");
+            if (map->count > 0) {
+                PMapCursor cursor;
+                ObjString* key;
+                Value item;
                 int j = 0;
 
-                for (int i = 0; i < table->capacity; i++) {
-                    Entry* entry = &table->entries[i];
-                    if (entry->key != NULL) {
-                        j++;
-                        printf("%s => ", entry->key->chars);
-                        printValue(entry->value);
-                        if (j < table->count) printf(" ; ");
-                    }
+                pmapCursor(map, &cursor);
+
+                while (pmapNext(&cursor, &key, &item)) {
+                    j++;
+                    outputChars(out, key->chars, key->length);
+                    outputCString(out, " => ");
+                    outputValue(out, item);
+                    if (j < map->count) outputCString(out, " ; ");
                 }
             }
             else {
-                printf("=>");
+                outputCString(out, "=>");
             }
-            printf(" ]");
+            outputCString(out, " |]");
             #else
-            printf("[=>]");
+            outputCString(out, "[|=>|]");
             #endif
             break;
         }
+        case OBJ_ARRAY: {
+            #ifdef OPTION_DETAILED_PRINTING
+            ObjArray* array = AS_ARRAY(value);
+            outputCString(out, "[# ");
+            if (array->count > 0) {
+                outputValue(out, arrayAt(array, 0));
+
+                for (int i = 1; i < array->count; ++i) {
+                    outputCString(out, " ; ");
+                    outputValue(out, arrayAt(array, i));
+                }
+            }
+            else {
+                outputCString(out, ";");
+            }
+            outputCString(out, " #]");
+            #else
+            outputCString(out, "[#;#]");
+            #endif
+            break;
+        }
+        case OBJ_ITERATOR: {
+            outputCString(out, "<iter>");
+            break;
+        }
+        case OBJ_FIBER: {
+            outputCString(out, "<fiber>");
+            break;
+        }
+        case OBJ_FUTURE: {
+            outputCString(out, "<future>");
+            break;
+        }
+        case OBJ_CHANNEL: {
+            outputCString(out, "<channel>");
+            break;
+        }
+        case OBJ_BUILDER: {
+            outputFormat(out, "<builder : %d>", AS_BUILDER(value)->count);
+            break;
+        }
+        case OBJ_MAPPING: {
+            outputFormat(out, "<mapping : %d>", AS_MAPPING(value)->length);
+            break;
+        }
+        case OBJ_READER: {
+            outputFormat(out, "<reader : %d>", AS_READER(value)->fd);
+            break;
+        }
     }
 }
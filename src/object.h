@@ -14,8 +14,21 @@
 #define IS_FUNC(val)        (isObjType(val, OBJ_FUNCTION))
 #define IS_NATIVE(val)      (isObjType(val, OBJ_NATIVE))
 #define IS_CLOSURE(val)     (isObjType(val, OBJ_CLOSURE))
-#define IS_LIST(val)        (isObjType(val, OBJ_LIST))
+#define IS_LIST(val)        (isObjType(val, OBJ_LIST) && AS_LIST(val)->step == 0)
 #define IS_MAP(val)         (isObjType(val, OBJ_MAP))
+#define IS_SHAPE(val)       (isObjType(val, OBJ_SHAPE))
+#define IS_NODE(val)        (isObjType(val, OBJ_NODE))
+#define IS_VECTOR(val)      (isObjType(val, OBJ_VECTOR))
+#define IS_PMAP(val)        (isObjType(val, OBJ_PMAP))
+#define IS_ARRAY(val)       (isObjType(val, OBJ_ARRAY))
+#define IS_RANGE(val)       (isObjType(val, OBJ_LIST) && AS_LIST(val)->step != 0)
+#define IS_ITERATOR(val)    (isObjType(val, OBJ_ITERATOR))
+#define IS_FIBER(val)       (isObjType(val, OBJ_FIBER))
+#define IS_FUTURE(val)      (isObjType(val, OBJ_FUTURE))
+#define IS_CHANNEL(val)     (isObjType(val, OBJ_CHANNEL))
+#define IS_BUILDER(val)     (isObjType(val, OBJ_BUILDER))
+#define IS_MAPPING(val)     (isObjType(val, OBJ_MAPPING))
+#define IS_READER(val)      (isObjType(val, OBJ_READER))
 
 #define AS_STRING(val)      ((ObjString*)AS_OBJ(val))
 #define AS_CELL(val)        ((ObjCell*)AS_OBJ(val))
@@ -24,6 +37,19 @@
 #define AS_CLOSURE(val)     ((ObjClosure*)AS_OBJ(val))
 #define AS_LIST(val)        ((ObjList*)AS_OBJ(val))
 #define AS_MAP(val)         ((ObjMap*)AS_OBJ(val))
+#define AS_SHAPE(val)       ((ObjShape*)AS_OBJ(val))
+#define AS_NODE(val)        ((ObjNode*)AS_OBJ(val))
+#define AS_VECTOR(val)      ((ObjVector*)AS_OBJ(val))
+#define AS_PMAP(val)        ((ObjPMap*)AS_OBJ(val))
+#define AS_ARRAY(val)       ((ObjArray*)AS_OBJ(val))
+#define AS_RANGE(val)       ((ObjList*)AS_OBJ(val))
+#define AS_ITERATOR(val)    ((ObjIterator*)AS_OBJ(val))
+#define AS_FIBER(val)       ((ObjFiber*)AS_OBJ(val))
+#define AS_FUTURE(val)      ((ObjFuture*)AS_OBJ(val))
+#define AS_CHANNEL(val)     ((ObjChannel*)AS_OBJ(val))
+#define AS_BUILDER(val)     ((ObjStringBuilder*)AS_OBJ(val))
+#define AS_MAPPING(val)     ((ObjMapping*)AS_OBJ(val))
+#define AS_READER(val)      ((ObjReader*)AS_OBJ(val))
 
 #define AS_CSTRING(val)     (((ObjString*)AS_OBJ(val))->chars)
 
@@ -34,9 +60,16 @@
 #define CLOSED_FN(val)      (((ObjClosure*)AS_OBJ(val))->function)
 
 #define ARRAY(val)          (((ObjList*)AS_OBJ(val))->array)
+#define ELEMS(val)          (listValues((ObjList*)AS_OBJ(val)))
 
 #define TABLE(val)          (((ObjMap*)AS_OBJ(val))->table)
 
+// Slices shorter than this are copied rather than viewed
+#define VIEW_MIN_LENGTH 16
+// Slices covering less than 1/VIEW_MAX_WASTE of their parent are copied, so a
+// small view doesn't keep a large parent alive
+#define VIEW_MAX_WASTE 4
+
 typedef enum {
     OBJ_STRING,
     OBJ_CELL,
@@ -45,6 +78,18 @@ typedef enum {
     OBJ_CLOSURE,
     OBJ_LIST,
     OBJ_MAP,
+    OBJ_SHAPE,
+    OBJ_NODE,
+    OBJ_VECTOR,
+    OBJ_PMAP,
+    OBJ_ARRAY,
+    OBJ_ITERATOR,
+    OBJ_FIBER,
+    OBJ_FUTURE,
+    OBJ_CHANNEL,
+    OBJ_BUILDER,
+    OBJ_MAPPING,
+    OBJ_READER,
 } ObjType;
 
 struct Obj {
@@ -54,11 +99,16 @@ struct Obj {
     struct Obj* line;
 };
 
+// Strings with no owner hold their own null-terminated chars and are interned;
+// views borrow 'length' chars from the owner's buffer, aren't terminated, and
+// aren't interned, so their hash is left at 0
 struct ObjString {
     Obj obj;
     int length;
     uint32_t hash;
+    Obj* owner;
     char* chars;
+    Format* format;     // NULL until it's used as a format
 };
 
 typedef struct {
@@ -90,26 +140,205 @@ typedef struct {
     uint8_t* depths;
 } ObjClosure;
 
-typedef struct {
+// A list with a parent is a view of 'array.count' values starting at 'offset'
+// in the parent's array, which always owns its storage. A list with a step is
+// a range, 'array.count' consecutive ints counting up or down from 'start';
+// IS_LIST is false for those, and only IS_RANGE holds. Either way its own
+// array stays empty until it is materialised
+typedef struct ObjList {
     Obj obj;
     ValueArray array;
+    struct ObjList* parent;
+    int offset;
+    long long start;
+    int step;       // 1 or -1 for a range, otherwise 0
 } ObjList;
 
+// Hidden class shared by every map built with the same keys in the same order;
+// maps in shape mode keep their values in a dense slot array indexed through it
+struct ObjShape {
+    Obj obj;
+    ValueArray keys;    // slot n holds the value for keys.values[n]
+    Table index;        // key -> INT_VAL(slot)
+    Table transitions;  // key -> OBJ_VAL(shape with that key appended)
+};
+
 typedef struct {
     Obj obj;
+    ObjShape* shape;    // NULL once the map has fallen back to dictionary mode
+    ValueArray slots;
     Table table;
 } ObjMap;
 
+// Trie node shared between versions of persistent collections; never changed
+// once built. Vector nodes hold children or values by position, map nodes hold
+// key/value pairs placed by 'bitmap', with a UNIT key marking a child node
+typedef struct {
+    Obj obj;
+    uint32_t bitmap;
+    int count;
+    Value slots[];
+} ObjNode;
+
+// Persistent vector: a 32-way trie of full leaves plus a tail of up to 32
+// values, so appends only touch the tail most of the time
+typedef struct {
+    Obj obj;
+    int count;
+    int shift;      // bits of the index consumed by the root
+    ObjNode* root;  // NULL while everything fits in the tail
+    ObjNode* tail;
+} ObjVector;
+
+// Persistent map: a hash array mapped trie keyed by interned strings
+typedef struct {
+    Obj obj;
+    int count;
+    ObjNode* root;  // NULL when empty
+} ObjPMap;
+
+typedef enum {
+    ARRAY_INT,
+    ARRAY_FLOAT,
+} ArrayKind;
+
+// Unboxed numbers of a single kind; like strings, a view borrows 'count'
+// elements of its owner's buffer, which is another array or a mapping
+typedef struct {
+    Obj obj;
+    ArrayKind kind;
+    int count;
+    Obj* owner;
+    union {
+        long long* ints;
+        double* floats;
+    } as;
+} ObjArray;
+
+typedef enum {
+    ITER_SOURCE,
+    ITER_MAP,
+    ITER_FILTER,
+    ITER_ZIP,
+} IterKind;
 
-void printObject(Value value);
+// One stage of a lazy pipeline; nothing is computed until a cursor pulls
+// values through it, one at a time. Stages never change once made, so one
+// pipeline can be walked by several cursors at once, each keeping its own place
+typedef struct {
+    Obj obj;
+    IterKind kind;
+    Value fn;       // UNIT for sources
+    Value source;   // the sequence read by a source, otherwise the stage before
+    Value other;    // the second stage fed into a zip
+    int sources;    // how many sources feed this stage, itself included
+} ObjIterator;
+
+typedef enum {
+    FIBER_NEW,
+    FIBER_SUSPENDED,
+    FIBER_RUNNING,
+    FIBER_DONE,
+} FiberState;
+
+// A function running on its own value and frame stacks, so it can stop part
+// way through and pick up again later; the VM points at the stacks of
+// whichever fiber is running
+typedef struct ObjFiber {
+    Obj obj;
+    FiberState state;
+    Value fn;
+    Value transfer;             // the value being yielded
+    struct ObjFiber* caller;    // who resumed it, NULL for the main stacks
+    Value* stack;
+    Value* stackTop;            // only up to date while it isn't running
+    CallFrame* frames;
+    int frameCount;
+} ObjFiber;
+
+// The result of a job handed to the worker pool; the job lives outside the
+// heap, shared with whichever worker runs it until both are done with it
+typedef struct {
+    Obj obj;
+    Job* job;       // NULL once the result has been brought into this heap
+    Value value;
+} ObjFuture;
+
+// One VM's handle on a ring that other VMs may hold handles on too
+typedef struct {
+    Obj obj;
+    Ring* ring;
+} ObjChannel;
+
+// Text being put together in place, so building a long string doesn't copy
+// it on every step; build$ hands the buffer over to a string and empties it
+typedef struct {
+    Obj obj;
+    int count;
+    int capacity;
+    char* chars;
+} ObjStringBuilder;
+
+// A file mapped into memory, or a block a reader filled; only ever seen as
+// the owner of the strings viewing it, and freed once none of them are left
+typedef struct {
+    Obj obj;
+    bool mapped;        // unmapped rather than freed
+    int length;
+    char* bytes;
+} ObjMapping;
+
+// Records read from a file descriptor as they're asked for. Each is a view
+// into the block it was read into, and a block is only kept while something
+// views it, so memory stays in proportion to the block size
+typedef struct {
+    Obj obj;
+    int fd;
+    bool owned;         // opened by the reader, so closed with it
+    bool atEnd;         // the fd has nothing more to give
+    bool csv;           // records are rows of fields, split on 'delimiter'
+    char delimiter;
+    int blockSize;
+    ObjMapping* block;  // NULL until the first read
+    int start;          // of the next record in 'block'
+    int end;            // of what's been read into it
+} ObjReader;
+
+
+void outputObject(Output* out, Value value);
 ObjString* copyString(VM* vm, const char* chars, size_t length);
 ObjString* takeString(VM* vm, char* chars, size_t length);
+ObjString* newStringView(VM* vm, ObjString* string, int start, int length);
+ObjString* internString(VM* vm, ObjString* string);
+ObjString* findInterned(VM* vm, ObjString* string);
+char* toCString(VM* vm, ObjString* string);
+void freeCString(VM* vm, char* chars, ObjString* string);
 ObjCell* newCell(VM* vm);
 ObjNative* newNative(VM* vm, NativeFn function, int arity);
 ObjFunction* newFunction(VM* vm, ObjString* name);
 ObjClosure* newClosure(VM* vm, ObjFunction* function, uint8_t upvalueCount);
 ObjList* newList(VM* vm);
+ObjList* newListView(VM* vm, ObjList* list, int start, int count);
+void materialiseList(VM* vm, ObjList* list);
 ObjMap* newMap(VM* vm);
+ObjShape* newShape(VM* vm);
+ObjNode* newNode(VM* vm, int count);
+ObjVector* newVector(VM* vm);
+ObjPMap* newPMap(VM* vm);
+ObjArray* newArray(VM* vm, ArrayKind kind, int count);
+ObjArray* newArrayView(VM* vm, ObjArray* array, int start, int count);
+ObjList* newRange(VM* vm, long long start, int step, int count);
+ObjList* rangeToList(VM* vm, ObjList* range);
+ObjIterator* newIterator(VM* vm, IterKind kind, Value fn, Value source, Value other);
+ObjFiber* newFiber(VM* vm, Value fn);
+ObjFuture* newFuture(VM* vm, Job* job);
+ObjChannel* newChannel(VM* vm, Ring* ring);
+ObjStringBuilder* newStringBuilder(VM* vm);
+ObjMapping* newMapping(VM* vm, char* bytes, int length);
+ObjMapping* newBlock(VM* vm, int length);
+ObjReader* newReader(VM* vm, int fd, bool owned, char delimiter, int blockSize);
+ObjString* newMappedString(VM* vm, ObjMapping* mapping, int start, int length);
+ObjArray* newMappedArray(VM* vm, ObjMapping* mapping, ArrayKind kind, int start, int count);
 
 static inline bool isCallable(Value value) {
     return IS_OBJ(value) && (
@@ -119,6 +348,22 @@ static inline bool isCallable(Value value) {
     );
 }
 
+static inline Value* listValues(ObjList* list) {
+    return list->parent == NULL
+        ? list->array.values
+        : list->parent->array.values + list->offset;
+}
+
+static inline Value arrayAt(ObjArray* array, int index) {
+    return array->kind == ARRAY_INT
+        ? INT_VAL(array->as.ints[index])
+        : FLOAT_VAL(array->as.floats[index]);
+}
+
+static inline long long rangeAt(ObjList* range, int index) {
+    return range->start + (long long)index * range->step;
+}
+
 static inline bool isObjType(Value value, ObjType type) {
     return IS_OBJ(value) && OBJ_TYPE(value) == type;
 }
@@ -0,0 +1,199 @@
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#include "output.h"
+
+
+void initOutput(Output* out, int fd) {
+    out->fd = fd;
+    out->lineBuffered = isatty(fd);
+    out->count = 0;
+    out->capacity = OUTPUT_CAPACITY;
+    out->bytes = malloc(OUTPUT_CAPACITY);
+
+    if (out->bytes == NULL) {
+        exit(1);
+    }
+}
+
+void initCollector(Output* out) {
+    out->fd = -1;
+    out->lineBuffered = false;
+    out->count = 0;
+    out->capacity = 0;
+    out->bytes = NULL;
+}
+
+static void growCollector(Output* out, size_t needed) {
+    size_t capacity = out->capacity < 64 ? 64 : out->capacity;
+
+    while (capacity - out->count < needed) {
+        capacity *= 2;
+    }
+
+    out->bytes = realloc(out->bytes, capacity);
+
+    if (out->bytes == NULL) {
+        exit(1);
+    }
+
+    out->capacity = capacity;
+}
+
+void freeOutput(Output* out) {
+    if (out->fd >= 0) {
+        flushOutput(out);
+    }
+
+    free(out->bytes);
+    out->bytes = NULL;
+}
+
+void redirectOutput(Output* out, int fd) {
+    flushOutput(out);
+    out->fd = fd;
+    out->lineBuffered = isatty(fd);
+}
+
+// Keeps going through short writes; gives up on real errors, since there's
+// nowhere left to report them
+static void writeAll(int fd, struct iovec* parts, int count) {
+    while (count > 0) {
+        ssize_t written = writev(fd, parts, count);
+
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            return;
+        }
+
+        while (count > 0 && (size_t)written >= parts->iov_len) {
+            written -= parts->iov_len;
+            parts++;
+            count--;
+        }
+
+        if (count > 0) {
+            parts->iov_base = (char*)parts->iov_base + written;
+            parts->iov_len -= written;
+        }
+    }
+}
+
+void flushOutput(Output* out) {
+    if (out->fd < 0) {
+        // a full collector makes room instead
+        if (out->count == out->capacity) {
+            growCollector(out, 1);
+        }
+
+        return;
+    }
+
+    if (out->count == 0) {
+        return;
+    }
+
+    struct iovec part = { out->bytes, out->count };
+    writeAll(out->fd, &part, 1);
+    out->count = 0;
+}
+
+void outputChars(Output* out, const char* chars, size_t length) {
+    if (length > out->capacity - out->count && out->fd < 0) {
+        growCollector(out, length);
+    }
+    else if (length > out->capacity - out->count) {
+        // too big to be worth copying; goes out in one call with the buffer
+        if (length >= OUTPUT_CAPACITY) {
+            struct iovec parts[2] = { { out->bytes, out->count }, { (char*)chars, length } };
+            writeAll(out->fd, parts, 2);
+            out->count = 0;
+            return;
+        }
+
+        flushOutput(out);
+    }
+
+    memcpy(out->bytes + out->count, chars, length);
+    out->count += length;
+
+    if (out->lineBuffered && memchr(chars, '\n', length) != NULL) {
+        flushOutput(out);
+    }
+}
+
+void outputFormat(Output* out, const char* format, ...) {
+    char small[64];
+    va_list args;
+
+    va_start(args, format);
+    int length = vsnprintf(small, sizeof(small), format, args);
+    va_end(args);
+
+    if (length < 0) {
+        return;
+    }
+
+    if ((size_t)length < sizeof(small)) {
+        outputChars(out, small, length);
+        return;
+    }
+
+    char* large = malloc(length + 1);
+
+    if (large == NULL) {
+        exit(1);
+    }
+
+    va_start(args, format);
+    vsnprintf(large, length + 1, format, args);
+    va_end(args);
+
+    outputChars(out, large, length);
+    free(large);
+}
+
+// Skips printf, since ints are most of what gets printed
+char* formatInt(char* end, long long n) {
+    char* start = end;
+    unsigned long long magnitude = n < 0 ? 0ull - (unsigned long long)n : (unsigned long long)n;
+
+    do {
+        *--start = (char)('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude > 0);
+
+    if (n < 0) {
+        *--start = '-';
+    }
+
+    return start;
+}
+
+// 15 digits when they're enough, which keeps 0.1 short, otherwise 17, which
+// always are (the same choice cJSON makes)
+int formatDouble(char* buffer, double x) {
+    int length = snprintf(buffer, DOUBLE_DIGITS_MAX, "%.15g", x);
+
+    if (strtod(buffer, NULL) != x) {
+        length = snprintf(buffer, DOUBLE_DIGITS_MAX, "%.17g", x);
+    }
+
+    return length;
+}
+
+void outputInt(Output* out, long long n) {
+    char digits[INT_DIGITS_MAX];
+    char* end = digits + sizeof(digits);
+    char* start = formatInt(end, n);
+
+    outputChars(out, start, end - start);
+}
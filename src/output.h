@@ -0,0 +1,59 @@
+#ifndef output_h_hammer
+#define output_h_hammer
+
+#include <string.h>
+
+#include "common.h"
+
+#define OUTPUT_CAPACITY 65536
+#define INT_DIGITS_MAX 24
+#define DOUBLE_DIGITS_MAX 32
+
+// Text on its way to a file descriptor, written out with write(2) once the
+// buffer fills or someone asks; stdio isn't involved at all. With no fd the
+// buffer grows instead, collecting the text for a string
+struct Output {
+    int fd;                 // -1 when collecting
+    bool lineBuffered;      // flushed at every newline, for terminals
+    size_t count;
+    size_t capacity;
+    char* bytes;
+};
+
+void initOutput(Output* out, int fd);
+void initCollector(Output* out);
+void freeOutput(Output* out);
+
+// Flushes what's buffered, then sends everything after it to 'fd'
+void redirectOutput(Output* out, int fd);
+void flushOutput(Output* out);
+
+void outputChars(Output* out, const char* chars, size_t length);
+void outputFormat(Output* out, const char* format, ...);
+void outputInt(Output* out, long long n);
+
+// Writes 'n' backwards from 'end', which needs INT_DIGITS_MAX chars before
+// it, and returns where it starts
+char* formatInt(char* end, long long n);
+
+// Writes the digits of 'x' that read back as exactly 'x' into 'buffer', which
+// holds DOUBLE_DIGITS_MAX chars, and returns how many there are
+int formatDouble(char* buffer, double x);
+
+static inline void outputChar(Output* out, char c) {
+    if (out->count == out->capacity) {
+        flushOutput(out);
+    }
+
+    out->bytes[out->count++] = c;
+
+    if (c == '\n' && out->lineBuffered) {
+        flushOutput(out);
+    }
+}
+
+static inline void outputCString(Output* out, const char* chars) {
+    outputChars(out, chars, strlen(chars));
+}
+
+#endif
@@ -0,0 +1,589 @@
+#include <string.h>
+
+#include "common.h"
+#include "persistent.h"
+#include "object.h"
+#include "memory.h"
+#include "vm.h"
+
+
+// Copies the first 'count' slots of 'node' (fewer if it has fewer) into a new
+// node; a NULL node gives an empty one
+static ObjNode* copyNode(VM* vm, ObjNode* node, int count) {
+    ObjNode* copy = newNode(vm, count);
+
+    if (node != NULL) {
+        copy->bitmap = node->bitmap;
+        memcpy(copy->slots, node->slots, (node->count < count ? node->count : count) * sizeof(Value));
+    }
+
+    return copy;
+}
+
+
+/*
++---------------------+
+| Vectors       vvvv  |
++---------------------+
+*/
+
+
+static int tailOffset(ObjVector* vector) {
+    if (vector->count < VECTOR_WIDTH) {
+        return 0;
+    }
+
+    return ((vector->count - 1) >> VECTOR_BITS) << VECTOR_BITS;
+}
+
+Value vectorGet(ObjVector* vector, int index) {
+    if (index >= tailOffset(vector)) {
+        return vector->tail->slots[index & VECTOR_MASK];
+    }
+
+    ObjNode* node = vector->root;
+
+    for (int level = vector->shift; level > 0; level -= VECTOR_BITS) {
+        node = AS_NODE(node->slots[(index >> level) & VECTOR_MASK]);
+    }
+
+    return node->slots[index & VECTOR_MASK];
+}
+
+// Chain of single-child nodes leading down 'level' bits to 'leaf'
+static ObjNode* newPath(VM* vm, int level, ObjNode* leaf) {
+    if (level == 0) {
+        return leaf;
+    }
+
+    ObjNode* child = newPath(vm, level - VECTOR_BITS, leaf);
+    push(vm, OBJ_VAL(child));
+
+    ObjNode* node = newNode(vm, 1);
+    node->slots[0] = OBJ_VAL(child);
+
+    pop(vm);
+
+    return node;
+}
+
+// Copy of the path from 'parent' to where the leaf starting at 'start' goes,
+// with the leaf in place
+static ObjNode* pushLeaf(VM* vm, int level, ObjNode* parent, int start, ObjNode* leaf) {
+    int sub = (start >> level) & VECTOR_MASK;
+    ObjNode* child;
+
+    if (level == VECTOR_BITS) {
+        child = leaf;
+    }
+    else if (parent != NULL && sub < parent->count) {
+        child = pushLeaf(vm, level - VECTOR_BITS, AS_NODE(parent->slots[sub]), start, leaf);
+    }
+    else {
+        child = newPath(vm, level - VECTOR_BITS, leaf);
+    }
+
+    push(vm, OBJ_VAL(child));
+
+    // appends only ever touch the last child, so 'sub' is the end of the copy
+    ObjNode* node = copyNode(vm, parent, sub + 1);
+    node->slots[sub] = OBJ_VAL(child);
+
+    pop(vm);
+
+    return node;
+}
+
+// Adds a full leaf to the trie of a vector that's still being built; 'start'
+// is the index of the leaf's first value
+static void addLeaf(VM* vm, ObjVector* vector, int start, ObjNode* leaf) {
+    push(vm, OBJ_VAL(leaf));
+
+    if ((start >> VECTOR_BITS) >= (1 << vector->shift)) {
+        // root is full, so the trie grows a level
+        ObjNode* path = newPath(vm, vector->shift, leaf);
+        push(vm, OBJ_VAL(path));
+
+        ObjNode* root = newNode(vm, 2);
+        root->slots[0] = OBJ_VAL(vector->root);
+        root->slots[1] = OBJ_VAL(path);
+
+        pop(vm);
+
+        vector->root = root;
+        vector->shift += VECTOR_BITS;
+    }
+    else {
+        vector->root = pushLeaf(vm, vector->shift, vector->root, start, leaf);
+    }
+
+    pop(vm);
+}
+
+ObjVector* vectorConj(VM* vm, ObjVector* vector, Value value) {
+    ObjVector* result = newVector(vm);
+    push(vm, OBJ_VAL(result));
+
+    result->count = vector->count;
+    result->shift = vector->shift;
+    result->root = vector->root;
+    result->tail = vector->tail;
+
+    int start = tailOffset(vector);
+    int tailCount = vector->count - start;
+
+    if (tailCount < VECTOR_WIDTH) {
+        ObjNode* tail = copyNode(vm, vector->tail, tailCount + 1);
+        tail->slots[tailCount] = value;
+        result->tail = tail;
+    }
+    else {
+        addLeaf(vm, result, start, vector->tail);
+
+        ObjNode* tail = newNode(vm, 1);
+        tail->slots[0] = value;
+        result->tail = tail;
+    }
+
+    result->count++;
+
+    pop(vm);
+
+    return result;
+}
+
+static ObjNode* assocPath(VM* vm, int level, ObjNode* node, int index, Value value) {
+    if (level == 0) {
+        ObjNode* leaf = copyNode(vm, node, node->count);
+        leaf->slots[index & VECTOR_MASK] = value;
+        return leaf;
+    }
+
+    int sub = (index >> level) & VECTOR_MASK;
+
+    ObjNode* child = assocPath(vm, level - VECTOR_BITS, AS_NODE(node->slots[sub]), index, value);
+    push(vm, OBJ_VAL(child));
+
+    ObjNode* copy = copyNode(vm, node, node->count);
+    copy->slots[sub] = OBJ_VAL(child);
+
+    pop(vm);
+
+    return copy;
+}
+
+// 'index' must be in range
+ObjVector* vectorAssoc(VM* vm, ObjVector* vector, int index, Value value) {
+    ObjVector* result = newVector(vm);
+    push(vm, OBJ_VAL(result));
+
+    result->count = vector->count;
+    result->shift = vector->shift;
+    result->root = vector->root;
+    result->tail = vector->tail;
+
+    if (index >= tailOffset(vector)) {
+        ObjNode* tail = copyNode(vm, vector->tail, vector->tail->count);
+        tail->slots[index & VECTOR_MASK] = value;
+        result->tail = tail;
+    }
+    else {
+        result->root = assocPath(vm, vector->shift, vector->root, index, value);
+    }
+
+    pop(vm);
+
+    return result;
+}
+
+static int itemCount(Value items) {
+    return IS_LIST(items) ? ARRAY(items).count : AS_VECTOR(items)->count;
+}
+
+static Value itemAt(Value items, int index) {
+    return IS_LIST(items) ? ELEMS(items)[index] : vectorGet(AS_VECTOR(items), index);
+}
+
+// Appends every value of a list or vector, filling whole leaves at a time
+// rather than copying the tail once per value
+ObjVector* vectorAppend(VM* vm, ObjVector* vector, Value items) {
+    ObjVector* result = newVector(vm);
+    push(vm, OBJ_VAL(result));
+
+    int start = tailOffset(vector);
+
+    result->count = start;
+    result->shift = vector->shift;
+    result->root = vector->root;
+
+    // values waiting for a leaf; all of them are still held by the arguments
+    Value buffer[VECTOR_WIDTH];
+    int buffered = vector->count - start;
+
+    if (buffered > 0) {
+        memcpy(buffer, vector->tail->slots, buffered * sizeof(Value));
+    }
+
+    int count = itemCount(items);
+
+    for (int i = 0; i < count; i++) {
+        if (buffered == VECTOR_WIDTH) {
+            ObjNode* leaf = newNode(vm, VECTOR_WIDTH);
+            memcpy(leaf->slots, buffer, sizeof(buffer));
+
+            addLeaf(vm, result, result->count, leaf);
+            result->count += VECTOR_WIDTH;
+            buffered = 0;
+        }
+
+        buffer[buffered++] = itemAt(items, i);
+    }
+
+    if (buffered > 0) {
+        ObjNode* tail = newNode(vm, buffered);
+        memcpy(tail->slots, buffer, buffered * sizeof(Value));
+
+        result->tail = tail;
+        result->count += buffered;
+    }
+
+    pop(vm);
+
+    return result;
+}
+
+
+/*
++---------------------+
+| Vectors       ^^^^  |
++=====================+
+| Maps          vvvv  |
++---------------------+
+*/
+
+
+static inline uint32_t bitFor(uint32_t hash, int shift) {
+    return 1u << ((hash >> shift) & VECTOR_MASK);
+}
+
+// Slot of the pair for 'bit' in a node's packed slots
+static inline int slotFor(uint32_t bitmap, uint32_t bit) {
+    return 2 * __builtin_popcount(bitmap & (bit - 1));
+}
+
+Value* pmapGet(ObjPMap* map, ObjString* key) {
+    ObjNode* node = map->root;
+    int shift = 0;
+
+    while (node != NULL) {
+        if (shift >= PMAP_COLLISION_SHIFT) {
+            for (int i = 0; i < node->count; i += 2) {
+                if (AS_STRING(node->slots[i]) == key) {
+                    return &node->slots[i + 1];
+                }
+            }
+
+            return NULL;
+        }
+
+        uint32_t bit = bitFor(key->hash, shift);
+
+        if (!(node->bitmap & bit)) {
+            return NULL;
+        }
+
+        int i = slotFor(node->bitmap, bit);
+
+        if (IS_UNIT(node->slots[i])) {
+            node = AS_NODE(node->slots[i + 1]);
+            shift += VECTOR_BITS;
+            continue;
+        }
+
+        return AS_STRING(node->slots[i]) == key ? &node->slots[i + 1] : NULL;
+    }
+
+    return NULL;
+}
+
+static ObjNode* insertPair(VM* vm, ObjNode* node, int at, Value key, Value value) {
+    ObjNode* copy = newNode(vm, node->count + 2);
+    copy->bitmap = node->bitmap;
+
+    memcpy(copy->slots, node->slots, at * sizeof(Value));
+    copy->slots[at] = key;
+    copy->slots[at + 1] = value;
+    memcpy(copy->slots + at + 2, node->slots + at, (node->count - at) * sizeof(Value));
+
+    return copy;
+}
+
+static ObjNode* removePair(VM* vm, ObjNode* node, int at) {
+    ObjNode* copy = newNode(vm, node->count - 2);
+    copy->bitmap = node->bitmap;
+
+    memcpy(copy->slots, node->slots, at * sizeof(Value));
+    memcpy(copy->slots + at, node->slots + at + 2, (node->count - at - 2) * sizeof(Value));
+
+    return copy;
+}
+
+// Node holding two pairs whose hashes agree up to 'shift'
+static ObjNode* pairNode(VM* vm, int shift, Value k1, Value v1, Value k2, Value v2) {
+    if (shift >= PMAP_COLLISION_SHIFT) {
+        ObjNode* node = newNode(vm, 4);
+        node->slots[0] = k1;
+        node->slots[1] = v1;
+        node->slots[2] = k2;
+        node->slots[3] = v2;
+        return node;
+    }
+
+    uint32_t b1 = bitFor(AS_STRING(k1)->hash, shift);
+    uint32_t b2 = bitFor(AS_STRING(k2)->hash, shift);
+
+    if (b1 == b2) {
+        ObjNode* child = pairNode(vm, shift + VECTOR_BITS, k1, v1, k2, v2);
+        push(vm, OBJ_VAL(child));
+
+        ObjNode* node = newNode(vm, 2);
+        node->bitmap = b1;
+        node->slots[1] = OBJ_VAL(child);
+
+        pop(vm);
+
+        return node;
+    }
+
+    ObjNode* node = newNode(vm, 4);
+    node->bitmap = b1 | b2;
+
+    int first = b1 < b2 ? 0 : 2;
+    node->slots[first] = k1;
+    node->slots[first + 1] = v1;
+    node->slots[2 - first] = k2;
+    node->slots[3 - first] = v2;
+
+    return node;
+}
+
+static ObjNode* assocNode(VM* vm, ObjNode* node, int shift, ObjString* key, Value value, bool* added) {
+    if (node == NULL) {
+        ObjNode* leaf = newNode(vm, 2);
+        leaf->bitmap = shift < PMAP_COLLISION_SHIFT ? bitFor(key->hash, shift) : 0;
+        leaf->slots[0] = OBJ_VAL(key);
+        leaf->slots[1] = value;
+        *added = true;
+        return leaf;
+    }
+
+    if (shift >= PMAP_COLLISION_SHIFT) {
+        for (int i = 0; i < node->count; i += 2) {
+            if (AS_STRING(node->slots[i]) == key) {
+                ObjNode* copy = copyNode(vm, node, node->count);
+                copy->slots[i + 1] = value;
+                return copy;
+            }
+        }
+
+        *added = true;
+        return insertPair(vm, node, node->count, OBJ_VAL(key), value);
+    }
+
+    uint32_t bit = bitFor(key->hash, shift);
+    int i = slotFor(node->bitmap, bit);
+
+    if (!(node->bitmap & bit)) {
+        ObjNode* copy = insertPair(vm, node, i, OBJ_VAL(key), value);
+        copy->bitmap |= bit;
+        *added = true;
+        return copy;
+    }
+
+    Value k = node->slots[i];
+    ObjNode* child;
+
+    if (IS_UNIT(k)) {
+        child = assocNode(vm, AS_NODE(node->slots[i + 1]), shift + VECTOR_BITS, key, value, added);
+    }
+    else if (AS_STRING(k) == key) {
+        ObjNode* copy = copyNode(vm, node, node->count);
+        copy->slots[i + 1] = value;
+        return copy;
+    }
+    else {
+        child = pairNode(vm, shift + VECTOR_BITS, k, node->slots[i + 1], OBJ_VAL(key), value);
+        *added = true;
+    }
+
+    push(vm, OBJ_VAL(child));
+
+    ObjNode* copy = copyNode(vm, node, node->count);
+    copy->slots[i] = UNIT_VAL;
+    copy->slots[i + 1] = OBJ_VAL(child);
+
+    pop(vm);
+
+    return copy;
+}
+
+// Returns 'node' itself if 'key' isn't under it, and NULL if nothing is left
+static ObjNode* dissocNode(VM* vm, ObjNode* node, int shift, ObjString* key) {
+    if (shift >= PMAP_COLLISION_SHIFT) {
+        for (int i = 0; i < node->count; i += 2) {
+            if (AS_STRING(node->slots[i]) == key) {
+                return node->count == 2 ? NULL : removePair(vm, node, i);
+            }
+        }
+
+        return node;
+    }
+
+    uint32_t bit = bitFor(key->hash, shift);
+
+    if (!(node->bitmap & bit)) {
+        return node;
+    }
+
+    int i = slotFor(node->bitmap, bit);
+    Value k = node->slots[i];
+
+    if (IS_UNIT(k)) {
+        ObjNode* child = AS_NODE(node->slots[i + 1]);
+        ObjNode* newChild = dissocNode(vm, child, shift + VECTOR_BITS, key);
+
+        if (newChild == child) {
+            return node;
+        }
+
+        if (newChild != NULL) {
+            push(vm, OBJ_VAL(newChild));
+
+            ObjNode* copy = copyNode(vm, node, node->count);
+            copy->slots[i + 1] = OBJ_VAL(newChild);
+
+            pop(vm);
+
+            return copy;
+        }
+    }
+    else if (AS_STRING(k) != key) {
+        return node;
+    }
+
+    if (node->count == 2) {
+        return NULL;
+    }
+
+    ObjNode* copy = removePair(vm, node, i);
+    copy->bitmap &= ~bit;
+    return copy;
+}
+
+// 'key' must be interned
+ObjPMap* pmapAssoc(VM* vm, ObjPMap* map, ObjString* key, Value value) {
+    bool added = false;
+
+    ObjNode* root = assocNode(vm, map->root, 0, key, value, &added);
+    push(vm, OBJ_VAL(root));
+
+    ObjPMap* result = newPMap(vm);
+    result->root = root;
+    result->count = map->count + (added ? 1 : 0);
+
+    pop(vm);
+
+    return result;
+}
+
+ObjPMap* pmapDissoc(VM* vm, ObjPMap* map, ObjString* key) {
+    if (map->root == NULL) {
+        return map;
+    }
+
+    ObjNode* root = dissocNode(vm, map->root, 0, key);
+
+    if (root == map->root) {
+        return map;
+    }
+
+    if (root != NULL) {
+        push(vm, OBJ_VAL(root));
+    }
+
+    ObjPMap* result = newPMap(vm);
+    result->root = root;
+    result->count = map->count - 1;
+
+    if (root != NULL) {
+        pop(vm);
+    }
+
+    return result;
+}
+
+// Pairs in 'b' win over pairs in 'a'
+ObjPMap* pmapMerge(VM* vm, ObjPMap* a, ObjPMap* b) {
+    if (a->count == 0) {
+        return b;
+    }
+
+    ObjPMap* result = a;
+    push(vm, OBJ_VAL(result));
+
+    PMapCursor cursor;
+    ObjString* key;
+    Value value;
+
+    pmapCursor(b, &cursor);
+
+    while (pmapNext(&cursor, &key, &value)) {
+        result = pmapAssoc(vm, result, key, value);
+
+        pop(vm);
+        push(vm, OBJ_VAL(result));
+    }
+
+    pop(vm);
+
+    return result;
+}
+
+void pmapCursor(ObjPMap* map, PMapCursor* cursor) {
+    cursor->depth = 0;
+
+    if (map->root != NULL) {
+        cursor->nodes[0] = map->root;
+        cursor->index[0] = 0;
+        cursor->depth = 1;
+    }
+}
+
+// Walks the pairs depth first; the map must not be collected while walking
+bool pmapNext(PMapCursor* cursor, ObjString** key, Value* value) {
+    while (cursor->depth > 0) {
+        int d = cursor->depth - 1;
+        ObjNode* node = cursor->nodes[d];
+        int i = cursor->index[d];
+
+        if (i >= node->count) {
+            cursor->depth--;
+            continue;
+        }
+
+        cursor->index[d] = i + 2;
+
+        if (IS_UNIT(node->slots[i])) {
+            cursor->nodes[d + 1] = AS_NODE(node->slots[i + 1]);
+            cursor->index[d + 1] = 0;
+            cursor->depth++;
+            continue;
+        }
+
+        *key = AS_STRING(node->slots[i]);
+        *value = node->slots[i + 1];
+        return true;
+    }
+
+    return false;
+}
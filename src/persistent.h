@@ -0,0 +1,37 @@
+#ifndef persistent_h_hammer
+#define persistent_h_hammer
+
+#include "common.h"
+#include "object.h"
+
+#define VECTOR_BITS 5
+#define VECTOR_WIDTH (1 << VECTOR_BITS)
+#define VECTOR_MASK (VECTOR_WIDTH - 1)
+
+// Map nodes this deep have used up all 32 bits of the hash and hold colliding
+// keys in a flat list
+#define PMAP_COLLISION_SHIFT 35
+#define PMAP_MAX_DEPTH (PMAP_COLLISION_SHIFT / VECTOR_BITS + 1)
+
+typedef struct {
+    int depth;
+    ObjNode* nodes[PMAP_MAX_DEPTH];
+    int index[PMAP_MAX_DEPTH];
+} PMapCursor;
+
+// Every operation leaves its arguments untouched and returns a new version;
+// callers keep the arguments reachable while they run
+Value vectorGet(ObjVector* vector, int index);
+ObjVector* vectorConj(VM* vm, ObjVector* vector, Value value);
+ObjVector* vectorAssoc(VM* vm, ObjVector* vector, int index, Value value);
+ObjVector* vectorAppend(VM* vm, ObjVector* vector, Value items);
+
+Value* pmapGet(ObjPMap* map, ObjString* key);
+ObjPMap* pmapAssoc(VM* vm, ObjPMap* map, ObjString* key, Value value);
+ObjPMap* pmapDissoc(VM* vm, ObjPMap* map, ObjString* key);
+ObjPMap* pmapMerge(VM* vm, ObjPMap* a, ObjPMap* b);
+
+void pmapCursor(ObjPMap* map, PMapCursor* cursor);
+bool pmapNext(PMapCursor* cursor, ObjString** key, Value* value);
+
+#endif
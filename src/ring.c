@@ -0,0 +1,257 @@
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "ring.h"
+
+// Tries before a thread that can't get through goes to sleep
+#define RING_SPINS 64
+
+// Every cell carries a sequence number saying whose turn it is: a sender at
+// position p may fill it once it reads p, a receiver once it reads p + 1.
+// Positions are claimed with a CAS, so no lock is taken unless someone has to
+// wait (D. Vyukov's bounded MPMC queue)
+typedef struct {
+    atomic_size_t sequence;
+    Parcel parcel;
+} RingCell;
+
+struct Ring {
+    atomic_int refs;
+    size_t mask;
+    RingCell* cells;
+
+    // kept on separate lines so senders and receivers don't keep stealing
+    // each other's cache line
+    _Alignas(64) atomic_size_t sendPos;
+    _Alignas(64) atomic_size_t receivePos;
+
+    // only used by threads that have to wait
+    _Alignas(64) atomic_bool closed;
+    atomic_int sleepingSenders;
+    atomic_int sleepingReceivers;
+    pthread_mutex_t lock;
+    pthread_cond_t sendable;
+    pthread_cond_t receivable;
+};
+
+
+Ring* newRing(int capacity) {
+    size_t size = 2;
+
+    while (size < (size_t)capacity) {
+        size *= 2;
+    }
+
+    Ring* ring = aligned_alloc(64, (sizeof(Ring) + 63) / 64 * 64);
+    RingCell* cells = malloc(size * sizeof(RingCell));
+
+    if (ring == NULL || cells == NULL) {
+        exit(1);
+    }
+
+    for (size_t i = 0; i < size; i++) {
+        atomic_init(&cells[i].sequence, i);
+        initParcel(&cells[i].parcel);
+    }
+
+    atomic_init(&ring->refs, 1);
+    ring->mask = size - 1;
+    ring->cells = cells;
+    atomic_init(&ring->sendPos, 0);
+    atomic_init(&ring->receivePos, 0);
+    atomic_init(&ring->closed, false);
+    atomic_init(&ring->sleepingSenders, 0);
+    atomic_init(&ring->sleepingReceivers, 0);
+    pthread_mutex_init(&ring->lock, NULL);
+    pthread_cond_init(&ring->sendable, NULL);
+    pthread_cond_init(&ring->receivable, NULL);
+
+    return ring;
+}
+
+Ring* retainRing(Ring* ring) {
+    atomic_fetch_add(&ring->refs, 1);
+    return ring;
+}
+
+void releaseRing(Ring* ring) {
+    if (atomic_fetch_sub(&ring->refs, 1) != 1) {
+        return;
+    }
+
+    size_t end = atomic_load(&ring->sendPos);
+
+    for (size_t pos = atomic_load(&ring->receivePos); pos != end; pos++) {
+        freeParcel(&ring->cells[pos & ring->mask].parcel);
+    }
+
+    pthread_mutex_destroy(&ring->lock);
+    pthread_cond_destroy(&ring->sendable);
+    pthread_cond_destroy(&ring->receivable);
+    free(ring->cells);
+    free(ring);
+}
+
+static bool trySend(Ring* ring, Parcel* parcel) {
+    size_t pos = atomic_load_explicit(&ring->sendPos, memory_order_relaxed);
+
+    for (;;) {
+        RingCell* cell = &ring->cells[pos & ring->mask];
+        size_t sequence = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+        intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&ring->sendPos, &pos, pos + 1,
+                    memory_order_relaxed, memory_order_relaxed)) {
+                cell->parcel = *parcel;
+                atomic_store_explicit(&cell->sequence, pos + 1, memory_order_release);
+                initParcel(parcel);
+                return true;
+            }
+        }
+        else if (diff < 0) {
+            return false;
+        }
+        else {
+            pos = atomic_load_explicit(&ring->sendPos, memory_order_relaxed);
+        }
+    }
+}
+
+static bool tryReceive(Ring* ring, Parcel* parcel) {
+    size_t pos = atomic_load_explicit(&ring->receivePos, memory_order_relaxed);
+
+    for (;;) {
+        RingCell* cell = &ring->cells[pos & ring->mask];
+        size_t sequence = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+        intptr_t diff = (intptr_t)sequence - (intptr_t)(pos + 1);
+
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&ring->receivePos, &pos, pos + 1,
+                    memory_order_relaxed, memory_order_relaxed)) {
+                *parcel = cell->parcel;
+                atomic_store_explicit(&cell->sequence, pos + ring->mask + 1, memory_order_release);
+                return true;
+            }
+        }
+        else if (diff < 0) {
+            return false;
+        }
+        else {
+            pos = atomic_load_explicit(&ring->receivePos, memory_order_relaxed);
+        }
+    }
+}
+
+// A sleeper counts itself before its last try, and a waker publishes before it
+// checks the count, so one of the two always sees the other
+static void wake(Ring* ring, atomic_int* sleeping, pthread_cond_t* cond) {
+    atomic_thread_fence(memory_order_seq_cst);
+
+    if (atomic_load(sleeping) > 0) {
+        pthread_mutex_lock(&ring->lock);
+        pthread_cond_broadcast(cond);
+        pthread_mutex_unlock(&ring->lock);
+    }
+}
+
+RingResult ringSend(Ring* ring, Parcel* parcel, bool wait) {
+    for (int i = 0; i < RING_SPINS; i++) {
+        if (atomic_load(&ring->closed)) {
+            return RING_CLOSED;
+        }
+
+        if (trySend(ring, parcel)) {
+            wake(ring, &ring->sleepingReceivers, &ring->receivable);
+            return RING_OK;
+        }
+
+        if (!wait) {
+            return RING_FULL;
+        }
+
+        sched_yield();
+    }
+
+    pthread_mutex_lock(&ring->lock);
+    atomic_fetch_add(&ring->sleepingSenders, 1);
+    atomic_thread_fence(memory_order_seq_cst);
+
+    RingResult result = RING_OK;
+
+    while (!trySend(ring, parcel)) {
+        if (atomic_load(&ring->closed)) {
+            result = RING_CLOSED;
+            break;
+        }
+
+        pthread_cond_wait(&ring->sendable, &ring->lock);
+    }
+
+    atomic_fetch_sub(&ring->sleepingSenders, 1);
+    pthread_mutex_unlock(&ring->lock);
+
+    if (result == RING_OK) {
+        wake(ring, &ring->sleepingReceivers, &ring->receivable);
+    }
+
+    return result;
+}
+
+RingResult ringReceive(Ring* ring, Parcel* parcel, bool wait) {
+    for (int i = 0; i < RING_SPINS; i++) {
+        if (tryReceive(ring, parcel)) {
+            wake(ring, &ring->sleepingSenders, &ring->sendable);
+            return RING_OK;
+        }
+
+        if (atomic_load(&ring->closed)) {
+            // something may have been sent just before it closed
+            return tryReceive(ring, parcel) ? RING_OK : RING_CLOSED;
+        }
+
+        if (!wait) {
+            return RING_EMPTY;
+        }
+
+        sched_yield();
+    }
+
+    pthread_mutex_lock(&ring->lock);
+    atomic_fetch_add(&ring->sleepingReceivers, 1);
+    atomic_thread_fence(memory_order_seq_cst);
+
+    RingResult result = RING_OK;
+
+    while (!tryReceive(ring, parcel)) {
+        if (atomic_load(&ring->closed)) {
+            result = tryReceive(ring, parcel) ? RING_OK : RING_CLOSED;
+            break;
+        }
+
+        pthread_cond_wait(&ring->receivable, &ring->lock);
+    }
+
+    atomic_fetch_sub(&ring->sleepingReceivers, 1);
+    pthread_mutex_unlock(&ring->lock);
+
+    if (result == RING_OK) {
+        wake(ring, &ring->sleepingSenders, &ring->sendable);
+    }
+
+    return result;
+}
+
+void closeRing(Ring* ring) {
+    atomic_store(&ring->closed, true);
+
+    pthread_mutex_lock(&ring->lock);
+    pthread_cond_broadcast(&ring->sendable);
+    pthread_cond_broadcast(&ring->receivable);
+    pthread_mutex_unlock(&ring->lock);
+}
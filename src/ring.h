@@ -0,0 +1,28 @@
+#ifndef ring_h_hammer
+#define ring_h_hammer
+
+#include "common.h"
+#include "transfer.h"
+
+typedef enum {
+    RING_OK,
+    RING_FULL,      // only when not waiting
+    RING_EMPTY,     // only when not waiting
+    RING_CLOSED,
+} RingResult;
+
+// Bounded queue of parcels that any number of threads can send to and receive
+// from at once; lives outside every VM's heap and is freed with its last
+// reference
+Ring* newRing(int capacity);
+Ring* retainRing(Ring* ring);
+void releaseRing(Ring* ring);
+
+// Sending takes the parcel over; receiving hands one back
+RingResult ringSend(Ring* ring, Parcel* parcel, bool wait);
+RingResult ringReceive(Ring* ring, Parcel* parcel, bool wait);
+
+// Wakes everyone waiting; receivers get what's left, then RING_CLOSED
+void closeRing(Ring* ring);
+
+#endif
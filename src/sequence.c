@@ -0,0 +1,242 @@
+#include <string.h>
+
+#include "common.h"
+#include "sequence.h"
+#include "object.h"
+#include "persistent.h"
+#include "vm.h"
+#include "builtins.h"
+
+
+bool isSequence(Value value) {
+    if (!IS_OBJ(value)) {
+        return false;
+    }
+
+    switch (OBJ_TYPE(value)) {
+    case OBJ_STRING:
+    case OBJ_LIST:
+    case OBJ_VECTOR:
+    case OBJ_ARRAY:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Sequences plus iterators, fibers and readers, which can only be walked with
+// a cursor
+bool isIterable(Value value) {
+    return isSequence(value) || IS_ITERATOR(value) || IS_FIBER(value) || IS_READER(value);
+}
+
+int seqLength(Value seq) {
+    switch (OBJ_TYPE(seq)) {
+    case OBJ_STRING:    return AS_STRING(seq)->length;
+    case OBJ_LIST:      return ARRAY(seq).count;
+    case OBJ_VECTOR:    return AS_VECTOR(seq)->count;
+    case OBJ_ARRAY:     return AS_ARRAY(seq)->count;
+    default:            return 0;
+    }
+}
+
+// 'index' must be in range
+Value seqAt(Value seq, int index) {
+    switch (OBJ_TYPE(seq)) {
+    case OBJ_STRING:    return CHAR_VAL(AS_CSTRING(seq)[index]);
+    case OBJ_LIST:      return IS_RANGE(seq) ? INT_VAL(rangeAt(AS_RANGE(seq), index)) : ELEMS(seq)[index];
+    case OBJ_VECTOR:    return vectorGet(AS_VECTOR(seq), index);
+    case OBJ_ARRAY:     return arrayAt(AS_ARRAY(seq), index);
+    default:            return UNIT_VAL;
+    }
+}
+
+typedef enum {
+    STEP_VALUE,
+    STEP_DONE,
+    STEP_ERROR,
+} Step;
+
+// Each value a fiber yields is an item; what it finally returns isn't
+static Step stepFiber(VM* vm, ObjFiber* fiber, Value* value) {
+    if (fiber->state == FIBER_DONE) {
+        return STEP_DONE;
+    }
+
+    if (!resumeFiber(vm, fiber, UNIT_VAL, value)) {
+        return STEP_ERROR;
+    }
+
+    return fiber->state == FIBER_DONE ? STEP_DONE : STEP_VALUE;
+}
+
+// Readers can't go back either, so a second walk carries on where it left off
+static Step stepReader(VM* vm, ObjReader* reader, Value* value) {
+    switch (readRecord(vm, reader, value)) {
+    case READ_RECORD:   return STEP_VALUE;
+    case READ_END:      return STEP_DONE;
+    default:            return STEP_ERROR;
+    }
+}
+
+// Pulls one value through 'iter'; 'positions' holds where this walk is in each
+// of its sources, in the order they're reached. Values are kept on the stack
+// whenever the next step could collect
+static Step step(VM* vm, ObjIterator* iter, int* positions, Value* value) {
+    switch (iter->kind) {
+    case ITER_SOURCE: {
+        if (IS_FIBER(iter->source)) {
+            return stepFiber(vm, AS_FIBER(iter->source), value);
+        }
+
+        if (IS_READER(iter->source)) {
+            return stepReader(vm, AS_READER(iter->source), value);
+        }
+
+        if (*positions >= seqLength(iter->source)) {
+            return STEP_DONE;
+        }
+
+        *value = seqAt(iter->source, (*positions)++);
+        return STEP_VALUE;
+    }
+    case ITER_MAP: {
+        Step result = step(vm, AS_ITERATOR(iter->source), positions, value);
+
+        if (result != STEP_VALUE) {
+            return result;
+        }
+
+        push(vm, iter->fn);
+        push(vm, *value);
+
+        if (!callFromC(vm, iter->fn, 1)) {
+            return STEP_ERROR;
+        }
+
+        *value = pop(vm);
+        return STEP_VALUE;
+    }
+    case ITER_FILTER: {
+        for (;;) {
+            Step result = step(vm, AS_ITERATOR(iter->source), positions, value);
+
+            if (result != STEP_VALUE) {
+                return result;
+            }
+
+            push(vm, *value);
+            push(vm, iter->fn);
+            push(vm, *value);
+
+            if (!callFromC(vm, iter->fn, 1)) {
+                return STEP_ERROR;
+            }
+
+            bool keep = isTruthy(pop(vm));
+            pop(vm);
+
+            if (keep) {
+                return STEP_VALUE;
+            }
+        }
+    }
+    case ITER_ZIP: {
+        Value x, y;
+        ObjIterator* first = AS_ITERATOR(iter->source);
+        Step result = step(vm, first, positions, &x);
+
+        if (result != STEP_VALUE) {
+            return result;
+        }
+
+        push(vm, x);
+        result = step(vm, AS_ITERATOR(iter->other), positions + first->sources, &y);
+        pop(vm);
+
+        if (result != STEP_VALUE) {
+            return result;
+        }
+
+        push(vm, iter->fn);
+        push(vm, x);
+        push(vm, y);
+
+        if (!callFromC(vm, iter->fn, 2)) {
+            return STEP_ERROR;
+        }
+
+        *value = pop(vm);
+        return STEP_VALUE;
+    }
+    }
+
+    return STEP_DONE;
+}
+
+void initCursor(Cursor* cursor, Value seq) {
+    cursor->seq = seq;
+    cursor->index = 0;
+    cursor->failed = false;
+
+    // every walk starts each source from the top
+    memset(cursor->positions, 0, sizeof(cursor->positions));
+}
+
+// Lengths are re-read every step, since lists can grow while being walked;
+// when this returns false, check 'failed' to tell an error from the end
+bool cursorNext(VM* vm, Cursor* cursor, Value* value) {
+    if (IS_ITERATOR(cursor->seq) || IS_FIBER(cursor->seq) || IS_READER(cursor->seq)) {
+        Step result = IS_FIBER(cursor->seq)
+            ? stepFiber(vm, AS_FIBER(cursor->seq), value)
+            : IS_READER(cursor->seq)
+            ? stepReader(vm, AS_READER(cursor->seq), value)
+            : step(vm, AS_ITERATOR(cursor->seq), cursor->positions, value);
+
+        switch (result) {
+        case STEP_VALUE:    cursor->index++; return true;
+        case STEP_DONE:     return false;
+        case STEP_ERROR:    cursor->failed = true; return false;
+        }
+    }
+
+    if (cursor->index >= seqLength(cursor->seq)) {
+        return false;
+    }
+
+    *value = seqAt(cursor->seq, cursor->index++);
+    return true;
+}
+
+// Wraps a plain sequence as the source of a pipeline
+ObjIterator* toIterator(VM* vm, Value iterable) {
+    if (IS_ITERATOR(iterable)) {
+        return AS_ITERATOR(iterable);
+    }
+
+    return newIterator(vm, ITER_SOURCE, UNIT_VAL, iterable, UNIT_VAL);
+}
+
+// Runs an iterator, fiber or reader to the end, collecting what comes out; NULL if
+// anything failed
+ObjList* drainIterator(VM* vm, Value iter) {
+    ObjList* list = newList(vm);
+    push(vm, OBJ_VAL(list));
+
+    Cursor cursor;
+    Value x;
+    initCursor(&cursor, iter);
+
+    while (cursorNext(vm, &cursor, &x)) {
+        push(vm, x);
+        writeValueArray(vm, &list->array, x);
+        pop(vm);
+    }
+
+    if (cursor.failed) {
+        return NULL;
+    }
+
+    pop(vm);
+    return list;
+}
@@ -0,0 +1,31 @@
+#ifndef sequence_h_hammer
+#define sequence_h_hammer
+
+#include "common.h"
+#include "object.h"
+
+// Iterator pipelines read from at most this many sources, so a cursor can
+// keep its place in each of them itself
+#define CURSOR_MAX_SOURCES 16
+
+// Position in anything that can be walked front to back; natives walking a
+// sequence should go through this rather than reaching into the object
+typedef struct {
+    Value seq;
+    int index;
+    bool failed;    // set when pulling through an iterator raised an error
+    int positions[CURSOR_MAX_SOURCES];  // how far each source of an iterator has read
+} Cursor;
+
+bool isSequence(Value value);
+bool isIterable(Value value);
+int seqLength(Value seq);
+Value seqAt(Value seq, int index);
+
+void initCursor(Cursor* cursor, Value seq);
+bool cursorNext(VM* vm, Cursor* cursor, Value* value);
+
+ObjIterator* toIterator(VM* vm, Value iterable);
+ObjList* drainIterator(VM* vm, Value iter);
+
+#endif
@@ -1,6 +1,8 @@
 #include "serialise.h"
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include "ast.h"
 #include "scanner.h"
 
@@ -156,3 +158,249 @@ void serialiseExpr(FILE* file, Expr* expression) {
         default: break;
     }
 }
+
+/*
++---------------------------+
+| JSON                 ^^^^ |
++---------------------------+
+| Flat                 vvvv |
++---------------------------+
+*/
+
+// Tables for a flat AST as it's written; tokens and strings that come up
+// more than once are only stored the first time
+typedef struct {
+    FlatToken* tokens;
+    uint32_t tokenCount;
+    uint32_t tokenCapacity;
+    FlatNode* nodes;
+    uint32_t nodeCount;
+    uint32_t nodeCapacity;
+    uint32_t* children;
+    uint32_t childCount;
+    uint32_t childCapacity;
+    char* strings;
+    uint32_t stringBytes;
+    uint32_t stringCapacity;
+    uint32_t stringCount;
+    uint32_t* stringIndex;  // open addressing; offset + 1, 0 when empty
+    uint32_t stringSlots;
+    uint32_t* tokenIndex;   // same, holding token index + 1
+    uint32_t tokenSlots;
+} FlatWriter;
+
+#define GROW_TABLE(table, count, capacity, type) \
+    do { \
+        if ((count) + 1 > (capacity)) { \
+            (capacity) = (capacity) < 8 ? 8 : (capacity) * 2; \
+            (table) = (type*)realloc((table), sizeof(type) * (capacity)); \
+            if ((table) == NULL) exit(64); \
+        } \
+    } while (false)
+
+static uint32_t hashFlat(const char* chars, size_t length, uint32_t seed) {
+    uint32_t hash = 2166136261u ^ seed;
+
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (uint8_t)chars[i];
+        hash *= 16777619;
+    }
+
+    return hash;
+}
+
+// Doubles 'slots' and puts every entry back, hashed by 'rehash'
+static uint32_t* growIndex(FlatWriter* writer, uint32_t* index, uint32_t* slots,
+                           uint32_t (*rehash)(FlatWriter*, uint32_t)) {
+    uint32_t oldSlots = *slots;
+    *slots = oldSlots == 0 ? 64 : oldSlots * 2;
+
+    uint32_t* grown = (uint32_t*)calloc(*slots, sizeof(uint32_t));
+    if (grown == NULL) exit(64);
+
+    for (uint32_t i = 0; i < oldSlots; i++) {
+        if (index[i] != 0) {
+            uint32_t slot = rehash(writer, index[i] - 1) & (*slots - 1);
+
+            while (grown[slot] != 0) {
+                slot = (slot + 1) & (*slots - 1);
+            }
+
+            grown[slot] = index[i];
+        }
+    }
+
+    free(index);
+    return grown;
+}
+
+static uint32_t rehashString(FlatWriter* writer, uint32_t offset) {
+    const char* chars = writer->strings + offset;
+    return hashFlat(chars, strlen(chars), 0);
+}
+
+static uint32_t hashToken(FlatToken* token) {
+    uint32_t parts[3] = { token->type, (uint32_t)token->line, token->start };
+    return hashFlat((const char*)parts, sizeof(parts), 0);
+}
+
+static uint32_t rehashToken(FlatWriter* writer, uint32_t index) {
+    return hashToken(&writer->tokens[index]);
+}
+
+static uint32_t flatString(FlatWriter* writer, const char* chars, int length) {
+    if (chars == NULL) {
+        chars = "";
+        length = 0;
+    }
+
+    if ((writer->stringCount + 1) * 2 > writer->stringSlots) {
+        writer->stringIndex = growIndex(writer, writer->stringIndex, &writer->stringSlots, rehashString);
+    }
+
+    uint32_t mask = writer->stringSlots - 1;
+    uint32_t slot = hashFlat(chars, length, 0) & mask;
+
+    for (; writer->stringIndex[slot] != 0; slot = (slot + 1) & mask) {
+        const char* found = writer->strings + writer->stringIndex[slot] - 1;
+
+        if (memcmp(found, chars, length) == 0 && found[length] == '\0') {
+            return writer->stringIndex[slot] - 1;
+        }
+    }
+
+    uint32_t offset = writer->stringBytes;
+
+    while (writer->stringBytes + length + 1 > writer->stringCapacity) {
+        writer->stringCapacity = writer->stringCapacity < 256 ? 256 : writer->stringCapacity * 2;
+        writer->strings = (char*)realloc(writer->strings, writer->stringCapacity);
+        if (writer->strings == NULL) exit(64);
+    }
+
+    memcpy(writer->strings + offset, chars, length);
+    writer->strings[offset + length] = '\0';
+    writer->stringBytes += length + 1;
+    writer->stringIndex[slot] = offset + 1;
+    writer->stringCount++;
+
+    return offset;
+}
+
+static uint32_t flatToken(FlatWriter* writer, Token* token) {
+    FlatToken flat = { (uint8_t)token->type, { 0, 0, 0 }, token->line, 0, 0 };
+    flat.start = flatString(writer, token->start, token->length);
+    flat.length = token->start == NULL ? 0 : (uint32_t)token->length;
+
+    if ((writer->tokenCount + 1) * 2 > writer->tokenSlots) {
+        writer->tokenIndex = growIndex(writer, writer->tokenIndex, &writer->tokenSlots, rehashToken);
+    }
+
+    uint32_t mask = writer->tokenSlots - 1;
+    uint32_t slot = hashToken(&flat) & mask;
+
+    for (; writer->tokenIndex[slot] != 0; slot = (slot + 1) & mask) {
+        FlatToken* found = &writer->tokens[writer->tokenIndex[slot] - 1];
+
+        if (found->type == flat.type && found->line == flat.line && found->start == flat.start) {
+            return writer->tokenIndex[slot] - 1;
+        }
+    }
+
+    GROW_TABLE(writer->tokens, writer->tokenCount, writer->tokenCapacity, FlatToken);
+    writer->tokens[writer->tokenCount] = flat;
+    writer->tokenIndex[slot] = writer->tokenCount + 1;
+
+    return writer->tokenCount++;
+}
+
+static uint32_t flatNode(FlatWriter* writer, Expr* expression);
+
+static uint32_t addNode(FlatWriter* writer, ExprType type, Token* token, uint32_t a, uint32_t b, uint32_t c) {
+    FlatNode node = { (uint8_t)type, { 0, 0, 0 }, flatToken(writer, token), a, b, c };
+
+    GROW_TABLE(writer->nodes, writer->nodeCount, writer->nodeCapacity, FlatNode);
+    writer->nodes[writer->nodeCount] = node;
+
+    return writer->nodeCount++;
+}
+
+static uint32_t flatBlock(FlatWriter* writer, BlockExpr* block) {
+    // children are written first, so their indexes are held until the end
+    uint32_t* indexes = (uint32_t*)malloc(sizeof(uint32_t) * (block->count + 1));
+    if (indexes == NULL) exit(64);
+
+    for (int i = 0; i < block->count; i++) {
+        indexes[i] = flatNode(writer, block->subexprs[i]);
+    }
+
+    uint32_t first = writer->childCount;
+
+    for (int i = 0; i < block->count; i++) {
+        GROW_TABLE(writer->children, writer->childCount, writer->childCapacity, uint32_t);
+        writer->children[writer->childCount++] = indexes[i];
+    }
+
+    free(indexes);
+    return addNode(writer, EXPR_BLOCK, &block->token, first, (uint32_t)block->count, 0);
+}
+
+static uint32_t flatNode(FlatWriter* writer, Expr* expression) {
+    switch (expression->type) {
+        case EXPR_LITERAL: {
+            LiteralExpr* literal = (LiteralExpr*)expression;
+            return addNode(writer, EXPR_LITERAL, &literal->token, 0, 0, 0);
+        }
+        case EXPR_UNARY: {
+            UnaryExpr* unary = (UnaryExpr*)expression;
+            uint32_t operand = flatNode(writer, unary->operand);
+            return addNode(writer, EXPR_UNARY, &unary->token, operand, 0, 0);
+        }
+        case EXPR_BINARY: {
+            BinaryExpr* binary = (BinaryExpr*)expression;
+            uint32_t left = flatNode(writer, binary->left);
+            uint32_t right = flatNode(writer, binary->right);
+            return addNode(writer, EXPR_BINARY, &binary->token, left, right, 0);
+        }
+        case EXPR_TERNARY: {
+            TernaryExpr* ternary = (TernaryExpr*)expression;
+            uint32_t pivot = flatNode(writer, ternary->pivot);
+            uint32_t left = flatNode(writer, ternary->left);
+            uint32_t right = flatNode(writer, ternary->right);
+            return addNode(writer, EXPR_TERNARY, &ternary->token, pivot, left, right);
+        }
+        case EXPR_BLOCK:
+        default:
+            return flatBlock(writer, (BlockExpr*)expression);
+    }
+}
+
+void serialiseFlat(FILE* file, Expr* program) {
+    FlatWriter writer;
+    memset(&writer, 0, sizeof(writer));
+
+    flatNode(&writer, program);
+
+    // the string table is padded so anything appended stays aligned
+    while (writer.stringBytes % 4 != 0) {
+        GROW_TABLE(writer.strings, writer.stringBytes, writer.stringCapacity, char);
+        writer.strings[writer.stringBytes++] = '\0';
+    }
+
+    FlatHeader header = {
+        FLAT_MAGIC, FLAT_VERSION, FLAT_ORDER,
+        writer.tokenCount, writer.nodeCount, writer.childCount, writer.stringBytes
+    };
+
+    fwrite(&header, sizeof(header), 1, file);
+    fwrite(writer.tokens, sizeof(FlatToken), writer.tokenCount, file);
+    fwrite(writer.nodes, sizeof(FlatNode), writer.nodeCount, file);
+    fwrite(writer.children, sizeof(uint32_t), writer.childCount, file);
+    fwrite(writer.strings, 1, writer.stringBytes, file);
+
+    free(writer.tokens);
+    free(writer.nodes);
+    free(writer.children);
+    free(writer.strings);
+    free(writer.stringIndex);
+    free(writer.tokenIndex);
+}
@@ -6,4 +6,48 @@
 
 void serialiseExpr(FILE *file, Expr *expression);
 
+// Flat ASTs are a header followed by four tables, each starting 4-byte
+// aligned:
+//   tokens     FlatToken[tokenCount]
+//   nodes      FlatNode[nodeCount], children before parents, the program last
+//   children   uint32_t[childCount], the subexpressions of each block in turn
+//   strings    the text of every distinct token, each ending in a '\0'
+// Nodes name their token and children by index, so the whole thing can be
+// read in one pass from wherever it's mapped
+#define FLAT_MAGIC "HMRA"
+#define FLAT_VERSION 1
+#define FLAT_ORDER 0x0102
+
+typedef struct {
+    char magic[4];
+    uint16_t version;
+    uint16_t order;
+    uint32_t tokenCount;
+    uint32_t nodeCount;
+    uint32_t childCount;
+    uint32_t stringBytes;
+} FlatHeader;
+
+typedef struct {
+    uint8_t type;       // a TokenType
+    uint8_t unused[3];
+    int32_t line;
+    uint32_t start;     // in the string table
+    uint32_t length;
+} FlatToken;
+
+// Unary nodes use 'a', binary nodes 'a' and 'b', ternary nodes all three as
+// pivot, left and right; a block's children are 'b' entries of the children
+// table, starting at 'a'
+typedef struct {
+    uint8_t type;       // an ExprType
+    uint8_t unused[3];
+    uint32_t token;
+    uint32_t a;
+    uint32_t b;
+    uint32_t c;
+} FlatNode;
+
+void serialiseFlat(FILE* file, Expr* program);
+
 #endif
@@ -0,0 +1,134 @@
+#include <stdio.h>
+
+#include "common.h"
+#include "shape.h"
+#include "object.h"
+#include "table.h"
+#include "memory.h"
+#include "vm.h"
+
+
+int shapeSlot(ObjShape* shape, ObjString* key) {
+    Entry* entry = tableGetEntry(&shape->index, key);
+
+    if (entry == NULL) {
+        return -1;
+    }
+
+    return (int)AS_INT(entry->value);
+}
+
+// Follows (or creates) the transition from 'shape' that appends 'key';
+// returns NULL if the map should be demoted to a dictionary instead
+static ObjShape* transition(VM* vm, ObjShape* shape, ObjString* key) {
+    Entry* entry = tableGetEntry(&shape->transitions, key);
+
+    if (entry != NULL) {
+        return AS_SHAPE(entry->value);
+    }
+
+    int limit = shape == vm->rootShape ? SHAPE_MAX_ROOT_TRANSITIONS : SHAPE_MAX_TRANSITIONS;
+
+    if (shape->keys.count >= SHAPE_MAX_SLOTS || shape->transitions.count >= limit) {
+        return NULL;
+    }
+
+    ObjShape* next = newShape(vm);
+
+    // GC :: 'next' isn't reachable from anything until it's in the transition table
+    push(vm, OBJ_VAL(next));
+
+    for (int i = 0; i < shape->keys.count; i++) {
+        writeValueArray(vm, &next->keys, shape->keys.values[i]);
+        tableAddEntry(vm, &next->index, AS_STRING(shape->keys.values[i]), INT_VAL(i));
+    }
+
+    writeValueArray(vm, &next->keys, OBJ_VAL(key));
+    tableAddEntry(vm, &next->index, key, INT_VAL(shape->keys.count));
+
+    tableAddEntry(vm, &shape->transitions, key, OBJ_VAL(next));
+
+    pop(vm);
+
+    return next;
+}
+
+static void toDictionary(VM* vm, ObjMap* map) {
+    ObjShape* shape = map->shape;
+
+    for (int i = 0; i < shape->keys.count; i++) {
+        tableAddEntry(vm, &map->table, AS_STRING(shape->keys.values[i]), map->slots.values[i]);
+    }
+
+    freeValueArray(vm, &map->slots);
+    map->shape = NULL;
+}
+
+int mapCount(ObjMap* map) {
+    if (map->shape != NULL) {
+        return map->shape->keys.count;
+    }
+
+    return map->table.count;
+}
+
+Value* mapGet(ObjMap* map, ObjString* key) {
+    if (map->shape != NULL) {
+        int slot = shapeSlot(map->shape, key);
+        return slot == -1 ? NULL : &map->slots.values[slot];
+    }
+
+    Entry* entry = tableGetEntry(&map->table, key);
+    return entry == NULL ? NULL : &entry->value;
+}
+
+// Same contract as tableAddEntry; returns whether the key is new to the map
+bool mapSet(VM* vm, ObjMap* map, ObjString* key, Value value) {
+    if (map->shape != NULL) {
+        int slot = shapeSlot(map->shape, key);
+
+        if (slot != -1) {
+            map->slots.values[slot] = value;
+            return false;
+        }
+
+        ObjShape* next = transition(vm, map->shape, key);
+
+        if (next != NULL) {
+            writeValueArray(vm, &map->slots, value);
+            map->shape = next;
+            return true;
+        }
+
+        toDictionary(vm, map);
+    }
+
+    return tableAddEntry(vm, &map->table, key, value);
+}
+
+// Walks a map's entries in slot order (or table order for dictionaries);
+// start with *cursor at 0
+bool mapNext(ObjMap* map, int* cursor, ObjString** key, Value* value) {
+    if (map->shape != NULL) {
+        if (*cursor >= map->shape->keys.count) {
+            return false;
+        }
+
+        *key = AS_STRING(map->shape->keys.values[*cursor]);
+        *value = map->slots.values[*cursor];
+        (*cursor)++;
+        return true;
+    }
+
+    while (*cursor < map->table.capacity) {
+        Entry* entry = &map->table.entries[(*cursor)++];
+
+        if (entry->key != NULL) {
+            *key = entry->key;
+            *value = entry->value;
+            return true;
+        }
+    }
+
+    return false;
+}
@@ -0,0 +1,23 @@
+#ifndef shape_h_hammer
+#define shape_h_hammer
+
+#include "common.h"
+#include "object.h"
+
+// Maps with more keys than this are kept as plain hashtables
+#define SHAPE_MAX_SLOTS 32
+// Shapes with this many distinct successors are considered unpredictable;
+// maps growing past them fall back to dictionary mode
+#define SHAPE_MAX_TRANSITIONS 8
+// Every map starts at the root, so its successors are every first key the
+// program uses rather than a sign of unpredictable maps
+#define SHAPE_MAX_ROOT_TRANSITIONS 4096
+
+int shapeSlot(ObjShape* shape, ObjString* key);
+
+int mapCount(ObjMap* map);
+Value* mapGet(ObjMap* map, ObjString* key);
+bool mapSet(VM* vm, ObjMap* map, ObjString* key, Value value);
+bool mapNext(ObjMap* map, int* cursor, ObjString** key, Value* value);
+
+#endif
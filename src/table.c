@@ -144,6 +144,20 @@ bool tableAddEntry(VM* vm, Table* table, ObjString* key, Value value) {
     return isNewEntry;
 }
 
+// Grows the table once, up front, so 'count' more entries fit without it
+// having to grow again; capacities follow the same steps as tableAddEntry
+void tableReserve(VM* vm, Table* table, int count) {
+    int capacity = table->capacity;
+
+    while (table->count + count > capacity * TABLE_MAX_LOAD) {
+        capacity = GROW_CAP(capacity);
+    }
+
+    if (capacity != table->capacity) {
+        growTable(vm, table, capacity);
+    }
+}
+
 bool tableDeleteEntry(Table* table, ObjString* key) {
     if (table->count == 0) return false;
 
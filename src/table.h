@@ -18,6 +18,7 @@ typedef struct {
 void initTable(Table* table);
 void freeTable(VM* vm, Table* table);
 bool tableAddEntry(VM* vm, Table* table, ObjString* key, Value value);
+void tableReserve(VM* vm, Table* table, int count);
 bool tableDeleteEntry(Table* table, ObjString* key);
 bool pingTable(Table* table, const char* str, size_t length);
 ObjString* tableFindString(Table* table, const char* chars, size_t length, uint32_t hash);
@@ -0,0 +1,1391 @@
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "transfer.h"
+#include "memory.h"
+#include "shape.h"
+#include "persistent.h"
+#include "vm.h"
+#include "ring.h"
+#include "sequence.h"
+
+
+void initTransfer(Transfer* memo) {
+    memo->count = 0;
+    memo->capacity = 0;
+    memo->from = NULL;
+    memo->to = NULL;
+}
+
+void freeTransfer(VM* vm, Transfer* memo) {
+    FREE_ARRAY(vm, memo->from, memo->capacity, Obj*);
+    FREE_ARRAY(vm, memo->to, memo->capacity, Obj*);
+    initTransfer(memo);
+}
+
+static uint32_t hashPointer(Obj* object) {
+    return (uint32_t)(((uintptr_t)object >> 3) * 2654435761u);
+}
+
+static int findSlot(Obj** from, int capacity, Obj* object) {
+    int index = hashPointer(object) & (capacity - 1);
+
+    while (from[index] != NULL && from[index] != object) {
+        index = (index + 1) & (capacity - 1);
+    }
+
+    return index;
+}
+
+static Obj* lookup(Transfer* memo, Obj* object) {
+    if (memo->count == 0) {
+        return NULL;
+    }
+
+    int index = findSlot(memo->from, memo->capacity, object);
+    return memo->from[index] == NULL ? NULL : memo->to[index];
+}
+
+static void remember(VM* vm, Transfer* memo, Obj* from, Obj* to) {
+    if ((memo->count + 1) * 4 > memo->capacity * 3) {
+        int capacity = GROW_CAP(memo->capacity) * 4;
+        Obj** froms = ALLOCATE(vm, capacity, Obj*);
+        Obj** tos = ALLOCATE(vm, capacity, Obj*);
+
+        for (int i = 0; i < capacity; i++) {
+            froms[i] = NULL;
+        }
+
+        for (int i = 0; i < memo->capacity; i++) {
+            if (memo->from[i] != NULL) {
+                int index = findSlot(froms, capacity, memo->from[i]);
+                froms[index] = memo->from[i];
+                tos[index] = memo->to[i];
+            }
+        }
+
+        FREE_ARRAY(vm, memo->from, memo->capacity, Obj*);
+        FREE_ARRAY(vm, memo->to, memo->capacity, Obj*);
+        memo->from = froms;
+        memo->to = tos;
+        memo->capacity = capacity;
+    }
+
+    int index = findSlot(memo->from, memo->capacity, from);
+    memo->from[index] = from;
+    memo->to[index] = to;
+    memo->count++;
+}
+
+static bool copyValues(VM* vm, Transfer* memo, const Value* values, int count, ValueArray* into) {
+    for (int i = 0; i < count; i++) {
+        Value value;
+
+        if (!transferValue(vm, memo, values[i], &value)) {
+            return false;
+        }
+
+        writeValueArray(vm, into, value);
+    }
+
+    return true;
+}
+
+static ObjFunction* copyFunction(VM* vm, Transfer* memo, ObjFunction* source) {
+    ObjFunction* function = newFunction(vm, NULL);
+    remember(vm, memo, (Obj*)source, (Obj*)function);
+
+    if (source->name != NULL) {
+        function->name = copyString(vm, source->name->chars, source->name->length);
+    }
+
+    function->arity = source->arity;
+
+    Chunk* from = &source->body;
+    Chunk* body = &function->body;
+
+    body->code = ALLOCATE(vm, from->count, uint8_t);
+    body->lines = ALLOCATE(vm, from->count, int);
+    memcpy(body->code, from->code, from->count);
+    memcpy(body->lines, from->lines, from->count * sizeof(int));
+    body->count = from->count;
+    body->capacity = from->count;
+
+    // shapes belong to the old heap, so every site starts cold again
+    body->caches = ALLOCATE(vm, from->cacheCount, InlineCache);
+    for (int i = 0; i < from->cacheCount; i++) {
+        body->caches[i] = (InlineCache){ NULL, 0 };
+    }
+    body->cacheCount = from->cacheCount;
+
+    if (!copyValues(vm, memo, from->constants.values, from->constants.count, &body->constants)) {
+        return NULL;
+    }
+
+    return function;
+}
+
+// Cons lists can be far longer than the C stack is deep, so cdrs are followed
+// in a loop and only cars recurse
+static bool copyCells(VM* vm, Transfer* memo, ObjCell* source, Value* out) {
+    ObjCell* head = newCell(vm);
+    remember(vm, memo, (Obj*)source, (Obj*)head);
+    *out = OBJ_VAL(head);
+
+    for (;;) {
+        if (!transferValue(vm, memo, source->car, &head->car)) {
+            return false;
+        }
+
+        Value next = source->cdr;
+
+        if (!IS_CELL(next) || lookup(memo, AS_OBJ(next)) != NULL) {
+            return transferValue(vm, memo, next, &head->cdr);
+        }
+
+        ObjCell* cell = newCell(vm);
+        remember(vm, memo, AS_OBJ(next), (Obj*)cell);
+        head->cdr = OBJ_VAL(cell);
+
+        head = cell;
+        source = AS_CELL(next);
+    }
+}
+
+bool transferValue(VM* vm, Transfer* memo, Value value, Value* out) {
+    if (!IS_OBJ(value)) {
+        *out = value;
+        return true;
+    }
+
+    Obj* seen = lookup(memo, AS_OBJ(value));
+
+    if (seen != NULL) {
+        *out = OBJ_VAL(seen);
+        return true;
+    }
+
+    switch (OBJ_TYPE(value)) {
+        case OBJ_STRING: {
+            ObjString* string = AS_STRING(value);
+            *out = OBJ_VAL(copyString(vm, string->chars, string->length));
+            return true;
+        }
+        case OBJ_CELL: {
+            return copyCells(vm, memo, AS_CELL(value), out);
+        }
+        case OBJ_NATIVE: {
+            ObjNative* native = AS_NATIVE(value);
+            ObjNative* copy = newNative(vm, native->function, native->arity);
+            remember(vm, memo, AS_OBJ(value), (Obj*)copy);
+            *out = OBJ_VAL(copy);
+            return true;
+        }
+        case OBJ_FUNCTION: {
+            ObjFunction* function = copyFunction(vm, memo, AS_FUNC(value));
+            *out = OBJ_VAL(function);
+            return function != NULL;
+        }
+        case OBJ_CLOSURE: {
+            ObjClosure* source = AS_CLOSURE(value);
+            ObjClosure* closure = newClosure(vm, NULL, source->upvalueCount);
+            remember(vm, memo, AS_OBJ(value), (Obj*)closure);
+            *out = OBJ_VAL(closure);
+
+            memcpy(closure->depths, source->depths, source->upvalueCount);
+            for (int i = 0; i < source->upvalueCount; i++) {
+                closure->upvalues[i] = UNIT_VAL;
+            }
+
+            Value function;
+            if (!transferValue(vm, memo, OBJ_VAL(source->function), &function)) {
+                return false;
+            }
+            closure->function = AS_FUNC(function);
+
+            for (int i = 0; i < source->upvalueCount; i++) {
+                if (!transferValue(vm, memo, source->upvalues[i], &closure->upvalues[i])) {
+                    return false;
+                }
+            }
+
+            return true;
+        }
+        case OBJ_LIST: {
+            if (IS_RANGE(value)) {
+                ObjList* source = AS_RANGE(value);
+                ObjList* range = newRange(vm, source->start, source->step, source->array.count);
+                remember(vm, memo, AS_OBJ(value), (Obj*)range);
+                *out = OBJ_VAL(range);
+                return true;
+            }
+
+            ObjList* list = newList(vm);
+            remember(vm, memo, AS_OBJ(value), (Obj*)list);
+            *out = OBJ_VAL(list);
+
+            // views come across as plain lists holding just their own values
+            return copyValues(vm, memo, ELEMS(value), ARRAY(value).count, &list->array);
+        }
+        case OBJ_MAP: {
+            ObjMap* map = newMap(vm);
+            remember(vm, memo, AS_OBJ(value), (Obj*)map);
+            *out = OBJ_VAL(map);
+
+            int cursor = 0;
+            ObjString* key;
+            Value item;
+
+            // setting keys in the same order walks the new heap's shapes the
+            // same way, so the copy shares shapes with maps built there
+            while (mapNext(AS_MAP(value), &cursor, &key, &item)) {
+                Value copy;
+
+                if (!transferValue(vm, memo, item, &copy)) {
+                    return false;
+                }
+
+                mapSet(vm, map, copyString(vm, key->chars, key->length), copy);
+            }
+
+            return true;
+        }
+        case OBJ_NODE: {
+            ObjNode* source = AS_NODE(value);
+            ObjNode* node = newNode(vm, source->count);
+            remember(vm, memo, AS_OBJ(value), (Obj*)node);
+            *out = OBJ_VAL(node);
+
+            node->bitmap = source->bitmap;
+
+            for (int i = 0; i < source->count; i++) {
+                if (!transferValue(vm, memo, source->slots[i], &node->slots[i])) {
+                    return false;
+                }
+            }
+
+            return true;
+        }
+        case OBJ_VECTOR: {
+            ObjVector* source = AS_VECTOR(value);
+            ObjVector* vector = newVector(vm);
+            remember(vm, memo, AS_OBJ(value), (Obj*)vector);
+            *out = OBJ_VAL(vector);
+
+            vector->count = source->count;
+            vector->shift = source->shift;
+
+            Value node;
+
+            if (source->root != NULL) {
+                if (!transferValue(vm, memo, OBJ_VAL(source->root), &node)) {
+                    return false;
+                }
+                vector->root = AS_NODE(node);
+            }
+
+            if (source->tail != NULL) {
+                if (!transferValue(vm, memo, OBJ_VAL(source->tail), &node)) {
+                    return false;
+                }
+                vector->tail = AS_NODE(node);
+            }
+
+            return true;
+        }
+        case OBJ_PMAP: {
+            // keys are placed by hash, which doesn't depend on the heap
+            ObjPMap* source = AS_PMAP(value);
+            ObjPMap* map = newPMap(vm);
+            remember(vm, memo, AS_OBJ(value), (Obj*)map);
+            *out = OBJ_VAL(map);
+
+            map->count = source->count;
+
+            if (source->root != NULL) {
+                Value node;
+
+                if (!transferValue(vm, memo, OBJ_VAL(source->root), &node)) {
+                    return false;
+                }
+                map->root = AS_NODE(node);
+            }
+
+            return true;
+        }
+        case OBJ_ARRAY: {
+            ObjArray* source = AS_ARRAY(value);
+            ObjArray* array = newArray(vm, source->kind, source->count);
+            remember(vm, memo, AS_OBJ(value), (Obj*)array);
+
+            memcpy(array->as.ints, source->as.ints, source->count * sizeof(long long));
+
+            *out = OBJ_VAL(array);
+            return true;
+        }
+        case OBJ_ITERATOR: {
+            ObjIterator* source = AS_ITERATOR(value);
+            ObjIterator* iter = newIterator(vm, source->kind, UNIT_VAL, UNIT_VAL, UNIT_VAL);
+            remember(vm, memo, AS_OBJ(value), (Obj*)iter);
+            *out = OBJ_VAL(iter);
+
+            iter->sources = source->sources;
+
+            return transferValue(vm, memo, source->fn, &iter->fn)
+                && transferValue(vm, memo, source->source, &iter->source)
+                && transferValue(vm, memo, source->other, &iter->other);
+        }
+        case OBJ_CHANNEL: {
+            ObjChannel* channel = newChannel(vm, retainRing(AS_CHANNEL(value)->ring));
+            remember(vm, memo, AS_OBJ(value), (Obj*)channel);
+            *out = OBJ_VAL(channel);
+            return true;
+        }
+        case OBJ_SHAPE:
+        case OBJ_FIBER:
+        default:
+            return false;
+    }
+}
+
+
+/*
++---------------------+
+| Transfer      ^^^^  |
++=====================+
+| Parcels       vvvv  |
++---------------------+
+*/
+
+
+// Every object gets the next index the first time it's packed; seeing it again
+// packs PACK_REF and that index instead
+typedef enum {
+    PACK_UNIT,
+    PACK_TRUE,
+    PACK_FALSE,
+    PACK_INT,
+    PACK_INT32,     // ints that fit in 4 bytes
+    PACK_FLOAT,
+    PACK_CHAR,
+    PACK_REF,
+    PACK_STRING,
+    PACK_CELL,
+    PACK_LIST,
+    PACK_MAP,
+    PACK_ARRAY,
+    PACK_RANGE,
+    PACK_VECTOR,
+    PACK_PMAP,
+    // only these are left out of images
+    PACK_NATIVE,
+    PACK_FUNCTION,
+    PACK_CLOSURE,
+    PACK_ITERATOR,
+    PACK_CHANNEL,
+} PackTag;
+
+typedef struct {
+    Parcel* parcel;
+    int count;
+    int capacity;
+    Obj** objects;
+    int* index;
+    bool portable;      // refuses anything that's only meaningful in this process
+    bool code;          // but lets functions through, for code images
+    PackedCode* packed; // where functions are noted, when it's set
+} Packer;
+
+typedef struct {
+    VM* vm;
+    const uint8_t* at;
+    const uint8_t* end;
+    int count;
+    int capacity;
+    Obj** objects;
+    bool portable;
+    bool code;
+    int depth;
+    ObjMapping* mapping;    // big arrays are borrowed from this when it's set
+} Unpacker;
+
+
+// Parcels are handed between threads, so they live outside every VM's heap
+void initParcel(Parcel* parcel) {
+    parcel->count = 0;
+    parcel->capacity = 0;
+    parcel->bytes = NULL;
+    parcel->ringCount = 0;
+    parcel->rings = NULL;
+}
+
+void freeParcel(Parcel* parcel) {
+    for (int i = 0; i < parcel->ringCount; i++) {
+        releaseRing(parcel->rings[i]);
+    }
+
+    free(parcel->rings);
+    free(parcel->bytes);
+    initParcel(parcel);
+}
+
+// Keeps a packed channel's ring alive for as long as the parcel is
+static void holdRing(Parcel* parcel, Ring* ring) {
+    Ring** rings = realloc(parcel->rings, (parcel->ringCount + 1) * sizeof(Ring*));
+
+    if (rings == NULL) {
+        exit(1);
+    }
+
+    rings[parcel->ringCount++] = retainRing(ring);
+    parcel->rings = rings;
+}
+
+static void writeBytes(Parcel* parcel, const void* bytes, size_t length) {
+    if (parcel->count + length > parcel->capacity) {
+        size_t capacity = parcel->capacity < 64 ? 64 : parcel->capacity;
+
+        while (capacity < parcel->count + length) {
+            capacity *= 2;
+        }
+
+        uint8_t* grown = realloc(parcel->bytes, capacity);
+
+        if (grown == NULL) {
+            exit(1);
+        }
+
+        parcel->bytes = grown;
+        parcel->capacity = capacity;
+    }
+
+    memcpy(parcel->bytes + parcel->count, bytes, length);
+    parcel->count += length;
+}
+
+static void writeByte(Parcel* parcel, uint8_t byte) {
+    writeBytes(parcel, &byte, 1);
+}
+
+static void writeInt(Parcel* parcel, int32_t n) {
+    writeBytes(parcel, &n, sizeof(n));
+}
+
+static bool readBytes(Unpacker* unpacker, void* into, size_t length) {
+    if ((size_t)(unpacker->end - unpacker->at) < length) {
+        return false;
+    }
+
+    memcpy(into, unpacker->at, length);
+    unpacker->at += length;
+    return true;
+}
+
+static bool readInt(Unpacker* unpacker, int32_t* n) {
+    return readBytes(unpacker, n, sizeof(*n)) && *n >= 0;
+}
+
+// Packs PACK_REF and returns true if 'object' was packed before, otherwise
+// gives it the next index
+static bool packSeen(Packer* packer, Obj* object) {
+    if (packer->count > 0) {
+        int slot = findSlot(packer->objects, packer->capacity, object);
+
+        if (packer->objects[slot] != NULL) {
+            writeByte(packer->parcel, PACK_REF);
+            writeInt(packer->parcel, packer->index[slot]);
+            return true;
+        }
+    }
+
+    if ((packer->count + 1) * 4 > packer->capacity * 3) {
+        int capacity = GROW_CAP(packer->capacity) * 4;
+        Obj** objects = calloc(capacity, sizeof(Obj*));
+        int* index = malloc(capacity * sizeof(int));
+
+        if (objects == NULL || index == NULL) {
+            exit(1);
+        }
+
+        for (int i = 0; i < packer->capacity; i++) {
+            if (packer->objects[i] != NULL) {
+                int slot = findSlot(objects, capacity, packer->objects[i]);
+                objects[slot] = packer->objects[i];
+                index[slot] = packer->index[i];
+            }
+        }
+
+        free(packer->objects);
+        free(packer->index);
+        packer->objects = objects;
+        packer->index = index;
+        packer->capacity = capacity;
+    }
+
+    int slot = findSlot(packer->objects, packer->capacity, object);
+    packer->objects[slot] = object;
+    packer->index[slot] = packer->count++;
+    return false;
+}
+
+void initPackedCode(PackedCode* code) {
+    code->count = 0;
+    code->capacity = 0;
+    code->functions = NULL;
+}
+
+void freePackedCode(PackedCode* code) {
+    free(code->functions);
+    initPackedCode(code);
+}
+
+static void notePacked(PackedCode* code, ObjFunction* function) {
+    if (code->count == code->capacity) {
+        code->capacity = GROW_CAP(code->capacity);
+        code->functions = realloc(code->functions, code->capacity * sizeof(ObjFunction*));
+
+        if (code->functions == NULL) {
+            exit(1);
+        }
+    }
+
+    code->functions[code->count++] = function;
+}
+
+static bool pack(Packer* packer, Value value);
+
+static bool packArray(Packer* packer, const Value* values, int count) {
+    writeInt(packer->parcel, count);
+
+    for (int i = 0; i < count; i++) {
+        if (!pack(packer, values[i])) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Plain data, as opposed to code and channels, which are packed by address
+static bool isPortable(Obj* object) {
+    switch (object->type) {
+        case OBJ_NATIVE:
+        case OBJ_FUNCTION:
+        case OBJ_CLOSURE:
+        case OBJ_ITERATOR:
+        case OBJ_CHANNEL:
+            return false;
+        default:
+            return true;
+    }
+}
+
+static bool packObject(Packer* packer, Obj* object) {
+    Parcel* parcel = packer->parcel;
+    Value value = OBJ_VAL(object);
+
+    if (packer->portable && !isPortable(object)
+        && !(packer->code && object->type == OBJ_FUNCTION)) {
+        return false;
+    }
+
+    switch (object->type) {
+        case OBJ_STRING: {
+            ObjString* string = (ObjString*)object;
+            writeByte(parcel, PACK_STRING);
+            writeInt(parcel, string->length);
+            writeBytes(parcel, string->chars, string->length);
+            return true;
+        }
+        case OBJ_CELL: {
+            // cdrs are followed in a loop, as with transfers
+            for (;;) {
+                writeByte(parcel, PACK_CELL);
+
+                if (!pack(packer, CAR(value))) {
+                    return false;
+                }
+
+                value = CDR(value);
+
+                if (!IS_CELL(value)) {
+                    return pack(packer, value);
+                }
+
+                if (packSeen(packer, AS_OBJ(value))) {
+                    return true;
+                }
+            }
+        }
+        case OBJ_LIST: {
+            if (IS_RANGE(value)) {
+                ObjList* range = AS_RANGE(value);
+                writeByte(parcel, PACK_RANGE);
+                writeBytes(parcel, &range->start, sizeof(range->start));
+                writeByte(parcel, range->step > 0);
+                writeInt(parcel, range->array.count);
+                return true;
+            }
+
+            writeByte(parcel, PACK_LIST);
+            return packArray(packer, ELEMS(value), ARRAY(value).count);
+        }
+        case OBJ_MAP: {
+            int cursor = 0;
+            int count = 0;
+            ObjString* key;
+            Value item;
+
+            while (mapNext(AS_MAP(value), &cursor, &key, &item)) {
+                count++;
+            }
+
+            writeByte(parcel, PACK_MAP);
+            writeInt(parcel, count);
+            cursor = 0;
+
+            while (mapNext(AS_MAP(value), &cursor, &key, &item)) {
+                if (!pack(packer, OBJ_VAL(key)) || !pack(packer, item)) {
+                    return false;
+                }
+            }
+
+            return true;
+        }
+        case OBJ_ARRAY: {
+            ObjArray* array = AS_ARRAY(value);
+            static const uint8_t zeros[sizeof(long long)] = { 0 };
+
+            writeByte(parcel, PACK_ARRAY);
+            writeByte(parcel, array->kind);
+            writeInt(parcel, array->count);
+
+            // the numbers start 8-byte aligned, so a mapped image can lend
+            // them out as they are
+            uint8_t padding = (uint8_t)((sizeof(long long) - (parcel->count + 1) % sizeof(long long)) % sizeof(long long));
+            writeByte(parcel, padding);
+            writeBytes(parcel, zeros, padding);
+
+            writeBytes(parcel, array->as.ints, array->count * sizeof(long long));
+            return true;
+        }
+        case OBJ_VECTOR: {
+            ObjVector* vector = AS_VECTOR(value);
+            writeByte(parcel, PACK_VECTOR);
+            writeInt(parcel, vector->count);
+
+            for (int i = 0; i < vector->count; i++) {
+                if (!pack(packer, vectorGet(vector, i))) {
+                    return false;
+                }
+            }
+
+            return true;
+        }
+        case OBJ_PMAP: {
+            PMapCursor cursor;
+            ObjString* key;
+            Value item;
+
+            writeByte(parcel, PACK_PMAP);
+            writeInt(parcel, AS_PMAP(value)->count);
+            pmapCursor(AS_PMAP(value), &cursor);
+
+            while (pmapNext(&cursor, &key, &item)) {
+                if (!pack(packer, OBJ_VAL(key)) || !pack(packer, item)) {
+                    return false;
+                }
+            }
+
+            return true;
+        }
+        case OBJ_NATIVE: {
+            ObjNative* native = AS_NATIVE(value);
+            writeByte(parcel, PACK_NATIVE);
+            writeBytes(parcel, &native->function, sizeof(native->function));
+            writeInt(parcel, native->arity);
+            return true;
+        }
+        case OBJ_FUNCTION: {
+            ObjFunction* function = AS_FUNC(value);
+            Chunk* body = &function->body;
+
+            if (packer->packed != NULL) {
+                notePacked(packer->packed, function);
+            }
+
+            writeByte(parcel, PACK_FUNCTION);
+
+            if (!pack(packer, function->name == NULL ? UNIT_VAL : OBJ_VAL(function->name))) {
+                return false;
+            }
+
+            writeByte(parcel, function->arity);
+            writeInt(parcel, body->count);
+            writeBytes(parcel, body->code, body->count);
+            writeBytes(parcel, body->lines, body->count * sizeof(int));
+            writeInt(parcel, body->cacheCount);
+
+            return packArray(packer, body->constants.values, body->constants.count);
+        }
+        case OBJ_CLOSURE: {
+            ObjClosure* closure = AS_CLOSURE(value);
+
+            // the count comes first so the closure can be made before its parts
+            writeByte(parcel, PACK_CLOSURE);
+            writeByte(parcel, closure->upvalueCount);
+            writeBytes(parcel, closure->depths, closure->upvalueCount);
+
+            if (!pack(packer, OBJ_VAL(closure->function))) {
+                return false;
+            }
+
+            for (int i = 0; i < closure->upvalueCount; i++) {
+                if (!pack(packer, closure->upvalues[i])) {
+                    return false;
+                }
+            }
+
+            return true;
+        }
+        case OBJ_ITERATOR: {
+            ObjIterator* iter = AS_ITERATOR(value);
+            writeByte(parcel, PACK_ITERATOR);
+            writeByte(parcel, iter->kind);
+
+            return pack(packer, iter->fn)
+                && pack(packer, iter->source)
+                && pack(packer, iter->other);
+        }
+        case OBJ_CHANNEL: {
+            Ring* ring = AS_CHANNEL(value)->ring;
+            holdRing(parcel, ring);
+            writeByte(parcel, PACK_CHANNEL);
+            writeBytes(parcel, &ring, sizeof(ring));
+            return true;
+        }
+        default:
+            return false;
+    }
+}
+
+static bool pack(Packer* packer, Value value) {
+    Parcel* parcel = packer->parcel;
+
+    switch (value.type) {
+        case VAL_UNIT:
+            writeByte(parcel, PACK_UNIT);
+            return true;
+        case VAL_BOOL:
+            writeByte(parcel, AS_BOOL(value) ? PACK_TRUE : PACK_FALSE);
+            return true;
+        case VAL_INT:
+            if (AS_INT(value) >= INT32_MIN && AS_INT(value) <= INT32_MAX) {
+                int32_t n = (int32_t)AS_INT(value);
+                writeByte(parcel, PACK_INT32);
+                writeBytes(parcel, &n, sizeof(n));
+                return true;
+            }
+
+            writeByte(parcel, PACK_INT);
+            writeBytes(parcel, &AS_INT(value), sizeof(long long));
+            return true;
+        case VAL_FLOAT:
+            writeByte(parcel, PACK_FLOAT);
+            writeBytes(parcel, &AS_FLOAT(value), sizeof(double));
+            return true;
+        case VAL_CHAR:
+            writeByte(parcel, PACK_CHAR);
+            writeByte(parcel, (uint8_t)AS_CHAR(value));
+            return true;
+        case VAL_OBJ:
+            if (isObjType(value, OBJ_FIBER) || isObjType(value, OBJ_SHAPE) || isObjType(value, OBJ_NODE)) {
+                return false;
+            }
+
+            if (packSeen(packer, AS_OBJ(value))) {
+                return true;
+            }
+
+            return packObject(packer, AS_OBJ(value));
+    }
+
+    return false;
+}
+
+bool packValues(Parcel* parcel, const Value* values, int count) {
+    return packValuesWithCode(parcel, values, count, NULL);
+}
+
+bool packValuesWithCode(Parcel* parcel, const Value* values, int count, PackedCode* code) {
+    Packer packer = { parcel, 0, 0, NULL, NULL, false, false, code };
+    bool ok = true;
+
+    for (int i = 0; i < count && ok; i++) {
+        ok = pack(&packer, values[i]);
+    }
+
+    free(packer.objects);
+    free(packer.index);
+    return ok;
+}
+
+// Indexes are handed out as objects are made, in the same order they were
+// given out by the packer
+static Obj* made(Unpacker* unpacker, Obj* object) {
+    if (unpacker->count + 1 > unpacker->capacity) {
+        int capacity = GROW_CAP(unpacker->capacity);
+        Obj** objects = realloc(unpacker->objects, capacity * sizeof(Obj*));
+
+        if (objects == NULL) {
+            exit(1);
+        }
+
+        unpacker->objects = objects;
+        unpacker->capacity = capacity;
+    }
+
+    unpacker->objects[unpacker->count++] = object;
+    return object;
+}
+
+static bool unpack(Unpacker* unpacker, Value* out);
+
+// Checks an unpacked stage reads from what a cursor can walk, and counts its
+// sources; stages still being unpacked haven't been counted, which catches a
+// pipeline that feeds into itself
+static bool countSources(ObjIterator* iter) {
+    if (iter->kind == ITER_SOURCE) {
+        return isIterable(iter->source) && !IS_ITERATOR(iter->source);
+    }
+
+    if (!IS_ITERATOR(iter->source) || AS_ITERATOR(iter->source)->sources == 0) {
+        return false;
+    }
+
+    iter->sources = AS_ITERATOR(iter->source)->sources;
+
+    if (iter->kind == ITER_ZIP) {
+        if (!IS_ITERATOR(iter->other) || AS_ITERATOR(iter->other)->sources == 0) {
+            return false;
+        }
+
+        iter->sources += AS_ITERATOR(iter->other)->sources;
+    }
+
+    return iter->sources <= CURSOR_MAX_SOURCES;
+}
+
+static bool unpackString(Unpacker* unpacker, ObjString** out) {
+    Value key;
+
+    if (!unpack(unpacker, &key) || !IS_STRING(key)) {
+        return false;
+    }
+
+    *out = AS_STRING(key);
+    return true;
+}
+
+static bool unpackValue(Unpacker* unpacker, Value* out) {
+    VM* vm = unpacker->vm;
+    uint8_t tag;
+
+    if (!readBytes(unpacker, &tag, 1)) {
+        return false;
+    }
+
+    // an image could have been written by anyone, so it never gets to name
+    // a function pointer or a ring
+    if (unpacker->portable && tag >= PACK_NATIVE
+        && !(unpacker->code && tag == PACK_FUNCTION)) {
+        return false;
+    }
+
+    switch (tag) {
+        case PACK_UNIT:     *out = UNIT_VAL; return true;
+        case PACK_TRUE:     *out = BOOL_VAL(true); return true;
+        case PACK_FALSE:    *out = BOOL_VAL(false); return true;
+        case PACK_INT: {
+            long long n;
+            return readBytes(unpacker, &n, sizeof(n)) && (*out = INT_VAL(n), true);
+        }
+        case PACK_INT32: {
+            int32_t n;
+            return readBytes(unpacker, &n, sizeof(n)) && (*out = INT_VAL(n), true);
+        }
+        case PACK_FLOAT: {
+            double x;
+            return readBytes(unpacker, &x, sizeof(x)) && (*out = FLOAT_VAL(x), true);
+        }
+        case PACK_CHAR: {
+            uint8_t c;
+            return readBytes(unpacker, &c, 1) && (*out = CHAR_VAL((char)c), true);
+        }
+        case PACK_REF: {
+            int32_t index;
+
+            // a vector or pmap is only filled in once it's finished
+            if (!readInt(unpacker, &index) || index >= unpacker->count || unpacker->objects[index] == NULL) {
+                return false;
+            }
+
+            *out = OBJ_VAL(unpacker->objects[index]);
+            return true;
+        }
+        case PACK_STRING: {
+            int32_t length;
+
+            if (!readInt(unpacker, &length) || unpacker->end - unpacker->at < length) {
+                return false;
+            }
+
+            *out = OBJ_VAL(made(unpacker, (Obj*)copyString(vm, (const char*)unpacker->at, length)));
+            unpacker->at += length;
+            return true;
+        }
+        case PACK_CELL: {
+            Value* slot = out;
+
+            for (;;) {
+                ObjCell* cell = newCell(vm);
+                cell->car = UNIT_VAL;
+                cell->cdr = UNIT_VAL;
+                *slot = OBJ_VAL(made(unpacker, (Obj*)cell));
+
+                if (!unpack(unpacker, &cell->car)) {
+                    return false;
+                }
+
+                if (unpacker->at < unpacker->end && *unpacker->at == PACK_CELL) {
+                    unpacker->at++;
+                    slot = &cell->cdr;
+                    continue;
+                }
+
+                return unpack(unpacker, &cell->cdr);
+            }
+        }
+        case PACK_LIST: {
+            ObjList* list = newList(vm);
+            int32_t count;
+            *out = OBJ_VAL(made(unpacker, (Obj*)list));
+
+            if (!readInt(unpacker, &count)) {
+                return false;
+            }
+
+            for (int i = 0; i < count; i++) {
+                Value item;
+
+                if (!unpack(unpacker, &item)) {
+                    return false;
+                }
+
+                writeValueArray(vm, &list->array, item);
+            }
+
+            return true;
+        }
+        case PACK_MAP: {
+            ObjMap* map = newMap(vm);
+            int32_t count;
+            *out = OBJ_VAL(made(unpacker, (Obj*)map));
+
+            if (!readInt(unpacker, &count)) {
+                return false;
+            }
+
+            for (int i = 0; i < count; i++) {
+                ObjString* key;
+                Value item;
+
+                if (!unpackString(unpacker, &key) || !unpack(unpacker, &item)) {
+                    return false;
+                }
+
+                mapSet(vm, map, key, item);
+            }
+
+            return true;
+        }
+        case PACK_ARRAY: {
+            uint8_t kind;
+            int32_t count;
+
+            uint8_t padding;
+
+            if (!readBytes(unpacker, &kind, 1) || kind > ARRAY_FLOAT || !readInt(unpacker, &count)
+                || !readBytes(unpacker, &padding, 1) || padding >= sizeof(long long)
+                || unpacker->end - unpacker->at < padding) {
+                return false;
+            }
+
+            unpacker->at += padding;
+
+            if ((size_t)(unpacker->end - unpacker->at) / sizeof(long long) < (size_t)count) {
+                return false;
+            }
+
+            if (unpacker->mapping != NULL && count >= IMAGE_BORROW_MIN
+                && (uintptr_t)unpacker->at % sizeof(long long) == 0) {
+                int start = (int)((const char*)unpacker->at - unpacker->mapping->bytes);
+                ObjArray* array = newMappedArray(vm, unpacker->mapping, (ArrayKind)kind, start, count);
+                *out = OBJ_VAL(made(unpacker, (Obj*)array));
+                unpacker->at += count * sizeof(long long);
+                return true;
+            }
+
+            ObjArray* array = newArray(vm, (ArrayKind)kind, count);
+            *out = OBJ_VAL(made(unpacker, (Obj*)array));
+            return readBytes(unpacker, array->as.ints, count * sizeof(long long));
+        }
+        case PACK_RANGE: {
+            long long start;
+            uint8_t up;
+            int32_t count;
+
+            if (!readBytes(unpacker, &start, sizeof(start)) || !readBytes(unpacker, &up, 1) || !readInt(unpacker, &count)) {
+                return false;
+            }
+
+            *out = OBJ_VAL(made(unpacker, (Obj*)newRange(vm, start, up ? 1 : -1, count)));
+            return true;
+        }
+        case PACK_VECTOR: {
+            // immutable, so nothing inside can point back at it; its index is
+            // taken now and filled once it's built
+            int index = unpacker->count;
+            int32_t count;
+            made(unpacker, NULL);
+
+            if (!readInt(unpacker, &count)) {
+                return false;
+            }
+
+            ObjVector* vector = newVector(vm);
+
+            for (int i = 0; i < count; i++) {
+                Value item;
+
+                if (!unpack(unpacker, &item)) {
+                    return false;
+                }
+
+                vector = vectorConj(vm, vector, item);
+            }
+
+            unpacker->objects[index] = (Obj*)vector;
+            *out = OBJ_VAL(vector);
+            return true;
+        }
+        case PACK_PMAP: {
+            int index = unpacker->count;
+            int32_t count;
+            made(unpacker, NULL);
+
+            if (!readInt(unpacker, &count)) {
+                return false;
+            }
+
+            ObjPMap* map = newPMap(vm);
+
+            for (int i = 0; i < count; i++) {
+                ObjString* key;
+                Value item;
+
+                if (!unpackString(unpacker, &key) || !unpack(unpacker, &item)) {
+                    return false;
+                }
+
+                map = pmapAssoc(vm, map, key, item);
+            }
+
+            unpacker->objects[index] = (Obj*)map;
+            *out = OBJ_VAL(map);
+            return true;
+        }
+        case PACK_NATIVE: {
+            NativeFn function;
+            int32_t arity;
+
+            if (!readBytes(unpacker, &function, sizeof(function)) || !readBytes(unpacker, &arity, sizeof(arity))) {
+                return false;
+            }
+
+            *out = OBJ_VAL(made(unpacker, (Obj*)newNative(vm, function, arity)));
+            return true;
+        }
+        case PACK_FUNCTION: {
+            ObjFunction* function = newFunction(vm, NULL);
+            Chunk* body = &function->body;
+            *out = OBJ_VAL(made(unpacker, (Obj*)function));
+
+            Value name;
+            int32_t count;
+            int32_t cacheCount;
+
+            if (!unpack(unpacker, &name) || (!IS_UNIT(name) && !IS_STRING(name))) {
+                return false;
+            }
+
+            function->name = IS_STRING(name) ? AS_STRING(name) : NULL;
+
+            if (!readBytes(unpacker, &function->arity, 1) || !readInt(unpacker, &count)) {
+                return false;
+            }
+
+            if ((size_t)(unpacker->end - unpacker->at) / (1 + sizeof(int)) < (size_t)count) {
+                return false;
+            }
+
+            body->code = ALLOCATE(vm, count, uint8_t);
+            body->lines = ALLOCATE(vm, count, int);
+            body->capacity = count;
+            body->count = count;
+            readBytes(unpacker, body->code, count);
+            readBytes(unpacker, body->lines, count * sizeof(int));
+
+            if (!readInt(unpacker, &cacheCount) || cacheCount > count) {
+                return false;
+            }
+
+            body->caches = ALLOCATE(vm, cacheCount, InlineCache);
+            for (int i = 0; i < cacheCount; i++) {
+                body->caches[i] = (InlineCache){ NULL, 0 };
+            }
+            body->cacheCount = cacheCount;
+
+            if (!readInt(unpacker, &count)) {
+                return false;
+            }
+
+            for (int i = 0; i < count; i++) {
+                Value constant;
+
+                if (!unpack(unpacker, &constant)) {
+                    return false;
+                }
+
+                writeValueArray(vm, &body->constants, constant);
+            }
+
+            return true;
+        }
+        case PACK_CLOSURE: {
+            uint8_t upvalueCount;
+
+            if (!readBytes(unpacker, &upvalueCount, 1)) {
+                return false;
+            }
+
+            ObjClosure* closure = newClosure(vm, NULL, upvalueCount);
+            *out = OBJ_VAL(made(unpacker, (Obj*)closure));
+
+            for (int i = 0; i < upvalueCount; i++) {
+                closure->upvalues[i] = UNIT_VAL;
+            }
+
+            Value function;
+
+            if (!readBytes(unpacker, closure->depths, upvalueCount)
+                || !unpack(unpacker, &function) || !IS_FUNC(function)) {
+                return false;
+            }
+
+            closure->function = AS_FUNC(function);
+
+            for (int i = 0; i < upvalueCount; i++) {
+                if (!unpack(unpacker, &closure->upvalues[i])) {
+                    return false;
+                }
+            }
+
+            return true;
+        }
+        case PACK_ITERATOR: {
+            uint8_t kind;
+
+            if (!readBytes(unpacker, &kind, 1) || kind > ITER_ZIP) {
+                return false;
+            }
+
+            ObjIterator* iter = newIterator(vm, (IterKind)kind, UNIT_VAL, UNIT_VAL, UNIT_VAL);
+            *out = OBJ_VAL(made(unpacker, (Obj*)iter));
+
+            if (!unpack(unpacker, &iter->fn) || !unpack(unpacker, &iter->source) || !unpack(unpacker, &iter->other)) {
+                return false;
+            }
+
+            return countSources(iter);
+        }
+        case PACK_CHANNEL: {
+            Ring* ring;
+
+            if (!readBytes(unpacker, &ring, sizeof(ring))) {
+                return false;
+            }
+
+            *out = OBJ_VAL(made(unpacker, (Obj*)newChannel(vm, retainRing(ring))));
+            return true;
+        }
+        default:
+            return false;
+    }
+}
+
+static bool unpack(Unpacker* unpacker, Value* out) {
+    if (unpacker->portable && unpacker->depth >= IMAGE_MAX_DEPTH) {
+        return false;
+    }
+
+    unpacker->depth++;
+    bool ok = unpackValue(unpacker, out);
+    unpacker->depth--;
+
+    return ok;
+}
+
+bool unpackValues(VM* vm, const Parcel* parcel, int count) {
+    Unpacker unpacker = { vm, parcel->bytes, parcel->bytes + parcel->count, 0, 0, NULL, false, false, 0, NULL };
+
+    // nothing made here is reachable until it's pushed
+    bool wasActive = vm->isActive;
+    vm->isActive = false;
+
+    bool ok = true;
+
+    for (int i = 0; i < count && ok; i++) {
+        Value value;
+        ok = unpack(&unpacker, &value);
+
+        if (ok) {
+            push(vm, value);
+        }
+    }
+
+    vm->isActive = wasActive;
+    free(unpacker.objects);
+    return ok;
+}
+
+
+/*
++---------------------+
+| Parcels       ^^^^  |
++=====================+
+| Images        vvvv  |
++---------------------+
+*/
+
+
+// Everything after the header is in the order of the machine that wrote it
+typedef struct {
+    char magic[4];
+    uint16_t version;
+    uint16_t order;
+    uint32_t bytecode;      // instruction set of the code inside, 0 for data
+    uint32_t length;        // of the packed value that follows
+} ImageHeader;
+
+#define IMAGE_MAGIC "HMRI"
+#define CODE_MAGIC "HMRC"
+#define IMAGE_ORDER 0x0102
+
+static bool packWithHeader(Parcel* parcel, Value value, const char* magic, uint32_t bytecode) {
+    ImageHeader header;
+    memcpy(header.magic, magic, sizeof(header.magic));
+    header.version = IMAGE_VERSION;
+    header.order = IMAGE_ORDER;
+    header.bytecode = bytecode;
+    header.length = 0;
+
+    writeBytes(parcel, &header, sizeof(header));
+
+    Packer packer = { parcel, 0, 0, NULL, NULL, true, bytecode != 0, NULL };
+    bool ok = pack(&packer, value);
+
+    free(packer.objects);
+    free(packer.index);
+
+    if (ok && parcel->count - sizeof(header) > UINT32_MAX) {
+        ok = false;
+    }
+
+    if (ok) {
+        uint32_t length = (uint32_t)(parcel->count - sizeof(header));
+        memcpy(parcel->bytes + offsetof(ImageHeader, length), &length, sizeof(length));
+    }
+
+    return ok;
+}
+
+static ImageResult unpackWithHeader(VM* vm, const uint8_t* bytes, size_t length, ObjMapping* mapping,
+                                    const char* magic, uint32_t bytecode, int* version) {
+    ImageHeader header;
+
+    if (length < sizeof(header)) {
+        return IMAGE_NOT_IMAGE;
+    }
+
+    memcpy(&header, bytes, sizeof(header));
+
+    if (memcmp(header.magic, magic, sizeof(header.magic)) != 0) {
+        return IMAGE_NOT_IMAGE;
+    }
+
+    *version = header.version;
+
+    if (header.version != IMAGE_VERSION || header.order != IMAGE_ORDER || header.bytecode != bytecode) {
+        return IMAGE_WRONG_VERSION;
+    }
+
+    if (header.length != length - sizeof(header)) {
+        return IMAGE_CORRUPT;
+    }
+
+    Unpacker unpacker = { vm, bytes + sizeof(header), bytes + length, 0, 0, NULL, true, bytecode != 0, 0, mapping };
+
+    bool wasActive = vm->isActive;
+    vm->isActive = false;
+
+    Value value;
+    bool ok = unpack(&unpacker, &value) && unpacker.at == unpacker.end;
+
+    if (ok) {
+        push(vm, value);
+    }
+
+    vm->isActive = wasActive;
+    free(unpacker.objects);
+
+    return ok ? IMAGE_OK : IMAGE_CORRUPT;
+}
+
+bool packImage(Parcel* parcel, Value value) {
+    return packWithHeader(parcel, value, IMAGE_MAGIC, 0);
+}
+
+ImageResult unpackImage(VM* vm, const uint8_t* bytes, size_t length, ObjMapping* mapping, int* version) {
+    return unpackWithHeader(vm, bytes, length, mapping, IMAGE_MAGIC, 0, version);
+}
+
+bool packCode(Parcel* parcel, ObjFunction* script) {
+    return packWithHeader(parcel, OBJ_VAL(script), CODE_MAGIC, BYTECODE_VERSION);
+}
+
+ImageResult unpackCode(VM* vm, const uint8_t* bytes, size_t length, int* version) {
+    ImageResult result = unpackWithHeader(vm, bytes, length, NULL, CODE_MAGIC, BYTECODE_VERSION, version);
+
+    if (result == IMAGE_OK && !IS_FUNC(vm->stackTop[-1])) {
+        pop(vm);
+        return IMAGE_CORRUPT;
+    }
+
+    return result;
+}
+
+bool isCodeImage(const uint8_t* bytes, size_t length) {
+    return length >= 4 && memcmp(bytes, CODE_MAGIC, 4) == 0;
+}
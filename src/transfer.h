@@ -0,0 +1,97 @@
+#ifndef transfer_h_hammer
+#define transfer_h_hammer
+
+#include "common.h"
+#include "object.h"
+
+// Objects already copied in one transfer, so shared and cyclic structures keep
+// their shape on the other side
+typedef struct {
+    int count;
+    int capacity;
+    Obj** from;
+    Obj** to;
+} Transfer;
+
+void initTransfer(Transfer* memo);
+void freeTransfer(VM* vm, Transfer* memo);
+
+// Deep-copies 'value' into the heap of 'vm'. Only reads the heap it copies
+// from, so that VM can't be running at the same time; the GC of 'vm' must be
+// off until the copy is reachable. Fails on values tied to their VM (fibers)
+bool transferValue(VM* vm, Transfer* memo, Value value, Value* out);
+
+// Values packed into a buffer that belongs to no heap, for handing to a VM
+// that's busy with something else; natives and channels are packed by
+// address, so they're only meaningful in the process that packed them
+typedef struct {
+    size_t count;
+    size_t capacity;
+    uint8_t* bytes;
+    int ringCount;
+    Ring** rings;       // held by the parcel until it's freed
+} Parcel;
+
+void initParcel(Parcel* parcel);
+void freeParcel(Parcel* parcel);
+
+// Appends 'count' values, sharing structure between them; fails on fibers
+bool packValues(Parcel* parcel, const Value* values, int count);
+
+// Functions met while packing, so the caller can tell what code went with the
+// values; they're borrowed from the heap the values came from
+typedef struct {
+    int count;
+    int capacity;
+    ObjFunction** functions;
+} PackedCode;
+
+void initPackedCode(PackedCode* code);
+void freePackedCode(PackedCode* code);
+
+// As packValues, adding every function it packs to 'code'
+bool packValuesWithCode(Parcel* parcel, const Value* values, int count, PackedCode* code);
+
+// Pushes the 'count' values packed into 'parcel' onto the stack of 'vm'
+bool unpackValues(VM* vm, const Parcel* parcel, int count);
+
+// Images are values packed for another process or a later run: a versioned
+// header, then the parcel encoding of plain data only. Bump the version
+// whenever the encoding changes
+#define IMAGE_VERSION 1
+// Arrays at least this long are borrowed from a mapped image, not copied
+#define IMAGE_BORROW_MIN 512
+// Images come from outside, so how deep they nest is limited
+#define IMAGE_MAX_DEPTH 4096
+
+typedef enum {
+    IMAGE_OK,
+    IMAGE_NOT_IMAGE,
+    IMAGE_WRONG_VERSION,
+    IMAGE_CORRUPT,
+} ImageResult;
+
+// Packs an image of 'value' into an empty parcel; fails on code, channels
+// and fibers
+bool packImage(Parcel* parcel, Value value);
+
+// Pushes the value in the image at 'bytes'. When those are inside 'mapping',
+// big arrays borrow their numbers from it rather than copying them; 'version'
+// is set once the header's been read
+ImageResult unpackImage(VM* vm, const uint8_t* bytes, size_t length, ObjMapping* mapping, int* version);
+
+// Code images hold a compiled script, with its nested functions, constants
+// and line tables, ready to run without going near the compiler. Bump this
+// whenever the instruction set changes
+#define BYTECODE_VERSION 1
+
+// Packs the code image of 'script' into an empty parcel
+bool packCode(Parcel* parcel, ObjFunction* script);
+
+// Pushes the script in the code image at 'bytes'. The bytecode itself isn't
+// checked, so an image is only as trustworthy as the source it came from
+ImageResult unpackCode(VM* vm, const uint8_t* bytes, size_t length, int* version);
+
+bool isCodeImage(const uint8_t* bytes, size_t length);
+
+#endif
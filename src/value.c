@@ -1,10 +1,12 @@
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "memory.h"
 #include "value.h"
 #include "common.h"
 #include "object.h"
+#include "output.h"
 
 void initValueArray(ValueArray* array)
 {
@@ -52,7 +54,15 @@ bool valuesEqual(Value a, Value b) {
             }
             
             switch (OBJ_TYPE(a)) {
-            case OBJ_STRING:    return AS_STRING(a) == AS_STRING(b);
+            case OBJ_STRING: {
+                ObjString* x = AS_STRING(a);
+                ObjString* y = AS_STRING(b);
+                // interned strings are equal only if they're the same object
+                if (x->owner == NULL && y->owner == NULL) {
+                    return x == y;
+                }
+                return x->length == y->length && memcmp(x->chars, y->chars, x->length) == 0;
+            }
             case OBJ_CELL:      return valuesEqual(CAR(a), CAR(b)) && valuesEqual(CDR(a), CDR(b));
             default: return false;
             }
@@ -61,13 +71,23 @@ bool valuesEqual(Value a, Value b) {
     }
 }
 
-void printValue(Value value) {
+void outputValue(Output* out, Value value) {
     switch (value.type) {
-        case VAL_UNIT:          printf("UNIT"); break;
-        case VAL_BOOL:          printf(AS_BOOL(value) ? "true" : "false"); break;
-        case VAL_INT:           printf("%lli", AS_INT(value)); break;
-        case VAL_FLOAT:         printf("%lg", AS_FLOAT(value)); break;
-        case VAL_CHAR:          printf("%c", AS_CHAR(value)); break;
-        case VAL_OBJ:           printObject(value); break;
+        case VAL_UNIT:          outputCString(out, "UNIT"); break;
+        case VAL_BOOL:          outputCString(out, AS_BOOL(value) ? "true" : "false"); break;
+        case VAL_INT:           outputInt(out, AS_INT(value)); break;
+        case VAL_FLOAT:         outputFormat(out, "%lg", AS_FLOAT(value)); break;
+        case VAL_CHAR:          outputChar(out, AS_CHAR(value)); break;
+        case VAL_OBJ:           outputObject(out, value); break;
     }
+}
+
+// For the debugging displays, which share stdout with stdio
+void printValue(Value value) {
+    Output out;
+    initOutput(&out, STDOUT_FILENO);
+
+    fflush(stdout);
+    outputValue(&out, value);
+    freeOutput(&out);
 }
\ No newline at end of file
@@ -5,6 +5,7 @@
 
 typedef struct Obj Obj;
 typedef struct ObjString ObjString;
+typedef struct ObjShape ObjShape;
 
 /*
 {}          = 0
@@ -76,6 +77,7 @@ void writeValueArray(VM* vm, ValueArray* array, Value value);
 void freeValueArray(VM* vm, ValueArray* array);
 bool valuesEqual(Value a, Value b);
 
+void outputValue(Output* out, Value value);
 void printValue(Value value);
 
 static inline bool isArith(Value val) {
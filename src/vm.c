@@ -1,9 +1,11 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <limits.h>
 #include <math.h>
 #include <stdarg.h>
 #include <time.h>
+#include <unistd.h>
 
 #include "vm.h"
 
@@ -11,6 +13,13 @@
 #include "compiler.h"
 #include "debug.h"
 #include "memory.h"
+#include "shape.h"
+#include "persistent.h"
+#include "builtins.h"
+#include "sequence.h"
+#include "broadcast.h"
+#include "format.h"
+#include "transfer.h"
 
 
 /*
@@ -20,6 +29,9 @@
 */
 
 void runtimeError(VM* vm, const char* format, ...) {
+    // so the error comes after whatever was printed before it
+    flushOutput(&vm->output);
+
     va_list args;
     va_start(args, format);
     vfprintf(stderr, format, args);
@@ -63,19 +75,6 @@ simple CallFrame* currentFrame(VM* vm) {
     return &vm->frames[vm->frameCount - 1];
 }
 
-simple void push(VM* vm, Value value) {
-    *vm->stackTop = value;
-    vm->stackTop++;
-}
-
-simple Value pop(VM* vm) {
-    return *(--vm->stackTop);
-}
-
-simple Value peek(VM* vm, int distance) {
-    return vm->stackTop[(-1) - distance];
-}
-
 
 /*
 +---------------------+
@@ -86,10 +85,9 @@ simple Value peek(VM* vm, int distance) {
 */
 
 static bool callValue(VM* vm, Value caller, uint8_t argCount);
-static bool isTruthy(Value value);
 InterpretResult run(VM* vm);
 
-static bool callFromC(VM* vm, Value caller, uint8_t argCount) {
+bool callFromC(VM* vm, Value caller, uint8_t argCount) {
     if (!callValue(vm, caller, argCount)) {
         return false;
     }
@@ -97,11 +95,11 @@ static bool callFromC(VM* vm, Value caller, uint8_t argCount) {
     if (!IS_NATIVE(caller)) {
         currentFrame(vm)->isCHOF = true;
 
-        if (run(vm) == INTERPRET_RUNTIME_ERROR) {
-            return false;
-        }
+        vm->nativeDepth++;
+        InterpretResult result = run(vm);
+        vm->nativeDepth--;
 
-        return true;
+        return result != INTERPRET_RUNTIME_ERROR;
     }
 
     #ifdef DEBUG_DISPLAY_STACK
@@ -133,6 +131,15 @@ bool clockNative(VM* vm, int argc, Value* argv) {
     return true;
 }
 
+// Output is otherwise only written once the buffer fills, at a newline on a
+// terminal, before the program waits on something, and at exit
+bool flushNative(VM* vm, int argc, Value* argv) {
+    (void)argv;
+    flushOutput(&vm->output);
+    returnNative(vm, argc, UNIT_VAL);
+    return true;
+}
+
 bool exitNative(VM* vm, int argc, Value* argv) {
     if (!IS_INT(argv[0])) {
         runtimeError(vm, "exit$ : Expected int, got %s", getValName(argv[0]));
@@ -145,95 +152,73 @@ bool exitNative(VM* vm, int argc, Value* argv) {
 // Change format for printf/n? currently '{n}' is the format but this means you cant just, put a number
 // between braces. I think something like the C format with a single, simple preceding character could
 // work, could use '%n' or similar. Would allow for escaping the format more easily.
-static inline bool isIntChar(char ch) {
-    return ch >= '0' && ch <= '9';
-}
-
-bool printfNative(VM* vm, int argc, Value* argv) {
-    if (!IS_STRING(argv[0])) {
-        runtimeError(vm, "printf$ : Expected string, got %s", getValName(argv[0]));
-        return false;
-    }
-
-    const char* format = AS_CSTRING(argv[0]);
-    char* end;
-
-    while (*format != '\0') {
-        char next = *format;
-
-        if (next == '{' && isIntChar(format[1])) {
-            format++;
-
-            long slot = strtol(format, &end, 10) + 1; // 0-indexed
-
-            if (slot > argc - 1) {
-                runtimeError(vm, "printf$ : Attempted to index out of args; got %d with %d args", slot, argc-1);
-                return false;
-            }
-
-            printValue(argv[slot]);
 
-            format = end;
+// Iterators are printed as the lists they produce
+static bool drainArgs(VM* vm, int argc, Value* argv) {
+    for (int i = 1; i < argc; i++) {
+        if (IS_ITERATOR(argv[i])) {
+            ObjList* list = drainIterator(vm, argv[i]);
 
-            if (*format != '}') {
-                runtimeError(vm, "printf$ : Expected '}' in format");
+            if (list == NULL) {
                 return false;
             }
 
-            format++;
-        }
-        else {
-            putchar(next);
-            format++;
+            argv[i] = OBJ_VAL(list);
         }
     }
 
-    returnNative(vm, argc, UNIT_VAL);
     return true;
 }
 
-bool printfnNative(VM* vm, int argc, Value* argv) {
+static bool checkFormat(VM* vm, int argc, Value* argv, const char* name) {
     if (!IS_STRING(argv[0])) {
-        runtimeError(vm, "printfn$ : Expected string, got %s", getValName(argv[0]));
+        runtimeError(vm, "%s$ : Expected string, got %s", name, getValName(argv[0]));
         return false;
     }
 
-    const char* format = AS_CSTRING(argv[0]);
-    char* end;
+    return drainArgs(vm, argc, argv);
+}
 
-    while (*format != '\0') {
-        char next = *format;
+bool printfNative(VM* vm, int argc, Value* argv) {
+    if (!checkFormat(vm, argc, argv, "printf")
+        || !renderFormat(vm, &vm->output, AS_STRING(argv[0]), argc - 1, argv + 1, "printf")) {
+        return false;
+    }
 
-        if (next == '{' && isIntChar(format[1])) {
-            format++;
+    returnNative(vm, argc, UNIT_VAL);
+    return true;
+}
 
-            long slot = strtol(format, &end, 10) + 1; //0-indexed
+bool printfnNative(VM* vm, int argc, Value* argv) {
+    if (!checkFormat(vm, argc, argv, "printfn")
+        || !renderFormat(vm, &vm->output, AS_STRING(argv[0]), argc - 1, argv + 1, "printfn")) {
+        return false;
+    }
 
-            if (slot > argc - 1) {
-                runtimeError(vm, "printfn$ : Attempted to index out of args; got %d with %d args", slot, argc-1);
-                return false;
-            }
+    outputChar(&vm->output, '\n');
 
-            printValue(argv[slot]);
+    returnNative(vm, argc, UNIT_VAL);
+    return true;
+}
 
-            format = end;
+// Like printf$, but returns what it would have printed
+bool formatNative(VM* vm, int argc, Value* argv) {
+    if (!checkFormat(vm, argc, argv, "format")) {
+        return false;
+    }
 
-            if (*format != '}') {
-                runtimeError(vm, "printfn$ : Expected '}' in format");
-                return false;
-            }
+    Output out;
+    initCollector(&out);
 
-            format++;
-        }
-        else {
-            putchar(next);
-            format++;
-        }
+    if (!renderFormat(vm, &out, AS_STRING(argv[0]), argc - 1, argv + 1, "format")) {
+        freeOutput(&out);
+        return false;
     }
 
-    putchar('\n');
+    ObjString* string = copyString(vm, out.bytes == NULL ? "" : out.bytes, out.count);
+    freeOutput(&out);
 
-    returnNative(vm, argc, UNIT_VAL);
+    returnNative(vm, argc, OBJ_VAL(string));
     return true;
 }
 
@@ -249,16 +234,35 @@ bool typeOfNative(VM* vm, int argc, Value* argv) {
 }
 
 bool lenNative(VM* vm, int argc, Value* argv) {
-    if (!IS_OBJ(argv[0])) {
-        runtimeError(vm, "len$ : Expected string or list, got %s", getValName(argv[0]));
-        return false;
-    }
+    if (IS_OBJ(argv[0])) {
+        switch (OBJ_TYPE(argv[0])) {
+        case OBJ_STRING:    returnNative(vm, argc, INT_VAL(AS_STRING(argv[0])->length)); return true;
+        case OBJ_LIST:      returnNative(vm, argc, INT_VAL(ARRAY(argv[0]).count)); return true;
+        case OBJ_VECTOR:    returnNative(vm, argc, INT_VAL(AS_VECTOR(argv[0])->count)); return true;
+        case OBJ_PMAP:      returnNative(vm, argc, INT_VAL(AS_PMAP(argv[0])->count)); return true;
+        case OBJ_ARRAY:     returnNative(vm, argc, INT_VAL(AS_ARRAY(argv[0])->count)); return true;
+        case OBJ_BUILDER:   returnNative(vm, argc, INT_VAL(AS_BUILDER(argv[0])->count)); return true;
+        case OBJ_ITERATOR:
+        case OBJ_FIBER: {
+            Cursor cursor;
+            Value x;
+            initCursor(&cursor, argv[0]);
+
+            while (cursorNext(vm, &cursor, &x));
+
+            if (cursor.failed) {
+                return false;
+            }
 
-    switch (OBJ_TYPE(argv[0])) {
-    case OBJ_STRING:    returnNative(vm, argc, INT_VAL(AS_STRING(argv[0])->length)); return true;
-    case OBJ_LIST:      returnNative(vm, argc, INT_VAL(ARRAY(argv[0]).count)); return true;
-    default: runtimeError(vm, "len$ : Expected string or list, got %s", getValName(argv[0])); return false;
+            returnNative(vm, argc, INT_VAL(cursor.index));
+            return true;
+        }
+        default: break;
+        }
     }
+
+    runtimeError(vm, "len$ : Expected string, list, vector, pmap, array, range, iterator, fiber or builder, got %s", getValName(argv[0]));
+    return false;
 }
 
 bool addOperator(VM* vm, int argc, Value* argv) {
@@ -474,8 +478,16 @@ bool mapNative(VM* vm, int argc, Value* argv) {
         runtimeError(vm, "map$ : Expected callable, got %s", getValName(argv[0]));
         return false;
     }
-    if (!IS_LIST(argv[1])) {
-        runtimeError(vm, "map$ : Expected list, got %s", getValName(argv[1]));
+    // readers may never end, so they're taken lazily like iterators
+    if (IS_READER(argv[1])) {
+        argv[1] = OBJ_VAL(toIterator(vm, argv[1]));
+    }
+    if (IS_ITERATOR(argv[1])) {
+        returnNative(vm, argc, OBJ_VAL(newIterator(vm, ITER_MAP, argv[0], argv[1], UNIT_VAL)));
+        return true;
+    }
+    if (!isSequence(argv[1])) {
+        runtimeError(vm, "map$ : Expected sequence, got %s", getValName(argv[1]));
         return false;
     }
 
@@ -493,10 +505,12 @@ bool mapNative(VM* vm, int argc, Value* argv) {
     printf("\n");
     #endif
 
-    for (int i = 0; i < ARRAY(l).count; ++i) {
-        push(vm, f);
+    Cursor cursor;
+    Value x;
+    initCursor(&cursor, l);
 
-        Value x = ARRAY(l).values[i];
+    while (cursorNext(vm, &cursor, &x)) {
+        push(vm, f);
         push(vm, x);
 
         if (!callFromC(vm, f, 1)) {
@@ -520,8 +534,16 @@ bool filterNative(VM* vm, int argc, Value* argv) {
         runtimeError(vm, "filter$ : Expected callable, got %s", getValName(argv[0]));
         return false;
     }
-    if (!IS_LIST(argv[1])) {
-        runtimeError(vm, "filter$ : Expected list, got %s", getValName(argv[1]));
+    // readers may never end, so they're taken lazily like iterators
+    if (IS_READER(argv[1])) {
+        argv[1] = OBJ_VAL(toIterator(vm, argv[1]));
+    }
+    if (IS_ITERATOR(argv[1])) {
+        returnNative(vm, argc, OBJ_VAL(newIterator(vm, ITER_FILTER, argv[0], argv[1], UNIT_VAL)));
+        return true;
+    }
+    if (!isSequence(argv[1])) {
+        runtimeError(vm, "filter$ : Expected sequence, got %s", getValName(argv[1]));
         return false;
     }
 
@@ -539,10 +561,12 @@ bool filterNative(VM* vm, int argc, Value* argv) {
     printf("\n");
     #endif
 
-    for (int i = 0; i < ARRAY(l).count; ++i) {
-        push(vm, f);
+    Cursor cursor;
+    Value x;
+    initCursor(&cursor, l);
 
-        Value x = ARRAY(l).values[i];
+    while (cursorNext(vm, &cursor, &x)) {
+        push(vm, f);
         push(vm, x);
 
         if (!callFromC(vm, f, 1)) {
@@ -564,8 +588,21 @@ bool zipNative(VM* vm, int argc, Value* argv) {
         runtimeError(vm, "zip$ : Expected callable, got %s", getValName(argv[0]));
         return false;
     }
-    if (!IS_LIST(argv[1]) || !IS_LIST(argv[2])) {
-        runtimeError(vm, "zip$ : Expected lists, got %s and %s", getValName(argv[1]), getValName(argv[2]));
+    if ((IS_ITERATOR(argv[1]) || IS_ITERATOR(argv[2])) && isIterable(argv[1]) && isIterable(argv[2])) {
+        // the stage only ever reads from other stages
+        argv[1] = OBJ_VAL(toIterator(vm, argv[1]));
+        argv[2] = OBJ_VAL(toIterator(vm, argv[2]));
+
+        if (AS_ITERATOR(argv[1])->sources + AS_ITERATOR(argv[2])->sources > CURSOR_MAX_SOURCES) {
+            runtimeError(vm, "zip$ : A pipeline can read from at most %d sources", CURSOR_MAX_SOURCES);
+            return false;
+        }
+
+        returnNative(vm, argc, OBJ_VAL(newIterator(vm, ITER_ZIP, argv[0], argv[1], argv[2])));
+        return true;
+    }
+    if (!isSequence(argv[1]) || !isSequence(argv[2])) {
+        runtimeError(vm, "zip$ : Expected sequences, got %s and %s", getValName(argv[1]), getValName(argv[2]));
         return false;
     }
 
@@ -584,15 +621,14 @@ bool zipNative(VM* vm, int argc, Value* argv) {
     printf("\n");
     #endif
 
-    int min = ARRAY(l1).count < ARRAY(l2).count ? ARRAY(l1).count : ARRAY(l2).count;
+    Cursor c1, c2;
+    Value x, y;
+    initCursor(&c1, l1);
+    initCursor(&c2, l2);
 
-    for (int i = 0; i < min; ++i) {
+    while (cursorNext(vm, &c1, &x) && cursorNext(vm, &c2, &y)) {
         push(vm, f);
-
-        Value x = ARRAY(l1).values[i];
         push(vm, x);
-
-        Value y = ARRAY(l2).values[i];
         push(vm, y);
 
         if (!callFromC(vm, f, 2)) {
@@ -618,7 +654,7 @@ static ObjList* reverseList(VM* vm, ObjList* in) {
     push(vm, OBJ_VAL(out));
 
     for (size_t i = 0; i < in->array.count; ++i) {
-        writeValueArray(vm, &out->array, in->array.values[(in->array.count - 1) - i]);
+        writeValueArray(vm, &out->array, listValues(in)[(in->array.count - 1) - i]);
     }
 
     pop(vm);
@@ -647,6 +683,12 @@ bool revNative(VM* vm, int argc, Value* argv) {
         returnNative(vm, argc, OBJ_VAL(reversed));
         return true;
     }
+    else if (IS_RANGE(to_reverse)) {
+        ObjList* range = AS_RANGE(to_reverse);
+        ObjList* reversed = newRange(vm, rangeAt(range, range->array.count - 1), -range->step, range->array.count);
+        returnNative(vm, argc, OBJ_VAL(reversed));
+        return true;
+    }
     else if (IS_STRING(to_reverse)) {
         ObjString* reversed = reverseString(vm, AS_STRING(to_reverse));
         returnNative(vm, argc, OBJ_VAL(reversed));
@@ -658,24 +700,44 @@ bool revNative(VM* vm, int argc, Value* argv) {
     }
 }
 
-// Need to fix :: replace the weird bits with callFromC()
+// Starts a lazy pipeline; map, filter and zip over an iterator give back
+// another stage instead of a list
+bool iterNative(VM* vm, int argc, Value* argv) {
+    if (!isIterable(argv[0])) {
+        runtimeError(vm, "iter$ : Expected sequence, got %s", getValName(argv[0]));
+        return false;
+    }
+
+    returnNative(vm, argc, OBJ_VAL(toIterator(vm, argv[0])));
+    return true;
+}
+
 bool foldlNative(VM* vm, int argc, Value* argv) {
     if (!IS_CALLABLE(argv[0])) {
         runtimeError(vm, "foldl$ : Expected callable, got %s", getValName(argv[0]));
+        return false;
     }
-    if (!IS_LIST(argv[1])) {
-        runtimeError(vm, "foldl$ : Expected list, got %s", getValName(argv[1]));
+    if (!isIterable(argv[1])) {
+        runtimeError(vm, "foldl$ : Expected sequence, got %s", getValName(argv[1]));
         return false;
     }
 
     Value f = argv[0];
     Value l = argv[1];
 
-    // get this sh*t started
-    push(vm, f);
+    Cursor cursor;
+    Value x, y;
+    initCursor(&cursor, l);
 
-    push(vm, ARRAY(l).values[0]);
-    push(vm, ARRAY(l).values[1]);
+    if (!cursorNext(vm, &cursor, &x)) {
+        if (!cursor.failed) {
+            runtimeError(vm, "foldl$ : Cannot fold an empty sequence");
+        }
+        return false;
+    }
+
+    // the accumulator lives on the stack between calls
+    push(vm, x);
 
     #ifdef DEBUG_DISPLAY_STACK
     for (Value* ptr = vm->stack; ptr < vm->stackTop; ptr++) {
@@ -685,17 +747,9 @@ bool foldlNative(VM* vm, int argc, Value* argv) {
     printf("\n");
     #endif
 
-    if (!callFromC(vm, f, 2)) {
-        return false;
-    }
-
-    Value x = pop(vm);
-
-    for (int i = 2; i < ARRAY(l).count; ++i) {
+    while (cursorNext(vm, &cursor, &y)) {
         push(vm, f);
-
-        Value y = ARRAY(l).values[i];
-        push(vm, x);
+        push(vm, peek(vm, 1));
         push(vm, y);
 
         if (!callFromC(vm, f, 2)) {
@@ -703,9 +757,15 @@ bool foldlNative(VM* vm, int argc, Value* argv) {
         }
 
         x = pop(vm);
+        pop(vm);
+        push(vm, x);
     }
 
-    returnNative(vm, argc, x);
+    if (cursor.failed) {
+        return false;
+    }
+
+    returnNative(vm, argc, pop(vm));
 
     return true;
 }
@@ -713,19 +773,24 @@ bool foldlNative(VM* vm, int argc, Value* argv) {
 bool foldrNative(VM* vm, int argc, Value* argv) {
     if (!IS_CALLABLE(argv[0])) {
         runtimeError(vm, "foldr$ : Expected callable, got %s", getValName(argv[0]));
+        return false;
     }
-    if (!IS_LIST(argv[1])) {
-        runtimeError(vm, "foldr$ : Expected list, got %s", getValName(argv[1]));
+    if (!isSequence(argv[1])) {
+        runtimeError(vm, "foldr$ : Expected sequence, got %s", getValName(argv[1]));
         return false;
     }
 
     Value f = argv[0];
     Value l = argv[1];
+    int count = seqLength(l);
 
-    // get this sh*t started
-    push(vm, f);
-    push(vm, ARRAY(l).values[ARRAY(l).count - 2]);
-    push(vm, ARRAY(l).values[ARRAY(l).count - 1]);
+    if (count == 0) {
+        runtimeError(vm, "foldr$ : Cannot fold an empty sequence");
+        return false;
+    }
+
+    // the accumulator lives on the stack between calls
+    push(vm, seqAt(l, count - 1));
 
     #ifdef DEBUG_DISPLAY_STACK
     for (Value* ptr = vm->stack; ptr < vm->stackTop; ptr++) {
@@ -735,27 +800,21 @@ bool foldrNative(VM* vm, int argc, Value* argv) {
     printf("\n");
     #endif
 
-    if (!callFromC(vm, f, 2)) {
-        return false;
-    }
-
-    Value x = pop(vm);
-
-    for (int i = ARRAY(l).count - 3; i >= 0; --i) {
+    for (int i = count - 2; i >= 0; --i) {
         push(vm, f);
-
-        Value y = ARRAY(l).values[i];
-        push(vm, y);
-        push(vm, x);
+        push(vm, seqAt(l, i));
+        push(vm, peek(vm, 2));
 
         if (!callFromC(vm, f, 2)) {
             return false;
         }
 
-        x = pop(vm);
+        Value x = pop(vm);
+        pop(vm);
+        push(vm, x);
     }
 
-    returnNative(vm, argc, x);
+    returnNative(vm, argc, pop(vm));
 
     return true;
 }
@@ -770,9 +829,22 @@ bool foldrNative(VM* vm, int argc, Value* argv) {
 
 
 void initVM(VM* vm) {
+    vm->frames = vm->mainFrames;
     vm->frameCount = 0;
-    vm->compiler = NULL;
+    vm->frameMax = FRAME_MAX;
+    vm->stack = vm->mainStack;
     vm->stackTop = vm->stack;
+    vm->compiler = NULL;
+
+    vm->fiber = NULL;
+    vm->mainTop = vm->stack;
+    vm->mainFrameCount = 0;
+    vm->nativeDepth = 0;
+    vm->yielding = false;
+    vm->loop = NULL;
+    initOutput(&vm->output, STDOUT_FILENO);
+    vm->pool = NULL;
+    vm->isWorker = false;
 
     vm->objects = NULL;
     vm->isActive = false;
@@ -784,11 +856,16 @@ void initVM(VM* vm) {
     initTable(&vm->strings);
     initTable(&vm->globals);
 
+    vm->rootShape = NULL;
+    vm->rootShape = newShape(vm);
+
     // stdlib
     defineNative(vm, "clock", clockNative, 0);
     defineNative(vm, "exit", exitNative, 1);
     defineNative(vm, "printf", printfNative, -2);
     defineNative(vm, "printfn", printfnNative, -2);
+    defineNative(vm, "format", formatNative, -2);
+    defineNative(vm, "flush", flushNative, 0);
     defineNative(vm, "typeOf", typeOfNative, 1);
     defineNative(vm, "len", lenNative, 1);
     defineNative(vm, "rev", revNative, 1);
@@ -797,6 +874,7 @@ void initVM(VM* vm) {
     defineNative(vm, "map", mapNative, 2);
     defineNative(vm, "zip", zipNative, 3);
     defineNative(vm, "filter", filterNative, 2);
+    defineNative(vm, "iter", iterNative, 1);
     defineNative(vm, "foldl", foldlNative, 2);
     defineNative(vm, "foldr", foldrNative, 2);
     defineNative(vm, "apply", applyNative, -2);
@@ -808,15 +886,21 @@ void initVM(VM* vm) {
     defineNative(vm, "%", modOperator, 2);
     defineNative(vm, "^", powOperator, 2);
     defineNative(vm, "$", applyNative, -2);
+
+    defineBuiltins(vm);
 }
 
 void freeVM(VM* vm) {
     #ifdef DEBUG_LOG_MEMORY
     printf("Ended with %zu bytes allocated with a threshold of %zu\n", vm->bytesAllocated, vm->nextGC);
     #endif
+    freeWorkerPool(vm);
+    freeEventLoop(vm);
+    freeOutput(&vm->output);
     freeObjects(vm);
     freeTable(vm, &vm->globals);
     freeTable(vm, &vm->strings);
+    vm->rootShape = NULL;
     vm->compiler = NULL;
     vm->objects = NULL;
     vm->frameCount = 0;
@@ -836,7 +920,7 @@ void freeVM(VM* vm) {
 */
 
 
-static bool isTruthy(Value value) {
+bool isTruthy(Value value) {
     switch (value.type) {
         case VAL_UNIT:      return false;
         case VAL_BOOL:      return AS_BOOL(value);
@@ -874,18 +958,18 @@ static ObjString* concatStrings(VM* vm, ObjString* a, ObjString* b) {
     return takeString(vm, heapChars, new_length);
 }
 
-static ObjList* concatLists(VM* vm, ValueArray* a, ValueArray* b) {
+static ObjList* concatLists(VM* vm, ObjList* a, ObjList* b) {
     ObjList* list = newList(vm);
 
     // Also GC
     push(vm, OBJ_VAL(list));
 
-    for (int i = 0; i < a->count; ++i) {
-        writeValueArray(vm, &list->array, a->values[i]);
+    for (int i = 0; i < a->array.count; ++i) {
+        writeValueArray(vm, &list->array, listValues(a)[i]);
     }
 
-    for (int i = 0; i < b->count; ++i) {
-        writeValueArray(vm, &list->array, b->values[i]);
+    for (int i = 0; i < b->array.count; ++i) {
+        writeValueArray(vm, &list->array, listValues(b)[i]);
     }
 
     pop(vm);
@@ -893,30 +977,33 @@ static ObjList* concatLists(VM* vm, ValueArray* a, ValueArray* b) {
     return list;
 }
 
-static ObjList* fromRange(VM* vm, long long a, long long b) {
-    ObjList* list = newList(vm);
+static ObjArray* concatTypedArrays(VM* vm, ObjArray* a, ObjArray* b) {
+    ObjArray* array = newArray(vm, a->kind, a->count + b->count);
 
-    // GC
-    push(vm, OBJ_VAL(list));
+    memcpy(array->as.ints, a->as.ints, a->count * sizeof(long long));
+    memcpy(array->as.ints + a->count, b->as.ints, b->count * sizeof(long long));
 
-    long long C = a;
+    return array;
+}
 
-    if (a > b) {
-        while (C >= b) {
-            writeValueArray(vm, &list->array, INT_VAL(C--));
-        }
-    }
-    else if (a < b) {
-        while (C <= b) {
-            writeValueArray(vm, &list->array, INT_VAL(C++)); //🤯
-        }
-    }
-    else {
-        writeValueArray(vm, &list->array, INT_VAL(C));
+// Only the ends of a range are stored; nothing is allocated per element
+static ObjList* fromRange(VM* vm, long long a, long long b) {
+    unsigned long long span = a > b
+        ? (unsigned long long)a - (unsigned long long)b
+        : (unsigned long long)b - (unsigned long long)a;
+
+    if (span >= INT_MAX) {
+        runtimeError(vm, "CONCAT : Range %lld .. %lld is too long", a, b);
+        return NULL;
     }
 
-    pop(vm);
+    return newRange(vm, a, a > b ? -1 : 1, (int)span + 1);
+}
 
+// Swaps the range 'distance' slots down the stack for the list it stands for
+static ObjList* expandRange(VM* vm, int distance) {
+    ObjList* list = rangeToList(vm, AS_RANGE(peek(vm, distance)));
+    vm->stackTop[-1 - distance] = OBJ_VAL(list);
     return list;
 }
 
@@ -926,7 +1013,7 @@ static bool callFunc(VM* vm, ObjFunction* func, uint8_t argCount) {
         return false;
     }
 
-    if (vm->frameCount + 1 >= FRAME_MAX) {
+    if (vm->frameCount + 1 >= vm->frameMax) {
         runtimeError(vm, "CALL : Encountered stack overflow");
         return false;
     }
@@ -966,7 +1053,7 @@ static bool callClosure(VM* vm, ObjClosure* closure, uint8_t argCount) {
         return false;
     }
 
-    if (vm->frameCount + 1 >= FRAME_MAX) {
+    if (vm->frameCount + 1 >= vm->frameMax) {
         runtimeError(vm, "CALL : Encountered stack overflow");
         return false;
     }
@@ -999,6 +1086,102 @@ static bool callValue(VM* vm, Value caller, uint8_t argCount) {
     }
 }
 
+// Parks the running stacks and puts those of 'to' (NULL for main) in their place
+static void switchFiber(VM* vm, ObjFiber* to) {
+    if (vm->fiber == NULL) {
+        vm->mainTop = vm->stackTop;
+        vm->mainFrameCount = vm->frameCount;
+    }
+    else {
+        vm->fiber->stackTop = vm->stackTop;
+        vm->fiber->frameCount = vm->frameCount;
+    }
+
+    if (to == NULL) {
+        vm->stack = vm->mainStack;
+        vm->stackTop = vm->mainTop;
+        vm->frames = vm->mainFrames;
+        vm->frameCount = vm->mainFrameCount;
+        vm->frameMax = FRAME_MAX;
+    }
+    else {
+        vm->stack = to->stack;
+        vm->stackTop = to->stackTop;
+        vm->frames = to->frames;
+        vm->frameCount = to->frameCount;
+        vm->frameMax = FIBER_FRAME_MAX;
+    }
+
+    vm->fiber = to;
+}
+
+// Runs 'fiber' until it yields or returns, passing 'in' as its argument or as
+// the result of the yield it stopped at; whatever it gave back ends up in 'out'
+bool resumeFiber(VM* vm, ObjFiber* fiber, Value in, Value* out) {
+    if (fiber->state == FIBER_DONE) {
+        runtimeError(vm, "resume$ : Fiber has already finished");
+        return false;
+    }
+
+    if (fiber->state == FIBER_RUNNING) {
+        runtimeError(vm, "resume$ : Fiber is already running");
+        return false;
+    }
+
+    int nativeDepth = vm->nativeDepth;
+    FiberState state = fiber->state;
+
+    fiber->caller = vm->fiber;
+    fiber->state = FIBER_RUNNING;
+    switchFiber(vm, fiber);
+    vm->nativeDepth = 0;
+
+    InterpretResult result = INTERPRET_OK;
+
+    if (state == FIBER_NEW) {
+        int arity = IS_CLOSURE(fiber->fn) ? CLOSED_FN(fiber->fn)->arity : AS_FUNC(fiber->fn)->arity;
+
+        push(vm, fiber->fn);
+        if (arity == 1) {
+            push(vm, in);
+        }
+
+        if (!callValue(vm, fiber->fn, arity)) {
+            result = INTERPRET_RUNTIME_ERROR;
+        }
+        else {
+            currentFrame(vm)->isCHOF = true;
+            result = run(vm);
+        }
+    }
+    else if (vm->frameCount == 0) {
+        // it yielded from a tail call, so there's nothing left to run and the
+        // yield's result is what it returns
+        vm->stackTop[-1] = in;
+    }
+    else {
+        vm->stackTop[-1] = in;
+        result = run(vm);
+    }
+
+    if (vm->yielding) {
+        *out = fiber->transfer;
+        fiber->transfer = UNIT_VAL;
+        fiber->state = FIBER_SUSPENDED;
+        vm->yielding = false;
+    }
+    else {
+        *out = result == INTERPRET_OK ? pop(vm) : UNIT_VAL;
+        fiber->state = FIBER_DONE;
+    }
+
+    switchFiber(vm, fiber->caller);
+    fiber->caller = NULL;
+    vm->nativeDepth = nativeDepth;
+
+    return result == INTERPRET_OK;
+}
+
 static bool retrieveUpvalue(VM* vm, uint8_t depth, Value* returnal) {
     ObjClosure* closure = currentFrame(vm)->closure;
 
@@ -1060,10 +1243,55 @@ static void subscriptList(VM* vm, ObjList* list, long long index, uint8_t offset
         push(vm, UNIT_VAL);
     }
     else if (index < offset && index > -(list->array.count - offset)) {
-        push(vm, list->array.values[(list->array.count + index) - offset]);
+        push(vm, listValues(list)[(list->array.count + index) - offset]);
+    }
+    else {
+        push(vm, listValues(list)[index - offset]);
+    }
+}
+
+static void subscriptVector(VM* vm, ObjVector* vector, long long index, uint8_t offset) {
+    pop(vm);
+    pop(vm);
+
+    if (index > vector->count - (1 - offset) || index < -(vector->count - offset)) {
+        push(vm, UNIT_VAL);
+    }
+    else if (index < offset && index > -(vector->count - offset)) {
+        push(vm, vectorGet(vector, (vector->count + index) - offset));
+    }
+    else {
+        push(vm, vectorGet(vector, index - offset));
+    }
+}
+
+static void subscriptTypedArray(VM* vm, ObjArray* array, long long index, uint8_t offset) {
+    pop(vm);
+    pop(vm);
+
+    if (index > array->count - (1 - offset) || index < -(array->count - offset)) {
+        push(vm, UNIT_VAL);
+    }
+    else if (index < offset && index > -(array->count - offset)) {
+        push(vm, arrayAt(array, (array->count + index) - offset));
+    }
+    else {
+        push(vm, arrayAt(array, index - offset));
+    }
+}
+
+static void subscriptRange(VM* vm, ObjList* range, long long index, uint8_t offset) {
+    pop(vm);
+    pop(vm);
+
+    if (index > range->array.count - (1 - offset) || index < -(range->array.count - offset)) {
+        push(vm, UNIT_VAL);
+    }
+    else if (index < offset && index > -(range->array.count - offset)) {
+        push(vm, INT_VAL(rangeAt(range, (range->array.count + index) - offset)));
     }
     else {
-        push(vm, list->array.values[index - offset]);
+        push(vm, INT_VAL(rangeAt(range, index - offset)));
     }
 }
 
@@ -1118,42 +1346,192 @@ static int getArity(VM* vm, Value fn) {
     }
 }
 
+// Slices share their parent's storage unless they're short enough that copying
+// is cheaper, or small enough next to the parent that they'd keep it alive
+static bool shouldCopySlice(int length, int parentLength) {
+    return length < VIEW_MIN_LENGTH || (long long)length * VIEW_MAX_WASTE < parentLength;
+}
+
 static bool sliceList(VM* vm, ObjList* list, long long x, long long y) {
-    if (x > list->array.count || y > list->array.count || x < 0 || y < 0) {
-        runtimeError(vm, "SLICE : Index was outside of list; length was %d, got indeces %d , %d", list->array.count, x, y);
+    int count = list->array.count;
+
+    if (x > count || (y >= count && y >= x) || x < 0 || y < 0) {
+        runtimeError(vm, "SLICE : Index was outside of list; length was %d, got indeces %d , %d", count, x, y);
         return false;
     }
 
+    int length = y >= x ? (y - x) + 1 : 0;
+    int parentLength = list->parent != NULL ? list->parent->array.count : count;
+
+    if (!shouldCopySlice(length, parentLength)) {
+        push(vm, OBJ_VAL(newListView(vm, list, x, length)));
+        return true;
+    }
+
     ObjList* new = newList(vm);
     push(vm, OBJ_VAL(new));
 
     for (int i = x; i <= y; i++) {
-        writeValueArray(vm, &new->array, list->array.values[i]);
+        writeValueArray(vm, &new->array, listValues(list)[i]);
     }
 
     return true;
 }
 
 static bool sliceString(VM* vm, ObjString* string, long long x, long long y) {
-    if (x > string->length || y > string->length || x < 0 || y < 0) {
+    if (x > string->length || (y >= string->length && y >= x) || x < 0 || y < 0) {
         runtimeError(vm, "SLICE : Index was outside of string; length was %d, got indeces %d , %d", string->length, x, y);
         return false;
     }
 
-    push(vm, OBJ_VAL(copyString(vm, (string->chars + x), (y - x) + 1)));
+    int length = y >= x ? (y - x) + 1 : 0;
+    int parentLength = string->owner == NULL
+        ? string->length
+        : string->owner->type == OBJ_MAPPING
+        ? ((ObjMapping*)string->owner)->length
+        : ((ObjString*)string->owner)->length;
+
+    if (!shouldCopySlice(length, parentLength)) {
+        push(vm, OBJ_VAL(newStringView(vm, string, x, length)));
+        return true;
+    }
+
+    push(vm, OBJ_VAL(copyString(vm, (string->chars + x), length)));
+
+    return true;
+}
+
+static bool sliceTypedArray(VM* vm, ObjArray* array, long long x, long long y) {
+    if (x > array->count || (y >= array->count && y >= x) || x < 0 || y < 0) {
+        runtimeError(vm, "SLICE : Index was outside of array; length was %d, got indeces %d , %d", array->count, x, y);
+        return false;
+    }
+
+    int length = y >= x ? (y - x) + 1 : 0;
+    int parentLength = array->owner == NULL
+        ? array->count
+        : array->owner->type == OBJ_MAPPING
+        ? ((ObjMapping*)array->owner)->length / (int)sizeof(long long)
+        : ((ObjArray*)array->owner)->count;
+
+    if (!shouldCopySlice(length, parentLength)) {
+        push(vm, OBJ_VAL(newArrayView(vm, array, x, length)));
+        return true;
+    }
+
+    ObjArray* copy = newArray(vm, array->kind, length);
+    memcpy(copy->as.ints, array->as.ints + x, length * sizeof(long long));
+    push(vm, OBJ_VAL(copy));
+
+    return true;
+}
+
+// A slice of a range is just a shorter range
+static bool sliceRange(VM* vm, ObjList* range, long long x, long long y) {
+    if (x > range->array.count || (y >= range->array.count && y >= x) || x < 0 || y < 0) {
+        runtimeError(vm, "SLICE : Index was outside of range; length was %d, got indeces %d , %d", range->array.count, x, y);
+        return false;
+    }
+
+    int length = y >= x ? (y - x) + 1 : 0;
+    push(vm, OBJ_VAL(newRange(vm, range->start + x * range->step, range->step, length)));
 
     return true;
 }
 
+static inline bool isSliceable(Value value) {
+    return IS_LIST(value) || IS_STRING(value) || IS_ARRAY(value) || IS_RANGE(value);
+}
+
 static bool sliceArray(VM* vm, Value array, long long x, long long y) {
     if (IS_LIST(array)) {
         return sliceList(vm, AS_LIST(array), x, y);
     }
+    else if (IS_ARRAY(array)) {
+        return sliceTypedArray(vm, AS_ARRAY(array), x, y);
+    }
+    else if (IS_RANGE(array)) {
+        return sliceRange(vm, AS_RANGE(array), x, y);
+    }
     else {
         return sliceString(vm, AS_STRING(array), x, y);
     }
 }
 
+// Indexes the second value on the stack with the first, replacing both with the result
+static bool subscriptValue(VM* vm) {
+    Value thing = peek(vm, 1);
+    Value index = peek(vm, 0);
+
+    if (IS_MAP(thing)) {
+        if (!IS_STRING(index)) {
+            runtimeError(vm, "SUBSCRIPT : Expected string, got %s", getValName(index));
+            return false;
+        }
+
+        ObjString* key = findInterned(vm, AS_STRING(index));
+        Value* value = key == NULL ? NULL : mapGet(AS_MAP(thing), key);
+
+        pop(vm);
+        pop(vm);
+
+        push(vm, value == NULL ? UNIT_VAL : *value);
+
+        return true;
+    }
+
+    if (IS_PMAP(thing)) {
+        if (!IS_STRING(index)) {
+            runtimeError(vm, "SUBSCRIPT : Expected string, got %s", getValName(index));
+            return false;
+        }
+
+        ObjString* key = findInterned(vm, AS_STRING(index));
+        Value* value = key == NULL ? NULL : pmapGet(AS_PMAP(thing), key);
+
+        pop(vm);
+        pop(vm);
+
+        push(vm, value == NULL ? UNIT_VAL : *value);
+
+        return true;
+    }
+
+    uint8_t offset;
+    #ifdef OPTION_ONE_INDEXED
+    offset = 1;
+    #else
+    offset = 0;
+    #endif
+
+    if (!IS_INT(index)) {
+        runtimeError(vm, "SUBSCRIPT : Expected integer, got %s", getValName(index));
+        return false;
+    }
+
+    if (IS_LIST(thing)) {
+        subscriptList(vm, AS_LIST(thing), AS_INT(index), offset);
+    }
+    else if (IS_VECTOR(thing)) {
+        subscriptVector(vm, AS_VECTOR(thing), AS_INT(index), offset);
+    }
+    else if (IS_ARRAY(thing)) {
+        subscriptTypedArray(vm, AS_ARRAY(thing), AS_INT(index), offset);
+    }
+    else if (IS_RANGE(thing)) {
+        subscriptRange(vm, AS_RANGE(thing), AS_INT(index), offset);
+    }
+    else if (IS_STRING(thing)) {
+        subscriptString(vm, AS_STRING(thing), AS_INT(index), offset);
+    }
+    else {
+        runtimeError(vm, "SUBSCRIPT : %s is not subscriptable", getValName(thing));
+        return false;
+    }
+
+    return true;
+}
+
 /*
 +---------------------+
 | Functionality ^^^^  |
@@ -1168,8 +1546,18 @@ InterpretResult run(VM* vm) {
     (currentFrame(v)->ip += 2, (uint16_t)((currentFrame(v)->ip[-2] << 8) | currentFrame(v)->ip[-1]))
 #define READ_CONST(v, i)    (currentFrame(vm)->function->body.constants.values[i])
 
-#define BINARY_OP(v, op)                                                                                \
+// Two numbers are by far the common case, so they never reach isBroadcast
+#define TRY_BROADCAST(v, bop)                                                                           \
+    if ((!IS_ARITH(peek(v, 1)) || !IS_ARITH(peek(v, 0))) && isBroadcast(peek(v, 1), peek(v, 0))) {      \
+        if (!broadcast(v, bop)) {                                                                       \
+            return INTERPRET_RUNTIME_ERROR;                                                             \
+        }                                                                                               \
+        break;                                                                                          \
+    }
+
+#define BINARY_OP(v, op, bop)                                                                           \
     do {                                                                                                \
+        TRY_BROADCAST(v, bop)                                                                           \
         Value b = pop(v);                                                                               \
         Value a = pop(v);                                                                               \
         if (!IS_ARITH(a) || !IS_ARITH(b)) {                                                             \
@@ -1207,7 +1595,8 @@ InterpretResult run(VM* vm) {
 
                 // Add a check to see if the run() call is being controlled by a C-based HOF or
                 // some other C function that isn't interpret(), and return if it is.
-                if (vm->frameCount - 1 > 0) {
+                // A fiber's first frame is marked as a CHOF so its result stays put
+                if (vm->frameCount - 1 > 0 || currentFrame(vm)->isCHOF) {
                     Value result = pop(vm);
 
                     while (vm->stackTop > (currentFrame(vm)->slots - 1)) {
@@ -1246,6 +1635,10 @@ InterpretResult run(VM* vm) {
                     return INTERPRET_RUNTIME_ERROR;
                 }
 
+                if (vm->yielding) {
+                    return INTERPRET_OK;
+                }
+
                 // Native functions don't hit an OP_RETURN so
                 // the eval loop needs to exit here.
                 if (isNative && isCHigherOrderFunction) {
@@ -1330,11 +1723,13 @@ InterpretResult run(VM* vm) {
 
                 break;
             }
-            case OP_ADD:        BINARY_OP(vm, + ); break;
-            case OP_SUBTRACT:   BINARY_OP(vm, - ); break;
-            case OP_MULTIPLY:   BINARY_OP(vm, * ); break;
-            case OP_DIVIDE:     BINARY_OP(vm, / ); break;
+            case OP_ADD:        BINARY_OP(vm, +, BCAST_ADD); break;
+            case OP_SUBTRACT:   BINARY_OP(vm, -, BCAST_SUB); break;
+            case OP_MULTIPLY:   BINARY_OP(vm, *, BCAST_MUL); break;
+            case OP_DIVIDE:     BINARY_OP(vm, /, BCAST_DIV); break;
             case OP_MODULO: {
+                TRY_BROADCAST(vm, BCAST_MOD)
+
                 Value b = pop(vm);
                 Value a = pop(vm);
 
@@ -1363,6 +1758,8 @@ InterpretResult run(VM* vm) {
                 break;
             }
             case OP_EXPONENT: {
+                TRY_BROADCAST(vm, BCAST_POW)
+
                 Value b = pop(vm);
                 Value a = pop(vm);
 
@@ -1391,6 +1788,8 @@ InterpretResult run(VM* vm) {
                 break;
             }
             case OP_DIFF: {
+                TRY_BROADCAST(vm, BCAST_GT)
+
                 Value b = pop(vm);
                 Value a = pop(vm);
 
@@ -1419,6 +1818,8 @@ InterpretResult run(VM* vm) {
                 break;
             }
             case OP_DIFFEQ: {
+                TRY_BROADCAST(vm, BCAST_GE)
+
                 Value b = pop(vm);
                 Value a = pop(vm);
 
@@ -1496,10 +1897,18 @@ InterpretResult run(VM* vm) {
                     return INTERPRET_RUNTIME_ERROR;
                 }
 
+                // ranges are joined as the lists they stand for
+                if (IS_RANGE(peek(vm, 1)) && (IS_LIST(peek(vm, 0)) || IS_RANGE(peek(vm, 0)))) {
+                    expandRange(vm, 1);
+                }
+                if (IS_RANGE(peek(vm, 0)) && IS_LIST(peek(vm, 1))) {
+                    expandRange(vm, 0);
+                }
+
                 Value b = peek(vm, 0);
                 Value a = peek(vm, 1);
 
-                if (IS_STRING(a)) {
+                if (IS_STRING(a) && IS_STRING(b)) {
                     ObjString* c = concatStrings(vm, AS_STRING(a), AS_STRING(b));
 
                     pop(vm); // b
@@ -1507,8 +1916,32 @@ InterpretResult run(VM* vm) {
 
                     push(vm, OBJ_VAL(c));
                 }
-                else if (IS_LIST(a)) {
-                    ObjList* c = concatLists(vm, &ARRAY(a), &ARRAY(b));
+                else if (IS_LIST(a) && IS_LIST(b)) {
+                    ObjList* c = concatLists(vm, AS_LIST(a), AS_LIST(b));
+
+                    pop(vm); // b
+                    pop(vm); // a
+
+                    push(vm, OBJ_VAL(c));
+                }
+                else if (IS_VECTOR(a) && (IS_VECTOR(b) || IS_LIST(b))) {
+                    ObjVector* c = vectorAppend(vm, AS_VECTOR(a), b);
+
+                    pop(vm); // b
+                    pop(vm); // a
+
+                    push(vm, OBJ_VAL(c));
+                }
+                else if (IS_ARRAY(a) && IS_ARRAY(b) && AS_ARRAY(a)->kind == AS_ARRAY(b)->kind) {
+                    ObjArray* c = concatTypedArrays(vm, AS_ARRAY(a), AS_ARRAY(b));
+
+                    pop(vm); // b
+                    pop(vm); // a
+
+                    push(vm, OBJ_VAL(c));
+                }
+                else if (IS_PMAP(a) && IS_PMAP(b)) {
+                    ObjPMap* c = pmapMerge(vm, AS_PMAP(a), AS_PMAP(b));
 
                     pop(vm); // b
                     pop(vm); // a
@@ -1518,6 +1951,10 @@ InterpretResult run(VM* vm) {
                 else if (IS_INT(a)) {
                     ObjList* c = fromRange(vm, AS_INT(a), AS_INT(b));
 
+                    if (c == NULL) {
+                        return INTERPRET_RUNTIME_ERROR;
+                    }
+
                     pop(vm); // b
                     pop(vm); // a
 
@@ -1589,6 +2026,11 @@ InterpretResult run(VM* vm) {
                     return INTERPRET_RUNTIME_ERROR;
                 }
 
+                // yield$ hands control back to whoever resumed the fiber
+                if (vm->yielding) {
+                    return INTERPRET_OK;
+                }
+
                 break;
             }
             case OP_UPVALUE: {
@@ -1706,10 +2148,16 @@ InterpretResult run(VM* vm) {
                         return INTERPRET_RUNTIME_ERROR;
                     }
 
-                    if (!tableAddEntry(vm, &map->table, AS_STRING(key), val)) {
-                        runtimeError(vm, "MAP : Key %s is already in map", AS_CSTRING(key));
+                    // GC :: the map holds on to the key once it's set
+                    ObjString* name = internString(vm, AS_STRING(key));
+                    push(vm, OBJ_VAL(name));
+
+                    if (!mapSet(vm, map, name, val)) {
+                        runtimeError(vm, "MAP : Key %s is already in map", name->chars);
                         return INTERPRET_RUNTIME_ERROR;
                     }
+
+                    pop(vm);
                 }
 
                 i = (count*2) + 1;
@@ -1723,50 +2171,7 @@ InterpretResult run(VM* vm) {
                 break;
             }
             case OP_SUBSCRIPT: {
-                Value thing = peek(vm, 1);
-                Value index = peek(vm, 0);
-
-                if (IS_MAP(thing)) {
-                    if (!IS_STRING(index)) {
-                        runtimeError(vm, "SUBSCRIPT : Expected string, got %s", getValName(index));
-                        return INTERPRET_RUNTIME_ERROR;
-                    }
-
-                    Entry* entry = tableGetEntry(&TABLE(thing), AS_STRING(index));
-
-                    pop(vm);
-                    pop(vm);
-
-                    if (entry == NULL) {
-                        push(vm, UNIT_VAL);
-                    }
-                    else {
-                        push(vm, entry->value);
-                    }
-
-                    break;
-                }
-
-                uint8_t offset;
-                #ifdef OPTION_ONE_INDEXED
-                offset = 1;
-                #else
-                offset = 0;
-                #endif
-
-                if (!IS_INT(index)) {
-                    runtimeError(vm, "SUBSCRIPT : Expected integer, got %s", getValName(index));
-                    return INTERPRET_RUNTIME_ERROR;
-                }
-
-                if (IS_LIST(thing)) {
-                    subscriptList(vm, AS_LIST(thing), AS_INT(index), offset);
-                }
-                else if (IS_STRING(thing)) {
-                    subscriptString(vm, AS_STRING(thing), AS_INT(index), offset);
-                }
-                else {
-                    runtimeError(vm, "SUBSCRIPT : %s is not subscriptable", getValName(thing));
+                if (!subscriptValue(vm)) {
                     return INTERPRET_RUNTIME_ERROR;
                 }
 
@@ -1776,10 +2181,13 @@ InterpretResult run(VM* vm) {
                 Value value = peek(vm, 0);
                 Value array = peek(vm, 1);
 
-                if (IS_LIST(array)) {
+                if (isObjType(array, OBJ_LIST)) {
 
                     ObjList* list = AS_LIST(array);
 
+                    // views share storage with their parent and ranges have none,
+                    // so fill in a copy before writing
+                    materialiseList(vm, list);
                     writeValueArray(vm, &list->array, value);
 
                     pop(vm);
@@ -1795,11 +2203,16 @@ InterpretResult run(VM* vm) {
                         return INTERPRET_RUNTIME_ERROR;
                     }
 
-                    if (!tableAddEntry(vm, &TABLE(array), AS_STRING(CAR(value)), CDR(value))) {
-                        runtimeError(vm, "RECEIVE : Key %s is already in map", AS_CSTRING(CAR(value)));
+                    ObjString* name = internString(vm, AS_STRING(CAR(value)));
+                    push(vm, OBJ_VAL(name));
+
+                    if (!mapSet(vm, AS_MAP(array), name, CDR(value))) {
+                        runtimeError(vm, "RECEIVE : Key %s is already in map", name->chars);
                         return INTERPRET_RUNTIME_ERROR;
                     }
 
+                    pop(vm);
+
                     pop(vm);
                     pop(vm);
 
@@ -1926,19 +2339,12 @@ InterpretResult run(VM* vm) {
                 switch (mode) {
                     case 0: {  // start to end
                         Value array = peek(vm, 0);
-                        if (!IS_LIST(array) && !IS_STRING(array)) {
+                        if (!isSliceable(array)) {
                             runtimeError(vm, "SLICE : Cannot slice %s", getValName(array));
                             return INTERPRET_RUNTIME_ERROR;
                         }
 
-                        long long length = 0;
-
-                        if (IS_LIST(array)) {
-                            length = ARRAY(array).count - 1;
-                        }
-                        else {
-                            length = AS_STRING(array)->length - 1;
-                        }
+                        long long length = seqLength(array) - 1;
 
                         if (!sliceArray(vm, array, 0, length)) {
                             return INTERPRET_RUNTIME_ERROR;
@@ -1953,7 +2359,7 @@ InterpretResult run(VM* vm) {
                         Value array = peek(vm, 1);
                         Value index = peek(vm, 0);
 
-                        if (!IS_LIST(array) && !IS_STRING(array)) {
+                        if (!isSliceable(array)) {
                             runtimeError(vm, "SLICE : Cannot slice %s", getValName(array));
                             return INTERPRET_RUNTIME_ERROR;
                         }
@@ -1977,7 +2383,7 @@ InterpretResult run(VM* vm) {
                         Value array = peek(vm, 1);
                         Value index = peek(vm, 0);
 
-                        if (!IS_LIST(array) && !IS_STRING(array)) {
+                        if (!isSliceable(array)) {
                             runtimeError(vm, "SLICE : Cannot slice %s", getValName(array));
                             return INTERPRET_RUNTIME_ERROR;
                         }
@@ -1987,14 +2393,7 @@ InterpretResult run(VM* vm) {
                             return INTERPRET_RUNTIME_ERROR;
                         }
 
-                        long long length = 0;
-
-                        if (IS_LIST(array)) {
-                            length = ARRAY(array).count - 1;
-                        }
-                        else {
-                            length = AS_STRING(array)->length - 1;
-                        }
+                        long long length = seqLength(array) - 1;
 
                         if (!sliceArray(vm, array, AS_INT(index) - offset, length)) {
                             return INTERPRET_RUNTIME_ERROR;
@@ -2011,7 +2410,7 @@ InterpretResult run(VM* vm) {
                         Value x = peek(vm, 1);
                         Value y = peek(vm, 0);
 
-                        if (!IS_LIST(array) && !IS_STRING(array)) {
+                        if (!isSliceable(array)) {
                             runtimeError(vm, "SLICE : Cannot slice %s", getValName(array));
                             return INTERPRET_RUNTIME_ERROR;
                         }
@@ -2039,6 +2438,41 @@ InterpretResult run(VM* vm) {
 
                 break;
             }
+            case OP_GET_FIELD: {
+                Value key = READ_CONST(vm, READ_BYTE(vm));
+                InlineCache* cache = &currentFrame(vm)->function->body.caches[READ_SHORT(vm)];
+                Value thing = peek(vm, 0);
+
+                if (IS_MAP(thing) && AS_MAP(thing)->shape != NULL) {
+                    ObjMap* map = AS_MAP(thing);
+
+                    if (map->shape != cache->shape) {
+                        int slot = shapeSlot(map->shape, AS_STRING(key));
+
+                        if (slot == -1) {
+                            pop(vm);
+                            push(vm, UNIT_VAL);
+                            break;
+                        }
+
+                        cache->shape = map->shape;
+                        cache->slot = slot;
+                    }
+
+                    pop(vm);
+                    push(vm, map->slots.values[cache->slot]);
+                    break;
+                }
+
+                // dictionaries and everything else take the long way round
+                push(vm, key);
+
+                if (!subscriptValue(vm)) {
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+
+                break;
+            }
             case OP_IN: {
                 Value list = peek(vm, 0);
                 Value atom = peek(vm, 1);
@@ -2047,12 +2481,50 @@ InterpretResult run(VM* vm) {
 
                 if (IS_LIST(list)) {
                     for (int i = 0; i < ARRAY(list).count; i++) {
-                        if (valuesEqual(ARRAY(list).values[i], atom)) {
+                        if (valuesEqual(ELEMS(list)[i], atom)) {
                             result = true;
                             break;
                         }
                     }
                 }
+                else if (IS_VECTOR(list)) {
+                    for (int i = 0; i < AS_VECTOR(list)->count; i++) {
+                        if (valuesEqual(vectorGet(AS_VECTOR(list), i), atom)) {
+                            result = true;
+                            break;
+                        }
+                    }
+                }
+                else if (IS_ARRAY(list) && IS_ARITH(atom)) {
+                    ObjArray* array = AS_ARRAY(list);
+                    for (int i = 0; i < array->count; i++) {
+                        if (valuesEqual(arrayAt(array, i), atom)) {
+                            result = true;
+                            break;
+                        }
+                    }
+                }
+                else if (IS_RANGE(list) && IS_ARITH(atom)) {
+                    // no need to walk a range, just check the bounds
+                    ObjList* range = AS_RANGE(list);
+
+                    if (range->array.count > 0) {
+                        long long lo = range->step > 0 ? range->start : rangeAt(range, range->array.count - 1);
+                        long long hi = range->step > 0 ? rangeAt(range, range->array.count - 1) : range->start;
+
+                        if (IS_INT(atom)) {
+                            result = AS_INT(atom) >= lo && AS_INT(atom) <= hi;
+                        }
+                        else {
+                            double x = AS_FLOAT(atom);
+                            result = x >= (double)lo && x <= (double)hi && x == floor(x);
+                        }
+                    }
+                }
+                else if (IS_PMAP(list) && IS_STRING(atom)) {
+                    ObjString* key = findInterned(vm, AS_STRING(atom));
+                    result = key != NULL && pmapGet(AS_PMAP(list), key) != NULL;
+                }
                 else if (IS_STRING(list) && IS_STRING(atom)) {
                     for (int i = 0; i <= AS_STRING(list)->length - AS_STRING(atom)->length; i++) {
                         if (memcmp(&AS_CSTRING(list)[i], AS_CSTRING(atom), AS_STRING(atom)->length) == 0) {
@@ -2137,6 +2609,11 @@ InterpretResult interpret(VM* vm, const char* source) {
         return INTERPRET_COMPILATION_ERROR;
     }
 
+    return interpretCompiled(vm, script);
+}
+
+// Runs a script that's already been compiled, or loaded from a code image
+InterpretResult interpretCompiled(VM* vm, ObjFunction* script) {
     vm->frames[vm->frameCount++] = (CallFrame){script, NULL, script->body.code, vm->stack, false};
     vm->isActive = true;
 
@@ -2157,6 +2634,40 @@ InterpretResult interpretPrecompiled(VM* vm, const char* source) {
     return run(vm);
 }
 
+InterpretResult interpretFlat(VM* vm, const uint8_t* bytes, size_t length) {
+    vm->isActive = false;
+    ObjFunction* script = recompileFlat(bytes, length, vm);
+
+    if (script == NULL) {
+        return INTERPRET_COMPILATION_ERROR;
+    }
+
+    return interpretCompiled(vm, script);
+}
+
+// Runs a script from a code image, as written by -c, without compiling it
+InterpretResult interpretImage(VM* vm, const uint8_t* bytes, size_t length) {
+    vm->isActive = false;
+    int version = 0;
+
+    switch (unpackCode(vm, bytes, length, &version)) {
+        case IMAGE_OK:
+            break;
+        case IMAGE_NOT_IMAGE:
+            fprintf(stderr, "Not a compiled Hammer file\n");
+            return INTERPRET_COMPILATION_ERROR;
+        case IMAGE_WRONG_VERSION:
+            fprintf(stderr, "Compiled by another version of Hammer, or for another byte order; recompile it\n");
+            return INTERPRET_COMPILATION_ERROR;
+        case IMAGE_CORRUPT:
+        default:
+            fprintf(stderr, "Compiled file is corrupt\n");
+            return INTERPRET_COMPILATION_ERROR;
+    }
+
+    return interpretCompiled(vm, AS_FUNC(pop(vm)));
+}
+
 InterpretResult repl() {
     VM vm;
     initVM(&vm);
@@ -2165,7 +2676,8 @@ InterpretResult repl() {
 
     for (;;) {
         char buf[2048];
-        printf("\n>>> ");
+        outputCString(&vm.output, "\n>>> ");
+        flushOutput(&vm.output);
 
         if (!fgets(buf, sizeof(buf), stdin)) {
             printf("Error receiving input\n");
@@ -5,23 +5,44 @@
 #include "value.h"
 #include "table.h"
 #include "object.h"
+#include "output.h"
 
 
-typedef struct {
+struct CallFrame {
     ObjFunction* function;
     ObjClosure* closure;
     uint8_t* ip;
     Value* slots;
     bool isCHOF;
-} CallFrame;
+};
 
 struct VM {
     // Static
-    CallFrame frames[FRAME_MAX];
+    CallFrame mainFrames[FRAME_MAX];
+    Value mainStack[STACK_SIZE];
+
+    // The stacks being run: the main ones above, or those of 'fiber'
+    CallFrame* frames;
     int frameCount;
-    Value stack[STACK_SIZE];
+    int frameMax;
+    Value* stack;
     Value* stackTop;
 
+    // Fibers
+    ObjFiber* fiber;        // NULL while on the main stacks
+    Value* mainTop;         // where the main stacks were left while a fiber runs
+    int mainFrameCount;
+    int nativeDepth;        // run() calls nested inside natives on these stacks
+    bool yielding;          // set by yield$ to stop the fiber's run()
+    EventLoop* loop;        // NULL until something uses it
+
+    // Printing
+    Output output;          // everything printf$ and friends print
+
+    // Threads
+    WorkerPool* pool;       // NULL until something uses it
+    bool isWorker;          // runs jobs for another VM's pool
+
     // Rigid
     Compiler* compiler;
 
@@ -31,6 +52,7 @@ struct VM {
     Obj* greyEnd;
     Table strings;
     Table globals;
+    ObjShape* rootShape;
 
 //  -+ Garbage Collection +-
     // Should the gc consider the heap size?
@@ -58,9 +80,32 @@ typedef enum {
 void initVM(VM* vm);
 void freeVM(VM* vm);
 InterpretResult interpret(VM* vm, const char* source);
+InterpretResult interpretCompiled(VM* vm, ObjFunction* script);
 InterpretResult interpretTEST(const char* source);
 InterpretResult interpretPrecompiled(VM* vm, const char* source);
+InterpretResult interpretFlat(VM* vm, const uint8_t* bytes, size_t length);
+InterpretResult interpretImage(VM* vm, const uint8_t* bytes, size_t length);
 InterpretResult repl();
 
+void runtimeError(VM* vm, const char* format, ...);
+void returnNative(VM* vm, int argCount, Value result);
+bool callFromC(VM* vm, Value caller, uint8_t argCount);
+bool resumeFiber(VM* vm, ObjFiber* fiber, Value in, Value* out);
+bool isTruthy(Value value);
+void defineNative(VM* vm, const char* name, NativeFn function, int arity);
+
+simple void push(VM* vm, Value value) {
+    *vm->stackTop = value;
+    vm->stackTop++;
+}
+
+simple Value pop(VM* vm) {
+    return *(--vm->stackTop);
+}
+
+simple Value peek(VM* vm, int distance) {
+    return vm->stackTop[(-1) - distance];
+}
+
 
 #endif
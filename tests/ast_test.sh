@@ -0,0 +1,27 @@
+# -a writes a script's syntax tree as flat binary, and -l runs it
+
+cat > ast_lib.hm <<'HM'
+// comments and layout don't matter
+twice : f x = f(f(x))
+inc : x = x + 1
+words = ["flat" "tree"]
+sign : n = if n < 0 then f"negative\t{0}" else "not negative"
+shape : v = match v
+| 0 => "zero"
+| _ => "other"
+nested = [1..3 {4 * 2} "a" .. "b" 'c' 2.5 true unit]
+HM
+
+echo 'printfn("{0} {1} {2} {3}" ; twice(inc ; 1) ; words ; shape(0) ; nested)' > ast_main.hm
+echo 'printfn(sign(-1) ; 1)' >> ast_main.hm
+
+"$HMC" -a ast_lib.hm
+"$HMC" -n -l ast_lib.hm.ast ast_main.hm
+
+# -o names the tree instead
+"$HMC" -a ast_lib.hm -o named.ast
+cmp -s ast_lib.hm.ast named.ast && echo "same tree"
+
+# the flat tree runs the same as the source it came from
+cat ast_lib.hm ast_main.hm > ast_whole.hm
+"$HMC" -n ast_whole.hm
@@ -0,0 +1,57 @@
+# Scripts are cached as images on their first run, and reused until the
+# source or the build of hmc changes
+
+XDG_CACHE_HOME=$(pwd)/cache_test
+export XDG_CACHE_HOME
+entries() { ls "$XDG_CACHE_HOME/hammer" 2>/dev/null | grep -c '\.o$'; }
+
+echo 'printfn("{0}" ; map(_ : x = x * 2 ; 1..3))' > cached.hm
+
+# -n leaves the cache alone
+"$HMC" -n cached.hm
+echo "entries: $(entries)"
+
+"$HMC" cached.hm
+echo "entries: $(entries)"
+"$HMC" cached.hm
+echo "entries: $(entries)"
+
+# a changed script misses
+echo 'printfn("{0}" ; "changed")' > cached.hm
+"$HMC" cached.hm
+echo "entries: $(entries)"
+
+# so does another build of hmc
+cp "$HMC" hmc_rebuilt
+./hmc_rebuilt cached.hm
+echo "entries: $(entries)"
+
+# a damaged entry is compiled again and replaced
+for entry in "$XDG_CACHE_HOME"/hammer/*.o; do
+    printf 'junk' > "$entry"
+done
+"$HMC" cached.hm
+echo "entries: $(entries)"
+"$HMC" cached.hm
+
+# scripts that don't compile aren't cached
+echo 'x = [1 ["k" => 1]]' > cached.hm
+"$HMC" cached.hm
+echo "entries: $(entries)"
+
+# storing an entry prunes ones unused for a month, and abandoned temporaries
+touch -d '40 days ago' "$XDG_CACHE_HOME/hammer/stale.o"
+touch -d '2 hours ago' "$XDG_CACHE_HOME/hammer/stale.o.123"
+touch "$XDG_CACHE_HOME/hammer/recent.o.456"
+echo 'printfn("{0}" ; "pruned")' > cached.hm
+"$HMC" cached.hm
+ls "$XDG_CACHE_HOME/hammer" | grep -v '^[0-9a-f]*\.o$'
+echo "entries: $(entries)"
+
+# using an entry keeps it from aging out
+rm "$XDG_CACHE_HOME/hammer/recent.o.456"
+touch -d '40 days ago' "$XDG_CACHE_HOME"/hammer/*.o
+"$HMC" cached.hm
+echo 'printfn("{0}" ; "fresh")' > cached.hm
+"$HMC" cached.hm
+echo "entries: $(entries)"
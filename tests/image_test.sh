@@ -0,0 +1,31 @@
+# -c compiles a library to a bytecode image, and -l runs it before the script
+
+cat > image_lib.hm <<'HM'
+square : x = x * x
+greeting = "hello from the image"
+table = ["pi" => 3.14159 "list" => [1 2 3]]
+pick : n = match n
+| 1 => "one"
+| _ => "many"
+HM
+
+cat > image_main.hm <<'HM'
+printfn("{0}" ; greeting)
+printfn("{0} {1}" ; square(12) ; map(square ; 1..4))
+printfn("{0} {1}" ; table["pi"] ; table["list"])
+printfn("{0} {1}" ; pick(1) ; pick(5))
+HM
+
+"$HMC" -c image_lib.hm
+echo "compiled: $?"
+"$HMC" -n -l image_lib.hm.o image_main.hm
+
+# -o names the image instead
+"$HMC" -c image_lib.hm -o named.o
+cmp -s image_lib.hm.o named.o && echo "same image"
+
+# a script that doesn't compile leaves no image behind
+echo 'x = [1 ["k" => 1]]' > image_bad.hm
+"$HMC" -c image_bad.hm
+echo "failed: $?"
+[ -f image_bad.hm.o ] || echo "no image"
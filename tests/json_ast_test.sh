@@ -0,0 +1,24 @@
+# -j writes a script's syntax tree as JSON, which -l reads back a token at a time
+
+cat > json_lib.hm <<'HM'
+twice : f x = f(f(x))
+inc : x = x + 1
+quoted = f"say \"hi\"\tthen leave"
+sign : n = if n < 0 then "negative" else "not negative"
+shape : v = match v
+| 0 => "zero"
+| _ => "other"
+nested = [1..3 {4 * 2} "a" .. "b" 'c' 2.5 true unit]
+HM
+
+echo 'printfn("{0} {1} {2} {3} {4}" ; twice(inc ; 1) ; quoted ; sign(-1) ; shape(3) ; nested)' > json_main.hm
+
+"$HMC" -j json_lib.hm
+"$HMC" -n -l json_lib.hm.json json_main.hm
+
+# a damaged tree is refused rather than run
+head -c 200 json_lib.hm.json > json_cut.json
+"$HMC" -n -l json_cut.json json_main.hm
+status=$?
+echo
+echo "failed: $status"
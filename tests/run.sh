@@ -0,0 +1,54 @@
+#!/bin/sh
+#
+# Runs each test in this directory and compares everything it prints with the
+# .out file beside it. A *_test.hm is run as a script; a *_test.sh is run with
+# HMC set, for tests that need the command line (images, the cache). A test
+# that exits non-zero has "[exit N]" appended to what it printed.
+#
+# Usage: tests/run.sh [path/to/hmc]
+#
+
+HMC=$(cd "$(dirname "${1:-./build/release/hmc}")" && pwd)/$(basename "${1:-./build/release/hmc}")
+DIR=$(cd "$(dirname "$0")" && pwd)
+WORK=$(mktemp -d)
+
+trap 'rm -rf "$WORK"' EXIT
+
+# keep the user's compile cache out of it
+XDG_CACHE_HOME=$WORK/cache
+export HMC XDG_CACHE_HOME
+
+passed=0
+failed=0
+
+for test in "$DIR"/*_test.hm "$DIR"/*_test.sh; do
+    expected=${test%.*}.out
+
+    [ -f "$expected" ] || continue
+
+    name=$(basename "$test")
+
+    if [ "${test##*.}" = "sh" ]; then
+        actual=$(cd "$WORK" && sh "$test" 2>&1 < /dev/null)
+    else
+        actual=$(cd "$WORK" && "$HMC" -n "$test" 2>&1 < /dev/null)
+    fi
+
+    status=$?
+
+    if [ $status -ne 0 ]; then
+        actual=$(printf '%s\n[exit %d]' "$actual" $status)
+    fi
+
+    if [ "$actual" = "$(cat "$expected")" ]; then
+        passed=$((passed + 1))
+    else
+        failed=$((failed + 1))
+        echo "FAIL $name"
+        printf '%s\n' "$actual" | diff "$expected" - | head -20
+    fi
+done
+
+echo "$passed passed, $failed failed"
+
+[ $failed -eq 0 ]